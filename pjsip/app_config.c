@@ -0,0 +1,250 @@
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "app_config.h"
+
+#define THIS_FILE                   "app_config.c"
+#define LINE_SIZE                   512
+#define NUMBER_BASE                 10
+#define COMMENT_SYMBOL              '#'
+#define SEPARATOR_SYMBOL            '='
+#define FIELD_SIZE(type, field)     (sizeof(((type *)0)->field))
+#define CONFIG_FIELD(field)         offsetof(app_config_t, field), FIELD_SIZE(app_config_t, field)
+
+typedef enum
+{
+    eCONFIG_TYPE_STRING,
+    eCONFIG_TYPE_SHORT,
+    eCONFIG_TYPE_UNSIGNED,
+    eCONFIG_TYPE_INT
+} config_type_e;
+
+typedef struct config_key_t
+{
+    const char      *name;
+    config_type_e   type;
+    size_t          offset;
+    size_t          size;
+} config_key_t;
+
+static char *trim(char *str);
+static const config_key_t *find_key(const char *name);
+static pj_status_t parse_line(char *line, app_config_t *cfg);
+static pj_status_t set_value(const config_key_t *key, const char *value, app_config_t *cfg);
+static pj_status_t parse_number(const char *value, long min, long max, long *number);
+
+static const config_key_t kCONFIG_KEYS[] =
+{
+    { "wav_file",                     eCONFIG_TYPE_STRING,   CONFIG_FIELD(wav_file)                     },
+    { "long_tone_freq",               eCONFIG_TYPE_SHORT,    CONFIG_FIELD(long_tone.freq1)              },
+    { "long_tone_on_msec",            eCONFIG_TYPE_SHORT,    CONFIG_FIELD(long_tone.on_msec)            },
+    { "long_tone_off_msec",           eCONFIG_TYPE_SHORT,    CONFIG_FIELD(long_tone.off_msec)           },
+    { "kpv_tone_freq",                eCONFIG_TYPE_SHORT,    CONFIG_FIELD(kpv_tone.freq1)               },
+    { "kpv_tone_on_msec",             eCONFIG_TYPE_SHORT,    CONFIG_FIELD(kpv_tone.on_msec)             },
+    { "kpv_tone_off_msec",            eCONFIG_TYPE_SHORT,    CONFIG_FIELD(kpv_tone.off_msec)            },
+    { "overload_max_clock_lag_msec",  eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(overload.max_clock_lag_msec)  },
+    { "overload_max_sip_queue_bytes", eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(overload.max_sip_queue_bytes) },
+    { "overload_max_cpu_percent",     eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(overload.max_cpu_percent)     },
+    { "overload_retry_after_min_sec", eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(overload.retry_after_min_sec) },
+    { "overload_retry_after_max_sec", eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(overload.retry_after_max_sec) },
+    { "media_clock_timerfd",          eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(media_clock_timerfd)          },
+    { "media_clock_rt_priority",      eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(media_clock.rt_priority)      },
+    { "media_clock_max_catch_up",     eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(media_clock.max_catch_up)     },
+    { "ptime_msec",                   eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(ptime_msec)                   },
+    { "kpv_silence_suppression",      eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(kpv_silence_suppression)      },
+    { "media_sendonly",               eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(media_sendonly)               },
+    { "l16_fast_path",                eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(l16_fast_path)                },
+    { "sip_udp_sockets",              eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(sip_udp_sockets)              },
+    { "sip_tcp",                      eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(sip_tcp)                      },
+    { "pcap_capture",                 eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(pcap_capture)                 },
+    { "pcap_file",                    eCONFIG_TYPE_STRING,   CONFIG_FIELD(pcap_file)                    },
+    { "pcap_file_size_kb",            eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(pcap_file_size_kb)            },
+    { "pcap_max_files",               eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(pcap_max_files)               },
+    { "pcap_rtp_sample",              eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(pcap_rtp_sample)              },
+    { "record_calls",                 eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(record_calls)                 },
+    { "record_dir",                   eCONFIG_TYPE_STRING,   CONFIG_FIELD(record_dir)                   },
+    { "record_buffer_msec",           eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(record_buffer_msec)           },
+    { "record_g711_raw",              eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(record_g711_raw)              },
+    { "cpus_sip",                     eCONFIG_TYPE_STRING,   CONFIG_FIELD(cpus_sip)                     },
+    { "cpus_media_io",                eCONFIG_TYPE_STRING,   CONFIG_FIELD(cpus_media_io)                },
+    { "cpus_media_clock",             eCONFIG_TYPE_STRING,   CONFIG_FIELD(cpus_media_clock)             },
+    { "numa_local",                   eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(numa_local)                   },
+    { "hugepage_pool_mb",             eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(hugepage_pool_mb)             },
+    { "pool_thread_cache",            eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(pool_thread_cache)            },
+    { "g711_simd",                    eCONFIG_TYPE_UNSIGNED, CONFIG_FIELD(g711_simd)                    },
+};
+
+/* Read the config file and override the fields found in it */
+pj_status_t app_config_load(const char *path, app_config_t *cfg)
+{
+    pj_status_t status;
+    char line[LINE_SIZE];
+    unsigned line_num = 0;
+    FILE *file;
+
+    file = fopen(path, "r");
+    if (file == NULL)
+    {
+        status = PJ_ENOTFOUND;
+        goto _exit;
+    }
+
+    status = PJ_SUCCESS;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        ++line_num;
+
+        status = parse_line(line, cfg);
+        if (status != PJ_SUCCESS)
+        {
+            PJ_LOG(2, (THIS_FILE, "%s:%u: malformed line", path, line_num));
+            break;
+        }
+    }
+
+    fclose(file);
+    goto _exit;
+
+_exit:
+    return status;
+}
+
+static pj_status_t parse_line(char *line, app_config_t *cfg)
+{
+    pj_status_t status = PJ_SUCCESS;
+    const config_key_t *key;
+    char *separator;
+    char *comment;
+    char *name;
+
+    comment = strchr(line, COMMENT_SYMBOL);
+    if (comment != NULL)
+        (*comment) = '\0';
+
+    name = trim(line);
+    if (name[0] == '\0')
+        goto _exit;
+
+    separator = strchr(name, SEPARATOR_SYMBOL);
+    if (separator == NULL)
+    {
+        status = PJ_EINVAL;
+        goto _exit;
+    }
+    (*separator) = '\0';
+
+    key = find_key(trim(name));
+    if (key == NULL)
+    {
+        PJ_LOG(3, (THIS_FILE, "Unknown config key \"%s\" is ignored", trim(name)));
+        goto _exit;
+    }
+
+    status = set_value(key, trim(separator + 1), cfg);
+    goto _exit;
+
+_exit:
+    return status;
+}
+
+static pj_status_t set_value(const config_key_t *key, const char *value, app_config_t *cfg)
+{
+    pj_status_t status = PJ_SUCCESS;
+    char *field = ((char *)cfg) + key->offset;
+    long number = 0;
+
+    switch (key->type)
+    {
+        case eCONFIG_TYPE_STRING:
+            if (strlen(value) >= key->size)
+            {
+                status = PJ_ETOOSMALL;
+                break;
+            }
+            strcpy(field, value);
+            break;
+
+        case eCONFIG_TYPE_SHORT:
+            status = parse_number(value, 0, SHRT_MAX, &number);
+            if (status == PJ_SUCCESS)
+                (*(short *)field) = (short)number;
+            break;
+
+        case eCONFIG_TYPE_UNSIGNED:
+            status = parse_number(value, 0, INT_MAX, &number);
+            if (status == PJ_SUCCESS)
+                (*(unsigned *)field) = (unsigned)number;
+            break;
+
+        case eCONFIG_TYPE_INT:
+            status = parse_number(value, INT_MIN, INT_MAX, &number);
+            if (status == PJ_SUCCESS)
+                (*(int *)field) = (int)number;
+            break;
+
+        default:
+            status = PJ_EBUG;
+            break;
+    }
+
+    return status;
+}
+
+static pj_status_t parse_number(const char *value, long min, long max, long *number)
+{
+    pj_status_t status = PJ_EINVAL;
+    char *end = NULL;
+    long result;
+
+    errno = 0;
+    result = strtol(value, &end, NUMBER_BASE);
+    if ((errno != 0) || (end == value) || ((*end) != '\0'))
+        goto _exit;
+
+    if ((result < min) || (result > max))
+        goto _exit;
+
+    (*number) = result;
+    status = PJ_SUCCESS;
+
+_exit:
+    return status;
+}
+
+static const config_key_t *find_key(const char *name)
+{
+    const config_key_t *key = NULL;
+
+    for (unsigned i = 0; i < PJ_ARRAY_SIZE(kCONFIG_KEYS); i++)
+    {
+        if (strcmp(kCONFIG_KEYS[i].name, name) == 0)
+        {
+            key = &kCONFIG_KEYS[i];
+            break;
+        }
+    }
+
+    return key;
+}
+
+/* Cut off leading and trailing spaces */
+static char *trim(char *str)
+{
+    char *end;
+
+    while (isspace((unsigned char)(*str)))
+        ++str;
+
+    end = str + strlen(str);
+    while ((end > str) && isspace((unsigned char)(*(end - 1))))
+        --end;
+
+    (*end) = '\0';
+
+    return str;
+}
@@ -0,0 +1,55 @@
+#ifndef _AUTO_ANSWER_APP_CONFIG_H_
+#define _AUTO_ANSWER_APP_CONFIG_H_
+
+#include <pjmedia.h>
+
+#include "media_clock.h"
+#include "overload_ctl.h"
+
+#define APP_CONFIG_FILE_NAME        "auto_answer.conf"
+#define APP_CONFIG_PATH_SIZE        256
+#define APP_CONFIG_CPU_LIST_SIZE    128
+
+/* Runtime settings of the auto answer. Each field is preset by the
+ * application with the compiled in default and may be overridden
+ * by the "key = value" line of the config file
+ */
+typedef struct app_config_t
+{
+    char                wav_file[APP_CONFIG_PATH_SIZE];
+    pjmedia_tone_desc   long_tone;
+    pjmedia_tone_desc   kpv_tone;
+    overload_limits_t   overload;
+    unsigned            media_clock_timerfd;    /* 0 - pjmedia master port, 1 - media_clock */
+    media_clock_param_t media_clock;
+    unsigned            ptime_msec;     /* Bridge frame and RTP packet size */
+    unsigned            kpv_silence_suppression;    /* 1 - no RTP during the KPV pauses */
+    unsigned            media_sendonly;             /* 1 - a=sendonly, inbound RTP is dropped */
+    unsigned            l16_fast_path;              /* 1 - L16/16000 calls are sent without codec */
+    unsigned            sip_udp_sockets;            /* SIP UDP sockets and worker threads */
+    unsigned            sip_tcp;                    /* 1 - SIP over TCP too */
+    unsigned            pcap_capture;               /* 1 - SIP to pcap files instead of the log */
+    char                pcap_file[APP_CONFIG_PATH_SIZE];    /* Prefix of the pcap files */
+    unsigned            pcap_file_size_kb;
+    unsigned            pcap_max_files;
+    unsigned            pcap_rtp_sample;            /* Every n-th RTP packet is captured, 0 - none */
+    unsigned            record_calls;               /* 1 - inbound audio of each call into a WAV */
+    char                record_dir[APP_CONFIG_PATH_SIZE];
+    unsigned            record_buffer_msec;         /* Audio of a call waiting for the writer */
+    unsigned            record_g711_raw;            /* 1 - G.711 payloads as they come, no decoding */
+    char                cpus_sip[APP_CONFIG_CPU_LIST_SIZE];         /* SIP worker threads, "" - any CPU */
+    char                cpus_media_io[APP_CONFIG_CPU_LIST_SIZE];    /* RTP ioqueue threads of pjmedia */
+    char                cpus_media_clock[APP_CONFIG_CPU_LIST_SIZE]; /* Media clock thread */
+    unsigned            numa_local;                 /* 1 - memory from the node of the CPUs of the role */
+    unsigned            hugepage_pool_mb;           /* Arena of the pool blocks on 2 MB pages, 0 - malloc() */
+    unsigned            pool_thread_cache;          /* 1 - free pool blocks cached in each thread */
+    unsigned            g711_simd;                  /* 1 - PCMU/PCMA on the vector kernels */
+} app_config_t;
+
+/* Read the config file and override the fields of cfg found in it.
+ * Returns PJ_ENOTFOUND if the file does not exist (cfg is untouched)
+ * and PJ_EINVAL if the file contains a malformed line
+ */
+pj_status_t app_config_load(const char *path, app_config_t *cfg);
+
+#endif /* _AUTO_ANSWER_APP_CONFIG_H_ */
@@ -0,0 +1,38 @@
+#ifndef _AUTO_ANSWER_AUTO_ANSWER_H_
+#define _AUTO_ANSWER_AUTO_ANSWER_H_
+
+#include <pjlib.h>
+
+/* Start the auto answer in the calling process: pjlib, SIP and media,
+ * the sound sources and the worker threads. auto_answer.conf and the
+ * wav file are taken from the current directory.
+ * calls_code_style.c built with AUTO_ANSWER_NO_MAIN has no main() and
+ * no menu, the embedding program drives the engine with these calls.
+ * On failure everything it has set up is released again, there is
+ * nothing to stop
+ */
+pj_status_t auto_answer_start(void);
+
+/* Stop the threads, hang up and release everything, pj_shutdown() included */
+pj_status_t auto_answer_stop(void);
+
+/* Start in the simulation mode: the media clock and the ringing and
+ * media timers of the calls run on a virtual clock which only moves in
+ * auto_answer_sim_advance(). A harness advancing it whenever the SIP and
+ * RTP on its side are quiet runs complete calls of 10 s in milliseconds,
+ * and the same way every time. SIP retransmissions and timeouts stay on
+ * the wall clock, stop with auto_answer_stop() as usual
+ */
+pj_status_t auto_answer_start_sim(void);
+
+/* Move the virtual clock forward, the media ticks and the timers due
+ * run in the calling thread. So do the media setup of the answered calls
+ * and the teardown of the ended ones, which have no threads of their own
+ * in the simulation. Nothing happens without the simulation mode
+ */
+void auto_answer_sim_advance(unsigned msec);
+
+/* Virtual time since the start, 0 without the simulation mode */
+pj_uint64_t auto_answer_sim_now_usec(void);
+
+#endif /* _AUTO_ANSWER_AUTO_ANSWER_H_ */
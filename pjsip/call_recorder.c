@@ -0,0 +1,596 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include "call_recorder.h"
+
+#define THIS_FILE                   "call_recorder.c"
+#define THREAD_NAME                 "rec-writer"
+#define LOCK_NAME                   "recorder"
+#define PORT_NAME                   "recorder"
+#define PORT_SIGNATURE              PJMEDIA_SIG_CLASS_APP('C', 'R')
+#define FILE_NAME_SIZE              320
+#define FILE_EXT                    ".wav"
+#define NCHANNELS                   1
+#define BITS_PER_SAMPLE             16
+#define BITS_IN_BYTE                8
+#define MSEC_IN_SEC                 1000
+#define WAVE_FMT_LEN                16
+#define WAVE_FMT_EX_LEN             18      /* The fmt of a non-PCM tag ends with cbSize = 0 */
+#define WAVE_FACT_LEN               4       /* The sample count */
+#define WAVE_EXT_SIZE               14      /* cbSize, the fact tag, its length and the count */
+#define FACT_TAG                    "fact"
+#define FACT_TAG_LEN                4
+#define RIFF_HDR_LEN                8       /* The RIFF tag and length are not counted */
+#define G711_CLOCK_RATE             8000
+#define G711_BITS_PER_SAMPLE        8
+#define ULAW_SILENCE                0xff
+#define ALAW_SILENCE                0xd5
+#define MAX_GAP_MSEC                10000   /* A longer jump is a new timestamp base */
+
+/* The media side and the writer thread share only the state of the
+ * channel and the ring positions
+ */
+#define LOAD_ACQUIRE(ptr)           __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(ptr, val)     __atomic_store_n((ptr), (val), __ATOMIC_RELEASE)
+#define ADD_RELAXED(ptr, val)       __atomic_add_fetch((ptr), (val), __ATOMIC_RELAXED)
+#define LOAD_RELAXED(ptr)           __atomic_load_n((ptr), __ATOMIC_RELAXED)
+
+typedef enum
+{
+    eCHANNEL_FREE,
+    eCHANNEL_RESERVED,              /* Taken, the format is being set */
+    eCHANNEL_OPEN,                  /* Filled by the bridge */
+    eCHANNEL_CLOSING                /* Port destroyed, the writer finishes the file */
+} channel_state_e;
+
+typedef struct rec_channel_t
+{
+    pjmedia_port                base;
+    call_recorder_t             *recorder;
+    int                         state;
+    char                        path[FILE_NAME_SIZE];
+
+    /* Format of the file */
+    unsigned                    fmt_tag;
+    unsigned                    sample_rate;
+    unsigned                    bytes_per_sample;
+    pj_uint8_t                  silence;
+
+    /* RTP of a G.711 channel, used by the receiving thread only */
+    unsigned                    pt;
+    pj_bool_t                   rtp_started;
+    pj_uint32_t                 next_ts;
+    pjmedia_rtp_session         rtp_session;    /* Only for decoding, it is not updated */
+
+    /* Positions only grow and wrap, the head is moved by the media side
+     * and the tail by the writer thread
+     */
+    pj_uint8_t                  *ring;
+    unsigned                    head;
+    unsigned                    tail;
+
+    /* Used by the writer thread only */
+    FILE                        *file;
+    pj_bool_t                   open_failed;
+    pj_uint32_t                 data_bytes;
+} rec_channel_t;
+
+struct call_recorder_t
+{
+    call_recorder_param_t       param;
+    pj_lock_t                   *lock;      /* Channel allocation by the SIP threads */
+    pj_thread_t                 *thread;
+    volatile pj_bool_t          quit;
+    rec_channel_t               *channels;
+    unsigned                    ring_size;  /* Power of 2 */
+
+    pj_uint64_t                 written_bytes;
+    pj_uint64_t                 dropped_frames;
+};
+
+static unsigned round_up_pow2(unsigned value);
+static rec_channel_t *open_channel(call_recorder_t *recorder, const char *name);
+static pj_bool_t ring_push(rec_channel_t *channel, const void *data, pj_size_t size);
+static pj_status_t rec_put_frame(pjmedia_port *this_port, pjmedia_frame *frame);
+static pj_status_t rec_get_frame(pjmedia_port *this_port, pjmedia_frame *frame);
+static pj_status_t rec_on_destroy(pjmedia_port *this_port);
+static void write_header(rec_channel_t *channel);
+static void put_le(pj_uint8_t *buf, pj_uint32_t value, unsigned len);
+static pj_bool_t open_file(rec_channel_t *channel);
+static void close_file(rec_channel_t *channel);
+static void flush_channel(call_recorder_t *recorder, rec_channel_t *channel);
+static int writer_thread_routine(void *arg);
+
+pj_status_t call_recorder_create(pj_pool_t *pool,
+                                 const call_recorder_param_t *param,
+                                 call_recorder_t **p_recorder)
+{
+    pj_status_t status;
+    call_recorder_t *recorder;
+    pj_str_t name = pj_str(PORT_NAME);
+    pj_size_t dir_len = strlen(param->dir);
+    unsigned frame_bytes = param->samples_per_frame * BITS_PER_SAMPLE / BITS_IN_BYTE;
+
+    if ((param->max_channels == 0) || (param->flush_msec == 0) || (param->buffer_msec <= param->flush_msec)
+        || (dir_len == 0))
+    {
+        status = PJ_EINVAL;
+        goto _exit;
+    }
+
+    /* A wrong directory fails at start and not with the first call */
+    if (access(param->dir, W_OK) != 0)
+    {
+        PJ_LOG(1, (THIS_FILE, "Unable to write to %s", param->dir));
+        status = PJ_ENOTFOUND;
+        goto _exit;
+    }
+
+    recorder = PJ_POOL_ZALLOC_T(pool, call_recorder_t);
+    recorder->param = *param;
+    recorder->ring_size = round_up_pow2(PJ_MAX(param->clock_rate * BITS_PER_SAMPLE / BITS_IN_BYTE
+                                               / MSEC_IN_SEC * param->buffer_msec,
+                                               frame_bytes));
+
+    recorder->param.dir = (char *)pj_pool_zalloc(pool, dir_len + 1);
+    recorder->channels = (rec_channel_t *)pj_pool_calloc(pool, param->max_channels, sizeof(rec_channel_t));
+    if ((recorder->param.dir == NULL) || (recorder->channels == NULL))
+    {
+        status = PJ_ENOMEM;
+        goto _exit;
+    }
+
+    pj_memcpy((char *)recorder->param.dir, param->dir, dir_len);
+
+    for (unsigned i = 0; i < param->max_channels; i++)
+    {
+        rec_channel_t *channel = &recorder->channels[i];
+
+        status = pjmedia_port_info_init(&channel->base.info,
+                                        &name,
+                                        PORT_SIGNATURE,
+                                        param->clock_rate,
+                                        NCHANNELS,
+                                        BITS_PER_SAMPLE,
+                                        param->samples_per_frame);
+        if (status != PJ_SUCCESS)
+            goto _exit;
+
+        channel->base.put_frame = &rec_put_frame;
+        channel->base.get_frame = &rec_get_frame;
+        channel->base.on_destroy = &rec_on_destroy;
+        channel->recorder = recorder;
+        channel->ring = (pj_uint8_t *)pj_pool_alloc(pool, recorder->ring_size);
+        if (channel->ring == NULL)
+        {
+            status = PJ_ENOMEM;
+            goto _exit;
+        }
+    }
+
+    status = pj_lock_create_simple_mutex(pool, LOCK_NAME, &recorder->lock);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    status = pj_thread_create(pool, THREAD_NAME, &writer_thread_routine, recorder, 0, 0, &recorder->thread);
+    if (status != PJ_SUCCESS)
+    {
+        pj_lock_destroy(recorder->lock);
+        goto _exit;
+    }
+
+    *p_recorder = recorder;
+
+_exit:
+    return status;
+}
+
+pj_status_t call_recorder_destroy(call_recorder_t *recorder)
+{
+    recorder->quit = PJ_TRUE;
+
+    pj_thread_join(recorder->thread);
+    pj_thread_destroy(recorder->thread);
+
+    /* Calls still recorded at the stop */
+    for (unsigned i = 0; i < recorder->param.max_channels; i++)
+    {
+        close_file(&recorder->channels[i]);
+    }
+
+    PJ_LOG(4, (THIS_FILE, "%llu bytes recorded, %llu frames dropped",
+               (unsigned long long)recorder->written_bytes,
+               (unsigned long long)recorder->dropped_frames));
+
+    return pj_lock_destroy(recorder->lock);
+}
+
+pj_status_t call_recorder_open_port(call_recorder_t *recorder, const char *name, pjmedia_port **p_port)
+{
+    pj_status_t status = PJ_ETOOMANY;
+    rec_channel_t *channel = open_channel(recorder, name);
+
+    if (channel == NULL)
+        goto _exit;
+
+    channel->fmt_tag = PJMEDIA_WAVE_FMT_TAG_PCM;
+    channel->sample_rate = recorder->param.clock_rate;
+    channel->bytes_per_sample = BITS_PER_SAMPLE / BITS_IN_BYTE;
+    channel->silence = 0;
+    STORE_RELEASE(&channel->state, eCHANNEL_OPEN);
+
+    *p_port = &channel->base;
+    status = PJ_SUCCESS;
+
+_exit:
+    return status;
+}
+
+pj_status_t call_recorder_open_g711(call_recorder_t *recorder, const char *name, unsigned pt, pjmedia_port **p_port)
+{
+    pj_status_t status = PJ_EINVAL;
+    rec_channel_t *channel;
+
+    if ((pt != PJMEDIA_RTP_PT_PCMU) && (pt != PJMEDIA_RTP_PT_PCMA))
+        goto _exit;
+
+    status = PJ_ETOOMANY;
+    channel = open_channel(recorder, name);
+    if (channel == NULL)
+        goto _exit;
+
+    channel->fmt_tag = (pt == PJMEDIA_RTP_PT_PCMU) ? PJMEDIA_WAVE_FMT_TAG_ULAW : PJMEDIA_WAVE_FMT_TAG_ALAW;
+    channel->sample_rate = G711_CLOCK_RATE;
+    channel->bytes_per_sample = G711_BITS_PER_SAMPLE / BITS_IN_BYTE;
+    channel->silence = (pt == PJMEDIA_RTP_PT_PCMU) ? ULAW_SILENCE : ALAW_SILENCE;
+    channel->pt = pt;
+    channel->rtp_started = PJ_FALSE;
+    STORE_RELEASE(&channel->state, eCHANNEL_OPEN);
+
+    *p_port = &channel->base;
+    status = PJ_SUCCESS;
+
+_exit:
+    return status;
+}
+
+/* The payload is copied in timestamp order, a gap gets G.711 silence and
+ * a slightly late or duplicated packet is dropped. A jump of the
+ * timestamp by more than MAX_GAP_MSEC either way starts a new base
+ */
+void call_recorder_on_rtp(void *user_data, const void *pkt, pj_ssize_t size)
+{
+    rec_channel_t *channel = (rec_channel_t *)user_data;
+    const pjmedia_rtp_hdr *hdr;
+    pj_uint32_t ts;
+    const void *payload;
+    unsigned payload_len;
+    pj_int32_t gap;
+    pj_uint32_t gap_abs;
+    pj_bool_t pushed = PJ_TRUE;
+
+    if ((size <= 0) || (LOAD_ACQUIRE(&channel->state) != eCHANNEL_OPEN))
+        goto _exit;
+
+    /* Other payload types (DTMF, comfort noise) are not audio of the call */
+    if ((pjmedia_rtp_decode_rtp(&channel->rtp_session, pkt, (int)size, &hdr, &payload, &payload_len) != PJ_SUCCESS)
+        || (hdr->pt != channel->pt))
+    {
+        goto _exit;
+    }
+
+    ts = pj_ntohl(hdr->ts);
+
+    if (!channel->rtp_started)
+    {
+        channel->next_ts = ts;
+        channel->rtp_started = PJ_TRUE;
+    }
+
+    gap = (pj_int32_t)(ts - channel->next_ts);
+    gap_abs = (gap < 0) ? (pj_uint32_t)0 - (pj_uint32_t)gap : (pj_uint32_t)gap;
+
+    if (gap_abs > channel->sample_rate / MSEC_IN_SEC * MAX_GAP_MSEC)
+        gap = 0;
+    else if (gap < 0)
+        goto _exit;
+
+    if (gap > 0)
+        pushed = ring_push(channel, NULL, (pj_size_t)gap);
+
+    if (pushed)
+        pushed = ring_push(channel, payload, payload_len);
+
+    if (!pushed)
+        ADD_RELAXED(&channel->recorder->dropped_frames, 1);
+
+    channel->next_ts = ts + (pj_uint32_t)payload_len;
+
+_exit:
+    return;
+}
+
+void call_recorder_get_stats(call_recorder_t *recorder, pj_uint64_t *written_bytes, pj_uint64_t *dropped_frames)
+{
+    *written_bytes = LOAD_RELAXED(&recorder->written_bytes);
+    *dropped_frames = LOAD_RELAXED(&recorder->dropped_frames);
+
+    return;
+}
+
+static unsigned round_up_pow2(unsigned value)
+{
+    unsigned result = 1;
+
+    while (result < value)
+    {
+        result <<= 1;
+    }
+
+    return result;
+}
+
+/* The channel is reserved, the caller sets the format and opens it */
+static rec_channel_t *open_channel(call_recorder_t *recorder, const char *name)
+{
+    rec_channel_t *channel = NULL;
+
+    pj_lock_acquire(recorder->lock);
+
+    for (unsigned i = 0; i < recorder->param.max_channels; i++)
+    {
+        if (LOAD_ACQUIRE(&recorder->channels[i].state) == eCHANNEL_FREE)
+        {
+            channel = &recorder->channels[i];
+            break;
+        }
+    }
+
+    if (channel)
+    {
+        pj_ansi_snprintf(channel->path, sizeof(channel->path), "%s/%s" FILE_EXT, recorder->param.dir, name);
+        channel->head = 0;
+        channel->tail = 0;
+        channel->open_failed = PJ_FALSE;
+        channel->data_bytes = 0;
+
+        /* Taken, the writer does not touch it until it is open */
+        STORE_RELEASE(&channel->state, eCHANNEL_RESERVED);
+    }
+
+    pj_lock_release(recorder->lock);
+
+    return channel;
+}
+
+/* All or nothing, NULL data is silence of the format */
+static pj_bool_t ring_push(rec_channel_t *channel, const void *data, pj_size_t size)
+{
+    unsigned ring_size = channel->recorder->ring_size;
+    unsigned head = channel->head;
+    unsigned tail = LOAD_ACQUIRE(&channel->tail);
+    unsigned offset = head & (ring_size - 1);
+    pj_size_t first = PJ_MIN(size, (pj_size_t)(ring_size - offset));
+    pj_bool_t pushed = PJ_FALSE;
+
+    if (ring_size - (head - tail) < size)
+        goto _exit;
+
+    if (data)
+    {
+        pj_memcpy(channel->ring + offset, data, first);
+        pj_memcpy(channel->ring, (const pj_uint8_t *)data + first, size - first);
+    }
+    else
+    {
+        pj_memset(channel->ring + offset, channel->silence, first);
+        pj_memset(channel->ring, channel->silence, size - first);
+    }
+
+    STORE_RELEASE(&channel->head, head + (unsigned)size);
+    pushed = PJ_TRUE;
+
+_exit:
+    return pushed;
+}
+
+/* Called by the bridge on every tick. No audio from the caller is
+ * recorded as silence, so the file keeps the time of the call
+ */
+static pj_status_t rec_put_frame(pjmedia_port *this_port, pjmedia_frame *frame)
+{
+    rec_channel_t *channel = (rec_channel_t *)this_port;
+    pj_bool_t pushed;
+
+    if (LOAD_ACQUIRE(&channel->state) != eCHANNEL_OPEN)
+        goto _exit;
+
+    if ((frame->type == PJMEDIA_FRAME_TYPE_AUDIO) && (frame->size > 0))
+        pushed = ring_push(channel, frame->buf, frame->size);
+    else
+        pushed = ring_push(channel, NULL, PJMEDIA_PIA_AVG_FSZ(&this_port->info));
+
+    if (!pushed)
+        ADD_RELAXED(&channel->recorder->dropped_frames, 1);
+
+_exit:
+    return PJ_SUCCESS;
+}
+
+static pj_status_t rec_get_frame(pjmedia_port *this_port, pjmedia_frame *frame)
+{
+    PJ_UNUSED_ARG(this_port);
+
+    frame->type = PJMEDIA_FRAME_TYPE_NONE;
+    frame->size = 0;
+
+    return PJ_SUCCESS;
+}
+
+/* The channel is reused only after the writer thread has closed the file */
+static pj_status_t rec_on_destroy(pjmedia_port *this_port)
+{
+    rec_channel_t *channel = (rec_channel_t *)this_port;
+
+    STORE_RELEASE(&channel->state, eCHANNEL_CLOSING);
+
+    return PJ_SUCCESS;
+}
+
+/* PCM has the plain 44 byte header. G.711 has the 18 byte fmt with
+ * cbSize = 0 and a fact chunk with the sample count, which players of
+ * the non-PCM tags expect; the count is written again with the lengths
+ */
+static void write_header(rec_channel_t *channel)
+{
+    pjmedia_wave_hdr hdr;
+    pj_uint8_t ext[WAVE_EXT_SIZE];
+    unsigned block_align = NCHANNELS * channel->bytes_per_sample;
+    pj_bool_t is_pcm = (channel->fmt_tag == PJMEDIA_WAVE_FMT_TAG_PCM);
+    pj_size_t ext_size = is_pcm ? 0 : sizeof(ext);
+
+    pj_bzero(&hdr, sizeof(hdr));
+    hdr.riff_hdr.riff = PJMEDIA_RIFF_TAG;
+    hdr.riff_hdr.file_len = (pj_uint32_t)(sizeof(hdr.riff_hdr) + sizeof(hdr.fmt_hdr) + ext_size
+                                          + sizeof(hdr.data_hdr) - RIFF_HDR_LEN + channel->data_bytes);
+    hdr.riff_hdr.wave = PJMEDIA_WAVE_TAG;
+    hdr.fmt_hdr.fmt = PJMEDIA_FMT_TAG;
+    hdr.fmt_hdr.len = is_pcm ? WAVE_FMT_LEN : WAVE_FMT_EX_LEN;
+    hdr.fmt_hdr.fmt_tag = (pj_uint16_t)channel->fmt_tag;
+    hdr.fmt_hdr.nchan = NCHANNELS;
+    hdr.fmt_hdr.sample_rate = channel->sample_rate;
+    hdr.fmt_hdr.bytes_per_sec = channel->sample_rate * block_align;
+    hdr.fmt_hdr.block_align = (pj_uint16_t)block_align;
+    hdr.fmt_hdr.bits_per_sample = (pj_uint16_t)(channel->bytes_per_sample * BITS_IN_BYTE);
+    hdr.data_hdr.data = PJMEDIA_DATA_TAG;
+    hdr.data_hdr.len = channel->data_bytes;
+
+    pjmedia_wave_hdr_host_to_file(&hdr);
+
+    /* Little endian whatever the host is */
+    put_le(ext, 0, sizeof(pj_uint16_t));
+    pj_memcpy(ext + sizeof(pj_uint16_t), FACT_TAG, FACT_TAG_LEN);
+    put_le(ext + sizeof(pj_uint16_t) + FACT_TAG_LEN, WAVE_FACT_LEN, sizeof(pj_uint32_t));
+    put_le(ext + sizeof(pj_uint16_t) + FACT_TAG_LEN + sizeof(pj_uint32_t), channel->data_bytes / block_align,
+           sizeof(pj_uint32_t));
+
+    /* The parts one by one, the struct may have padding */
+    fseek(channel->file, 0, SEEK_SET);
+    fwrite(&hdr.riff_hdr, sizeof(hdr.riff_hdr), 1, channel->file);
+    fwrite(&hdr.fmt_hdr, sizeof(hdr.fmt_hdr), 1, channel->file);
+    if (ext_size > 0)
+        fwrite(ext, ext_size, 1, channel->file);
+    fwrite(&hdr.data_hdr, sizeof(hdr.data_hdr), 1, channel->file);
+    fseek(channel->file, 0, SEEK_END);
+
+    return;
+}
+
+static void put_le(pj_uint8_t *buf, pj_uint32_t value, unsigned len)
+{
+    for (unsigned i = 0; i < len; i++)
+    {
+        buf[i] = (pj_uint8_t)(value >> (i * BITS_IN_BYTE));
+    }
+
+    return;
+}
+
+/* The ring is already a large block, the file is not buffered again */
+static pj_bool_t open_file(rec_channel_t *channel)
+{
+    channel->file = fopen(channel->path, "wb");
+    if (channel->file == NULL)
+    {
+        PJ_LOG(2, (THIS_FILE, "Unable to open %s, the call is not recorded", channel->path));
+        channel->open_failed = PJ_TRUE;
+        goto _exit;
+    }
+
+    setvbuf(channel->file, NULL, _IONBF, 0);
+
+    /* The lengths are written again when the file is closed */
+    write_header(channel);
+
+_exit:
+    return (channel->file != NULL);
+}
+
+static void close_file(rec_channel_t *channel)
+{
+    if (channel->file == NULL)
+        goto _exit;
+
+    write_header(channel);
+    fclose(channel->file);
+    channel->file = NULL;
+
+_exit:
+    return;
+}
+
+/* The state is read before the head, so that a closing channel has
+ * all its frames in the ring
+ */
+static void flush_channel(call_recorder_t *recorder, rec_channel_t *channel)
+{
+    int state = LOAD_ACQUIRE(&channel->state);
+    unsigned head;
+    unsigned tail = channel->tail;
+    unsigned offset;
+    unsigned size;
+    unsigned first;
+
+    if ((state == eCHANNEL_FREE) || (state == eCHANNEL_RESERVED))
+        goto _exit;
+
+    head = LOAD_ACQUIRE(&channel->head);
+    size = head - tail;
+
+    if ((size > 0) && (channel->file || (!channel->open_failed && open_file(channel))))
+    {
+        offset = tail & (recorder->ring_size - 1);
+        first = PJ_MIN(size, recorder->ring_size - offset);
+
+        fwrite(channel->ring + offset, first, 1, channel->file);
+        if (size > first)
+            fwrite(channel->ring, size - first, 1, channel->file);
+
+        channel->data_bytes += size;
+        ADD_RELAXED(&recorder->written_bytes, size);
+    }
+
+    STORE_RELEASE(&channel->tail, head);
+
+    if (state == eCHANNEL_CLOSING)
+    {
+        close_file(channel);
+        STORE_RELEASE(&channel->state, eCHANNEL_FREE);
+    }
+
+_exit:
+    return;
+}
+
+static int writer_thread_routine(void *arg)
+{
+    call_recorder_t *recorder = (call_recorder_t *)arg;
+
+    while (!recorder->quit)
+    {
+        pj_thread_sleep(recorder->param.flush_msec);
+
+        for (unsigned i = 0; i < recorder->param.max_channels; i++)
+        {
+            flush_channel(recorder, &recorder->channels[i]);
+        }
+    }
+
+    /* What was queued before the stop */
+    for (unsigned i = 0; i < recorder->param.max_channels; i++)
+    {
+        flush_channel(recorder, &recorder->channels[i]);
+    }
+
+    return PJ_SUCCESS;
+}
@@ -0,0 +1,62 @@
+#ifndef _AUTO_ANSWER_CALL_RECORDER_H_
+#define _AUTO_ANSWER_CALL_RECORDER_H_
+
+#include <pjmedia.h>
+
+/* Recording settings */
+typedef struct call_recorder_param_t
+{
+    const char          *dir;               /* Files are <dir>/<name>.wav */
+    unsigned            clock_rate;
+    unsigned            samples_per_frame;
+    unsigned            max_channels;       /* Calls recorded at once */
+    unsigned            buffer_msec;        /* Audio of a call waiting for the writer thread */
+    unsigned            flush_msec;         /* Period of the writer thread */
+} call_recorder_param_t;
+
+typedef struct call_recorder_t call_recorder_t;
+
+/* Recording of many calls, each into its own WAV file: 16-bit PCM from
+ * the bridge or G.711 straight from the RTP.
+ * The media side only copies the frame into the ring of its call, a
+ * single producer single consumer ring with no lock and no system call.
+ * The writer thread opens the files, writes each ring in one or two
+ * large writes and closes the files. A frame which finds the ring full
+ * is dropped, the media clock never waits for the disk
+ */
+pj_status_t call_recorder_create(pj_pool_t *pool,
+                                 const call_recorder_param_t *param,
+                                 call_recorder_t **p_recorder);
+
+/* Stop the writer thread, write what is left and close the files.
+ * None of the ports may be in the bridge any more
+ */
+pj_status_t call_recorder_destroy(call_recorder_t *recorder);
+
+/* Sink port for the bridge which records one call into <dir>/<name>.wav.
+ * PJ_ETOOMANY when all the channels are busy. Destroying the port ends
+ * the recording, the writer thread finishes the file afterwards
+ */
+pj_status_t call_recorder_open_port(call_recorder_t *recorder, const char *name, pjmedia_port **p_port);
+
+/* Channel which records the RTP payloads of a G.711 call (PT 0 or 8)
+ * into a G.711 WAV of 8 kHz as they are, without decoding. The port is
+ * not for the bridge, it is the handle given to call_recorder_on_rtp()
+ * and destroyed at the end of the call. PJ_EINVAL for another PT
+ */
+pj_status_t call_recorder_open_g711(call_recorder_t *recorder, const char *name, unsigned pt, pjmedia_port **p_port);
+
+/* Received RTP packet of a G.711 channel, user_data is its port. The
+ * payload goes to the ring in timestamp order: a gap of up to 10 s is
+ * filled with silence, so the file keeps the time of the call, and a
+ * late or duplicate packet within 10 s of the written audio is dropped.
+ * A timestamp jump of more than 10 s either way is taken as a new base:
+ * the packet is written next, with no fill. Call it from one thread at
+ * a time, the transport must be closed before the port is destroyed
+ */
+void call_recorder_on_rtp(void *user_data, const void *pkt, pj_ssize_t size);
+
+/* Bytes written to the files and frames (packets) dropped on full rings */
+void call_recorder_get_stats(call_recorder_t *recorder, pj_uint64_t *written_bytes, pj_uint64_t *dropped_frames);
+
+#endif /* _AUTO_ANSWER_CALL_RECORDER_H_ */
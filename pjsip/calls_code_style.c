@@ -1,3 +1,6 @@
+#include <signal.h>
+#include <sys/socket.h>
+
 #include <pjsip.h>
 #include <pjmedia.h>
 #include <pjmedia-codec.h>
@@ -6,6 +9,23 @@
 #include <pjlib-util.h>
 #include <pjlib.h>
 
+#include "app_config.h"
+#include "auto_answer.h"
+#include "call_recorder.h"
+#include "clock_probe.h"
+#include "cpu_affinity.h"
+#include "g711_simd_codec.h"
+#include "hugepage_policy.h"
+#include "l16_fanout.h"
+#include "media_clock.h"
+#include "silence_gate.h"
+#include "overload_ctl.h"
+#include "pcap_writer.h"
+#include "port_proxy.h"
+#include "rtp_tap.h"
+#include "sim_clock.h"
+#include "thread_pool_factory.h"
+
 /* Settings */
 #define THIS_FILE                   "calls_code_style.c"
 #define FILE_NAME                   "output_4.wav"
@@ -15,14 +35,32 @@
 #define LONG_TONE_NAME              "200"
 #define KPV_TONE_NAME               "300"
 #define THREAD_NAME                 "worker"
+#define RELOAD_THREAD_NAME          "reload"
 #define MUTEX_NAME                  "mutex_calls"
+#define RELOAD_SEM_NAME             "sem_reload"
+#define REAPER_THREAD_NAME          "reaper"
+#define REAPER_SEM_NAME             "sem_reaper"
+#define MEDIA_SETUP_THREAD_NAME     "media-setup"
+#define MEDIA_SETUP_SEM_NAME        "sem_media_setup"
+#define MEDIA_SETUP_THREADS         2   /* Streams created off the SIP threads */
+#define SOURCE_POOL_NAME            "source"
 #define CLOCK_RATE                  16000
-#define SAMPLES_PER_FRAME           (CLOCK_RATE/100)
+#define MSEC_IN_SEC                 1000
+#define USEC_IN_MSEC                1000
+#define SAMPLES_PER_FRAME(ptime)    (CLOCK_RATE * (ptime) / MSEC_IN_SEC)
 #define BITS_PER_SAMPLE             16
 #define NCHANNELS                   1
 #define MAX_CALLS_STATIC                   30
 #define SIP_PORT                    5062
 #define RTP_PORT                    4000
+#define SIP_UDP_SOCKETS             1   /* More share the port with SO_REUSEPORT */
+#define MAX_SIP_UDP_SOCKETS         16  /* One worker thread for each */
+#define SIP_UDP_ASYNC_CNT           1   /* Pending reads per socket */
+#define SIP_TCP                     0   /* UDP only, 1 - TCP listener next to UDP */
+#define SIP_TCP_ASYNC_CNT           4   /* Pending accepts */
+#define MAX_TCP_CONNECTIONS         256 /* Kept open while the peer keeps them */
+#define TCP_LOCK_NAME               "tcp_conns"
+#define TCP_URI_PARAM               ";transport=tcp"
 #define AF                          (pj_AF_INET())
 #define NUMBER_OF_TONES_IN_ARRAY    1
 #define FLAGS_BITMASK_IPV6          2
@@ -32,18 +70,75 @@
 #define ON_MSEC                     1000
 #define OFF_MSEC_LONG_TONE          0
 #define OFF_MSEC_KPV_TONE           4000
-#define PTIME                       (SAMPLES_PER_FRAME * 1000 / NCHANNELS / CLOCK_RATE)
+#define PTIME_MSEC                  10
+#define PTIME_MIN_MSEC              10
+#define PTIME_MAX_MSEC              40
+#define PTIME_STEP_MSEC             10
+#define PTIME_ATTR_NAME             "ptime"
+#define PTIME_ATTR_SIZE             16
+#define SENDRECV_ATTR_NAME          "sendrecv"
+#define SENDONLY_ATTR_NAME          "sendonly"
+#define MEDIA_SENDONLY              1   /* Callers are never listened to */
+#define PREFERRED_CODEC_ID          "G722/16000"    /* Same rate as the bridge, no resampling */
+#define L16_CODEC_PREFIX            "L16"
+#define L16_CODEC_ID                "L16/16000/1"
+#define L16_CODEC_NAME              "L16"
+#define L16_FAST_PATH               0   /* 256 kbit/s per call, for test trunks */
 #define RINGING_TIMER_SEC           3
 #define RINGING_TIMER_MSEC          0
 #define MEDIA_TIMER_SEC             7
 #define MEDIA_TIMER_MSEC            0
+#define TIMERS_PER_CALL             2   /* Ringing and media, on the virtual clock in simulation */
+#define OVERLOAD_TIMER_SEC          1
+#define OVERLOAD_TIMER_MSEC         0
+#define OVERLOAD_MAX_CLOCK_LAG_MSEC 20
+#define OVERLOAD_MAX_SIP_QUEUE      65536   /* bytes */
+#define OVERLOAD_MAX_CPU_PERCENT    90
+#define RETRY_AFTER_MIN_SEC         5
+#define RETRY_AFTER_MAX_SEC         60
+#define MEDIA_CLOCK_TIMERFD         0   /* pjmedia master port by default */
+#define MEDIA_CLOCK_RT_PRIORITY     0
+#define MEDIA_CLOCK_MAX_CATCH_UP    5   /* ticks */
+#define KPV_SILENCE_SUPPRESSION     0   /* KPV silence is sent as RTP by default */
+#define SILENCE_MAX_LEVEL           0   /* Tone generator pauses are exact zeros */
+#define PCAP_CAPTURE                0   /* Text dumps of SIP by default */
+#define PCAP_FILE_PREFIX            "auto_answer"
+#define PCAP_FILE_SIZE_KB           65536
+#define PCAP_MAX_FILES              4
+#define PCAP_RING_PACKETS           1024    /* 4 MB of slots */
+#define PCAP_RTP_SAMPLE             0   /* RTP is not captured */
+#define RECORD_CALLS                0   /* Callers are not recorded */
+#define RECORD_DIR                  "."
+#define RECORD_BUFFER_MSEC          2000    /* 64 KB per call */
+#define RECORD_FLUSH_MSEC           250
+#define RECORD_G711_RAW             0   /* G.711 is recorded from the bridge too */
+#define RECORD_NAME_SIZE            128
+#define CPUS_SIP                    ""  /* The scheduler places the threads */
+#define CPUS_MEDIA_IO               ""
+#define CPUS_MEDIA_CLOCK            ""
+#define NUMA_LOCAL                  1   /* Only for the roles with CPUs */
+#define HUGEPAGE_POOL_MB            0   /* Pool blocks from malloc() */
+#define POOL_THREAD_CACHE           0   /* One caching pool for every thread */
+#if defined(__x86_64__) || defined(__i386__)
+#define G711_SIMD                   1   /* Same bytes as the pjmedia G.711 */
+#else
+#define G711_SIMD                   0   /* The NEON code is not measured on real boards yet */
+#endif
+#define BYTES_IN_MB                 (1024 * 1024)
+#define BYTES_IN_KB                 1024
 #define BUF_SIZE_WAV_PLAYEER        0
 #define OK_ANSWER                   200
 #define RINGING_ANSWER              180
 #define UNDEFINED_ID                -1
 #define POOL_INCREMENT_SIZE         4000
 #define POOL_SIZE                   4000
-#define NUM_USED_APP_PORTS          4
+#define MAX_SOURCE_SETS             3   /* The current set and the sets replaced by reload
+                                         * which still play to the calls made before it */
+#define PORTS_PER_SOURCE            2   /* The source and its L16 fanout */
+#define NUM_USED_APP_PORTS          (1 + (eSOURCE_COUNT * MAX_SOURCE_SETS * PORTS_PER_SOURCE))
+#define MAX_RETIRED_SOURCES         (eSOURCE_COUNT * (MAX_SOURCE_SETS - 2)) /* The current and the new set take the rest */
+#define PORTS_PER_CALL              3   /* Stream and recorder proxies, a slot of the stream when it has another format */
+#define MAX_PENDING_RELOADS         8
 #define LOG_LEVEL                   5
 #define MAX_TIME_EVENTS_WAIT        10
 #define LOG_LEVEL_MIDDLE            4
@@ -51,12 +146,39 @@
 #define ARR_SIZE                    10
 #define NAME_ARR_SIZE               80
 
-typedef struct 
+/* Sound sources, one per dialed number */
+typedef enum
+{
+    eSOURCE_WAV,
+    eSOURCE_LONG_TONE,
+    eSOURCE_KPV_TONE,
+    eSOURCE_COUNT
+} source_e;
+
+/* Threads placed on their own CPUs */
+typedef enum
+{
+    eROLE_SIP,
+    eROLE_MEDIA_IO,
+    eROLE_MEDIA_CLOCK,
+    eROLE_COUNT
+} thread_role_e;
+
+/* The port of the sound source in the bridge. The source is replaced
+ * by reload for the new calls only, the replaced (retired) one is
+ * destroyed when the last call connected to it ends
+ */
+typedef struct media_source_t
 {
-    pjmedia_tone_desc   tone;
-    unsigned            tone_slot;
-    pjmedia_port        *tone_pjmedia_port;
-} player_tone_t;
+    pj_pool_t                   *pool;
+    pjmedia_port                *port;
+    pjmedia_port                *gate;          /* Same as port if silence is suppressed */
+    unsigned                    slot;
+    pjmedia_port                *fanout;        /* L16 calls listen here */
+    unsigned                    fanout_slot;
+    unsigned                    ref_cnt;
+    pj_bool_t                   retired;
+} media_source_t;
 
 typedef struct call_t 
 {
@@ -66,7 +188,17 @@ typedef struct call_t
     pjmedia_port                *port;
     unsigned                    slot;
     pj_bool_t                   in_use;
+    pj_bool_t                   dying;          /* Ended, the reaper releases the media and the slot */
+    pj_bool_t                   media_pending;  /* Queued to or in a media setup thread */
     pjmedia_transport           *transport;
+    media_source_t              *source;
+    int                         fanout_id;      /* L16 call without stream */
+    pjmedia_port                *rec_port;      /* Recorder of the inbound leg */
+    unsigned                    rec_slot;
+    pjmedia_port                *proxy;         /* Bridge slots reserved at start */
+    unsigned                    proxy_slot;
+    pjmedia_port                *rec_proxy;     /* NULL when calls are not recorded */
+    unsigned                    rec_proxy_slot;
     pj_str_t                    sip_uri_target_user;
     pj_timer_entry              ringing_timer;
     pj_timer_entry              call_media_timer;
@@ -75,6 +207,10 @@ typedef struct call_t
 static struct app_t 
 {
     pj_caching_pool             cp;
+    thread_pool_factory_t       *tpf;
+    pj_pool_factory             *pf;        /* Either of the two above */
+    pj_pool_factory_policy      pool_policy;
+    pj_bool_t                   is_hugepage_pool;
     pj_pool_t                   *pool;
     pj_pool_t                   *snd_pool;
     pjmedia_endpt               *med_endpt;
@@ -82,23 +218,51 @@ static struct app_t
     pjmedia_conf                *conf;
     pjmedia_port                *null_port;
     pjmedia_master_port         *null_snd;
-
-    pjmedia_port                *wav_port;
-    unsigned                    wav_slot;
-    pj_str_t                    wav_player_name;
-
-    pj_str_t                    long_tone_player_name;
-    player_tone_t               long_tone;
-
-    pj_str_t                    kpv_tone_player_name;
-    player_tone_t               kpv_tone;
+    unsigned                    ptime;          /* Bridge frame, fixed at start */
+    pj_bool_t                   l16_fast_path;  /* Fixed at start */
+    media_clock_t               *media_clock;
+    pj_bool_t                   sim;            /* Virtual clock, fixed at start */
+    sim_clock_t                 *sim_clock;
+
+    app_config_t                cfg;
+    cpu_affinity_t              *affinity[eROLE_COUNT];    /* Fixed at start */
+    overload_ctl_t              overload;
+    pj_timer_entry              overload_timer;
+    pj_str_t                    source_numbers[eSOURCE_COUNT];
+    media_source_t              *sources[eSOURCE_COUNT];
+    unsigned                    retired_cnt;    /* Replaced sources still playing, under app.mutex */
+    pj_uint64_t                 own_slot_cnt;   /* Calls the proxies could not take, under app.mutex */
 
     call_t                      calls[MAX_CALLS_STATIC];
-    pj_thread_t                 *worker_thread;
+    pj_thread_t                 *worker_threads[MAX_SIP_UDP_SOCKETS];
+    unsigned                    worker_cnt;     /* Fixed at start */
+    pj_thread_t                 *reload_thread;
+    pj_sem_t                    *reload_sem;
+    pj_thread_t                 *reaper_thread;
+    pj_sem_t                    *reaper_sem;
+    pj_thread_t                 *setup_threads[MEDIA_SETUP_THREADS];
+    pj_sem_t                    *setup_sem;
+    int                         setup_queue[MAX_CALLS_STATIC];  /* Call indexes, under app.mutex */
+    unsigned                    setup_head;
+    unsigned                    setup_cnt;
     pj_bool_t                   quit;
     pj_mutex_t                  *mutex;
+
+    pcap_writer_t               *pcap;
+    pj_sockaddr                 host_addr;      /* Replaces the wildcard address in the capture */
+
+    call_recorder_t             *recorder;
+    pj_bool_t                   record_raw;     /* G.711 from the RTP, fixed at start */
+    unsigned                    record_seq;
+
+    pj_lock_t                   *tcp_lock;
+    pjsip_transport             *tcp_conns[MAX_TCP_CONNECTIONS];
+    unsigned                    tcp_conn_cnt;
 } app;
 
+/* Set by SIGHUP, handled by the worker thread */
+static volatile sig_atomic_t reload_requested;
+
 
 /* Function prototypes */
 
@@ -106,10 +270,37 @@ static struct app_t
 static pj_status_t init_system(void);
 static pj_status_t init_pjsip(void);
 static pj_status_t init_pjmedia(void);
+static pj_status_t init_affinity(void);
+static void thread_set_role(thread_role_e role);
+static pj_status_t create_media_endpt(void);
+static pj_status_t init_codecs(void);
+static pj_status_t start_udp_transports(unsigned count);
+static pj_status_t create_reuseport_socket(const pj_sockaddr *addr, pj_sock_t *p_sock);
+static pj_status_t start_tcp_transport(void);
+static void on_transport_state(pjsip_transport *tp,
+                               pjsip_transport_state state,
+                               const pjsip_transport_state_info *info);
+static void release_tcp_connections(void);
+static pj_status_t start_capture(void);
+static pj_status_t start_recording(void);
+static void capture_sip(pjsip_transport *transport,
+                        const pj_sockaddr *remote,
+                        pj_bool_t is_rx,
+                        const char *buf,
+                        pj_size_t size);
 
 /* Clean */
 static pj_status_t cleanup_all_resources(void);
 static pj_status_t call_cleanup(call_t *call);
+static void call_cancel_timers(call_t *call);
+static void call_release_media(call_t *call);
+static void call_reset_slot(call_t *call);
+static void reap_dying_calls(void);
+static int reaper_thread_routine(void *arg);
+static void call_setup_media(call_t *call);
+static call_t *setup_queue_pop(void);
+static int setup_thread_routine(void *arg);
+static void run_sim_queues(void);
 static pj_status_t cleanup_ports(void);
 static pj_status_t destroy_port(pjmedia_port *port);
 static pj_status_t cleanup_media(void);
@@ -127,16 +318,22 @@ static pj_status_t logging_on_tx_msg(pjsip_tx_data *tdata);
 /* Timer call backs */
 static void ringing_timeout_cb(pj_timer_heap_t *timer_heap, struct pj_timer_entry *entry);
 static void media_timeout_cb(pj_timer_heap_t *timer_heap, struct pj_timer_entry *entry);
+static void overload_timeout_cb(pj_timer_heap_t *timer_heap, struct pj_timer_entry *entry);
 
-static pj_bool_t is_available_numbers(pj_str_t *target_sip_uri);
+static int get_source_index(const pj_str_t *number);
 static pj_bool_t is_request_verified(pjsip_rx_data *rdata);
 static int get_free_call_slot(void);
 static pjsip_sip_uri* get_target_uri(pjsip_rx_data *rdata);
 static pj_status_t create_and_connect_master_port();
+static pj_status_t start_master_port(void);
+static void check_media_clock(void);
+static pj_status_t create_call_proxies(void);
+static pj_status_t start_overload_control(void);
 
 /* Send response stateless */
 static pj_status_t process_non_invite_request(pjsip_rx_data *rdata);
 static void respond_busy(pjsip_rx_data *rdata);
+static void respond_overloaded(pjsip_rx_data *rdata, unsigned retry_after_sec);
 static void respond_unsupported_scheme(pjsip_rx_data *rdata);
 static void respond_not_found(pjsip_rx_data *rdata);
 
@@ -144,7 +341,15 @@ static void respond_not_found(pjsip_rx_data *rdata);
 static pj_status_t call_send_ring(call_t *call, pjsip_rx_data *rdata);
 static pj_status_t call_add_media(call_t *call);
 static pj_status_t create_media_stream(call_t *call, pjmedia_stream_info *stream_info);
+static void stream_set_default_ptime(pjmedia_stream_info *stream_info, const pjmedia_sdp_media *remote_media);
+static pj_status_t sdp_add_ptime(pj_pool_t *pool, pjmedia_sdp_session *sdp);
+static pj_status_t sdp_set_sendonly(pj_pool_t *pool, pjmedia_sdp_session *sdp);
 static pj_status_t call_connect_audio_source(call_t *call);
+static void call_start_recording(call_t *call, const pjmedia_stream_info *stream_info);
+static media_source_t *call_acquire_source(call_t *call);
+static pj_bool_t is_l16_fast_path(const pjmedia_stream_info *stream_info);
+static pj_status_t call_add_l16_media(call_t *call, const pjmedia_stream_info *stream_info);
+static void l16_on_rx_rtp(void *user_data, void *pkt, pj_ssize_t size);
 static pj_status_t call_add_media_port(call_t *call);
 static pj_status_t call_add_to_bridge(call_t *call);
 static pj_status_t call_create(pjsip_rx_data *rdata,
@@ -161,6 +366,7 @@ static pj_status_t create_invite_session(pjsip_dialog *dlg,
                                         pjmedia_sdp_session *local_sdp,
                                         pjsip_inv_session **inv_session);
 
+static void timer_cancel(pj_timer_entry *timer);
 static pj_status_t timer_create(pj_timer_entry *timer,
                                         call_t *call,
                                         long sec,
@@ -172,11 +378,26 @@ static int thread_routine(void *arg);
 /* Util to display the error message for the specified error code  */
 static void app_perror(const char *sender, const char *title, pj_status_t status);
 
-/* Add the player to the bridge */
-static pj_status_t create_and_connect_player_to_conf(const char *filename);
-
-/* Add tone to the bridge */
-static pj_status_t create_and_connect_tone_to_conf(player_tone_t *player);
+/* Print the load and media clock metrics */
+static void print_metrics(void);
+
+/* Sound sources */
+static void set_default_config(app_config_t *cfg);
+static pj_status_t load_config(app_config_t *cfg);
+static pj_status_t media_sources_create(const app_config_t *cfg, media_source_t *sources[]);
+static pj_status_t media_source_create_wav(const char *filename, media_source_t **p_source);
+static pj_status_t media_source_create_tone(const pjmedia_tone_desc *tone,
+                                            pj_bool_t suppress_silence,
+                                            media_source_t **p_source);
+static pj_status_t media_source_add_to_conf(media_source_t *source);
+static pj_status_t media_source_add_fanout(media_source_t *source);
+static void media_source_destroy(media_source_t *source);
+static void media_source_release(media_source_t *source);
+
+/* Reload of the sound sources */
+static void reload_signal_cb(int signum);
+static pj_status_t reload_media_sources(void);
+static int reload_thread_routine(void *arg);
 
 static pjsip_module mod_simpleua =
 {
@@ -198,6 +419,16 @@ static pjsip_module mod_simpleua =
 /* Notification on incoming messages */
 static pj_bool_t logging_on_rx_msg(pjsip_rx_data *rdata)
 {
+    if (app.pcap)
+    {
+        capture_sip(rdata->tp_info.transport,
+                    &rdata->pkt_info.src_addr,
+                    PJ_TRUE,
+                    rdata->msg_info.msg_buf,
+                    (pj_size_t)rdata->msg_info.len);
+        goto _exit;
+    }
+
     PJ_LOG(4, (THIS_FILE,
             "RX %d bytes %s from %s %s:%d:\n"
             "%.*s\n"
@@ -209,7 +440,8 @@ static pj_bool_t logging_on_rx_msg(pjsip_rx_data *rdata)
             rdata->pkt_info.src_port,
             (int)rdata->msg_info.len,
             rdata->msg_info.msg_buf));
-    
+
+_exit:
     /* Always return false, otherwise messages will not get processed! */
     return PJ_FALSE;
 }
@@ -217,6 +449,16 @@ static pj_bool_t logging_on_rx_msg(pjsip_rx_data *rdata)
 /* Notification on outgoing messages */
 static pj_status_t logging_on_tx_msg(pjsip_tx_data *tdata)
 {
+    if (app.pcap)
+    {
+        capture_sip(tdata->tp_info.transport,
+                    &tdata->tp_info.dst_addr,
+                    PJ_FALSE,
+                    tdata->buf.start,
+                    (pj_size_t)(tdata->buf.cur - tdata->buf.start));
+        goto _exit;
+    }
+
     PJ_LOG(4, (THIS_FILE,
                 "TX %ld bytes %s to %s %s:%d:\n"
                 "%.*s\n"
@@ -229,6 +471,7 @@ static pj_status_t logging_on_tx_msg(pjsip_tx_data *tdata)
                 (int)(tdata->buf.cur - tdata->buf.start),
                 tdata->buf.start));
 
+_exit:
     /* Always return success, otherwise message will not get sent! */
     return PJ_SUCCESS;
 }
@@ -253,10 +496,10 @@ static pjsip_module msg_logger =
 
 };
 
-int main()
+/* Everything but the menu, so that the engine can run inside a benchmark */
+pj_status_t auto_answer_start(void)
 {
     pj_status_t status;
-    int return_code = PJ_FALSE;
 
     status = init_system();
     if (status != PJ_SUCCESS)
@@ -276,61 +519,142 @@ int main()
         app.calls[i].in_use = PJ_FALSE;
     }
 
-    /* Set the namber of the player and tones 
+    /* Set the numbers of the player and tones
      * to choose sound */
-    app.wav_player_name = pj_str(WAV_PLAYER_NAME);
+    app.source_numbers[eSOURCE_WAV] =       pj_str(WAV_PLAYER_NAME);
+    app.source_numbers[eSOURCE_LONG_TONE] = pj_str(LONG_TONE_NAME);
+    app.source_numbers[eSOURCE_KPV_TONE] =  pj_str(KPV_TONE_NAME);
 
-    status = create_and_connect_player_to_conf(FILE_NAME);
+    /* Creating and attaching the player and tones to the bridge */
+    status = media_sources_create(&app.cfg, app.sources);
     if (status != PJ_SUCCESS)
     {
         goto _exit;
     }
 
-    /* Tone initialization */
-    app.long_tone.tone.freq1 =          FREQ1;
-    app.long_tone.tone.freq2 =          FREQ2;
-    app.long_tone.tone.on_msec =        ON_MSEC;
-    app.long_tone.tone.off_msec =       OFF_MSEC_LONG_TONE;
-    app.long_tone.tone.volume =         0;
-    app.long_tone.tone.flags =          0;
-    app.long_tone.tone_slot =           (unsigned)UNDEFINED_ID;
-    app.long_tone.tone_pjmedia_port =   NULL;
-    app.long_tone_player_name =         pj_str(LONG_TONE_NAME);
+    /* New calls are rejected when the box can not serve them */
+    status = start_overload_control();
+    if (status != PJ_SUCCESS)
+    {
+        goto _exit;
+    }
 
-    /* Creating and attaching a tone to the bridge*/
-    status = create_and_connect_tone_to_conf(&app.long_tone);
+    /* Create event manager */
+    status = pjmedia_event_mgr_create(app.pool, 0, NULL);
     if (status != PJ_SUCCESS)
     {
         goto _exit;
     }
-    
-    /* Tone initialization */
-    app.kpv_tone.tone.freq1 =           FREQ1; 
-    app.kpv_tone.tone.freq2 =           FREQ2;
-    app.kpv_tone.tone.on_msec =         ON_MSEC;
-    app.kpv_tone.tone.off_msec =        OFF_MSEC_KPV_TONE;
-    app.kpv_tone.tone.volume =          0;
-    app.kpv_tone.tone.flags =           0;
-    app.kpv_tone.tone_slot =            (unsigned)UNDEFINED_ID;
-    app.kpv_tone.tone_pjmedia_port =    NULL;
-    app.kpv_tone_player_name =          pj_str(KPV_TONE_NAME);
 
-    /* Creating and attaching a tone to the bridge*/
-    status = create_and_connect_tone_to_conf(&app.kpv_tone);
+    /* The reload thread loads new sound sources in the background */
+    status = pj_sem_create(app.pool, RELOAD_SEM_NAME, 0, MAX_PENDING_RELOADS, &app.reload_sem);
     if (status != PJ_SUCCESS)
     {
         goto _exit;
     }
 
-    /* Create event manager */
-    status = pjmedia_event_mgr_create(app.pool, 0, NULL);
+    status = pj_thread_create(app.pool, RELOAD_THREAD_NAME, &reload_thread_routine, NULL, 0, 0, &app.reload_thread);
+    if (status != PJ_SUCCESS)
+    {
+        goto _exit;
+    }
+
+    signal(SIGHUP, &reload_signal_cb);
+
+    /* The reaper tears down the ended calls outside of app.mutex */
+    status = pj_sem_create(app.pool, REAPER_SEM_NAME, 0, MAX_CALLS_STATIC + 1, &app.reaper_sem);
     if (status != PJ_SUCCESS)
     {
         goto _exit;
     }
 
-    /*Creating a new thread - it will handle events*/
-    status = pj_thread_create(app.pool, THREAD_NAME, &thread_routine, NULL, 0, 0, &app.worker_thread);
+    /* The simulation has neither the reaper nor the setup threads, the
+     * harness runs their queues in auto_answer_sim_advance(). The posts
+     * of their semaphores are then only counted */
+    if (!app.sim)
+    {
+        status = pj_thread_create(app.pool, REAPER_THREAD_NAME, &reaper_thread_routine, NULL, 0, 0,
+                                  &app.reaper_thread);
+        if (status != PJ_SUCCESS)
+        {
+            goto _exit;
+        }
+    }
+
+    /* The media of the answered calls is set up off the SIP threads */
+    status = pj_sem_create(app.pool, MEDIA_SETUP_SEM_NAME, 0, MAX_CALLS_STATIC + MEDIA_SETUP_THREADS, &app.setup_sem);
+    if (status != PJ_SUCCESS)
+    {
+        goto _exit;
+    }
+
+    for (unsigned i = 0; (i < MEDIA_SETUP_THREADS) && !app.sim; i++)
+    {
+        status = pj_thread_create(app.pool, MEDIA_SETUP_THREAD_NAME, &setup_thread_routine, NULL, 0, 0,
+                                  &app.setup_threads[i]);
+        if (status != PJ_SUCCESS)
+        {
+            goto _exit;
+        }
+    }
+
+    /*Creating new threads - they will handle events, one per SIP UDP socket*/
+    for (unsigned i = 0; i < app.worker_cnt; i++)
+    {
+        status = pj_thread_create(app.pool, THREAD_NAME, &thread_routine, (void *)(pj_ssize_t)i, 0, 0,
+                                  &app.worker_threads[i]);
+        if (status != PJ_SUCCESS)
+        {
+            goto _exit;
+        }
+    }
+
+_exit:
+    /* A partial start releases what it has made, the threads too */
+    if (status != PJ_SUCCESS)
+        cleanup_all_resources();
+
+    return status;
+}
+
+pj_status_t auto_answer_stop(void)
+{
+    return cleanup_all_resources();
+}
+
+pj_status_t auto_answer_start_sim(void)
+{
+    app.sim = PJ_TRUE;
+
+    return auto_answer_start();
+}
+
+void auto_answer_sim_advance(unsigned msec)
+{
+    if (app.sim_clock)
+    {
+        /* The calls answered and ended since the last step first, then
+         * those of the timers of this step */
+        run_sim_queues();
+        sim_clock_advance(app.sim_clock, (pj_uint64_t)msec * USEC_IN_MSEC);
+        run_sim_queues();
+    }
+
+    return;
+}
+
+pj_uint64_t auto_answer_sim_now_usec(void)
+{
+    return app.sim_clock ? sim_clock_now_usec(app.sim_clock) : 0;
+}
+
+#ifndef AUTO_ANSWER_NO_MAIN
+int main()
+{
+    pj_status_t status;
+    int return_code = PJ_FALSE;
+
+    status = auto_answer_start();
     if (status != PJ_SUCCESS)
     {
         goto _exit;
@@ -341,16 +665,22 @@ int main()
     {
         char s[ARR_SIZE];
 
-        printf("\nMenu:\n\tq\tQuit\n");
+        printf("\nMenu:\n\tm\tShow metrics\n\tr\tReload sound sources\n\tq\tQuit\n");
 
         if (fgets(s, sizeof(s), stdin) == NULL)
             continue;
 
+        if (s[0] == 'm')
+            print_metrics();
+
+        if (s[0] == 'r')
+            pj_sem_post(app.reload_sem);
+
         if (s[0] =='q')
             break;
     }
 
-    status = cleanup_all_resources();
+    status = auto_answer_stop();
     if (status != PJ_SUCCESS)
     {
         goto _exit;
@@ -372,6 +702,7 @@ _exit:
 
     return return_code;
 }
+#endif /* AUTO_ANSWER_NO_MAIN */
 
 /* Initialization SIP */
 static pj_status_t init_pjsip(void)
@@ -380,22 +711,33 @@ static pj_status_t init_pjsip(void)
     
     const pj_str_t *hostname = pj_gethostname();
 
-    status = pjsip_endpt_create(&app.cp.factory, hostname->ptr, &app.sip_endpt);
+    status = pjsip_endpt_create(app.pf, hostname->ptr, &app.sip_endpt);
     if (status != PJ_SUCCESS)
     {
         goto _exit;
     }
 
-    /* Adding UDP transport */
-    pj_sockaddr addr;
-    pj_sockaddr_init(pj_AF_INET(), &addr, NULL, (pj_uint16_t)SIP_PORT);
+    /* Adding UDP transports */
+    app.worker_cnt = app.cfg.sip_udp_sockets;
 
-    status = pjsip_udp_transport_start(app.sip_endpt, &addr.ipv4, NULL, 1, NULL);
+    status = start_udp_transports(app.worker_cnt);
     if (status != PJ_SUCCESS)
     {
+        app_perror(THIS_FILE, "Unable to start UDP transport", status);
         goto _exit;
     }
 
+    /* Adding TCP transport */
+    if (app.cfg.sip_tcp)
+    {
+        status = start_tcp_transport();
+        if (status != PJ_SUCCESS)
+        {
+            app_perror(THIS_FILE, "Unable to start TCP transport", status);
+            goto _exit;
+        }
+    }
+
     /* Initialization of modules */
     status = pjsip_tsx_layer_init_module(app.sip_endpt);
     if (status != PJ_SUCCESS)
@@ -448,411 +790,506 @@ _exit:
     return status;
 }
 
-/* Initialize media */
-static pj_status_t init_pjmedia(void)
+/* UDP sockets on the SIP port. With more than one the kernel spreads
+ * the peers over them by the hash of the addresses, each socket has one
+ * pending read, so the worker threads parse the messages of different
+ * sockets at the same time
+ */
+static pj_status_t start_udp_transports(unsigned count)
 {
-    pj_status_t status;
+    pj_status_t status = PJ_SUCCESS;
+    pj_sockaddr addr;
+    pj_sockaddr host_addr;
+    pjsip_host_port a_name;
+    char host[PJ_INET6_ADDRSTRLEN];
 
-    status = pjmedia_endpt_create(&app.cp.factory, NULL, 1, &app.med_endpt);
-    if (status != PJ_SUCCESS)
+    pj_sockaddr_init(pj_AF_INET(), &addr, NULL, (pj_uint16_t)SIP_PORT);
+
+    if (count == 1)
     {
+        status = pjsip_udp_transport_start(app.sip_endpt, &addr.ipv4, NULL, 1, NULL);
         goto _exit;
     }
 
-    app.pool = pjmedia_endpt_create_pool(app.med_endpt, "Media pool", POOL_SIZE, POOL_INCREMENT_SIZE);
-    if (!app.pool)
+    /* Published as pjsip_udp_transport_start does for a wildcard address */
+    status = pj_gethostip(pj_AF_INET(), &host_addr);
+    if (status != PJ_SUCCESS)
     {
-        status = PJ_ENOMEM;
         goto _exit;
     }
 
-    status = pjmedia_codec_g711_init(app.med_endpt);
+    pj_sockaddr_print(&host_addr, host, sizeof(host), 0);
+    a_name.host = pj_str(host);
+    a_name.port = SIP_PORT;
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        pj_sock_t sock;
+
+        status = create_reuseport_socket(&addr, &sock);
+        if (status != PJ_SUCCESS)
+            break;
+
+        status = pjsip_udp_transport_attach2(app.sip_endpt, PJSIP_TRANSPORT_UDP, sock, &a_name,
+                                             SIP_UDP_ASYNC_CNT, NULL);
+        if (status != PJ_SUCCESS)
+        {
+            pj_sock_close(sock);
+            break;
+        }
+    }
+
+    if (status == PJ_SUCCESS)
+        PJ_LOG(3, (THIS_FILE, "%u SIP UDP sockets on port %d", count, SIP_PORT));
+
+_exit:
+    return status;
+}
+
+static pj_status_t create_reuseport_socket(const pj_sockaddr *addr, pj_sock_t *p_sock)
+{
+    int reuse = 1;
+    pj_sock_t sock;
+    pj_status_t status;
+
+    status = pj_sock_socket(pj_AF_INET(), pj_SOCK_DGRAM(), 0, &sock);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    /* Set on every socket before bind, the first one included */
+    status = pj_sock_setsockopt(sock, (pj_uint16_t)pj_SOL_SOCKET(), (pj_uint16_t)SO_REUSEPORT, &reuse, sizeof(reuse));
+    if (status == PJ_SUCCESS)
+        status = pj_sock_bind(sock, addr, (int)pj_sockaddr_get_len(addr));
+
     if (status != PJ_SUCCESS)
     {
+        pj_sock_close(sock);
         goto _exit;
     }
 
-    status = pjmedia_conf_create(app.pool,
-                                MAX_CALLS_STATIC + NUM_USED_APP_PORTS,
-                                CLOCK_RATE,
-                                NCHANNELS,
-                                SAMPLES_PER_FRAME,
-                                BITS_PER_SAMPLE,
-                                PJMEDIA_CONF_NO_DEVICE,
-                                &app.conf);
+    *p_sock = sock;
+
+_exit:
+    return status;
+}
+
+/* TCP listener on the SIP port. Every accepted connection is kept until
+ * the peer closes it, so a trunk sends all its calls over one connection
+ * and our requests in the dialogs reuse it instead of connecting back
+ */
+static pj_status_t start_tcp_transport(void)
+{
+    static int tcp_nodelay = 1;
+    pj_status_t status;
+    pjsip_tcp_transport_cfg cfg;
+
+    status = pj_lock_create_simple_mutex(app.snd_pool, TCP_LOCK_NAME, &app.tcp_lock);
     if (status != PJ_SUCCESS)
     {
         goto _exit;
     }
 
-    /* Creating and connecting the master port */
-    status = create_and_connect_master_port();
+    pjsip_tcp_transport_cfg_default(&cfg, pj_AF_INET());
+    pj_sockaddr_init(pj_AF_INET(), &cfg.bind_addr, NULL, (pj_uint16_t)SIP_PORT);
+    cfg.async_cnt = SIP_TCP_ASYNC_CNT;
+    cfg.reuse_addr = PJ_TRUE;
+
+    /* Responses are sent at once, not held back by Nagle */
+    cfg.sockopt_params.cnt = 1;
+    cfg.sockopt_params.options[0].level = pj_SOL_TCP();
+    cfg.sockopt_params.options[0].optname = pj_TCP_NODELAY();
+    cfg.sockopt_params.options[0].optval = &tcp_nodelay;
+    cfg.sockopt_params.options[0].optlen = sizeof(tcp_nodelay);
+
+    status = pjsip_tcp_transport_start3(app.sip_endpt, &cfg, NULL);
     if (status != PJ_SUCCESS)
     {
         goto _exit;
     }
 
-    status = PJ_SUCCESS;
-    goto _exit;
+    status = pjsip_tpmgr_set_state_cb(pjsip_endpt_get_tpmgr(app.sip_endpt), &on_transport_state);
 
 _exit:
     return status;
 }
 
-/* Call state callback */
-static void call_on_state_changed_cb(pjsip_inv_session *inv, pjsip_event *event)
+/* Hold a reference of the connection while it is up, otherwise pjsip
+ * closes it after PJSIP_TRANSPORT_IDLE_TIME without a transaction
+ */
+static void on_transport_state(pjsip_transport *tp,
+                               pjsip_transport_state state,
+                               const pjsip_transport_state_info *info)
 {
-    call_t *call = NULL;
-    PJ_UNUSED_ARG(event);
+    PJ_UNUSED_ARG(info);
 
-    if (inv->state == PJSIP_INV_STATE_DISCONNECTED)
-    {
-        pj_mutex_lock(app.mutex);
+    if ((tp->flag & PJSIP_TRANSPORT_RELIABLE) == 0)
+        goto _exit;
 
-        call = inv->mod_data[0];
+    pj_lock_acquire(app.tcp_lock);
 
-        if (call && call->in_use)
+    if ((state == PJSIP_TP_STATE_CONNECTED) && (app.tcp_conn_cnt < MAX_TCP_CONNECTIONS))
+    {
+        pjsip_transport_add_ref(tp);
+        app.tcp_conns[app.tcp_conn_cnt++] = tp;
+    }
+    else if (state == PJSIP_TP_STATE_DISCONNECTED)
+    {
+        for (unsigned i = 0; i < app.tcp_conn_cnt; i++)
         {
-            call_cleanup(call);
+            if (app.tcp_conns[i] == tp)
+            {
+                app.tcp_conns[i] = app.tcp_conns[--app.tcp_conn_cnt];
+                pjsip_transport_dec_ref(tp);
+                break;
+            }
         }
-
-        pj_mutex_unlock(app.mutex);
     }
 
+    pj_lock_release(app.tcp_lock);
+
+_exit:
     return;
 }
 
-/* Clear call */
-static pj_status_t call_cleanup(call_t *call)
+static void release_tcp_connections(void)
 {
-    pj_status_t status;
-    if (!call->in_use)
-    {
-        status = PJ_EGONE;
+    if (app.tcp_lock == NULL)
         goto _exit;
-    }
 
-    if (call->inv && call->inv->dlg)
-    {
-        status = pjsip_inv_terminate(call->inv, PJSIP_SC_OK, PJ_FALSE);
-        app_perror(THIS_FILE, "Failed to forcefully terminate and destroy INVITE session", status);
-    }
+    pjsip_tpmgr_set_state_cb(pjsip_endpt_get_tpmgr(app.sip_endpt), NULL);
 
-    if ((call->port != NULL) && (call->slot != (unsigned)UNDEFINED_ID))
+    pj_lock_acquire(app.tcp_lock);
+    while (app.tcp_conn_cnt > 0)
     {
-        status = pjmedia_conf_remove_port(app.conf, call->slot);
-        app_perror(THIS_FILE, "Failed to remove the specified port from the conference bridge", status);
+        pjsip_transport_dec_ref(app.tcp_conns[--app.tcp_conn_cnt]);
     }
+    pj_lock_release(app.tcp_lock);
 
-    if (call->stream)
-    {
-        status = pjmedia_stream_destroy(call->stream);
-        app_perror(THIS_FILE, "Failed to destroy the media stream", status);
-    }
+    pj_lock_destroy(app.tcp_lock);
+    app.tcp_lock = NULL;
 
-    if (call->transport)
-    {
-        status = pjmedia_transport_close(call->transport);
-        app_perror(THIS_FILE, "Failed to close media transport", status);
-    }
+_exit:
+    return;
+}
 
-    if (call->ringing_timer._timer_id > 0)
+/* Capture of SIP, and of the sampled RTP of the calls, replaces the
+ * text dumps of msg_logger. Applied at start only
+ */
+static pj_status_t start_capture(void)
+{
+    pj_status_t status;
+    pcap_writer_param_t param;
+
+    status = pj_gethostip(pj_AF_INET(), &app.host_addr);
+    if (status != PJ_SUCCESS)
     {
-        pjsip_endpt_cancel_timer(app.sip_endpt, &call->ringing_timer);
-        PJ_LOG(3, (THIS_FILE, "pjsip_endpt_cancel_timer : ringing_timer - DONE"));
+        goto _exit;
     }
 
-    if (call->call_media_timer._timer_id > 0)
+    param.file_prefix = app.cfg.pcap_file;
+    param.ring_packets = PCAP_RING_PACKETS;
+    param.file_size_kb = app.cfg.pcap_file_size_kb;
+    param.max_files = app.cfg.pcap_max_files;
+
+    status = pcap_writer_create(app.snd_pool, &param, &app.pcap);
+    if (status != PJ_SUCCESS)
     {
-        pjsip_endpt_cancel_timer(app.sip_endpt, &call->call_media_timer);
-        PJ_LOG(3, (THIS_FILE, "pjsip_endpt_cancel_timer : call_media_timer - DONE"));
+        goto _exit;
     }
 
-    call->in_use = PJ_FALSE;
-    call->inv = NULL;
-    call->port = NULL;
-    call->stream = NULL;
-    call->slot = (unsigned)UNDEFINED_ID;
-    call->transport = NULL;
-
-    status = PJ_SUCCESS;
-    goto _exit;
+    PJ_LOG(3, (THIS_FILE, "Capturing to %s_*.pcap, RTP packets sampled 1/%u (0 - none)",
+               app.cfg.pcap_file, app.cfg.pcap_rtp_sample));
 
 _exit:
     return status;
 }
 
-/* Clear all resources */
-static pj_status_t cleanup_all_resources(void) 
+static void capture_sip(pjsip_transport *transport,
+                        const pj_sockaddr *remote,
+                        pj_bool_t is_rx,
+                        const char *buf,
+                        pj_size_t size)
+{
+    pj_sockaddr local;
+
+    pj_memcpy(&local, &transport->local_addr, sizeof(local));
+    if (!pj_sockaddr_has_addr(&local))
+        local.ipv4.sin_addr = app.host_addr.ipv4.sin_addr;
+
+    if (is_rx)
+        pcap_writer_write(app.pcap, remote, &local, buf, size);
+    else
+        pcap_writer_write(app.pcap, &local, remote, buf, size);
+
+    return;
+}
+
+/* One recorder channel per call slot, the frames are those of the bridge */
+static pj_status_t start_recording(void)
 {
     pj_status_t status;
+    call_recorder_param_t param;
 
-    /* Clear all calls */
-    for (int i = 0; i < MAX_CALLS_STATIC; i++) 
-    {
-        call_cleanup(&app.calls[i]);
-    }
+    param.dir = app.cfg.record_dir;
+    param.clock_rate = CLOCK_RATE;
+    param.samples_per_frame = SAMPLES_PER_FRAME(app.ptime);
+    param.max_channels = MAX_CALLS_STATIC;
+    param.buffer_msec = app.cfg.record_buffer_msec;
+    param.flush_msec = RECORD_FLUSH_MSEC;
 
-    if (app.mutex)
+    status = call_recorder_create(app.snd_pool, &param, &app.recorder);
+    if (status != PJ_SUCCESS)
     {
-        status = pj_mutex_destroy(app.mutex);
-        app.mutex = NULL;
-
-        if (status != PJ_SUCCESS)
-            app_perror(THIS_FILE, "Failed to destroy mutex", status);
+        goto _exit;
     }
 
-    /* Clear all media resources */
-    cleanup_media();
+    app.record_raw = (app.cfg.record_g711_raw != 0);
 
-    if (app.sip_endpt)
-    {
-        pjsip_endpt_destroy(app.sip_endpt);
-        
-        PJ_LOG(3, (THIS_FILE, "Destroying endpoint instance"));
-    }
-
-    /* Pools releasing */
-    release_all_pools();
-
-    pj_shutdown();
+    PJ_LOG(3, (THIS_FILE, "Recording the callers into %s, %u ms buffered per call, G.711 %s",
+               app.cfg.record_dir, app.cfg.record_buffer_msec, app.record_raw ? "raw" : "decoded"));
 
-    return PJ_SUCCESS;
+_exit:
+    return status;
 }
 
-
-static pj_status_t cleanup_ports(void)
+/* Initialize media */
+static pj_status_t init_pjmedia(void)
 {
     pj_status_t status;
 
-    /* Stop master port */
-    if (app.null_snd)
-    {
-        status = pjmedia_master_port_stop(app.null_snd);
-        if (status != PJ_SUCCESS)
-            app_perror(THIS_FILE, "Failed to stop the media flow", status);
+    /* The bridge, the streams and the RTP buffers are used on the media
+     * CPUs, the threads created here inherit the preference */
+    if (app.cfg.numa_local)
+        cpu_affinity_prefer_node(cpu_affinity_get_node(app.affinity[eROLE_MEDIA_CLOCK]));
 
-        status = pjmedia_master_port_destroy(app.null_snd, PJ_FALSE);
-        if (status != PJ_SUCCESS)
-            app_perror(THIS_FILE, "Failed to destroy the master port", status);
-        
-        app.null_snd = NULL;
+    /* Its ioqueue threads start on the media io CPUs */
+    status = cpu_affinity_call(app.affinity[eROLE_MEDIA_IO], &create_media_endpt);
+    if (status != PJ_SUCCESS)
+    {
+        goto _exit;
     }
 
-    /* Destroying ports */
-    if (app.null_port)
+    app.pool = pjmedia_endpt_create_pool(app.med_endpt, "Media pool", POOL_SIZE, POOL_INCREMENT_SIZE);
+    if (!app.pool)
     {
-        destroy_port(app.null_port);
+        status = PJ_ENOMEM;
+        goto _exit;
     }
 
-    if (app.wav_port)
+    status = init_codecs();
+    if (status != PJ_SUCCESS)
     {
-        status = pjmedia_conf_remove_port(app.conf, (unsigned)app.wav_slot);
-        if (status != PJ_SUCCESS)
-        {
-            app_perror(THIS_FILE, "Failed to remove the specified port from the conference bridge", status);
-        }
-
-        destroy_port(app.wav_port);
+        goto _exit;
     }
 
-    if (app.long_tone.tone_pjmedia_port)
+    status = pjmedia_conf_create(app.pool,
+                                MAX_CALLS_STATIC * PORTS_PER_CALL + NUM_USED_APP_PORTS,
+                                CLOCK_RATE,
+                                NCHANNELS,
+                                SAMPLES_PER_FRAME(app.ptime),
+                                BITS_PER_SAMPLE,
+                                PJMEDIA_CONF_NO_DEVICE,
+                                &app.conf);
+    if (status != PJ_SUCCESS)
     {
-        status = pjmedia_conf_remove_port(app.conf, (unsigned)app.long_tone.tone_slot);
-        if (status != PJ_SUCCESS)
-        {
-            app_perror(THIS_FILE, "Failed to remove the specified port from the conference bridge", status);
-        }
-
-        destroy_port(app.long_tone.tone_pjmedia_port);
-
-        app.long_tone.tone_pjmedia_port = NULL;
+        goto _exit;
     }
 
-    if (app.kpv_tone.tone_pjmedia_port)
+    /* The bridge slots of the calls, before the clock runs */
+    status = create_call_proxies();
+    if (status != PJ_SUCCESS)
     {
-        status = pjmedia_conf_remove_port(app.conf, (unsigned)app.kpv_tone.tone_slot);
-        if (status != PJ_SUCCESS)
-        {
-            app_perror(THIS_FILE, "Failed to remove the specified port from the conference bridge", status);
-        }
-
-        destroy_port(app.kpv_tone.tone_pjmedia_port);
+        goto _exit;
     }
 
-    return PJ_SUCCESS;
-}
-
-/* Destroying ports */
-static pj_status_t destroy_port(pjmedia_port *port)
-{
-    pj_status_t status;
-
-    if (port)
+    /* Creating and connecting the master port, its clock thread starts
+     * on the media clock CPUs */
+    status = cpu_affinity_call(app.affinity[eROLE_MEDIA_CLOCK], &create_and_connect_master_port);
+    if (status != PJ_SUCCESS)
     {
-        status = pjmedia_port_destroy(port);
-
-        if (status != PJ_SUCCESS)
-        {
-            app_perror(THIS_FILE, "Failed to destroy port (and subsequent downstream ports)", status);
-            goto _exit;
-        }
+        goto _exit;
     }
 
     status = PJ_SUCCESS;
     goto _exit;
 
 _exit:
+    if (app.cfg.numa_local)
+        cpu_affinity_prefer_node(CPU_AFFINITY_NO_NODE);
+
     return status;
 }
 
-/* Clear all media resources */
-static pj_status_t cleanup_media(void)
+static pj_status_t create_media_endpt(void)
 {
-    pj_status_t status;
-
-    cleanup_ports();
-
-    /* Conference conferece bridge  */
-    if (app.conf)
-    {
-        status = pjmedia_conf_destroy(app.conf);
+    return pjmedia_endpt_create(app.pf, NULL, 1, &app.med_endpt);
+}
 
-        if (status != PJ_SUCCESS)
-            app_perror(THIS_FILE, "Failed to destroy conference bridge", status);
-    }
+/* CPU sets of the thread roles, the lists are checked by load_config() */
+static pj_status_t init_affinity(void)
+{
+    pj_status_t status = PJ_SUCCESS;
+    const char *lists[eROLE_COUNT];
 
-    /* Destroy event manager */
-    pjmedia_event_mgr_destroy(NULL);
+    lists[eROLE_SIP] =          app.cfg.cpus_sip;
+    lists[eROLE_MEDIA_IO] =     app.cfg.cpus_media_io;
+    lists[eROLE_MEDIA_CLOCK] =  app.cfg.cpus_media_clock;
 
-    /* Destroy media endpoint */
-    if (app.med_endpt) 
+    for (int i = 0; i < eROLE_COUNT; i++)
     {
-        status = pjmedia_endpt_destroy(app.med_endpt);
-        
+        status = cpu_affinity_create(app.snd_pool, lists[i], &app.affinity[i]);
         if (status != PJ_SUCCESS)
-            app_perror(THIS_FILE, "Failed to destroy media endpoint instance and shutdown audio subsystem", status);
+        {
+            app_perror(THIS_FILE, "Invalid CPU list", status);
+            goto _exit;
+        }
+
+        if (lists[i][0] != '\0')
+            PJ_LOG(4, (THIS_FILE, "CPUs %s, NUMA node %d for role %d",
+                       lists[i], cpu_affinity_get_node(app.affinity[i]), i));
     }
 
-    return PJ_SUCCESS;
+_exit:
+    return status;
 }
 
-/* Realising pools */
-static void release_all_pools(void)
+/* Called by a thread of the role when it starts */
+static void thread_set_role(thread_role_e role)
 {
-    if (app.pool)
-    {
-        pj_pool_release(app.pool);
-    }
-
-    if (app.snd_pool)
-    {
-        pj_pool_release(app.snd_pool);
-    }
+    cpu_affinity_apply(app.affinity[role]);
 
-    pj_caching_pool_destroy(&app.cp);
+    if (app.cfg.numa_local && (cpu_affinity_get_node(app.affinity[role]) != CPU_AFFINITY_NO_NODE))
+        cpu_affinity_prefer_node(cpu_affinity_get_node(app.affinity[role]));
 
     return;
 }
 
-static pj_bool_t on_rx_request(pjsip_rx_data *rdata)
+/* G.722 is preferred, G.711 callers get the bridge audio resampled to 8 kHz */
+static pj_status_t init_codecs(void)
 {
     pj_status_t status;
-    pj_bool_t bool = PJ_FALSE;
-    int call_idx = UNDEFINED_ID;
-    pjsip_sip_uri *target_sip_uri;
+    pj_str_t codec_id = pj_str(PREFERRED_CODEC_ID);
 
-    /* Process only INVITE requests */
-    if (rdata->msg_info.msg->line.req.method.id != PJSIP_INVITE_METHOD)
+    if (app.cfg.g711_simd)
+        status = g711_simd_codec_init(app.med_endpt);
+    else
+        status = pjmedia_codec_g711_init(app.med_endpt);
+    if (status != PJ_SUCCESS)
     {
-        status = process_non_invite_request(rdata);
         goto _exit;
     }
 
-    pj_mutex_lock(app.mutex);
-    call_idx = get_free_call_slot();
-    if (call_idx == UNDEFINED_ID) 
+    status = pjmedia_codec_g722_init(app.med_endpt);
+    if (status != PJ_SUCCESS)
     {
-        respond_busy(rdata);
-        goto _on_exit_with_unlock;
+        app_perror(THIS_FILE, "Unable to register G.722", status);
+        goto _exit;
     }
 
-    if (!PJSIP_URI_SCHEME_IS_SIP(rdata->msg_info.msg->line.req.uri))
+    status = pjmedia_codec_mgr_set_codec_priority(pjmedia_endpt_get_codec_mgr(app.med_endpt),
+                                                  &codec_id,
+                                                  PJMEDIA_CODEC_PRIO_HIGHEST);
+    if (status != PJ_SUCCESS)
     {
-        respond_unsupported_scheme(rdata);
-        goto _on_exit_with_unlock;
+        app_perror(THIS_FILE, "Unable to set the codec priority", status);
+        goto _exit;
     }
 
-    target_sip_uri = get_target_uri(rdata);
-
-    /* Check if the dialed number is correct */
-    if (!is_available_numbers(&target_sip_uri->user))
+    /* L16 at the bridge rate goes out without any codec, the other
+     * L16 variants would need resampling and are not offered */
+    app.l16_fast_path = (app.cfg.l16_fast_path != 0);
+    if (app.l16_fast_path)
     {
-        respond_not_found(rdata);
-        goto _on_exit_with_unlock;
-    }
+        pjmedia_codec_mgr *mgr = pjmedia_endpt_get_codec_mgr(app.med_endpt);
+        pj_str_t l16_prefix = pj_str(L16_CODEC_PREFIX);
+        pj_str_t l16_id = pj_str(L16_CODEC_ID);
 
-    if (!is_request_verified(rdata))
-    {
-        goto _on_exit_with_unlock;
-    }
+        status = pjmedia_codec_l16_init(app.med_endpt, 0);
+        if (status != PJ_SUCCESS)
+        {
+            app_perror(THIS_FILE, "Unable to register L16", status);
+            goto _exit;
+        }
 
-    status = call_create(rdata, call_idx, target_sip_uri);
-    if (status != PJ_SUCCESS) 
-    {
-        goto _on_exit_with_unlock;
+        pjmedia_codec_mgr_set_codec_priority(mgr, &l16_prefix, PJMEDIA_CODEC_PRIO_DISABLED);
+        pjmedia_codec_mgr_set_codec_priority(mgr, &codec_id, PJMEDIA_CODEC_PRIO_NEXT_HIGHER);
+        status = pjmedia_codec_mgr_set_codec_priority(mgr, &l16_id, PJMEDIA_CODEC_PRIO_HIGHEST);
+        if (status != PJ_SUCCESS)
+        {
+            app_perror(THIS_FILE, "Unable to set the codec priority", status);
+        }
     }
 
-    PJ_LOG(3,(THIS_FILE,
-            "CALL TO %.*s!!",
-            (int)app.calls[call_idx].sip_uri_target_user.slen,
-            app.calls[call_idx].sip_uri_target_user.ptr));
+_exit:
+    return status;
+}
 
-    pj_mutex_unlock(app.mutex);
+/* Call state callback */
+static void call_on_state_changed_cb(pjsip_inv_session *inv, pjsip_event *event)
+{
+    call_t *call = NULL;
+    pj_bool_t reap = PJ_FALSE;
+    PJ_UNUSED_ARG(event);
 
-    status = call_send_ring(&app.calls[call_idx], rdata);
-    if (status != PJ_SUCCESS)
+    if (inv->state == PJSIP_INV_STATE_DISCONNECTED)
     {
-        goto _exit;
-    }
+        pj_mutex_lock(app.mutex);
 
-    /* Specifies the time interval for the ringing timer */
-    status = timer_create(&(app.calls[call_idx].ringing_timer),
-                                        &app.calls[call_idx],
-                                        RINGING_TIMER_SEC,
-                                        RINGING_TIMER_MSEC,
-                                        &ringing_timeout_cb);
-    if (status != PJ_SUCCESS)
-    {
-        app_perror(THIS_FILE, "timer_create", status);
-    }
+        call = inv->mod_data[0];
 
-    bool = PJ_TRUE;
-    goto _exit;
+        /* The session is destroyed after this callback: the timers
+         * referring to it go now, the media is left to the reaper and
+         * the slot stays busy until it is done. The stream lives in the
+         * pool of the dialog, which is kept until the reaper drops it */
+        if (call && call->in_use && !call->dying)
+        {
+            call_cancel_timers(call);
+            pjsip_dlg_inc_session(inv->dlg, &mod_simpleua);
+            inv->mod_data[0] = NULL;
+            call->inv = NULL;
+            call->dying = PJ_TRUE;
+            reap = PJ_TRUE;
+        }
 
-_on_exit_with_unlock:
-    pj_mutex_unlock(app.mutex);
-    goto _exit;
+        pj_mutex_unlock(app.mutex);
 
-_exit:
-    return bool;
+        if (reap)
+            pj_sem_post(app.reaper_sem);
+    }
+
+    return;
 }
 
-static pj_status_t process_non_invite_request(pjsip_rx_data *rdata)
+/* Synchronous teardown of a call, live or dying, at shutdown */
+static pj_status_t call_cleanup(call_t *call)
 {
     pj_status_t status;
-    if (rdata->msg_info.msg->line.req.method.id != PJSIP_ACK_METHOD)
+    pjsip_dialog *dlg = NULL;
+
+    if (!call->in_use)
     {
-        pj_str_t reason = pj_str("Simple UA unable to handle this request");
-        status = pjsip_endpt_respond_stateless(app.sip_endpt,
-                                                rdata,
-                                                PJSIP_SC_FORBIDDEN,
-                                                &reason,
-                                                NULL,
-                                                NULL);
+        status = PJ_EGONE;
         goto _exit;
     }
 
+    if (call->inv && call->inv->dlg)
+    {
+        status = pjsip_inv_terminate(call->inv, PJSIP_SC_OK, PJ_FALSE);
+        app_perror(THIS_FILE, "Failed to forcefully terminate and destroy INVITE session", status);
+    }
+
+    call_cancel_timers(call);
+    call_release_media(call);
+
+    pj_mutex_lock(app.mutex);
+    if (call->dying)
+        dlg = call->dlg;
+    call_reset_slot(call);
+    pj_mutex_unlock(app.mutex);
+
+    if (dlg)
+        pjsip_dlg_dec_session(dlg, &mod_simpleua);
+
     status = PJ_SUCCESS;
     goto _exit;
 
@@ -860,474 +1297,1778 @@ _exit:
     return status;
 }
 
-static void respond_busy(pjsip_rx_data *rdata)
+static void call_cancel_timers(call_t *call)
 {
-    pj_str_t reason = pj_str("Too many calls");
-    pjsip_endpt_respond_stateless(app.sip_endpt, rdata, PJSIP_SC_BUSY_HERE, &reason, NULL, NULL);
-}
+    if (call->ringing_timer._timer_id > 0)
+    {
+        timer_cancel(&call->ringing_timer);
+        PJ_LOG(3, (THIS_FILE, "pjsip_endpt_cancel_timer : ringing_timer - DONE"));
+    }
 
-static void respond_unsupported_scheme(pjsip_rx_data *rdata)
-{
-    pjsip_endpt_respond_stateless(app.sip_endpt, rdata, PJSIP_SC_UNSUPPORTED_URI_SCHEME, NULL, NULL, NULL);
-}
+    if (call->call_media_timer._timer_id > 0)
+    {
+        timer_cancel(&call->call_media_timer);
+        PJ_LOG(3, (THIS_FILE, "pjsip_endpt_cancel_timer : call_media_timer - DONE"));
+    }
 
-static pjsip_sip_uri* get_target_uri(pjsip_rx_data *rdata)
-{
-    return (pjsip_sip_uri*)pjsip_uri_get_uri(rdata->msg_info.msg->line.req.uri);
+    return;
 }
 
-/* Check if the number exist in avaible numbers */
-static pj_bool_t is_available_numbers(pj_str_t *number)
+/* Bridge ports, stream, transport and recorder of the call. The bridge
+ * and the transport take their own locks, app.mutex is only taken for
+ * the source reference */
+static void call_release_media(call_t *call)
 {
-    return (pj_strcmp(number, &app.wav_player_name) == 0) ||
-           (pj_strcmp(number, &app.long_tone_player_name) == 0) ||
-           (pj_strcmp(number, &app.kpv_tone_player_name) == 0);
-}
+    pj_status_t status;
+
+    if (call->rec_slot != (unsigned)UNDEFINED_ID)
+        port_proxy_bind(call->rec_proxy, NULL, PJ_FALSE);
+
+    /* The reserved slot stays in the bridge, only the source is
+     * disconnected from it */
+    if ((call->port != NULL) && (call->slot == call->proxy_slot))
+    {
+        if (call->source)
+        {
+            status = pjmedia_conf_disconnect_port(app.conf, call->source->slot, call->slot);
+            app_perror(THIS_FILE, "Failed to disconnect the source from the call", status);
+        }
+
+        port_proxy_bind(call->proxy, NULL, PJ_FALSE);
+    }
+    else if ((call->port != NULL) && (call->slot != (unsigned)UNDEFINED_ID))
+    {
+        status = pjmedia_conf_remove_port(app.conf, call->slot);
+        app_perror(THIS_FILE, "Failed to remove the specified port from the conference bridge", status);
+    }
+
+    if (call->source)
+    {
+        if (call->fanout_id != UNDEFINED_ID)
+            l16_fanout_remove_listener(call->source->fanout, call->fanout_id);
+
+        pj_mutex_lock(app.mutex);
+        media_source_release(call->source);
+        call->source = NULL;
+        pj_mutex_unlock(app.mutex);
+    }
+
+    if (call->stream)
+    {
+        status = pjmedia_stream_destroy(call->stream);
+        app_perror(THIS_FILE, "Failed to destroy the media stream", status);
+    }
+
+    if (call->transport)
+    {
+        status = pjmedia_transport_close(call->transport);
+        app_perror(THIS_FILE, "Failed to close media transport", status);
+    }
+
+    /* Neither the bridge nor the transport feed it now, the writer
+     * thread finishes the file */
+    if (call->rec_port)
+        pjmedia_port_destroy(call->rec_port);
+
+    return;
+}
+
+/* Return the slot to the free pool. Must be called with app.mutex held */
+static void call_reset_slot(call_t *call)
+{
+    call->in_use = PJ_FALSE;
+    call->dying = PJ_FALSE;
+    call->inv = NULL;
+    call->dlg = NULL;
+    call->port = NULL;
+    call->stream = NULL;
+    call->slot = (unsigned)UNDEFINED_ID;
+    call->transport = NULL;
+    call->source = NULL;
+    call->fanout_id = UNDEFINED_ID;
+    call->rec_port = NULL;
+    call->rec_slot = (unsigned)UNDEFINED_ID;
+
+    return;
+}
+
+/* Tear down every dying call, each one outside of app.mutex */
+static void reap_dying_calls(void)
+{
+    for (int i = 0; i < MAX_CALLS_STATIC; i++)
+    {
+        call_t *call = &app.calls[i];
+        pjsip_dialog *dlg;
+        pj_bool_t dying;
+
+        /* A call still in a setup thread is reaped when it comes back */
+        pj_mutex_lock(app.mutex);
+        dying = call->in_use && call->dying && !call->media_pending;
+        pj_mutex_unlock(app.mutex);
+
+        if (!dying)
+            continue;
+
+        call_release_media(call);
+
+        pj_mutex_lock(app.mutex);
+        dlg = call->dlg;
+        call_reset_slot(call);
+        pj_mutex_unlock(app.mutex);
+
+        /* The media is gone, the dialog and its pool may go too */
+        pjsip_dlg_dec_session(dlg, &mod_simpleua);
+    }
+
+    return;
+}
+
+/* Function for the reaper thread, woken once for each ended call */
+static int reaper_thread_routine(void *arg)
+{
+    PJ_UNUSED_ARG(arg);
+
+    for (;;)
+    {
+        pj_sem_wait(app.reaper_sem);
+
+        reap_dying_calls();
+
+        if (app.quit)
+            break;
+    }
+
+    return PJ_SUCCESS;
+}
+
+/* Clear all resources */
+static pj_status_t cleanup_all_resources(void) 
+{
+    pj_status_t status;
+
+    /* Stop the threads */
+    app.quit = PJ_TRUE;
+
+    if (app.reload_thread)
+    {
+        pj_sem_post(app.reload_sem);
+        pj_thread_join(app.reload_thread);
+        pj_thread_destroy(app.reload_thread);
+        app.reload_thread = NULL;
+    }
+
+    for (unsigned i = 0; i < app.worker_cnt; i++)
+    {
+        if (app.worker_threads[i])
+        {
+            pj_thread_join(app.worker_threads[i]);
+            pj_thread_destroy(app.worker_threads[i]);
+            app.worker_threads[i] = NULL;
+        }
+    }
+
+    if (app.reload_sem)
+    {
+        pj_sem_destroy(app.reload_sem);
+        app.reload_sem = NULL;
+    }
+
+    /* The setup threads finish the queue first, a call they fail or
+     * find ended goes to the reaper */
+    for (unsigned i = 0; i < MEDIA_SETUP_THREADS; i++)
+    {
+        if (app.setup_threads[i])
+            pj_sem_post(app.setup_sem);
+    }
+
+    for (unsigned i = 0; i < MEDIA_SETUP_THREADS; i++)
+    {
+        if (app.setup_threads[i])
+        {
+            pj_thread_join(app.setup_threads[i]);
+            pj_thread_destroy(app.setup_threads[i]);
+            app.setup_threads[i] = NULL;
+        }
+    }
+
+    if (app.setup_sem)
+    {
+        pj_sem_destroy(app.setup_sem);
+        app.setup_sem = NULL;
+    }
+
+    /* Without the threads the queues are finished here */
+    if (app.sim)
+        run_sim_queues();
+
+    /* The workers are stopped, no call ends any more: the reaper
+     * finishes the dying ones and quits */
+    if (app.reaper_thread)
+    {
+        pj_sem_post(app.reaper_sem);
+        pj_thread_join(app.reaper_thread);
+        pj_thread_destroy(app.reaper_thread);
+        app.reaper_thread = NULL;
+    }
+
+    if (app.reaper_sem)
+    {
+        pj_sem_destroy(app.reaper_sem);
+        app.reaper_sem = NULL;
+    }
+
+    /* Clear all calls */
+    for (int i = 0; i < MAX_CALLS_STATIC; i++) 
+    {
+        call_cleanup(&app.calls[i]);
+    }
+
+    if (app.mutex)
+    {
+        status = pj_mutex_destroy(app.mutex);
+        app.mutex = NULL;
+
+        if (status != PJ_SUCCESS)
+            app_perror(THIS_FILE, "Failed to destroy mutex", status);
+    }
+
+    /* Clear all media resources */
+    cleanup_media();
+
+    if (app.sip_endpt)
+    {
+        if (app.overload_timer.id)
+        {
+            pjsip_endpt_cancel_timer(app.sip_endpt, &app.overload_timer);
+            app.overload_timer.id = PJ_FALSE;
+        }
+
+        /* The SIP threads are joined, nobody checks it any more */
+        overload_ctl_destroy(&app.overload);
+
+        release_tcp_connections();
+
+        pjsip_endpt_destroy(app.sip_endpt);
+        
+        PJ_LOG(3, (THIS_FILE, "Destroying endpoint instance"));
+    }
+
+    /* Nothing is sent or received any more */
+    if (app.pcap)
+    {
+        pcap_writer_destroy(app.pcap);
+        app.pcap = NULL;
+    }
+
+    /* The bridge is destroyed, no frame comes to the recorder */
+    if (app.recorder)
+    {
+        call_recorder_destroy(app.recorder);
+        app.recorder = NULL;
+    }
+
+    /* Pools releasing */
+    release_all_pools();
+
+    pj_shutdown();
+
+    return PJ_SUCCESS;
+}
+
+
+static pj_status_t cleanup_ports(void)
+{
+    pj_status_t status;
+
+    /* Stop media clock */
+    if (app.media_clock)
+    {
+        media_clock_stop(app.media_clock);
+        app.media_clock = NULL;
+    }
+
+    /* Nothing ticks the virtual clock after the harness stopped */
+    if (app.sim_clock)
+    {
+        sim_clock_destroy(app.sim_clock);
+        app.sim_clock = NULL;
+    }
+
+    /* Stop master port */
+    if (app.null_snd)
+    {
+        status = pjmedia_master_port_stop(app.null_snd);
+        if (status != PJ_SUCCESS)
+            app_perror(THIS_FILE, "Failed to stop the media flow", status);
+
+        status = pjmedia_master_port_destroy(app.null_snd, PJ_FALSE);
+        if (status != PJ_SUCCESS)
+            app_perror(THIS_FILE, "Failed to destroy the master port", status);
+        
+        app.null_snd = NULL;
+    }
+
+    /* Destroying ports */
+    if (app.null_port)
+    {
+        destroy_port(app.null_port);
+    }
+
+    /* Destroying sound sources */
+    for (int i = 0; i < eSOURCE_COUNT; i++)
+    {
+        if (app.sources[i])
+        {
+            media_source_destroy(app.sources[i]);
+            app.sources[i] = NULL;
+        }
+    }
+
+    return PJ_SUCCESS;
+}
+
+/* Destroying ports */
+static pj_status_t destroy_port(pjmedia_port *port)
+{
+    pj_status_t status;
+
+    if (port)
+    {
+        status = pjmedia_port_destroy(port);
+
+        if (status != PJ_SUCCESS)
+        {
+            app_perror(THIS_FILE, "Failed to destroy port (and subsequent downstream ports)", status);
+            goto _exit;
+        }
+    }
+
+    status = PJ_SUCCESS;
+    goto _exit;
+
+_exit:
+    return status;
+}
+
+/* Clear all media resources */
+static pj_status_t cleanup_media(void)
+{
+    pj_status_t status;
+
+    cleanup_ports();
+
+    /* Conference conferece bridge  */
+    if (app.conf)
+    {
+        status = pjmedia_conf_destroy(app.conf);
+
+        if (status != PJ_SUCCESS)
+            app_perror(THIS_FILE, "Failed to destroy conference bridge", status);
+    }
+
+    /* Destroy event manager */
+    pjmedia_event_mgr_destroy(NULL);
+
+    /* Destroy media endpoint */
+    if (app.med_endpt) 
+    {
+        status = pjmedia_endpt_destroy(app.med_endpt);
+        
+        if (status != PJ_SUCCESS)
+            app_perror(THIS_FILE, "Failed to destroy media endpoint instance and shutdown audio subsystem", status);
+    }
+
+    return PJ_SUCCESS;
+}
+
+/* Realising pools */
+static void release_all_pools(void)
+{
+    /* The caches of the running threads would keep blocks of the arena
+     * unmapped below: every engine thread must be joined by now */
+    pj_assert(app.reload_thread == NULL);
+    pj_assert(app.reaper_thread == NULL);
+    for (unsigned i = 0; i < MAX_SIP_UDP_SOCKETS; i++)
+    {
+        pj_assert(app.worker_threads[i] == NULL);
+    }
+    for (unsigned i = 0; i < MEDIA_SETUP_THREADS; i++)
+    {
+        pj_assert(app.setup_threads[i] == NULL);
+    }
+
+    if (app.pool)
+    {
+        pj_pool_release(app.pool);
+    }
+
+    if (app.snd_pool)
+    {
+        pj_pool_release(app.snd_pool);
+    }
+
+    /* No factory when the config has failed. The threads of the
+     * engine have ended, their cached blocks are in the reserve. The
+     * endpoints, the media clock and the recorder joined their own
+     * threads when they were destroyed */
+    if (app.tpf)
+    {
+        thread_pool_factory_destroy(app.tpf);
+        app.tpf = NULL;
+    }
+    else if (app.pf == &app.cp.factory)
+    {
+        pj_caching_pool_destroy(&app.cp);
+        pj_bzero(&app.cp, sizeof(app.cp));
+    }
+    app.pf = NULL;
+
+    /* The blocks of the pool factory are back, the arena can go */
+    if (app.is_hugepage_pool)
+    {
+        hugepage_policy_destroy();
+        app.is_hugepage_pool = PJ_FALSE;
+    }
+
+    return;
+}
+
+static pj_bool_t on_rx_request(pjsip_rx_data *rdata)
+{
+    pj_status_t status;
+    pj_bool_t bool = PJ_FALSE;
+    int call_idx = UNDEFINED_ID;
+    unsigned retry_after_sec = 0;
+    pjsip_sip_uri *target_sip_uri;
+
+    /* Process only INVITE requests */
+    if (rdata->msg_info.msg->line.req.method.id != PJSIP_INVITE_METHOD)
+    {
+        status = process_non_invite_request(rdata);
+        goto _exit;
+    }
+
+    /* Admission control: keep the calls in progress healthy */
+    if (overload_ctl_is_overloaded(&app.overload, &retry_after_sec))
+    {
+        respond_overloaded(rdata, retry_after_sec);
+        goto _exit;
+    }
+
+    pj_mutex_lock(app.mutex);
+    call_idx = get_free_call_slot();
+    if (call_idx == UNDEFINED_ID) 
+    {
+        respond_busy(rdata);
+        goto _on_exit_with_unlock;
+    }
+
+    if (!PJSIP_URI_SCHEME_IS_SIP(rdata->msg_info.msg->line.req.uri))
+    {
+        respond_unsupported_scheme(rdata);
+        goto _on_exit_with_unlock;
+    }
+
+    target_sip_uri = get_target_uri(rdata);
+
+    /* Check if the dialed number is correct */
+    if (get_source_index(&target_sip_uri->user) == UNDEFINED_ID)
+    {
+        respond_not_found(rdata);
+        goto _on_exit_with_unlock;
+    }
+
+    if (!is_request_verified(rdata))
+    {
+        goto _on_exit_with_unlock;
+    }
+
+    status = call_create(rdata, call_idx, target_sip_uri);
+    if (status != PJ_SUCCESS) 
+    {
+        goto _on_exit_with_unlock;
+    }
+
+    PJ_LOG(3,(THIS_FILE,
+            "CALL TO %.*s!!",
+            (int)app.calls[call_idx].sip_uri_target_user.slen,
+            app.calls[call_idx].sip_uri_target_user.ptr));
+
+    pj_mutex_unlock(app.mutex);
+
+    status = call_send_ring(&app.calls[call_idx], rdata);
+    if (status != PJ_SUCCESS)
+    {
+        goto _exit;
+    }
+
+    /* Specifies the time interval for the ringing timer */
+    status = timer_create(&(app.calls[call_idx].ringing_timer),
+                                        &app.calls[call_idx],
+                                        RINGING_TIMER_SEC,
+                                        RINGING_TIMER_MSEC,
+                                        &ringing_timeout_cb);
+    if (status != PJ_SUCCESS)
+    {
+        app_perror(THIS_FILE, "timer_create", status);
+    }
+
+    bool = PJ_TRUE;
+    goto _exit;
+
+_on_exit_with_unlock:
+    pj_mutex_unlock(app.mutex);
+    goto _exit;
+
+_exit:
+    return bool;
+}
+
+static pj_status_t process_non_invite_request(pjsip_rx_data *rdata)
+{
+    pj_status_t status;
+    if (rdata->msg_info.msg->line.req.method.id != PJSIP_ACK_METHOD)
+    {
+        pj_str_t reason = pj_str("Simple UA unable to handle this request");
+        status = pjsip_endpt_respond_stateless(app.sip_endpt,
+                                                rdata,
+                                                PJSIP_SC_FORBIDDEN,
+                                                &reason,
+                                                NULL,
+                                                NULL);
+        goto _exit;
+    }
+
+    status = PJ_SUCCESS;
+    goto _exit;
+
+_exit:
+    return status;
+}
+
+static void respond_busy(pjsip_rx_data *rdata)
+{
+    pj_str_t reason = pj_str("Too many calls");
+    pjsip_endpt_respond_stateless(app.sip_endpt, rdata, PJSIP_SC_BUSY_HERE, &reason, NULL, NULL);
+}
+
+/* 503 with Retry-After so the upstream proxies back off */
+static void respond_overloaded(pjsip_rx_data *rdata, unsigned retry_after_sec)
+{
+    pj_str_t reason = pj_str("Overloaded");
+    pjsip_hdr hdr_list;
+    pjsip_retry_after_hdr *retry_after;
+
+    pj_list_init(&hdr_list);
+    retry_after = pjsip_retry_after_hdr_create(rdata->tp_info.pool, (int)retry_after_sec);
+    pj_list_push_back(&hdr_list, retry_after);
+
+    pjsip_endpt_respond_stateless(app.sip_endpt,
+                                  rdata,
+                                  PJSIP_SC_SERVICE_UNAVAILABLE,
+                                  &reason,
+                                  &hdr_list,
+                                  NULL);
+}
+
+static void respond_unsupported_scheme(pjsip_rx_data *rdata)
+{
+    pjsip_endpt_respond_stateless(app.sip_endpt, rdata, PJSIP_SC_UNSUPPORTED_URI_SCHEME, NULL, NULL, NULL);
+}
+
+static pjsip_sip_uri* get_target_uri(pjsip_rx_data *rdata)
+{
+    return (pjsip_sip_uri*)pjsip_uri_get_uri(rdata->msg_info.msg->line.req.uri);
+}
+
+/* Find the sound source of the dialed number */
+static int get_source_index(const pj_str_t *number)
+{
+    int source_idx = UNDEFINED_ID;
+
+    for (int i = 0; i < eSOURCE_COUNT; i++)
+    {
+        if (pj_strcmp(number, &app.source_numbers[i]) == 0)
+        {
+            source_idx = i;
+            break;
+        }
+    }
+
+    return source_idx;
+}
+
+static void respond_not_found(pjsip_rx_data *rdata)
+{
+    pj_str_t reason = pj_str("The number is dialed incorrectly");
+    pjsip_endpt_respond_stateless(app.sip_endpt, rdata, PJSIP_SC_NOT_FOUND, &reason, NULL, NULL);
+}
+
+static pj_bool_t is_request_verified(pjsip_rx_data *rdata)
+{
+    pj_status_t status;
+    pj_bool_t bool = PJ_FALSE;
+    unsigned options = 0;
+    pj_str_t reason;
+    
+    status = pjsip_inv_verify_request(rdata, &options, NULL, NULL, app.sip_endpt, NULL);
+    if (status != PJ_SUCCESS)
+    {
+        reason = pj_str("Sorry Simple UA can not handle this INVITE");
+
+        pjsip_endpt_respond_stateless(app.sip_endpt, rdata, PJSIP_SC_NOT_ACCEPTABLE, &reason, NULL, NULL);
+        goto _exit;
+    }
+
+    bool = PJ_TRUE;
+    goto _exit;
+
+_exit:
+    return bool;
+}
+
+static pj_status_t call_create(pjsip_rx_data *rdata,
+                                    int call_idx,
+                                    pjsip_sip_uri *target_sip_uri)
+{
+    pjmedia_transport *transport;
+    pj_sockaddr hostaddr;
+    pjsip_dialog *dlg;
+    pj_str_t local_uri;
+    pjmedia_sdp_session *local_sdp;
+    pj_status_t status;
+    char temp[80], hostip[PJ_INET6_ADDRSTRLEN];
 
-static void respond_not_found(pjsip_rx_data *rdata)
+    /* Get server IP for Contact header */
+    status = pj_gethostip(pj_AF_INET(), &hostaddr);
+    if (status != PJ_SUCCESS)
+    {
+        goto _exit;
+    }
+
+    /* Create Contact URI */
+    pj_sockaddr_print(&hostaddr, hostip, sizeof(hostip), FLAGS_BITMASK_IPV6);
+    pj_ansi_snprintf(temp,
+                    sizeof(temp),
+                    "<sip:%.*s@%s:%d%s>",
+                    (int)target_sip_uri->user.slen,
+                    target_sip_uri->user.ptr,
+                    hostip,SIP_PORT,
+                    (rdata->tp_info.transport->key.type == PJSIP_TRANSPORT_TCP) ? TCP_URI_PARAM : "");
+    local_uri = pj_str(temp);
+
+    /* Create a UAS dialog */
+    status = pjsip_dlg_create_uas_and_inc_lock(pjsip_ua_instance(), rdata, &local_uri, &dlg);
+    if (status != PJ_SUCCESS) 
+    {
+        goto _exit;
+    }
+
+    /* Create media transport for SDP offer */
+    status = pjmedia_transport_udp_create3(app.med_endpt,
+                                            pj_AF_INET(),
+                                            NULL,
+                                            NULL,
+                                            RTP_PORT + (call_idx * MULTIPLIER_RTP_PORT),
+                                            0,
+                                            &transport);
+    if (status != PJ_SUCCESS)
+    {
+        goto _exit;
+    }
+
+    /* Sampled RTP of the call into the capture, the raw recording
+     * gets the received RTP here too */
+    if ((app.pcap && app.cfg.pcap_rtp_sample) || app.record_raw)
+    {
+        pjmedia_transport *tap;
+
+        status = rtp_tap_create(app.med_endpt,
+                                transport,
+                                app.cfg.pcap_rtp_sample ? app.pcap : NULL,
+                                app.cfg.pcap_rtp_sample,
+                                &tap);
+        if (status != PJ_SUCCESS)
+        {
+            pjmedia_transport_close(transport);
+            goto _exit;
+        }
+
+        transport = tap;
+    }
+
+    /* Create SDP offer */
+    pjmedia_sock_info sock_info;
+    pjmedia_transport_info tp_info;
+    pjmedia_transport_info_init(&tp_info);
+    pjmedia_transport_get_info(transport, &tp_info);
+    pj_memcpy(&sock_info, &tp_info.sock_info, sizeof(pjmedia_sock_info));
+
+    status = pjmedia_endpt_create_sdp(app.med_endpt, dlg->pool, 1, &sock_info, &local_sdp);
+    if (status != PJ_SUCCESS)
+    {
+        pjmedia_transport_close(transport);
+        goto _exit;
+    }
+
+    status = sdp_add_ptime(dlg->pool, local_sdp);
+    if (status != PJ_SUCCESS)
+    {
+        pjmedia_transport_close(transport);
+        goto _exit;
+    }
+
+    /* The recorder needs the inbound leg */
+    if (app.cfg.media_sendonly && !app.recorder)
+    {
+        status = sdp_set_sendonly(dlg->pool, local_sdp);
+        if (status != PJ_SUCCESS)
+        {
+            pjmedia_transport_close(transport);
+            goto _exit;
+        }
+    }
+
+    status = create_invite_session(dlg, rdata, local_sdp, &app.calls[call_idx].inv);
+    if (status != PJ_SUCCESS)
+    {
+        pjmedia_transport_close(app.calls[call_idx].transport);
+        goto _exit;
+    }
+
+    /* Save *call in invite session*/
+    app.calls[call_idx].inv->mod_data[0] = &(app.calls[call_idx]);
+
+    /* Unlock dialog */
+    pjsip_dlg_dec_lock(dlg);
+
+    call_save_info(call_idx, transport, dlg, &target_sip_uri->user);
+
+    status = PJ_SUCCESS;
+    goto _exit;
+
+_exit:
+    return status;
+}
+
+static pj_status_t create_invite_session(pjsip_dialog *dlg,
+                                        pjsip_rx_data *rdata,
+                                        pjmedia_sdp_session *local_sdp,
+                                        pjsip_inv_session **inv_session)
 {
-    pj_str_t reason = pj_str("The number is dialed incorrectly");
-    pjsip_endpt_respond_stateless(app.sip_endpt, rdata, PJSIP_SC_NOT_FOUND, &reason, NULL, NULL);
+    pj_status_t status = pjsip_inv_create_uas(dlg, rdata, local_sdp, 0, inv_session);
+    if (status != PJ_SUCCESS) 
+    {
+        pj_str_t reason = pj_str("Invite session error");
+        pjsip_endpt_respond_stateless(app.sip_endpt, rdata, PJSIP_SC_INTERNAL_SERVER_ERROR, &reason, NULL, NULL);
+    }
+    else if ((*inv_session)->neg)
+    {
+        /* Our codec priority decides, not the order of the offer */
+        pjmedia_sdp_neg_set_prefer_remote_codec_order((*inv_session)->neg, PJ_FALSE);
+    }
+
+    return status;
+}
+
+static pj_status_t call_send_ring(call_t *call, pjsip_rx_data *rdata)
+{
+    pjsip_tx_data *tdata;
+
+    pj_status_t status = pjsip_inv_initial_answer(call->inv, rdata, RINGING_ANSWER, NULL, NULL, &tdata);
+    if (status != PJ_SUCCESS)
+    {
+        goto _exit;
+    }
+
+    status = pjsip_inv_send_msg(call->inv, tdata);
+    goto _exit;
+
+_exit:
+    return status;
+}
+
+/* Saving call information */
+static void call_save_info(int call_idx,
+                                    pjmedia_transport *transport,
+                                    pjsip_dialog *dlg,
+                                    pj_str_t *target_sip_uri)
+{
+    app.calls[call_idx].in_use = PJ_TRUE;
+    app.calls[call_idx].dying = PJ_FALSE;
+    app.calls[call_idx].media_pending = PJ_FALSE;
+    app.calls[call_idx].transport = transport;
+    app.calls[call_idx].port = NULL;
+    app.calls[call_idx].slot = (unsigned)UNDEFINED_ID;
+    app.calls[call_idx].stream = NULL;
+    app.calls[call_idx].source = NULL;
+    app.calls[call_idx].fanout_id = UNDEFINED_ID;
+    app.calls[call_idx].rec_port = NULL;
+    app.calls[call_idx].rec_slot = (unsigned)UNDEFINED_ID;
+    app.calls[call_idx].ringing_timer.id = PJ_FALSE;
+    app.calls[call_idx].call_media_timer.id = PJ_FALSE;
+    app.calls[call_idx].dlg = dlg;
+
+    app.calls[call_idx].sip_uri_target_user.ptr = (char*) pj_pool_alloc(app.pool , MAX_SIP_URI_SIZE);
+    pj_strcpy(&app.calls[call_idx].sip_uri_target_user, target_sip_uri);
+
+    return;
+}
+
+/* Initialization and start of the timer */
+static pj_status_t timer_create(pj_timer_entry *timer,
+                                            call_t *call,
+                                            long sec,
+                                            long msec,
+                                            pj_timer_heap_callback *cb)
+{
+    pj_time_val delay;
+    pj_status_t status;
+
+    delay.sec = sec;
+    delay.msec = msec;
+
+    pj_timer_entry_init(timer, 0, (void*)call->inv, cb);
+
+    if (app.sim_clock)
+        status = sim_clock_schedule(app.sim_clock, timer, &delay);
+    else
+        status = pjsip_endpt_schedule_timer(app.sip_endpt, timer, &delay);
+    if (status != PJ_SUCCESS)
+    {
+        app_perror(THIS_FILE, "Schedule timer error", status);
+        goto _exit;
+    }
+
+    status = PJ_SUCCESS;
+    goto _exit;
+
+_exit:
+    return status;
+}
+
+/* Cancel a call timer on the heap it was scheduled on */
+static void timer_cancel(pj_timer_entry *timer)
+{
+    if (app.sim_clock)
+        sim_clock_cancel(app.sim_clock, timer);
+    else
+        pjsip_endpt_cancel_timer(app.sip_endpt, timer);
+
+    return;
+}
+
+/* Check the number of active calls */
+static int get_free_call_slot(void)
+{
+    int call_idx = UNDEFINED_ID;
+
+    for (int i = 0; i < MAX_CALLS_STATIC; i++) 
+    {
+        if (!app.calls[i].in_use) 
+        {
+            call_idx = i;
+            break;
+        }
+    }
+
+    return call_idx;
+}
+
+/* Connecting master port */
+static pj_status_t create_and_connect_master_port()
+{
+    pj_status_t status;
+    pjmedia_port *conf_port;
+
+    /* Create null port if not exists. The probe is a null port
+     * which also measures how late the clock ticks are */
+    if (!app.null_port)
+    {
+        status = clock_probe_create(app.pool,
+                                    CLOCK_RATE,
+                                    SAMPLES_PER_FRAME(app.ptime),
+                                    BITS_PER_SAMPLE,
+                                    &app.null_port);
+        if (status != PJ_SUCCESS) 
+        {
+            PJ_LOG(3, (THIS_FILE, "Unable to create null port"));
+            pj_log_pop_indent();
+            goto _exit;
+        }
+    }
+
+    /* Get the port0 of the conference bridge. */
+    conf_port = pjmedia_conf_get_master_port(app.conf);
+    if (conf_port == NULL) 
+    {
+        status = PJ_EBUG;
+        goto _exit;
+    }
+
+    /* The virtual clock of the simulation, ticked by the harness together
+     * with the call timers
+     */
+    if (app.sim)
+    {
+        status = sim_clock_create(app.snd_pool, app.null_port, conf_port,
+                                  MAX_CALLS_STATIC * TIMERS_PER_CALL, &app.sim_clock);
+        if (status != PJ_SUCCESS)
+            app_perror(THIS_FILE, "Unable to create virtual clock", status);
+        goto _exit;
+    }
+
+    /* The timerfd clock, connecting port0 of the conference bridge to
+     * a null port, with absolute deadlines and catch up of late ticks
+     */
+    if (app.cfg.media_clock_timerfd)
+    {
+        status = media_clock_create(app.snd_pool, app.null_port, conf_port, &app.cfg.media_clock, &app.media_clock);
+        if (status != PJ_SUCCESS)
+        {
+            app_perror(THIS_FILE, "Unable to create media clock", status);
+            goto _exit;
+        }
+
+        status = media_clock_start(app.media_clock);
+        if (status != PJ_SUCCESS)
+        {
+            app_perror(THIS_FILE, "Unable to start media clock", status);
+            media_clock_stop(app.media_clock);
+            app.media_clock = NULL;
+        }
+        goto _exit;
+    }
+
+    status = start_master_port();
+
+_exit:
+    return status;
 }
 
-static pj_bool_t is_request_verified(pjsip_rx_data *rdata)
+/* Create master port, connecting port0 of the conference bridge to
+ * a null port, and start it
+ */
+static pj_status_t start_master_port(void)
 {
     pj_status_t status;
-    pj_bool_t bool = PJ_FALSE;
-    unsigned options = 0;
-    pj_str_t reason;
-    
-    status = pjsip_inv_verify_request(rdata, &options, NULL, NULL, app.sip_endpt, NULL);
+
+    status = pjmedia_master_port_create(app.snd_pool,
+                                        app.null_port,
+                                        pjmedia_conf_get_master_port(app.conf),
+                                        0,
+                                        &app.null_snd);
     if (status != PJ_SUCCESS)
     {
-        reason = pj_str("Sorry Simple UA can not handle this INVITE");
+        PJ_LOG(3, (THIS_FILE, "Unable to create null sound device: %d", (int)status));
+        goto _exit;
+    }
 
-        pjsip_endpt_respond_stateless(app.sip_endpt, rdata, PJSIP_SC_NOT_ACCEPTABLE, &reason, NULL, NULL);
+    /* Start the master port */
+    status = pjmedia_master_port_start(app.null_snd);
+    if (status != PJ_SUCCESS) 
+    {
+        PJ_LOG(4, (THIS_FILE, "Unable to start null sound device: %d", status));
         goto _exit;
     }
 
-    bool = PJ_TRUE;
+    status = PJ_SUCCESS;
     goto _exit;
 
 _exit:
-    return bool;
+    return status;
 }
 
-static pj_status_t call_create(pjsip_rx_data *rdata,
-                                    int call_idx,
-                                    pjsip_sip_uri *target_sip_uri)
+/* The timerfd clock gave up: the master port drives the bridge from now
+ * on, on the same CPUs. Only the overload timer calls it, one at a time
+ */
+static void check_media_clock(void)
 {
-    pjmedia_transport *transport;
-    pj_sockaddr hostaddr;
-    pjsip_dialog *dlg;
-    pj_str_t local_uri;
-    pjmedia_sdp_session *local_sdp;
     pj_status_t status;
-    char temp[80], hostip[PJ_INET6_ADDRSTRLEN];
 
-    /* Get server IP for Contact header */
-    status = pj_gethostip(pj_AF_INET(), &hostaddr);
+    if ((app.media_clock == NULL) || (app.null_snd != NULL))
+        goto _exit;
+
+    status = media_clock_get_status(app.media_clock);
+    if (status == PJ_SUCCESS)
+        goto _exit;
+
+    app_perror(THIS_FILE, "Media clock stopped, switching to the master port", status);
+
+    status = cpu_affinity_call(app.affinity[eROLE_MEDIA_CLOCK], &start_master_port);
     if (status != PJ_SUCCESS)
+        app_perror(THIS_FILE, "No clock drives the calls", status);
+
+_exit:
+    return;
+}
+
+/* Add the player to the bridge */
+static pj_status_t media_source_create_wav(const char *filename, media_source_t **p_source)
+{
+    pj_status_t status;
+    pj_pool_t *pool;
+    media_source_t *source;
+
+    pool = pjmedia_endpt_create_pool(app.med_endpt, SOURCE_POOL_NAME, POOL_SIZE, POOL_INCREMENT_SIZE);
+    if (!pool)
     {
+        status = PJ_ENOMEM;
         goto _exit;
     }
 
-    /* Create Contact URI */
-    pj_sockaddr_print(&hostaddr, hostip, sizeof(hostip), FLAGS_BITMASK_IPV6);
-    pj_ansi_snprintf(temp,
-                    sizeof(temp),
-                    "<sip:%.*s@%s:%d>",
-                    (int)target_sip_uri->user.slen,
-                    target_sip_uri->user.ptr,
-                    hostip,SIP_PORT);
-    local_uri = pj_str(temp);
+    source = PJ_POOL_ZALLOC_T(pool, media_source_t);
+    source->pool = pool;
+    source->slot = (unsigned)UNDEFINED_ID;
 
-    /* Create a UAS dialog */
-    status = pjsip_dlg_create_uas_and_inc_lock(pjsip_ua_instance(), rdata, &local_uri, &dlg);
-    if (status != PJ_SUCCESS) 
+    status = pjmedia_wav_player_port_create(pool,
+                                            filename,
+                                            app.ptime,
+                                            0,
+                                            BUF_SIZE_WAV_PLAYEER,
+                                            &source->port);
+    if (status != PJ_SUCCESS)
     {
+        app_perror(THIS_FILE, "Unable to open file for playback", status);
+        pj_pool_release(pool);
         goto _exit;
     }
 
-    /* Create media transport for SDP offer */
-    status = pjmedia_transport_udp_create3(app.med_endpt,
-                                            pj_AF_INET(),
-                                            NULL,
-                                            NULL,
-                                            RTP_PORT + (call_idx * MULTIPLIER_RTP_PORT),
-                                            0,
-                                            &transport);
+    status = media_source_add_to_conf(source);
     if (status != PJ_SUCCESS)
     {
         goto _exit;
     }
 
-    /* Create SDP offer */
-    pjmedia_sock_info sock_info;
-    pjmedia_transport_info tp_info;
-    pjmedia_transport_info_init(&tp_info);
-    pjmedia_transport_get_info(transport, &tp_info);
-    pj_memcpy(&sock_info, &tp_info.sock_info, sizeof(pjmedia_sock_info));
+    PJ_LOG(3, (THIS_FILE, "WAV player: %s - CREATED", filename));
+    *p_source = source;
+    goto _exit;
 
-    status = pjmedia_endpt_create_sdp(app.med_endpt, dlg->pool, 1, &sock_info, &local_sdp);
+_exit:
+    return status;
+}
+
+/* Initialize the entire system */
+static pj_status_t init_system(void)
+{
+    pj_status_t status;
+
+    status = pj_init();
     if (status != PJ_SUCCESS)
+        goto _exit;
+
+    pj_log_set_level(LOG_LEVEL);
+
+    status = pjlib_util_init();
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    /* The settings of the transports, the bridge and its clock, the pool
+     * factory policy among them */
+    status = load_config(&app.cfg);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+    app.ptime = app.cfg.ptime_msec;
+
+    app.pool_policy = pj_pool_factory_default_policy;
+    if (app.cfg.hugepage_pool_mb)
     {
-        pjmedia_transport_close(transport);
+        status = hugepage_policy_init((pj_size_t)app.cfg.hugepage_pool_mb * BYTES_IN_MB, &app.pool_policy);
+        if (status != PJ_SUCCESS)
+        {
+            app_perror(THIS_FILE, "Unable to map the pool arena", status);
+            goto _exit;
+        }
+        app.is_hugepage_pool = PJ_TRUE;
+    }
+
+    /* Must create a pool factory before we can allocate any memory. */
+    if (app.cfg.pool_thread_cache)
+    {
+        status = thread_pool_factory_create(&app.pool_policy, &app.tpf);
+        if (status != PJ_SUCCESS)
+        {
+            app_perror(THIS_FILE, "Unable to create the pool factory", status);
+            goto _exit;
+        }
+        app.pf = thread_pool_factory_get(app.tpf);
+    }
+    else
+    {
+        pj_caching_pool_init(&app.cp, &app.pool_policy, 0);
+        app.pf = &app.cp.factory;
+    }
+
+    app.snd_pool = pj_pool_create(app.pf, "snd", POOL_SIZE, POOL_INCREMENT_SIZE, NULL);
+    if (!app.snd_pool)
+    {
+        status = PJ_ENOMEM;
         goto _exit;
     }
 
-    status = create_invite_session(dlg, rdata, local_sdp, &app.calls[call_idx].inv);
+    status = init_affinity();
     if (status != PJ_SUCCESS)
-    {
-        pjmedia_transport_close(app.calls[call_idx].transport);
         goto _exit;
+
+    if (app.cfg.pcap_capture)
+    {
+        status = start_capture();
+        if (status != PJ_SUCCESS)
+        {
+            app_perror(THIS_FILE, "Unable to start pcap capture", status);
+            goto _exit;
+        }
     }
 
-    /* Save *call in invite session*/
-    app.calls[call_idx].inv->mod_data[0] = &(app.calls[call_idx]);
+    if (app.cfg.record_calls)
+    {
+        status = start_recording();
+        if (status != PJ_SUCCESS)
+        {
+            app_perror(THIS_FILE, "Unable to start call recording", status);
+            goto _exit;
+        }
+    }
 
-    /* Unlock dialog */
-    pjsip_dlg_dec_lock(dlg);
+    /* Initialization SIP */
+    status = init_pjsip();
+    if (status != PJ_SUCCESS)
+        goto _exit;
 
-    call_save_info(call_idx, transport, dlg, &target_sip_uri->user);
+    /* Initialize media */
+    status = init_pjmedia();
+    if (status != PJ_SUCCESS)
+        goto _exit;
 
-    status = PJ_SUCCESS;
     goto _exit;
 
 _exit:
     return status;
 }
 
-static pj_status_t create_invite_session(pjsip_dialog *dlg,
-                                        pjsip_rx_data *rdata,
-                                        pjmedia_sdp_session *local_sdp,
-                                        pjsip_inv_session **inv_session)
+/* Add tone to the bridge */
+static pj_status_t media_source_create_tone(const pjmedia_tone_desc *tone,
+                                            pj_bool_t suppress_silence,
+                                            media_source_t **p_source)
 {
-    pj_status_t status = pjsip_inv_create_uas(dlg, rdata, local_sdp, 0, inv_session);
-    if (status != PJ_SUCCESS) 
+    pj_status_t status;
+    char name[NAME_ARR_SIZE];
+    pj_str_t label;
+    pj_pool_t *pool;
+    media_source_t *source;
+
+    pool = pjmedia_endpt_create_pool(app.med_endpt, SOURCE_POOL_NAME, POOL_SIZE, POOL_INCREMENT_SIZE);
+    if (!pool)
     {
-        pj_str_t reason = pj_str("Invite session error");
-        pjsip_endpt_respond_stateless(app.sip_endpt, rdata, PJSIP_SC_INTERNAL_SERVER_ERROR, &reason, NULL, NULL);
+        status = PJ_ENOMEM;
+        goto _on_error;
+    }
+
+    source = PJ_POOL_ZALLOC_T(pool, media_source_t);
+    source->pool = pool;
+    source->slot = (unsigned)UNDEFINED_ID;
+
+    pj_ansi_snprintf(name,
+                    sizeof(name),
+                    "tone-%d,%d,%d,%d",
+                    tone->freq1,
+                    tone->freq2,
+                    tone->off_msec,
+                    tone->on_msec);
+    label = pj_str(name);
+
+    status = pjmedia_tonegen_create2(pool,
+                                    &label,
+                                    CLOCK_RATE,
+                                    NCHANNELS,
+                                    SAMPLES_PER_FRAME(app.ptime),
+                                    BITS_PER_SAMPLE,
+                                    PJMEDIA_TONEGEN_LOOP,
+                                    &source->port);
+
+    if (status != PJ_SUCCESS)
+    {
+        app_perror(THIS_FILE, "Unable to create tone generator", status);
+        pj_pool_release(pool);
+        goto _on_error;
+    }
+
+    status = pjmedia_tonegen_play(source->port, 1, tone, 0);
+    if (status != PJ_SUCCESS)
+    {
+        app_perror(THIS_FILE, "Unable to play tone", status);
+        destroy_port(source->port);
+        pj_pool_release(pool);
+        goto _on_error;
+    }
+
+    /* The pauses are not sent to the callers */
+    if (suppress_silence)
+    {
+        status = silence_gate_create(pool, source->port, SILENCE_MAX_LEVEL, &source->gate);
+        if (status != PJ_SUCCESS)
+        {
+            app_perror(THIS_FILE, "Unable to create silence gate", status);
+            destroy_port(source->port);
+            pj_pool_release(pool);
+            goto _on_error;
+        }
+        source->port = source->gate;
+    }
+
+    status = media_source_add_to_conf(source);
+    if (status != PJ_SUCCESS)
+    {
+        goto _on_error;
+    }
+
+    PJ_LOG(3, (THIS_FILE, "Tone generator: %s - CREATED", name));
+    *p_source = source;
+    goto _on_error;
+
+_on_error:
+    return status;
+}
+
+/* Add the port of the source to the bridge, the source is destroyed on failure */
+static pj_status_t media_source_add_to_conf(media_source_t *source)
+{
+    pj_status_t status;
+
+    source->fanout_slot = (unsigned)UNDEFINED_ID;
+
+    status = pjmedia_conf_add_port(app.conf, source->pool, source->port, NULL, &source->slot);
+    if (status != PJ_SUCCESS)
+    {
+        app_perror(THIS_FILE, "Unable to add sound source to conference bridge", status);
+        source->slot = (unsigned)UNDEFINED_ID;
+        media_source_destroy(source);
+        goto _exit;
+    }
+
+    if (app.l16_fast_path)
+    {
+        status = media_source_add_fanout(source);
+        if (status != PJ_SUCCESS)
+        {
+            app_perror(THIS_FILE, "Unable to add L16 fanout to conference bridge", status);
+            media_source_destroy(source);
+        }
+    }
+
+_exit:
+    return status;
+}
+
+/* The source frame is read by the bridge once per tick and handed
+ * to the fanout, which sends it to all the L16 calls of this source
+ */
+static pj_status_t media_source_add_fanout(media_source_t *source)
+{
+    pj_status_t status;
+
+    status = l16_fanout_create(source->pool, CLOCK_RATE, SAMPLES_PER_FRAME(app.ptime), MAX_CALLS_STATIC, &source->fanout);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    status = pjmedia_conf_add_port(app.conf, source->pool, source->fanout, NULL, &source->fanout_slot);
+    if (status != PJ_SUCCESS)
+    {
+        source->fanout_slot = (unsigned)UNDEFINED_ID;
+        goto _exit;
     }
 
+    status = pjmedia_conf_connect_port(app.conf, source->slot, source->fanout_slot, 0);
+
+_exit:
     return status;
 }
 
-static pj_status_t call_send_ring(call_t *call, pjsip_rx_data *rdata)
-{
-    pjsip_tx_data *tdata;
+/* Remove the source from the bridge and free it */
+static void media_source_destroy(media_source_t *source)
+{
+    pj_status_t status;
+
+    if (source->slot != (unsigned)UNDEFINED_ID)
+    {
+        status = pjmedia_conf_remove_port(app.conf, source->slot);
+        if (status != PJ_SUCCESS)
+        {
+            app_perror(THIS_FILE, "Failed to remove the specified port from the conference bridge", status);
+        }
+    }
+
+    if (source->fanout_slot != (unsigned)UNDEFINED_ID)
+    {
+        status = pjmedia_conf_remove_port(app.conf, source->fanout_slot);
+        if (status != PJ_SUCCESS)
+        {
+            app_perror(THIS_FILE, "Failed to remove the specified port from the conference bridge", status);
+        }
+    }
 
-    pj_status_t status = pjsip_inv_initial_answer(call->inv, rdata, RINGING_ANSWER, NULL, NULL, &tdata);
-    if (status != PJ_SUCCESS)
+    if (source->fanout)
     {
-        goto _exit;
+        destroy_port(source->fanout);
     }
 
-    status = pjsip_inv_send_msg(call->inv, tdata);
-    goto _exit;
+    destroy_port(source->port);
+    pj_pool_release(source->pool);
 
-_exit:
-    return status;
+    return;
 }
 
-/* Saving call information */
-static void call_save_info(int call_idx,
-                                    pjmedia_transport *transport,
-                                    pjsip_dialog *dlg,
-                                    pj_str_t *target_sip_uri)
+/* Drop the reference of the call to the source. Must be called with app.mutex held */
+static void media_source_release(media_source_t *source)
 {
-    app.calls[call_idx].in_use = PJ_TRUE;
-    app.calls[call_idx].transport = transport;
-    app.calls[call_idx].port = NULL;
-    app.calls[call_idx].slot = (unsigned)UNDEFINED_ID;
-    app.calls[call_idx].stream = NULL;
-    app.calls[call_idx].ringing_timer.id = PJ_FALSE;
-    app.calls[call_idx].call_media_timer.id = PJ_FALSE;
-    app.calls[call_idx].dlg = dlg;
+    source->ref_cnt--;
 
-    app.calls[call_idx].sip_uri_target_user.ptr = (char*) pj_pool_alloc(app.pool , MAX_SIP_URI_SIZE);
-    pj_strcpy(&app.calls[call_idx].sip_uri_target_user, target_sip_uri);
+    if (source->retired && (source->ref_cnt == 0))
+    {
+        PJ_LOG(4, (THIS_FILE, "Last call of the retired source in slot %u ended", source->slot));
+        app.retired_cnt--;
+        media_source_destroy(source);
+    }
 
     return;
 }
 
-/* Initialization and start of the timer */
-static pj_status_t timer_create(pj_timer_entry *timer,
-                                            call_t *call,
-                                            long sec,
-                                            long msec,
-                                            pj_timer_heap_callback *cb)
+/* Create the player and both tones, nothing is left on failure */
+static pj_status_t media_sources_create(const app_config_t *cfg, media_source_t *sources[])
 {
-    pj_time_val delay;
     pj_status_t status;
+    media_source_t *created[eSOURCE_COUNT] = { NULL };
 
-    delay.sec = sec;
-    delay.msec = msec;
+    status = media_source_create_wav(cfg->wav_file, &created[eSOURCE_WAV]);
+    if (status != PJ_SUCCESS)
+    {
+        goto _on_error;
+    }
 
-    pj_timer_entry_init(timer, 0, (void*)call->inv, cb);
+    status = media_source_create_tone(&cfg->long_tone, PJ_FALSE, &created[eSOURCE_LONG_TONE]);
+    if (status != PJ_SUCCESS)
+    {
+        goto _on_error;
+    }
 
-    status = pjsip_endpt_schedule_timer(app.sip_endpt, timer, &delay);
+    status = media_source_create_tone(&cfg->kpv_tone,
+                                      (cfg->kpv_silence_suppression != 0),
+                                      &created[eSOURCE_KPV_TONE]);
     if (status != PJ_SUCCESS)
     {
-        app_perror(THIS_FILE, "Schedule timer error", status);
-        goto _exit;
+        goto _on_error;
+    }
+
+    for (int i = 0; i < eSOURCE_COUNT; i++)
+    {
+        sources[i] = created[i];
     }
 
     status = PJ_SUCCESS;
     goto _exit;
 
+_on_error:
+    for (int i = 0; i < eSOURCE_COUNT; i++)
+    {
+        if (created[i])
+        {
+            media_source_destroy(created[i]);
+        }
+    }
+    goto _exit;
+
 _exit:
     return status;
 }
 
-/* Check the number of active calls */
-static int get_free_call_slot(void)
+/* Compiled in settings, the config file may override them */
+static void set_default_config(app_config_t *cfg)
 {
-    int call_idx = UNDEFINED_ID;
+    pj_bzero(cfg, sizeof(*cfg));
 
-    for (int i = 0; i < MAX_CALLS_STATIC; i++) 
-    {
-        if (!app.calls[i].in_use) 
-        {
-            call_idx = i;
-            break;
-        }
-    }
+    pj_ansi_snprintf(cfg->wav_file, sizeof(cfg->wav_file), "%s", FILE_NAME);
 
-    return call_idx;
+    /* Tone initialization */
+    cfg->long_tone.freq1 =      FREQ1;
+    cfg->long_tone.freq2 =      FREQ2;
+    cfg->long_tone.on_msec =    ON_MSEC;
+    cfg->long_tone.off_msec =   OFF_MSEC_LONG_TONE;
+
+    cfg->kpv_tone.freq1 =       FREQ1;
+    cfg->kpv_tone.freq2 =       FREQ2;
+    cfg->kpv_tone.on_msec =     ON_MSEC;
+    cfg->kpv_tone.off_msec =    OFF_MSEC_KPV_TONE;
+
+    /* Admission limits */
+    cfg->overload.max_clock_lag_msec =  OVERLOAD_MAX_CLOCK_LAG_MSEC;
+    cfg->overload.max_sip_queue_bytes = OVERLOAD_MAX_SIP_QUEUE;
+    cfg->overload.max_cpu_percent =     OVERLOAD_MAX_CPU_PERCENT;
+    cfg->overload.retry_after_min_sec = RETRY_AFTER_MIN_SEC;
+    cfg->overload.retry_after_max_sec = RETRY_AFTER_MAX_SEC;
+
+    /* Media clock */
+    cfg->media_clock_timerfd =          MEDIA_CLOCK_TIMERFD;
+    cfg->media_clock.rt_priority =      MEDIA_CLOCK_RT_PRIORITY;
+    cfg->media_clock.max_catch_up =     MEDIA_CLOCK_MAX_CATCH_UP;
+
+    cfg->ptime_msec =                   PTIME_MSEC;
+
+    cfg->kpv_silence_suppression =      KPV_SILENCE_SUPPRESSION;
+    cfg->media_sendonly =               MEDIA_SENDONLY;
+    cfg->l16_fast_path =                L16_FAST_PATH;
+
+    pj_ansi_snprintf(cfg->pcap_file, sizeof(cfg->pcap_file), "%s", PCAP_FILE_PREFIX);
+    cfg->pcap_capture =                 PCAP_CAPTURE;
+    cfg->pcap_file_size_kb =            PCAP_FILE_SIZE_KB;
+    cfg->pcap_max_files =               PCAP_MAX_FILES;
+    cfg->pcap_rtp_sample =              PCAP_RTP_SAMPLE;
+
+    pj_ansi_snprintf(cfg->record_dir, sizeof(cfg->record_dir), "%s", RECORD_DIR);
+    cfg->record_calls =                 RECORD_CALLS;
+    cfg->record_buffer_msec =           RECORD_BUFFER_MSEC;
+    cfg->record_g711_raw =              RECORD_G711_RAW;
+
+    cfg->sip_udp_sockets =              SIP_UDP_SOCKETS;
+    cfg->sip_tcp =                      SIP_TCP;
+
+    pj_ansi_snprintf(cfg->cpus_sip, sizeof(cfg->cpus_sip), "%s", CPUS_SIP);
+    pj_ansi_snprintf(cfg->cpus_media_io, sizeof(cfg->cpus_media_io), "%s", CPUS_MEDIA_IO);
+    pj_ansi_snprintf(cfg->cpus_media_clock, sizeof(cfg->cpus_media_clock), "%s", CPUS_MEDIA_CLOCK);
+    cfg->numa_local =                   NUMA_LOCAL;
+    cfg->hugepage_pool_mb =             HUGEPAGE_POOL_MB;
+    cfg->pool_thread_cache =            POOL_THREAD_CACHE;
+    cfg->g711_simd =                    G711_SIMD;
+
+    return;
 }
 
-/* Connecting master port */
-static pj_status_t create_and_connect_master_port()
+/* Defaults overridden by the config file if it exists */
+static pj_status_t load_config(app_config_t *cfg)
 {
     pj_status_t status;
-    pjmedia_port *conf_port;
 
-    /* Create null port if not exists */
-    if (!app.null_port)
+    set_default_config(cfg);
+
+    status = app_config_load(APP_CONFIG_FILE_NAME, cfg);
+    if (status == PJ_ENOTFOUND)
     {
-        status = pjmedia_null_port_create(app.pool,
-                                        CLOCK_RATE,
-                                        1,
-                                        SAMPLES_PER_FRAME,
-                                        BITS_PER_SAMPLE,
-                                        &app.null_port);
-        if (status != PJ_SUCCESS) 
-        {
-            PJ_LOG(3, (THIS_FILE, "Unable to create null port"));
-            pj_log_pop_indent();
-            goto _exit;
-        }
+        PJ_LOG(4, (THIS_FILE, "No %s, the default settings are used", APP_CONFIG_FILE_NAME));
+        status = PJ_SUCCESS;
     }
 
-    /* Get the port0 of the conference bridge. */
-    conf_port = pjmedia_conf_get_master_port(app.conf);
-    if (conf_port == NULL) 
+    if ((cfg->ptime_msec < PTIME_MIN_MSEC) || (cfg->ptime_msec > PTIME_MAX_MSEC)
+        || ((cfg->ptime_msec % PTIME_STEP_MSEC) != 0))
     {
-        status = PJ_EBUG;
-        goto _exit;
+        PJ_LOG(2, (THIS_FILE, "ptime_msec must be %d..%d in steps of %d",
+                   PTIME_MIN_MSEC, PTIME_MAX_MSEC, PTIME_STEP_MSEC));
+        status = PJ_EINVAL;
     }
 
-    /* Create master port, connecting port0 of the conference bridge to
-    * a null port.
-    */
-    status = pjmedia_master_port_create(app.snd_pool,
-                                        app.null_port,
-                                        conf_port,
-                                        0,
-                                        &app.null_snd);
-    if (status != PJ_SUCCESS)
+    if ((cfg->sip_udp_sockets < 1) || (cfg->sip_udp_sockets > MAX_SIP_UDP_SOCKETS))
     {
-        PJ_LOG(3, (THIS_FILE, "Unable to create null sound device: %d", (int)status));
-        goto _exit;
+        PJ_LOG(2, (THIS_FILE, "sip_udp_sockets must be 1..%d", MAX_SIP_UDP_SOCKETS));
+        status = PJ_EINVAL;
     }
 
-    /* Start the master port */
-    status = pjmedia_master_port_start(app.null_snd);
-    if (status != PJ_SUCCESS) 
+    if (cfg->record_calls && (cfg->record_buffer_msec <= RECORD_FLUSH_MSEC))
     {
-        PJ_LOG(4, (THIS_FILE, "Unable to start null sound device: %d", status));
-        goto _exit;
+        PJ_LOG(2, (THIS_FILE, "record_buffer_msec must be above %d", RECORD_FLUSH_MSEC));
+        status = PJ_EINVAL;
     }
 
-    status = PJ_SUCCESS;
-    goto _exit;
+    if (!cpu_affinity_is_valid(cfg->cpus_sip) || !cpu_affinity_is_valid(cfg->cpus_media_io)
+        || !cpu_affinity_is_valid(cfg->cpus_media_clock))
+    {
+        PJ_LOG(2, (THIS_FILE, "cpus_sip, cpus_media_io and cpus_media_clock must be lists like 0-3,8"));
+        status = PJ_EINVAL;
+    }
 
-_exit:
     return status;
 }
 
-/* Add the player to the bridge */
-static pj_status_t create_and_connect_player_to_conf(const char *filename)
+/* Load new sound sources and switch the new calls to them */
+static pj_status_t reload_media_sources(void)
 {
     pj_status_t status;
+    app_config_t cfg;
+    media_source_t *sources[eSOURCE_COUNT];
+    media_source_t *unused[eSOURCE_COUNT] = { NULL };
+    unsigned retired_cnt;
 
-    status = pjmedia_wav_player_port_create(app.pool,
-                                            filename,
-                                            PTIME,
-                                            0,
-                                            BUF_SIZE_WAV_PLAYEER,
-                                            &app.wav_port);
-
+    status = load_config(&cfg);
     if (status != PJ_SUCCESS)
     {
-        app_perror(THIS_FILE, "Unable to open file for playback", status);
+        app_perror(THIS_FILE, "Config is not reloaded", status);
         goto _exit;
     }
 
-    status = pjmedia_conf_add_port(app.conf, app.pool,
-        app.wav_port, NULL, &app.wav_slot);
-    if (status != PJ_SUCCESS) 
+    /* The bridge has room for MAX_SOURCE_SETS sets, the replaced ones
+     * stay in it until their last call ends */
+    pj_mutex_lock(app.mutex);
+    retired_cnt = app.retired_cnt;
+    pj_mutex_unlock(app.mutex);
+
+    if (retired_cnt > MAX_RETIRED_SOURCES)
     {
-        destroy_port(app.wav_port);
-        app_perror(THIS_FILE, "Unable to add file to conference bridge",
-        status);
+        PJ_LOG(2, (THIS_FILE, "Config is not reloaded: %u replaced sources still play to the calls, "
+                   "try again when they end", retired_cnt));
+        status = PJ_ETOOMANY;
         goto _exit;
     }
 
-    status = PJ_SUCCESS;
+    /* Ports are created and added to the bridge without app.mutex,
+     * the calls keep being set up meanwhile */
+    status = media_sources_create(&cfg, sources);
+    if (status != PJ_SUCCESS)
+    {
+        app_perror(THIS_FILE, "Sound sources are not reloaded", status);
+        goto _exit;
+    }
+
+    if (cfg.ptime_msec != app.ptime)
+        PJ_LOG(3, (THIS_FILE, "ptime_msec is applied at the next start, %u ms is kept", app.ptime));
+
+    if (cfg.sip_udp_sockets != app.worker_cnt)
+        PJ_LOG(3, (THIS_FILE, "sip_udp_sockets is applied at the next start, %u are kept", app.worker_cnt));
+
+    if ((cfg.record_calls != 0) != (app.recorder != NULL))
+        PJ_LOG(3, (THIS_FILE, "record_calls is applied at the next start"));
+
+    if (app.recorder && ((cfg.record_g711_raw != 0) != app.record_raw))
+        PJ_LOG(3, (THIS_FILE, "record_g711_raw is applied at the next start"));
+
+    if ((pj_ansi_strcmp(cfg.cpus_sip, app.cfg.cpus_sip) != 0)
+        || (pj_ansi_strcmp(cfg.cpus_media_io, app.cfg.cpus_media_io) != 0)
+        || (pj_ansi_strcmp(cfg.cpus_media_clock, app.cfg.cpus_media_clock) != 0)
+        || (cfg.numa_local != app.cfg.numa_local))
+        PJ_LOG(3, (THIS_FILE, "CPU and NUMA placement is applied at the next start"));
+
+    if (cfg.hugepage_pool_mb != app.cfg.hugepage_pool_mb)
+        PJ_LOG(3, (THIS_FILE, "hugepage_pool_mb is applied at the next start, %u MB are kept", app.cfg.hugepage_pool_mb));
+
+    if ((cfg.pool_thread_cache != 0) != (app.tpf != NULL))
+        PJ_LOG(3, (THIS_FILE, "pool_thread_cache is applied at the next start"));
+
+    if (cfg.g711_simd != app.cfg.g711_simd)
+        PJ_LOG(3, (THIS_FILE, "g711_simd is applied at the next start"));
+
+    pj_mutex_lock(app.mutex);
+
+    app.cfg = cfg;
+    overload_ctl_set_limits(&app.overload, &cfg.overload);
+    for (int i = 0; i < eSOURCE_COUNT; i++)
+    {
+        media_source_t *old = app.sources[i];
+
+        app.sources[i] = sources[i];
+        if (old)
+        {
+            old->retired = PJ_TRUE;
+            if (old->ref_cnt == 0)
+                unused[i] = old;
+            else
+                app.retired_cnt++;
+        }
+    }
+
+    pj_mutex_unlock(app.mutex);
+
+    /* Nobody listens to these, no need to wait for the calls */
+    for (int i = 0; i < eSOURCE_COUNT; i++)
+    {
+        if (unused[i])
+        {
+            media_source_destroy(unused[i]);
+        }
+    }
+
+    PJ_LOG(3, (THIS_FILE, "Sound sources reloaded"));
     goto _exit;
 
 _exit:
     return status;
 }
 
-/* Initialize the entire system */
-static pj_status_t init_system(void)
+/* SIGHUP handler, the reload itself is started by the worker thread */
+static void reload_signal_cb(int signum)
 {
-    pj_status_t status;
+    PJ_UNUSED_ARG(signum);
 
-    status = pj_init();
-    if (status != PJ_SUCCESS)
-        goto _exit;
+    reload_requested = 1;
 
-    pj_log_set_level(LOG_LEVEL);
+    return;
+}
 
-    status = pjlib_util_init();
-    if (status != PJ_SUCCESS)
-        goto _exit;
+/* Function for reload thread */
+static int reload_thread_routine(void *arg)
+{
+    PJ_UNUSED_ARG(arg);
 
-    /* Must create a pool factory before we can allocate any memory. */
-    pj_caching_pool_init(&app.cp, &pj_pool_factory_default_policy, 0);
+    for (;;)
+    {
+        pj_sem_wait(app.reload_sem);
 
-    app.snd_pool = pj_pool_create(&app.cp.factory, "snd", POOL_SIZE, POOL_INCREMENT_SIZE, NULL);
-    if (!app.snd_pool)
+        if (app.quit)
+            break;
+
+        reload_media_sources();
+    }
+
+    return PJ_SUCCESS;
+}
+
+/* Media update handler */
+static void call_on_media_update_cb(pjsip_inv_session *inv, pj_status_t status)
+{
+    call_t *call;
+
+    if (status != PJ_SUCCESS) 
     {
-        status = PJ_ENOMEM;
+        app_perror(THIS_FILE, "Media update failed: %d", status);
         goto _exit;
     }
-
-    /* Initialization SIP */
-    status = init_pjsip();
-    if (status != PJ_SUCCESS)
+    
+    call = inv->mod_data[0];
+    if (call == NULL)
         goto _exit;
 
-    /* Initialize media */
-    status = init_pjmedia();
-    if (status != PJ_SUCCESS)
+    pj_mutex_lock(app.mutex);
+    if (call->media_pending)
+    {
+        pj_mutex_unlock(app.mutex);
+        PJ_LOG(3, (THIS_FILE, "Media setup of the call is in progress, update ignored"));
         goto _exit;
+    }
+
+    call->media_pending = PJ_TRUE;
+    app.setup_queue[(app.setup_head + app.setup_cnt) % MAX_CALLS_STATIC] = (int)(call - app.calls);
+    app.setup_cnt++;
+    pj_mutex_unlock(app.mutex);
+
+    /* The dialog, and the session in its pool, outlive the setup */
+    pjsip_dlg_inc_session(inv->dlg, &mod_simpleua);
+    pj_sem_post(app.setup_sem);
 
     goto _exit;
 
 _exit:
-    return status;
+    return;
 }
 
-/* Add tone to the bridge */
-static pj_status_t create_and_connect_tone_to_conf(player_tone_t *player)
+/* Streams, transport and bridge of an answered call, in a setup thread.
+ * The dialog lock keeps the SIP threads out of the session meanwhile
+ */
+static void call_setup_media(call_t *call)
 {
-    pj_status_t status;
-    char name[NAME_ARR_SIZE];
-    pj_str_t label;
+    pjsip_dialog *dlg = call->dlg;
+    pj_status_t status = PJ_SUCCESS;
+    pj_status_t timer_status;
+    pj_bool_t reap;
 
-    pj_ansi_snprintf(name,
-                    sizeof(name),
-                    "tone-%d,%d,%d,%d",
-                    player->tone.freq1,
-                    player->tone.freq2,
-                    player->tone.off_msec,
-                    player->tone.on_msec);
-    label = pj_str(name);
+    pjsip_dlg_inc_lock(dlg);
 
-    status = pjmedia_tonegen_create2(app.pool,
-                                    &label,
-                                    CLOCK_RATE,
-                                    NCHANNELS,
-                                    SAMPLES_PER_FRAME,
-                                    BITS_PER_SAMPLE,
-                                    PJMEDIA_TONEGEN_LOOP,
-                                    &player->tone_pjmedia_port);
+    /* Ended while it was queued */
+    if (call->inv == NULL)
+        goto _on_exit_unlock;
 
+    status = call_add_media(call);
     if (status != PJ_SUCCESS)
-    {
-        app_perror(THIS_FILE, "Unable to create tone generator", status);
-        goto _on_error;
-    }
+        goto _on_exit_unlock;
 
-    status = pjmedia_conf_add_port(app.conf, app.pool, player->tone_pjmedia_port, NULL, &player->tone_slot);
-    if (status != PJ_SUCCESS)
+    /* Initialization and start of the timer */
+    timer_status = timer_create(&(call->call_media_timer),
+                                call,
+                                MEDIA_TIMER_SEC,
+                                MEDIA_TIMER_MSEC,
+                                &media_timeout_cb);
+    if (timer_status != PJ_SUCCESS)
     {
-        destroy_port(player->tone_pjmedia_port);
-        app_perror(THIS_FILE, "Unable to add file to conference bridge",
-        status);
-        goto _on_error;
+        app_perror(THIS_FILE, "timer_create", timer_status);
     }
 
-    status = pjmedia_tonegen_play(player->tone_pjmedia_port, 1, &player->tone, 0);
+_on_exit_unlock:
+    pj_mutex_lock(app.mutex);
+    call->media_pending = PJ_FALSE;
+    reap = call->dying;
+
     if (status != PJ_SUCCESS)
     {
-        app_perror(THIS_FILE, "Unable to play tone", status);
-        goto _on_error;
+        call->inv->mod_data[0] = NULL;
+        call->in_use = PJ_FALSE;
+        call->inv = NULL;
     }
+    pj_mutex_unlock(app.mutex);
 
-    PJ_LOG(3, (THIS_FILE, "Tone generator: %s - CREATED", name));
-    status = PJ_SUCCESS;
-    goto _on_error;
+    pjsip_dlg_dec_lock(dlg);
 
-_on_error:
-    return status;
+    /* The reaper skipped it while the setup was pending */
+    if (reap)
+        pj_sem_post(app.reaper_sem);
+
+    pjsip_dlg_dec_session(dlg, &mod_simpleua);
+
+    return;
 }
 
-/* Media update handler */
-static void call_on_media_update_cb(pjsip_inv_session *inv, pj_status_t status)
+/* Function for a media setup thread. It leaves when it finds the queue
+ * empty after the quit */
+static int setup_thread_routine(void *arg)
+{
+    int node = cpu_affinity_get_node(app.affinity[eROLE_MEDIA_CLOCK]);
+
+    PJ_UNUSED_ARG(arg);
+
+    /* The streams are used by the media clock, their memory is taken
+     * from its node. The thread itself may run anywhere */
+    if (app.cfg.numa_local && (node != CPU_AFFINITY_NO_NODE))
+        cpu_affinity_prefer_node(node);
+
+    for (;;)
+    {
+        call_t *call;
+
+        pj_sem_wait(app.setup_sem);
+
+        call = setup_queue_pop();
+        if (call)
+            call_setup_media(call);
+        else if (app.quit)
+            break;
+    }
+
+    return PJ_SUCCESS;
+}
+
+static call_t *setup_queue_pop(void)
 {
-    call_t *call;
+    call_t *call = NULL;
 
-    if (status != PJ_SUCCESS) 
+    pj_mutex_lock(app.mutex);
+    if (app.setup_cnt > 0)
     {
-        app_perror(THIS_FILE, "Media update failed: %d", status);
-        goto _exit;
+        call = &app.calls[app.setup_queue[app.setup_head]];
+        app.setup_head = (app.setup_head + 1) % MAX_CALLS_STATIC;
+        app.setup_cnt--;
     }
-    
-    call = inv->mod_data[0];
-    
-    status = call_add_media(call);
-    if (status != PJ_SUCCESS) 
-    {
-        pj_mutex_lock(app.mutex);
-        
-        call->in_use = PJ_FALSE;
-        call->inv = NULL;
+    pj_mutex_unlock(app.mutex);
 
-        pj_mutex_unlock(app.mutex);
+    return call;
+}
 
-        goto _exit;
-    }
+/* The work of the setup threads and the reaper in the simulation, in
+ * the thread of the harness: every call is set up and torn down at a
+ * fixed point of the virtual time and not when a thread gets to it */
+static void run_sim_queues(void)
+{
+    call_t *call;
 
-    /* Initialization and start of the timer */
-    status = timer_create(&(call->call_media_timer),
-                                    call,
-                                    MEDIA_TIMER_SEC,
-                                    MEDIA_TIMER_MSEC,
-                                    &media_timeout_cb);
-    if (status != PJ_SUCCESS)
+    while ((call = setup_queue_pop()) != NULL)
     {
-        app_perror(THIS_FILE, "timer_create", status);
+        call_setup_media(call);
     }
 
-    goto _exit;
+    reap_dying_calls();
 
-_exit:
     return;
 }
 
@@ -1365,6 +3106,76 @@ _exit:
     return status;
 }
 
+/* pjmedia takes the packet size from a=ptime of the offer only, without
+ * it the codec default is used. The answer announces our ptime, the
+ * stream must send what it announces
+ */
+static void stream_set_default_ptime(pjmedia_stream_info *stream_info, const pjmedia_sdp_media *remote_media)
+{
+    unsigned frm_ptime = stream_info->param->info.frm_ptime;
+
+    if (pjmedia_sdp_media_find_attr2(remote_media, PTIME_ATTR_NAME, NULL) != NULL)
+        goto _exit;
+
+    if (frm_ptime != 0)
+        stream_info->param->setting.frm_per_pkt = (pj_uint8_t)PJ_MAX(app.ptime / frm_ptime, 1);
+
+_exit:
+    return;
+}
+
+/* Announce the packetization time of the bridge */
+static pj_status_t sdp_add_ptime(pj_pool_t *pool, pjmedia_sdp_session *sdp)
+{
+    pj_status_t status = PJ_SUCCESS;
+    pjmedia_sdp_media *media = sdp->media[0];
+    pjmedia_sdp_attr *attr;
+    char value[PTIME_ATTR_SIZE];
+    pj_str_t value_str;
+
+    pj_ansi_snprintf(value, sizeof(value), "%u", app.ptime);
+    value_str = pj_str(value);
+
+    pjmedia_sdp_media_remove_all_attr(media, PTIME_ATTR_NAME);
+
+    attr = pjmedia_sdp_attr_create(pool, PTIME_ATTR_NAME, &value_str);
+    if (attr == NULL)
+    {
+        status = PJ_ENOMEM;
+        goto _exit;
+    }
+
+    status = pjmedia_sdp_media_add_attr(media, attr);
+
+_exit:
+    return status;
+}
+
+/* Offer to send only: the negotiated stream has no decoding direction, so
+ * inbound RTP is neither jitter buffered nor decoded
+ */
+static pj_status_t sdp_set_sendonly(pj_pool_t *pool, pjmedia_sdp_session *sdp)
+{
+    pj_status_t status = PJ_SUCCESS;
+    pjmedia_sdp_media *media = sdp->media[0];
+    pjmedia_sdp_attr *attr;
+
+    pjmedia_sdp_media_remove_all_attr(media, SENDRECV_ATTR_NAME);
+    pjmedia_sdp_attr_remove_all(&sdp->attr_count, sdp->attr, SENDRECV_ATTR_NAME);
+
+    attr = pjmedia_sdp_attr_create(pool, SENDONLY_ATTR_NAME, NULL);
+    if (attr == NULL)
+    {
+        status = PJ_ENOMEM;
+        goto _exit;
+    }
+
+    status = pjmedia_sdp_media_add_attr(media, attr);
+
+_exit:
+    return status;
+}
+
 static pj_status_t call_add_media_port(call_t *call)
 {
     pj_status_t status = pjmedia_stream_get_port(call->stream, &call->port);
@@ -1379,53 +3190,162 @@ static pj_status_t call_add_media_port(call_t *call)
 
 static pj_status_t call_add_to_bridge(call_t *call)
 {
-    pj_status_t status = pjmedia_conf_add_port(app.conf, 
-                                             call->inv->dlg->pool,
-                                             call->port, 
-                                             NULL, 
-                                             &call->slot);
+    pjmedia_stream_info stream_info;
+    pj_status_t status;
+
+    /* The reserved slot of the call, its proxy converts G.711 and any
+     * ptime. The bridge does not read the stream until it is recorded */
+    if (port_proxy_fits(call->proxy, call->port))
+    {
+        port_proxy_bind(call->proxy, call->port, PJ_FALSE);
+        call->slot = call->proxy_slot;
+        status = PJ_SUCCESS;
+        goto _exit;
+    }
+
+    /* A rate the proxy has no resampler for, the bridge converts it in
+     * a slot of its own. Counted, it costs the bridge lock twice */
+    pj_mutex_lock(app.mutex);
+    app.own_slot_cnt++;
+    pj_mutex_unlock(app.mutex);
+
+    status = pjmedia_conf_add_port(app.conf, 
+                                   call->inv->dlg->pool,
+                                   call->port, 
+                                   NULL, 
+                                   &call->slot);
     if (status != PJ_SUCCESS) 
     {
         app_perror(THIS_FILE, "Failed to add to conference", status);
         call->port = NULL;
+        goto _exit;
+    }
+
+    /* Send only stream has its decoder paused, the bridge need not read it */
+    status = pjmedia_stream_get_info(call->stream, &stream_info);
+    if ((status == PJ_SUCCESS) && ((stream_info.dir & PJMEDIA_DIR_DECODING) == 0))
+    {
+        status = pjmedia_conf_configure_port(app.conf, call->slot, PJMEDIA_PORT_ENABLE, PJMEDIA_PORT_DISABLE);
+        if (status != PJ_SUCCESS)
+            app_perror(THIS_FILE, "Failed to disable the reception from the call", status);
     }
+    status = PJ_SUCCESS;
+
+_exit:
     return status;
 }
 
+/* The call keeps the source current at the moment of connection
+ * until it ends, even if the source is reloaded */
+static media_source_t *call_acquire_source(call_t *call)
+{
+    media_source_t *source = NULL;
+    int source_idx = get_source_index(&call->sip_uri_target_user);
+
+    pj_mutex_lock(app.mutex);
+    if ((source_idx != UNDEFINED_ID) && app.sources[source_idx])
+    {
+        source = app.sources[source_idx];
+        source->ref_cnt++;
+        call->source = source;
+    }
+    pj_mutex_unlock(app.mutex);
+
+    if (source == NULL)
+    {
+        PJ_LOG(3,(THIS_FILE, "No matching audio source found"));
+    }
+
+    return source;
+}
+
 static pj_status_t call_connect_audio_source(call_t *call)
 {
     pj_status_t status;
-    if (pj_strcmp(&call->sip_uri_target_user, &app.wav_player_name) == 0) 
+    media_source_t *source = call_acquire_source(call);
+
+    if (source == NULL)
     {
-        if (app.wav_port) 
-        {
-            status = pjmedia_conf_connect_port(app.conf, app.wav_slot, call->slot, 0);
-            goto _exit;
-        }
+        status = PJ_ENOTFOUND;
+        goto _exit;
     }
-    else if (pj_strcmp(&call->sip_uri_target_user, &app.long_tone_player_name) == 0) 
+
+    status = pjmedia_conf_connect_port(app.conf, source->slot, call->slot, 0);
+    if (status != PJ_SUCCESS)
     {
-        if (app.long_tone.tone_pjmedia_port) 
-        {
-            status = pjmedia_conf_connect_port(app.conf, app.long_tone.tone_slot, call->slot, 0);
-            goto _exit;
-        }
+        pj_mutex_lock(app.mutex);
+        media_source_release(source);
+        call->source = NULL;
+        pj_mutex_unlock(app.mutex);
     }
-    else if (pj_strcmp(&call->sip_uri_target_user, &app.kpv_tone_player_name) == 0) 
+    goto _exit;
+
+_exit:
+    return status;
+}
+
+/* The bridge puts the decoded audio of the caller to the recorder port,
+ * or in the raw mode the tap of the transport gives it the G.711 RTP
+ * as it comes. The call is answered even if it cannot be recorded
+ */
+static void call_start_recording(call_t *call, const pjmedia_stream_info *stream_info)
+{
+    pj_status_t status;
+    pj_time_val now;
+    unsigned seq;
+    char name[RECORD_NAME_SIZE];
+
+    pj_mutex_lock(app.mutex);
+    seq = app.record_seq++;
+    pj_mutex_unlock(app.mutex);
+
+    pj_gettimeofday(&now);
+    pj_ansi_snprintf(name, sizeof(name), "%.*s_%ld_%u",
+                     (int)call->sip_uri_target_user.slen,
+                     call->sip_uri_target_user.ptr,
+                     (long)now.sec,
+                     seq);
+
+    if (app.record_raw
+        && ((stream_info->fmt.pt == PJMEDIA_RTP_PT_PCMU) || (stream_info->fmt.pt == PJMEDIA_RTP_PT_PCMA)))
     {
-        if (app.kpv_tone.tone_pjmedia_port) 
+        status = call_recorder_open_g711(app.recorder, name, stream_info->fmt.pt, &call->rec_port);
+        if (status != PJ_SUCCESS)
         {
-            status = pjmedia_conf_connect_port(app.conf, app.kpv_tone.tone_slot, call->slot, 0);
+            app_perror(THIS_FILE, "Call is not recorded", status);
+            call->rec_port = NULL;
             goto _exit;
         }
+
+        rtp_tap_set_rx_cb(call->transport, &call_recorder_on_rtp, call->rec_port);
+        goto _exit;
     }
-    
-    PJ_LOG(3,(THIS_FILE, "No matching audio source found"));
-    status = PJ_ENOTFOUND;
-    goto _exit;
+
+    status = call_recorder_open_port(app.recorder, name, &call->rec_port);
+    if (status != PJ_SUCCESS)
+    {
+        app_perror(THIS_FILE, "Call is not recorded", status);
+        call->rec_port = NULL;
+        goto _exit;
+    }
+
+    port_proxy_bind(call->rec_proxy, call->rec_port, PJ_FALSE);
+    call->rec_slot = call->rec_proxy_slot;
+
+    /* The reserved slots are connected since the start, the bridge
+     * starts reading the stream */
+    if (call->slot == call->proxy_slot)
+    {
+        port_proxy_bind(call->proxy, call->port, (stream_info->dir & PJMEDIA_DIR_DECODING) != 0);
+        goto _exit;
+    }
+
+    status = pjmedia_conf_connect_port(app.conf, call->slot, call->rec_slot, 0);
+    if (status != PJ_SUCCESS)
+        app_perror(THIS_FILE, "Failed to connect the call to its recorder", status);
 
 _exit:
-    return status;
+    return;
 }
 
 static pj_status_t call_add_media(call_t *call)
@@ -1451,6 +3371,14 @@ static pj_status_t call_add_media(call_t *call)
         goto _exit;
     }
 
+    if (is_l16_fast_path(&stream_info))
+    {
+        status = call_add_l16_media(call, &stream_info);
+        goto _exit;
+    }
+
+    stream_set_default_ptime(&stream_info, remote_sdp->media[0]);
+
     /* Create and start media stream */
     if ((status = create_media_stream(call, &stream_info)) != PJ_SUCCESS) 
     {
@@ -1489,12 +3417,17 @@ static pj_status_t call_add_media(call_t *call)
         goto _on_exit_transport_close_stream_destroy;
     }
 
+    if (app.recorder)
+        call_start_recording(call, &stream_info);
+
     status = PJ_SUCCESS;
     goto _exit;
 
 
 
 _on_exit_transport_close_stream_destroy:
+    if (call->slot == call->proxy_slot)
+        port_proxy_bind(call->proxy, NULL, PJ_FALSE);
     pjmedia_stream_destroy(call->stream);
     call->stream = NULL;
     pjmedia_transport_close(call->transport);
@@ -1504,15 +3437,98 @@ _exit:
     return status;
 }
 
-/* Function for worker thread */
+/* L16 at the bridge rate, mono, and only sending */
+static pj_bool_t is_l16_fast_path(const pjmedia_stream_info *stream_info)
+{
+    return app.l16_fast_path
+           && (pj_stricmp2(&stream_info->fmt.encoding_name, L16_CODEC_NAME) == 0)
+           && (stream_info->fmt.clock_rate == CLOCK_RATE)
+           && (stream_info->fmt.channel_cnt == NCHANNELS)
+           && (stream_info->dir == PJMEDIA_DIR_ENCODING);
+}
+
+/* No stream: the fanout of the source sends the RTP to the transport.
+ * The frame goes out at the bridge ptime, RTCP is not sent
+ */
+static pj_status_t call_add_l16_media(call_t *call, const pjmedia_stream_info *stream_info)
+{
+    pj_status_t status;
+    media_source_t *source;
+
+    status = pjmedia_transport_attach(call->transport,
+                                      call,
+                                      &stream_info->rem_addr,
+                                      &stream_info->rem_rtcp,
+                                      pj_sockaddr_get_len(&stream_info->rem_addr),
+                                      &l16_on_rx_rtp,
+                                      NULL);
+    if (status != PJ_SUCCESS)
+    {
+        app_perror(THIS_FILE, "Unable to attach media transport", status);
+        goto _exit;
+    }
+
+    status = pjmedia_transport_media_start(call->transport, 0, 0, 0, 0);
+    if (status != PJ_SUCCESS)
+    {
+        app_perror(THIS_FILE, "Unable to start UDP media transport", status);
+        pjmedia_transport_detach(call->transport, call);
+        goto _exit;
+    }
+
+    source = call_acquire_source(call);
+    if (source == NULL)
+    {
+        status = PJ_ENOTFOUND;
+        pjmedia_transport_detach(call->transport, call);
+        goto _exit;
+    }
+
+    status = l16_fanout_add_listener(source->fanout, call->transport, stream_info->tx_pt, &call->fanout_id);
+    if (status != PJ_SUCCESS)
+    {
+        app_perror(THIS_FILE, "Unable to add L16 listener", status);
+        call->fanout_id = UNDEFINED_ID;
+        pjmedia_transport_detach(call->transport, call);
+        pj_mutex_lock(app.mutex);
+        media_source_release(source);
+        call->source = NULL;
+        pj_mutex_unlock(app.mutex);
+    }
+
+_exit:
+    return status;
+}
+
+/* The callers are not listened to */
+static void l16_on_rx_rtp(void *user_data, void *pkt, pj_ssize_t size)
+{
+    PJ_UNUSED_ARG(user_data);
+    PJ_UNUSED_ARG(pkt);
+    PJ_UNUSED_ARG(size);
+
+    return;
+}
+
+/* Function for worker thread, all of them poll the ioqueue of the endpoint */
 static int thread_routine(void *arg)
 {
-    PJ_UNUSED_ARG(arg);
+    unsigned index = (unsigned)(pj_ssize_t)arg;
+
+    /* Dialogs and transactions come from the pools of this thread */
+    thread_set_role(eROLE_SIP);
 
     while (!app.quit)
     {
         pj_time_val interval = {0, MAX_TIME_EVENTS_WAIT};
         pjsip_endpt_handle_events(app.sip_endpt, &interval);
+
+        /* The first worker starts the reload */
+        if ((index == 0) && reload_requested)
+        {
+            reload_requested = 0;
+            pj_sem_post(app.reload_sem);
+        }
     }
     
     return PJ_SUCCESS;
@@ -1556,6 +3572,199 @@ static void media_timeout_cb(pj_timer_heap_t *timer_heap, struct pj_timer_entry
     return;
 }
 
+/* Periodic sample of the load signals */
+static void overload_timeout_cb(pj_timer_heap_t *timer_heap, struct pj_timer_entry *entry)
+{
+    pj_time_val delay = {OVERLOAD_TIMER_SEC, OVERLOAD_TIMER_MSEC};
+
+    PJ_UNUSED_ARG(timer_heap);
+
+    /* The virtual clock ticks in bursts, its lag means nothing */
+    overload_ctl_sample(&app.overload, app.sim_clock ? 0 : clock_probe_get_lag_usec(app.null_port));
+    check_media_clock();
+
+    pjsip_endpt_schedule_timer(app.sip_endpt, entry, &delay);
+
+    return;
+}
+
+/* A stream slot and, when calls are recorded, a recorder slot for each
+ * call slot. They stay in the bridge, the stream slot feeds the recorder
+ * slot for good and a call only binds its ports to them
+ */
+static pj_status_t create_call_proxies(void)
+{
+    pj_status_t status = PJ_SUCCESS;
+
+    for (int i = 0; i < MAX_CALLS_STATIC; i++)
+    {
+        call_t *call = &app.calls[i];
+
+        call->rec_proxy = NULL;
+        call->rec_proxy_slot = (unsigned)UNDEFINED_ID;
+
+        status = port_proxy_create(app.pool, CLOCK_RATE, SAMPLES_PER_FRAME(app.ptime), PJ_TRUE, &call->proxy);
+        if (status != PJ_SUCCESS)
+            goto _exit;
+
+        status = pjmedia_conf_add_port(app.conf, app.pool, call->proxy, NULL, &call->proxy_slot);
+        if (status != PJ_SUCCESS)
+            goto _exit;
+
+        if (!app.cfg.record_calls)
+            continue;
+
+        /* The recorder has the format of the bridge */
+        status = port_proxy_create(app.pool, CLOCK_RATE, SAMPLES_PER_FRAME(app.ptime), PJ_FALSE, &call->rec_proxy);
+        if (status != PJ_SUCCESS)
+            goto _exit;
+
+        status = pjmedia_conf_add_port(app.conf, app.pool, call->rec_proxy, NULL, &call->rec_proxy_slot);
+        if (status != PJ_SUCCESS)
+            goto _exit;
+
+        status = pjmedia_conf_connect_port(app.conf, call->proxy_slot, call->rec_proxy_slot, 0);
+        if (status != PJ_SUCCESS)
+            goto _exit;
+    }
+
+_exit:
+    if (status != PJ_SUCCESS)
+        app_perror(THIS_FILE, "Unable to reserve the bridge slots of the calls", status);
+
+    return status;
+}
+
+/* Start sampling of the load signals */
+static pj_status_t start_overload_control(void)
+{
+    pj_status_t status;
+    pj_time_val delay = {OVERLOAD_TIMER_SEC, OVERLOAD_TIMER_MSEC};
+
+    status = overload_ctl_init(&app.overload, app.pool, &app.cfg.overload, SIP_PORT);
+    if (status != PJ_SUCCESS)
+    {
+        app_perror(THIS_FILE, "Unable to create the overload lock", status);
+        goto _exit;
+    }
+
+    pj_timer_entry_init(&app.overload_timer, PJ_TRUE, NULL, &overload_timeout_cb);
+
+    status = pjsip_endpt_schedule_timer(app.sip_endpt, &app.overload_timer, &delay);
+    if (status != PJ_SUCCESS)
+    {
+        app_perror(THIS_FILE, "Schedule timer error", status);
+        app.overload_timer.id = PJ_FALSE;
+    }
+
+_exit:
+    return status;
+}
+
+/* Print the load and media clock metrics */
+static void print_metrics(void)
+{
+    clock_probe_stats_t clock_stats;
+    char jitter[HISTOGRAM_STR_SIZE];
+    char process[HISTOGRAM_STR_SIZE];
+    unsigned calls_cnt = 0;
+    pj_uint64_t own_slot_cnt;
+    pj_uint64_t skipped_cnt = 0;
+    pj_uint64_t kpv_frame_cnt = 0;
+    pj_uint64_t kpv_silent_cnt = 0;
+    pj_uint64_t pcap_written_cnt = 0;
+    pj_uint64_t pcap_dropped_cnt = 0;
+    pj_uint64_t rec_written_bytes = 0;
+    pj_uint64_t rec_dropped_cnt = 0;
+    pj_size_t arena_size = 0;
+    pj_size_t arena_carved = 0;
+    pj_uint64_t arena_fallback_cnt = 0;
+    pj_uint64_t pool_refill_cnt = 0;
+    pj_uint64_t pool_upstream_cnt = 0;
+    pj_uint64_t rejected_cnt = 0;
+    unsigned cpu_percent = 0;
+    unsigned sip_queue_bytes = 0;
+
+    pj_mutex_lock(app.mutex);
+    for (int i = 0; i < MAX_CALLS_STATIC; i++)
+    {
+        if (app.calls[i].in_use)
+            calls_cnt++;
+    }
+    own_slot_cnt = app.own_slot_cnt;
+
+    if (app.sources[eSOURCE_KPV_TONE] && app.sources[eSOURCE_KPV_TONE]->gate)
+        silence_gate_get_stats(app.sources[eSOURCE_KPV_TONE]->gate, &kpv_frame_cnt, &kpv_silent_cnt);
+    pj_mutex_unlock(app.mutex);
+
+    clock_probe_get_stats(app.null_port, &clock_stats);
+    histogram_print(&clock_stats.start_jitter_usec, jitter, sizeof(jitter));
+    histogram_print(&clock_stats.process_usec, process, sizeof(process));
+
+    if (app.media_clock)
+        skipped_cnt = media_clock_get_skipped_cnt(app.media_clock);
+
+    if (app.pcap)
+        pcap_writer_get_stats(app.pcap, &pcap_written_cnt, &pcap_dropped_cnt);
+
+    if (app.recorder)
+        call_recorder_get_stats(app.recorder, &rec_written_bytes, &rec_dropped_cnt);
+
+    if (app.is_hugepage_pool)
+        hugepage_policy_get_stats(&arena_size, &arena_carved, &arena_fallback_cnt);
+
+    if (app.tpf)
+        thread_pool_factory_get_stats(app.tpf, &pool_refill_cnt, &pool_upstream_cnt);
+
+    if (app.overload.lock)
+        overload_ctl_get_stats(&app.overload, &rejected_cnt, &cpu_percent, &sip_queue_bytes);
+
+    printf("\nMetrics:\n"
+           "\tcalls:                 %u/%u\n"
+           "\tcalls in own slots:    %llu\n"
+           "\trejected (overload):   %llu\n"
+           "\tCPU:                   %u%%\n"
+           "\tSIP queue:             %u bytes\n"
+           "\tTCP connections:       %u\n"
+           "\tclock lag:             %u usec\n"
+           "\tclock ticks:           %llu\n"
+           "\tmissed deadlines:      %llu\n"
+           "\tskipped ticks:         %llu\n"
+           "\ttick start jitter:     %s usec\n"
+           "\ttick processing:       %s usec\n"
+           "\tKPV silent frames:     %llu/%llu\n"
+           "\tpcap packets/dropped:  %llu/%llu\n"
+           "\trecording KB/dropped:  %llu/%llu\n"
+           "\tpool arena KB/other:   %llu/%llu of %llu\n"
+           "\tpool refills/new:      %llu/%llu\n",
+           calls_cnt,
+           MAX_CALLS_STATIC,
+           (unsigned long long)own_slot_cnt,
+           (unsigned long long)rejected_cnt,
+           cpu_percent,
+           sip_queue_bytes,
+           app.tcp_conn_cnt,
+           clock_stats.lag_usec,
+           (unsigned long long)clock_stats.tick_cnt,
+           (unsigned long long)clock_stats.missed_deadline_cnt,
+           (unsigned long long)skipped_cnt,
+           jitter,
+           process,
+           (unsigned long long)kpv_silent_cnt,
+           (unsigned long long)kpv_frame_cnt,
+           (unsigned long long)pcap_written_cnt,
+           (unsigned long long)pcap_dropped_cnt,
+           (unsigned long long)(rec_written_bytes / BYTES_IN_KB),
+           (unsigned long long)rec_dropped_cnt,
+           (unsigned long long)(arena_carved / BYTES_IN_KB),
+           (unsigned long long)arena_fallback_cnt,
+           (unsigned long long)(arena_size / BYTES_IN_KB),
+           (unsigned long long)pool_refill_cnt,
+           (unsigned long long)pool_upstream_cnt);
+
+    return;
+}
+
 /* Util to display the error message for the specified error code  */
 static void app_perror( const char *sender, const char *title, pj_status_t status)
 {
@@ -0,0 +1,182 @@
+#include <time.h>
+
+#include "clock_probe.h"
+
+#define THIS_FILE                   "clock_probe.c"
+#define PROBE_NAME                  "clock-probe"
+#define PROBE_SIGNATURE             PJMEDIA_SIG_CLASS_APP('C', 'P')
+#define NCHANNELS                   1
+#define USEC_IN_SEC                 1000000
+#define NSEC_IN_USEC                1000
+#define MAX_LAG_USEC                500000  /* pjmedia clock resyncs when it is late that much */
+#define LAG_SMOOTH_SHIFT            4       /* lag += (sample - lag) / 16 */
+
+typedef struct clock_probe_t
+{
+    pjmedia_port                base;
+    pj_uint64_t                 period_usec;
+    pj_uint64_t                 start_usec;
+    pj_uint64_t                 tick_cnt;
+    pj_uint64_t                 last_start_usec;
+    pj_uint64_t                 tick_start_usec;
+    pj_uint64_t                 tick_deadline_usec;
+    volatile unsigned           lag_usec;
+    clock_probe_stats_t         stats;
+} clock_probe_t;
+
+static pj_uint64_t now_usec(void);
+static void update_lag(clock_probe_t *probe, pj_uint64_t now);
+static void update_jitter(clock_probe_t *probe, pj_uint64_t now);
+static pj_status_t probe_get_frame(pjmedia_port *this_port, pjmedia_frame *frame);
+static pj_status_t probe_put_frame(pjmedia_port *this_port, pjmedia_frame *frame);
+static pj_status_t probe_on_destroy(pjmedia_port *this_port);
+
+/* Create the probe port */
+pj_status_t clock_probe_create(pj_pool_t *pool,
+                               unsigned clock_rate,
+                               unsigned samples_per_frame,
+                               unsigned bits_per_sample,
+                               pjmedia_port **p_port)
+{
+    pj_status_t status;
+    clock_probe_t *probe;
+    pj_str_t name = pj_str(PROBE_NAME);
+
+    probe = PJ_POOL_ZALLOC_T(pool, clock_probe_t);
+
+    status = pjmedia_port_info_init(&probe->base.info,
+                                    &name,
+                                    PROBE_SIGNATURE,
+                                    clock_rate,
+                                    NCHANNELS,
+                                    bits_per_sample,
+                                    samples_per_frame);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    probe->base.get_frame = &probe_get_frame;
+    probe->base.put_frame = &probe_put_frame;
+    probe->base.on_destroy = &probe_on_destroy;
+    probe->period_usec = ((pj_uint64_t)samples_per_frame * USEC_IN_SEC) / clock_rate;
+
+    *p_port = &probe->base;
+
+_exit:
+    return status;
+}
+
+unsigned clock_probe_get_lag_usec(pjmedia_port *port)
+{
+    return ((clock_probe_t *)port)->lag_usec;
+}
+
+void clock_probe_get_stats(pjmedia_port *port, clock_probe_stats_t *stats)
+{
+    clock_probe_t *probe = (clock_probe_t *)port;
+
+    *stats = probe->stats;
+    stats->lag_usec = probe->lag_usec;
+
+    return;
+}
+
+static pj_uint64_t now_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((pj_uint64_t)ts.tv_sec * USEC_IN_SEC) + ((pj_uint64_t)ts.tv_nsec / NSEC_IN_USEC);
+}
+
+/* Compare the tick start with the ideal clock started by the first tick */
+static void update_lag(clock_probe_t *probe, pj_uint64_t now)
+{
+    pj_uint64_t expected = probe->start_usec + (probe->tick_cnt * probe->period_usec);
+    pj_uint64_t sample = 0;
+
+    /* First tick, or the clock was early or resynced: restart the ideal clock here */
+    if ((probe->tick_cnt == 0) || (now < expected) || ((now - expected) > MAX_LAG_USEC))
+    {
+        probe->start_usec = now;
+        probe->tick_cnt = 0;
+    }
+    else
+    {
+        sample = now - expected;
+    }
+
+    /* The tick must be done before the next one is due */
+    probe->tick_deadline_usec = probe->start_usec + ((probe->tick_cnt + 1) * probe->period_usec);
+
+    probe->tick_cnt++;
+    probe->lag_usec = (unsigned)((pj_int64_t)probe->lag_usec
+                                 + (((pj_int64_t)sample - (pj_int64_t)probe->lag_usec) >> LAG_SMOOTH_SHIFT));
+
+    return;
+}
+
+/* Deviation of the interval between the tick starts from the period */
+static void update_jitter(clock_probe_t *probe, pj_uint64_t now)
+{
+    pj_uint64_t interval;
+    pj_uint64_t jitter;
+
+    if (probe->last_start_usec != 0)
+    {
+        interval = now - probe->last_start_usec;
+        jitter = (interval > probe->period_usec) ? (interval - probe->period_usec)
+                                                 : (probe->period_usec - interval);
+        histogram_add(&probe->stats.start_jitter_usec, (pj_uint32_t)PJ_MIN(jitter, PJ_MAXINT32));
+    }
+
+    probe->last_start_usec = now;
+
+    return;
+}
+
+/* Start of the tick */
+static pj_status_t probe_get_frame(pjmedia_port *this_port, pjmedia_frame *frame)
+{
+    clock_probe_t *probe = (clock_probe_t *)this_port;
+    pj_uint64_t now = now_usec();
+
+    update_jitter(probe, now);
+    update_lag(probe, now);
+    probe->tick_start_usec = now;
+    probe->stats.tick_cnt++;
+
+    frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+    frame->size = PJMEDIA_PIA_AVG_FSZ(&this_port->info);
+    frame->timestamp.u32.lo += PJMEDIA_PIA_SPF(&this_port->info);
+    pjmedia_zero_samples((pj_int16_t *)frame->buf, PJMEDIA_PIA_SPF(&this_port->info));
+
+    return PJ_SUCCESS;
+}
+
+/* End of the tick, the mixed frame of the bridge is dropped */
+static pj_status_t probe_put_frame(pjmedia_port *this_port, pjmedia_frame *frame)
+{
+    clock_probe_t *probe = (clock_probe_t *)this_port;
+    pj_uint64_t now = now_usec();
+
+    PJ_UNUSED_ARG(frame);
+
+    if (probe->tick_start_usec != 0)
+    {
+        histogram_add(&probe->stats.process_usec,
+                      (pj_uint32_t)PJ_MIN(now - probe->tick_start_usec, PJ_MAXINT32));
+
+        if (now > probe->tick_deadline_usec)
+            probe->stats.missed_deadline_cnt++;
+    }
+
+    return PJ_SUCCESS;
+}
+
+static pj_status_t probe_on_destroy(pjmedia_port *this_port)
+{
+    PJ_UNUSED_ARG(this_port);
+
+    return PJ_SUCCESS;
+}
@@ -0,0 +1,35 @@
+#ifndef _AUTO_ANSWER_CLOCK_PROBE_H_
+#define _AUTO_ANSWER_CLOCK_PROBE_H_
+
+#include <pjmedia.h>
+
+#include "histogram.h"
+
+/* What the probe has seen since it was created */
+typedef struct clock_probe_stats_t
+{
+    histogram_t         start_jitter_usec;  /* |tick start interval - period| */
+    histogram_t         process_usec;       /* Time the bridge spent in the tick */
+    pj_uint64_t         tick_cnt;
+    pj_uint64_t         missed_deadline_cnt;    /* Tick finished after the next one was due */
+    unsigned            lag_usec;
+} clock_probe_stats_t;
+
+/* Null port which also watches the media clock driving it.
+ * It takes the place of the null port as the upstream port of the
+ * master port: get_frame() is called at the start of every clock tick,
+ * put_frame() after the bridge has processed the tick
+ */
+pj_status_t clock_probe_create(pj_pool_t *pool,
+                               unsigned clock_rate,
+                               unsigned samples_per_frame,
+                               unsigned bits_per_sample,
+                               pjmedia_port **p_port);
+
+/* Smoothed lateness of the tick start against the ideal clock */
+unsigned clock_probe_get_lag_usec(pjmedia_port *port);
+
+/* Snapshot of the statistics */
+void clock_probe_get_stats(pjmedia_port *port, clock_probe_stats_t *stats);
+
+#endif /* _AUTO_ANSWER_CLOCK_PROBE_H_ */
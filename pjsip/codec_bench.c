@@ -0,0 +1,328 @@
+/* CPU cost of the transmit path of one call for the 16 kHz bridge:
+ * G.722 encoding of the bridge frame against resampling it to 8 kHz
+ * and G.711 encoding, as the bridge does for a PCMU/PCMA stream.
+ *
+ *   ./codec_bench [seconds of audio]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <pjmedia.h>
+#include <pjmedia-codec.h>
+#include <pjlib.h>
+
+#define THIS_FILE                   "codec_bench.c"
+#define CLOCK_RATE                  16000
+#define NCHANNELS                   1
+#define BITS_PER_SAMPLE             16
+#define FRAME_MSEC                  10
+#define MSEC_IN_SEC                 1000
+#define NSEC_IN_MSEC                1000000
+#define SAMPLES_PER_FRAME           (CLOCK_RATE * FRAME_MSEC / MSEC_IN_SEC)
+#define G711_CLOCK_RATE             8000
+#define G711_SAMPLES_PER_FRAME      (G711_CLOCK_RATE * FRAME_MSEC / MSEC_IN_SEC)
+#define DEFAULT_SECONDS             600
+#define INPUT_FRAMES                100     /* One second of tone is looped */
+#define OUT_BUF_SIZE                640
+#define POOL_SIZE                   4000
+#define POOL_INCREMENT_SIZE         4000
+#define TONE_FREQ1                  425
+#define TONE_FREQ2                  1200
+#define TONE_ON_MSEC                1000
+#define TONE_OFF_MSEC               0
+#define PERCENT                     100
+#define RESAMPLE_HIGH_QUALITY       PJ_TRUE     /* Options of the bridge */
+#define RESAMPLE_LARGE_FILTER       PJ_TRUE
+
+typedef struct bench_t
+{
+    pj_caching_pool             cp;
+    pj_pool_t                   *pool;
+    pjmedia_endpt               *med_endpt;
+    pj_int16_t                  input[INPUT_FRAMES][SAMPLES_PER_FRAME];
+    unsigned                    frame_cnt;
+} bench_t;
+
+static pj_status_t bench_init(bench_t *bench);
+static void bench_destroy(bench_t *bench);
+static pj_status_t fill_input(bench_t *bench);
+static pj_status_t codec_open(bench_t *bench, const char *id, pjmedia_codec **p_codec);
+static void codec_release(bench_t *bench, pjmedia_codec *codec);
+static pj_status_t encode(pjmedia_codec *codec, pj_int16_t *samples, unsigned count);
+static pj_status_t bench_g722(bench_t *bench, pj_uint64_t *nsec);
+static pj_status_t bench_g711_resample(bench_t *bench, pj_uint64_t *nsec);
+static void print_result(const char *name, pj_uint64_t nsec, unsigned frame_cnt);
+
+int main(int argc, char *argv[])
+{
+    static bench_t bench;
+    pj_status_t status;
+    pj_uint64_t g722_nsec = 0;
+    pj_uint64_t g711_nsec = 0;
+    unsigned seconds = DEFAULT_SECONDS;
+
+    if (argc > 1)
+        seconds = (unsigned)atoi(argv[1]);
+
+    bench.frame_cnt = seconds * (MSEC_IN_SEC / FRAME_MSEC);
+
+    status = bench_init(&bench);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    status = bench_g722(&bench, &g722_nsec);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    status = bench_g711_resample(&bench, &g711_nsec);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    printf("%u s of %u Hz audio, %u ms frames\n", seconds, CLOCK_RATE, FRAME_MSEC);
+    print_result("G.722", g722_nsec, bench.frame_cnt);
+    print_result("resample + G.711", g711_nsec, bench.frame_cnt);
+
+_exit:
+    bench_destroy(&bench);
+
+    return (status == PJ_SUCCESS) ? 0 : 1;
+}
+
+static pj_status_t bench_init(bench_t *bench)
+{
+    pj_status_t status;
+
+    status = pj_init();
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    pj_caching_pool_init(&bench->cp, &pj_pool_factory_default_policy, 0);
+
+    status = pjmedia_endpt_create(&bench->cp.factory, NULL, 1, &bench->med_endpt);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    bench->pool = pjmedia_endpt_create_pool(bench->med_endpt, "bench", POOL_SIZE, POOL_INCREMENT_SIZE);
+    if (!bench->pool)
+    {
+        status = PJ_ENOMEM;
+        goto _exit;
+    }
+
+    status = pjmedia_codec_g711_init(bench->med_endpt);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    status = pjmedia_codec_g722_init(bench->med_endpt);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    status = fill_input(bench);
+
+_exit:
+    return status;
+}
+
+static void bench_destroy(bench_t *bench)
+{
+    if (bench->pool)
+        pj_pool_release(bench->pool);
+
+    if (bench->med_endpt)
+    {
+        pjmedia_endpt_destroy(bench->med_endpt);
+        pj_caching_pool_destroy(&bench->cp);
+    }
+
+    pj_shutdown();
+
+    return;
+}
+
+/* Two tone signal, so that neither encoder sees silence */
+static pj_status_t fill_input(bench_t *bench)
+{
+    pj_status_t status;
+    pjmedia_port *tonegen = NULL;
+    pjmedia_tone_desc tone;
+    pjmedia_frame frame;
+
+    status = pjmedia_tonegen_create(bench->pool, CLOCK_RATE, NCHANNELS, SAMPLES_PER_FRAME, BITS_PER_SAMPLE,
+                                    PJMEDIA_TONEGEN_LOOP, &tonegen);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    pj_bzero(&tone, sizeof(tone));
+    tone.freq1 = TONE_FREQ1;
+    tone.freq2 = TONE_FREQ2;
+    tone.on_msec = TONE_ON_MSEC;
+    tone.off_msec = TONE_OFF_MSEC;
+
+    status = pjmedia_tonegen_play(tonegen, 1, &tone, 0);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    for (unsigned i = 0; i < INPUT_FRAMES; i++)
+    {
+        pj_bzero(&frame, sizeof(frame));
+        frame.buf = bench->input[i];
+        frame.size = sizeof(bench->input[i]);
+
+        status = pjmedia_port_get_frame(tonegen, &frame);
+        if (status != PJ_SUCCESS)
+            goto _exit;
+    }
+
+_exit:
+    if (tonegen)
+        pjmedia_port_destroy(tonegen);
+
+    return status;
+}
+
+static pj_status_t codec_open(bench_t *bench, const char *id, pjmedia_codec **p_codec)
+{
+    pj_status_t status;
+    pjmedia_codec_mgr *mgr = pjmedia_endpt_get_codec_mgr(bench->med_endpt);
+    const pjmedia_codec_info *info;
+    pjmedia_codec_param param;
+    pjmedia_codec *codec = NULL;
+    pj_str_t codec_id = pj_str((char *)id);
+    unsigned count = 1;
+
+    status = pjmedia_codec_mgr_find_codecs_by_id(mgr, &codec_id, &count, &info, NULL);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    status = pjmedia_codec_mgr_get_default_param(mgr, info, &param);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    /* Encoder cost only, as the stream of the auto answer has it */
+    param.setting.vad = 0;
+    param.setting.plc = 0;
+
+    status = pjmedia_codec_mgr_alloc_codec(mgr, info, &codec);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    status = pjmedia_codec_init(codec, bench->pool);
+    if (status == PJ_SUCCESS)
+        status = pjmedia_codec_open(codec, &param);
+
+    if (status != PJ_SUCCESS)
+    {
+        pjmedia_codec_mgr_dealloc_codec(mgr, codec);
+        goto _exit;
+    }
+
+    *p_codec = codec;
+
+_exit:
+    if (status != PJ_SUCCESS)
+        PJ_LOG(1, (THIS_FILE, "Unable to open codec %s: %d", id, status));
+
+    return status;
+}
+
+static void codec_release(bench_t *bench, pjmedia_codec *codec)
+{
+    pjmedia_codec_close(codec);
+    pjmedia_codec_mgr_dealloc_codec(pjmedia_endpt_get_codec_mgr(bench->med_endpt), codec);
+
+    return;
+}
+
+static pj_status_t encode(pjmedia_codec *codec, pj_int16_t *samples, unsigned count)
+{
+    static pj_uint8_t out_buf[OUT_BUF_SIZE];
+    pjmedia_frame in_frame;
+    pjmedia_frame out_frame;
+
+    pj_bzero(&in_frame, sizeof(in_frame));
+    in_frame.type = PJMEDIA_FRAME_TYPE_AUDIO;
+    in_frame.buf = samples;
+    in_frame.size = count * sizeof(pj_int16_t);
+
+    pj_bzero(&out_frame, sizeof(out_frame));
+    out_frame.buf = out_buf;
+
+    return pjmedia_codec_encode(codec, &in_frame, sizeof(out_buf), &out_frame);
+}
+
+static pj_status_t bench_g722(bench_t *bench, pj_uint64_t *nsec)
+{
+    pj_status_t status;
+    pjmedia_codec *codec;
+    pj_timestamp start, stop;
+
+    status = codec_open(bench, "G722/16000", &codec);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    pj_get_timestamp(&start);
+    for (unsigned i = 0; (i < bench->frame_cnt) && (status == PJ_SUCCESS); i++)
+    {
+        status = encode(codec, bench->input[i % INPUT_FRAMES], SAMPLES_PER_FRAME);
+    }
+    pj_get_timestamp(&stop);
+
+    *nsec = pj_elapsed_nanosec(&start, &stop);
+    codec_release(bench, codec);
+
+_exit:
+    return status;
+}
+
+static pj_status_t bench_g711_resample(bench_t *bench, pj_uint64_t *nsec)
+{
+    pj_status_t status;
+    pjmedia_codec *codec;
+    pjmedia_resample *resample;
+    pj_int16_t narrow[G711_SAMPLES_PER_FRAME];
+    pj_timestamp start, stop;
+
+    status = pjmedia_resample_create(bench->pool, RESAMPLE_HIGH_QUALITY, RESAMPLE_LARGE_FILTER, NCHANNELS,
+                                     CLOCK_RATE, G711_CLOCK_RATE, SAMPLES_PER_FRAME, &resample);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    status = codec_open(bench, "PCMU/8000", &codec);
+    if (status != PJ_SUCCESS)
+    {
+        pjmedia_resample_destroy(resample);
+        goto _exit;
+    }
+
+    pj_get_timestamp(&start);
+    for (unsigned i = 0; (i < bench->frame_cnt) && (status == PJ_SUCCESS); i++)
+    {
+        pjmedia_resample_run(resample, bench->input[i % INPUT_FRAMES], narrow);
+        status = encode(codec, narrow, G711_SAMPLES_PER_FRAME);
+    }
+    pj_get_timestamp(&stop);
+
+    *nsec = pj_elapsed_nanosec(&start, &stop);
+    codec_release(bench, codec);
+    pjmedia_resample_destroy(resample);
+
+_exit:
+    return status;
+}
+
+/* Cost per frame and the number of calls one core could carry */
+static void print_result(const char *name, pj_uint64_t nsec, unsigned frame_cnt)
+{
+    pj_uint64_t frame_nsec = (frame_cnt > 0) ? (nsec / frame_cnt) : 0;
+    pj_uint64_t calls_per_core = (frame_nsec > 0) ? (((pj_uint64_t)FRAME_MSEC * NSEC_IN_MSEC) / frame_nsec) : 0;
+    unsigned long long core_percent_x100 = (frame_nsec * PERCENT * PERCENT) / ((pj_uint64_t)FRAME_MSEC * NSEC_IN_MSEC);
+
+    printf("%-18s %8llu ns/frame  %3llu.%02llu%% of a core per call  ~%llu calls per core\n",
+           name,
+           (unsigned long long)frame_nsec,
+           core_percent_x100 / PERCENT,
+           core_percent_x100 % PERCENT,
+           (unsigned long long)calls_per_core);
+
+    return;
+}
@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "cpu_affinity.h"
+
+#define THIS_FILE                   "cpu_affinity.c"
+#define NODE_CPULIST_PATH           "/sys/devices/system/node/node%d/cpulist"
+#define PATH_SIZE                   64
+#define CPULIST_SIZE                1024
+#define MAX_NUMA_NODES              64      /* Bits of the node mask */
+#define RANGE_SYMBOL                '-'
+#define LIST_SEPARATOR              ','
+#define NUMBER_BASE                 10
+
+struct cpu_affinity_t
+{
+    cpu_set_t                   cpus;
+    pj_bool_t                   is_set;     /* PJ_FALSE - left to the scheduler */
+    int                         node;
+};
+
+static pj_status_t parse_list(const char *list, cpu_set_t *cpus);
+static int first_cpu(const cpu_set_t *cpus);
+static int find_node(int cpu);
+
+pj_status_t cpu_affinity_create(pj_pool_t *pool, const char *list, cpu_affinity_t **p_affinity)
+{
+    pj_status_t status;
+    cpu_affinity_t *affinity;
+
+    affinity = PJ_POOL_ZALLOC_T(pool, cpu_affinity_t);
+    affinity->node = CPU_AFFINITY_NO_NODE;
+
+    status = parse_list(list, &affinity->cpus);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    if (CPU_COUNT(&affinity->cpus) > 0)
+    {
+        affinity->is_set = PJ_TRUE;
+        affinity->node = find_node(first_cpu(&affinity->cpus));
+    }
+
+    *p_affinity = affinity;
+
+_exit:
+    return status;
+}
+
+pj_bool_t cpu_affinity_is_valid(const char *list)
+{
+    cpu_set_t cpus;
+
+    return (parse_list(list, &cpus) == PJ_SUCCESS);
+}
+
+pj_status_t cpu_affinity_apply(const cpu_affinity_t *affinity)
+{
+    pj_status_t status = PJ_SUCCESS;
+
+    if (!affinity->is_set)
+        goto _exit;
+
+    if (sched_setaffinity(0, sizeof(affinity->cpus), &affinity->cpus) != 0)
+    {
+        status = PJ_STATUS_FROM_OS(errno);
+        PJ_LOG(2, (THIS_FILE, "Unable to pin the thread: %s", strerror(errno)));
+    }
+
+_exit:
+    return status;
+}
+
+pj_status_t cpu_affinity_call(const cpu_affinity_t *affinity, pj_status_t (*fn)(void))
+{
+    pj_status_t status;
+    cpu_set_t prev;
+
+    if (!affinity->is_set)
+    {
+        status = (*fn)();
+        goto _exit;
+    }
+
+    if (sched_getaffinity(0, sizeof(prev), &prev) != 0)
+    {
+        status = PJ_STATUS_FROM_OS(errno);
+        goto _exit;
+    }
+
+    cpu_affinity_apply(affinity);
+
+    status = (*fn)();
+
+    sched_setaffinity(0, sizeof(prev), &prev);
+
+_exit:
+    return status;
+}
+
+int cpu_affinity_get_node(const cpu_affinity_t *affinity)
+{
+    return affinity->node;
+}
+
+/* No libnuma: the node mask goes to the system call as it is */
+pj_status_t cpu_affinity_prefer_node(int node)
+{
+    pj_status_t status = PJ_SUCCESS;
+    unsigned long mask;
+    long err;
+
+    if ((node == CPU_AFFINITY_NO_NODE) || (node >= MAX_NUMA_NODES))
+    {
+        err = syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+    }
+    else
+    {
+        mask = 1UL << node;
+        err = syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask, MAX_NUMA_NODES + 1);
+    }
+
+    if (err != 0)
+    {
+        status = PJ_STATUS_FROM_OS(errno);
+        PJ_LOG(2, (THIS_FILE, "Unable to prefer the memory of node %d: %s", node, strerror(errno)));
+    }
+
+    return status;
+}
+
+/* "0-3,8,10-11", a trailing new line of sysfs is allowed */
+static pj_status_t parse_list(const char *list, cpu_set_t *cpus)
+{
+    pj_status_t status = PJ_SUCCESS;
+    const char *pos = list;
+
+    CPU_ZERO(cpus);
+
+    while ((*pos != '\0') && (*pos != '\n'))
+    {
+        char *end;
+        long first;
+        long last;
+
+        first = strtol(pos, &end, NUMBER_BASE);
+        if ((end == pos) || (first < 0) || (first >= CPU_SETSIZE))
+        {
+            status = PJ_EINVAL;
+            goto _exit;
+        }
+
+        last = first;
+        if (*end == RANGE_SYMBOL)
+        {
+            pos = end + 1;
+            last = strtol(pos, &end, NUMBER_BASE);
+            if ((end == pos) || (last < first) || (last >= CPU_SETSIZE))
+            {
+                status = PJ_EINVAL;
+                goto _exit;
+            }
+        }
+
+        for (long cpu = first; cpu <= last; cpu++)
+        {
+            CPU_SET((int)cpu, cpus);
+        }
+
+        if (*end == LIST_SEPARATOR)
+        {
+            end++;
+        }
+        else if ((*end != '\0') && (*end != '\n'))
+        {
+            status = PJ_EINVAL;
+            goto _exit;
+        }
+
+        pos = end;
+    }
+
+_exit:
+    return status;
+}
+
+static int first_cpu(const cpu_set_t *cpus)
+{
+    int cpu;
+
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, cpus))
+            break;
+    }
+
+    return cpu;
+}
+
+/* The node whose cpulist in sysfs has the CPU, none on a box without NUMA */
+static int find_node(int cpu)
+{
+    int node = CPU_AFFINITY_NO_NODE;
+
+    for (int i = 0; (i < MAX_NUMA_NODES) && (node == CPU_AFFINITY_NO_NODE); i++)
+    {
+        char path[PATH_SIZE];
+        char list[CPULIST_SIZE];
+        cpu_set_t cpus;
+        FILE *file;
+
+        snprintf(path, sizeof(path), NODE_CPULIST_PATH, i);
+        file = fopen(path, "r");
+        if (file == NULL)
+            continue;
+
+        if ((fgets(list, sizeof(list), file) != NULL)
+            && (parse_list(list, &cpus) == PJ_SUCCESS)
+            && CPU_ISSET(cpu, &cpus))
+        {
+            node = i;
+        }
+
+        fclose(file);
+    }
+
+    return node;
+}
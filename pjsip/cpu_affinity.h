@@ -0,0 +1,36 @@
+#ifndef _AUTO_ANSWER_CPU_AFFINITY_H_
+#define _AUTO_ANSWER_CPU_AFFINITY_H_
+
+#include <pjlib.h>
+
+#define CPU_AFFINITY_NO_NODE        -1
+
+typedef struct cpu_affinity_t cpu_affinity_t;
+
+/* CPUs of a thread role from a list in the cpulist format of the kernel,
+ * e.g. "0-3,8,10-11", and the NUMA node of the first of them. An empty
+ * list leaves the role to the scheduler. PJ_EINVAL for a malformed list
+ */
+pj_status_t cpu_affinity_create(pj_pool_t *pool, const char *list, cpu_affinity_t **p_affinity);
+
+/* Check of a list from the config file */
+pj_bool_t cpu_affinity_is_valid(const char *list);
+
+/* Pin the calling thread for good */
+pj_status_t cpu_affinity_apply(const cpu_affinity_t *affinity);
+
+/* Call fn with the calling thread pinned and restore its CPUs after. The
+ * threads fn creates inherit the set: this is how the threads of pjmedia
+ * are placed
+ */
+pj_status_t cpu_affinity_call(const cpu_affinity_t *affinity, pj_status_t (*fn)(void));
+
+int cpu_affinity_get_node(const cpu_affinity_t *affinity);
+
+/* Pages first touched by the calling thread, and by the threads it
+ * creates afterwards, come from the node while it has free memory.
+ * CPU_AFFINITY_NO_NODE returns to the default local allocation
+ */
+pj_status_t cpu_affinity_prefer_node(int node);
+
+#endif /* _AUTO_ANSWER_CPU_AFFINITY_H_ */
@@ -0,0 +1,257 @@
+/* G.711 kernels of g711_simd.c: bit exactness against the pjmedia
+ * routines for every sample value and every code, then the cost of a
+ * 20 ms frame for both. Exits with 1 on the first mismatch.
+ *
+ *   ./g711_bench [seconds of audio]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <pjmedia.h>
+#include <pjlib.h>
+
+#include "g711_simd.h"
+
+#define THIS_FILE                   "g711_bench.c"
+#define CLOCK_RATE                  8000
+#define FRAME_MSEC                  20
+#define MSEC_IN_SEC                 1000
+#define NSEC_IN_MSEC                1000000
+#define SAMPLES_PER_FRAME           (CLOCK_RATE * FRAME_MSEC / MSEC_IN_SEC)
+#define DEFAULT_SECONDS             3600
+#define INPUT_FRAMES                50      /* One second is looped */
+#define SAMPLE_CNT                  65536   /* Every pj_int16_t */
+#define CODE_CNT                    256
+#define TAIL_SAMPLES                7       /* Not a multiple of any vector step */
+#define RAND_SEED                   711
+#define PERCENT                     100
+
+typedef enum
+{
+    eKERNEL_ULAW_ENCODE,
+    eKERNEL_ALAW_ENCODE,
+    eKERNEL_ULAW_DECODE,
+    eKERNEL_ALAW_DECODE,
+    eKERNEL_COUNT
+} kernel_e;
+
+typedef struct bench_t
+{
+    pj_int16_t                  input[INPUT_FRAMES][SAMPLES_PER_FRAME];
+    pj_uint8_t                  coded[INPUT_FRAMES][SAMPLES_PER_FRAME];
+    unsigned                    frame_cnt;
+} bench_t;
+
+static const char *kKERNEL_NAMES[eKERNEL_COUNT] =
+{
+    "u-law encode",
+    "A-law encode",
+    "u-law decode",
+    "A-law decode",
+};
+
+static int check_encode(void);
+static int check_decode(void);
+static void fill_input(bench_t *bench);
+static void run_kernel(bench_t *bench, kernel_e kernel, pj_bool_t simd, pj_uint64_t *nsec);
+static void print_result(const char *name, pj_uint64_t ref_nsec, pj_uint64_t simd_nsec, unsigned frame_cnt);
+
+int main(int argc, char *argv[])
+{
+    static bench_t bench;
+    pj_status_t status;
+    unsigned seconds = DEFAULT_SECONDS;
+    int mismatch_cnt;
+
+    if (argc > 1)
+        seconds = (unsigned)atoi(argv[1]);
+
+    bench.frame_cnt = seconds * (MSEC_IN_SEC / FRAME_MSEC);
+
+    status = pj_init();
+    if (status != PJ_SUCCESS)
+        return 1;
+
+    g711_simd_init();
+    printf("G.711 kernels: %s\n", g711_simd_isa());
+
+    mismatch_cnt = check_encode() + check_decode();
+    if (mismatch_cnt > 0)
+    {
+        printf("%d mismatches against pjmedia\n", mismatch_cnt);
+        goto _exit;
+    }
+    printf("bit exact with pjmedia: %u samples, %u codes\n", SAMPLE_CNT, CODE_CNT);
+
+    fill_input(&bench);
+
+    printf("%u s of %u Hz audio, %u ms frames\n", seconds, CLOCK_RATE, FRAME_MSEC);
+    for (int k = 0; k < eKERNEL_COUNT; k++)
+    {
+        pj_uint64_t ref_nsec = 0;
+        pj_uint64_t simd_nsec = 0;
+
+        run_kernel(&bench, (kernel_e)k, PJ_FALSE, &ref_nsec);
+        run_kernel(&bench, (kernel_e)k, PJ_TRUE, &simd_nsec);
+        print_result(kKERNEL_NAMES[k], ref_nsec, simd_nsec, bench.frame_cnt);
+    }
+
+_exit:
+    pj_shutdown();
+
+    return (mismatch_cnt == 0) ? 0 : 1;
+}
+
+/* Every sample value, in one buffer with a tail for the scalar code */
+static int check_encode(void)
+{
+    static pj_int16_t samples[SAMPLE_CNT + TAIL_SAMPLES];
+    static pj_uint8_t ulaw[SAMPLE_CNT + TAIL_SAMPLES];
+    static pj_uint8_t alaw[SAMPLE_CNT + TAIL_SAMPLES];
+    int mismatch_cnt = 0;
+
+    for (unsigned i = 0; i < SAMPLE_CNT + TAIL_SAMPLES; i++)
+    {
+        samples[i] = (pj_int16_t)(i % SAMPLE_CNT);
+    }
+
+    g711_simd_ulaw_encode(ulaw, samples, SAMPLE_CNT + TAIL_SAMPLES);
+    g711_simd_alaw_encode(alaw, samples, SAMPLE_CNT + TAIL_SAMPLES);
+
+    for (unsigned i = 0; i < SAMPLE_CNT + TAIL_SAMPLES; i++)
+    {
+        if (ulaw[i] != (pj_uint8_t)pjmedia_linear2ulaw(samples[i]))
+        {
+            printf("u-law encode of %d: 0x%02X, pjmedia 0x%02X\n",
+                   samples[i], ulaw[i], (pj_uint8_t)pjmedia_linear2ulaw(samples[i]));
+            mismatch_cnt++;
+        }
+
+        if (alaw[i] != (pj_uint8_t)pjmedia_linear2alaw(samples[i]))
+        {
+            printf("A-law encode of %d: 0x%02X, pjmedia 0x%02X\n",
+                   samples[i], alaw[i], (pj_uint8_t)pjmedia_linear2alaw(samples[i]));
+            mismatch_cnt++;
+        }
+    }
+
+    return mismatch_cnt;
+}
+
+static int check_decode(void)
+{
+    pj_uint8_t codes[CODE_CNT + TAIL_SAMPLES];
+    pj_int16_t ulaw[CODE_CNT + TAIL_SAMPLES];
+    pj_int16_t alaw[CODE_CNT + TAIL_SAMPLES];
+    int mismatch_cnt = 0;
+
+    for (unsigned i = 0; i < CODE_CNT + TAIL_SAMPLES; i++)
+    {
+        codes[i] = (pj_uint8_t)(i % CODE_CNT);
+    }
+
+    g711_simd_ulaw_decode(ulaw, codes, CODE_CNT + TAIL_SAMPLES);
+    g711_simd_alaw_decode(alaw, codes, CODE_CNT + TAIL_SAMPLES);
+
+    for (unsigned i = 0; i < CODE_CNT + TAIL_SAMPLES; i++)
+    {
+        if (ulaw[i] != (pj_int16_t)pjmedia_ulaw2linear(codes[i]))
+        {
+            printf("u-law decode of 0x%02X: %d, pjmedia %d\n",
+                   codes[i], ulaw[i], (pj_int16_t)pjmedia_ulaw2linear(codes[i]));
+            mismatch_cnt++;
+        }
+
+        if (alaw[i] != (pj_int16_t)pjmedia_alaw2linear(codes[i]))
+        {
+            printf("A-law decode of 0x%02X: %d, pjmedia %d\n",
+                   codes[i], alaw[i], (pj_int16_t)pjmedia_alaw2linear(codes[i]));
+            mismatch_cnt++;
+        }
+    }
+
+    return mismatch_cnt;
+}
+
+/* Noise over the whole range, so that every segment is taken */
+static void fill_input(bench_t *bench)
+{
+    srand(RAND_SEED);
+
+    for (unsigned i = 0; i < INPUT_FRAMES; i++)
+    {
+        for (unsigned j = 0; j < SAMPLES_PER_FRAME; j++)
+        {
+            bench->input[i][j] = (pj_int16_t)(rand() % SAMPLE_CNT);
+            bench->coded[i][j] = (pj_uint8_t)(rand() % CODE_CNT);
+        }
+    }
+
+    return;
+}
+
+/* The reference is the pjmedia routine called per sample, as the pjmedia codec does */
+static void run_kernel(bench_t *bench, kernel_e kernel, pj_bool_t simd, pj_uint64_t *nsec)
+{
+    static pj_uint8_t coded_out[SAMPLES_PER_FRAME];
+    static pj_int16_t pcm_out[SAMPLES_PER_FRAME];
+    pj_timestamp start, stop;
+
+    pj_get_timestamp(&start);
+    for (unsigned i = 0; i < bench->frame_cnt; i++)
+    {
+        const pj_int16_t *pcm = bench->input[i % INPUT_FRAMES];
+        const pj_uint8_t *coded = bench->coded[i % INPUT_FRAMES];
+
+        switch (kernel)
+        {
+            case eKERNEL_ULAW_ENCODE:
+                if (simd)
+                    g711_simd_ulaw_encode(coded_out, pcm, SAMPLES_PER_FRAME);
+                else
+                    pjmedia_ulaw_encode(coded_out, pcm, SAMPLES_PER_FRAME);
+                break;
+            case eKERNEL_ALAW_ENCODE:
+                if (simd)
+                    g711_simd_alaw_encode(coded_out, pcm, SAMPLES_PER_FRAME);
+                else
+                    pjmedia_alaw_encode(coded_out, pcm, SAMPLES_PER_FRAME);
+                break;
+            case eKERNEL_ULAW_DECODE:
+                if (simd)
+                    g711_simd_ulaw_decode(pcm_out, coded, SAMPLES_PER_FRAME);
+                else
+                    pjmedia_ulaw_decode(pcm_out, coded, SAMPLES_PER_FRAME);
+                break;
+            case eKERNEL_ALAW_DECODE:
+            default:
+                if (simd)
+                    g711_simd_alaw_decode(pcm_out, coded, SAMPLES_PER_FRAME);
+                else
+                    pjmedia_alaw_decode(pcm_out, coded, SAMPLES_PER_FRAME);
+                break;
+        }
+    }
+    pj_get_timestamp(&stop);
+
+    *nsec = pj_elapsed_nanosec(&start, &stop);
+
+    return;
+}
+
+static void print_result(const char *name, pj_uint64_t ref_nsec, pj_uint64_t simd_nsec, unsigned frame_cnt)
+{
+    pj_uint64_t ref_frame_nsec = (frame_cnt > 0) ? (ref_nsec / frame_cnt) : 0;
+    pj_uint64_t simd_frame_nsec = (frame_cnt > 0) ? (simd_nsec / frame_cnt) : 0;
+    unsigned long long speedup_x100 = (simd_nsec > 0) ? ((ref_nsec * PERCENT) / simd_nsec) : 0;
+
+    printf("%-14s pjmedia %6llu ns/frame  %s %6llu ns/frame  x%llu.%02llu\n",
+           name,
+           (unsigned long long)ref_frame_nsec,
+           g711_simd_isa(),
+           (unsigned long long)simd_frame_nsec,
+           speedup_x100 / PERCENT,
+           speedup_x100 % PERCENT);
+
+    return;
+}
@@ -0,0 +1,469 @@
+#include "g711_simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define G711_SIMD_X86               1
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#define G711_SIMD_NEON              1
+#include <arm_neon.h>
+#endif
+
+#define ISA_SCALAR                  "scalar"
+#define ISA_AVX2                    "avx2"
+#define ISA_NEON                    "neon"
+#define ULAW_BIAS                   0x84
+#define ULAW_CLIP                   8159        /* Of the sample >> 2 */
+#define ULAW_MAX                    0x1FFF      /* Biased, the clipped ones give 0x7F too */
+#define ALAW_SEG0_BIAS              8
+#define ALAW_BIAS                   0x108
+#define SIGN_BIT                    0x80
+#define ULAW_POS_MASK               0xFF
+#define ALAW_POS_MASK               0xD5
+#define MANT_MASK                   0x0F
+#define SEG_MASK                    0x07
+#define SEG_SHIFT                   4
+#define AVX2_STEP                   16
+#define NEON_STEP                   8
+
+typedef struct g711_kernels_t
+{
+    const char                  *isa;
+    void                        (*ulaw_encode)(pj_uint8_t *dst, const pj_int16_t *src, unsigned cnt);
+    void                        (*alaw_encode)(pj_uint8_t *dst, const pj_int16_t *src, unsigned cnt);
+    void                        (*ulaw_decode)(pj_int16_t *dst, const pj_uint8_t *src, unsigned cnt);
+    void                        (*alaw_decode)(pj_int16_t *dst, const pj_uint8_t *src, unsigned cnt);
+} g711_kernels_t;
+
+static void scalar_ulaw_encode(pj_uint8_t *dst, const pj_int16_t *src, unsigned cnt);
+static void scalar_alaw_encode(pj_uint8_t *dst, const pj_int16_t *src, unsigned cnt);
+static void scalar_ulaw_decode(pj_int16_t *dst, const pj_uint8_t *src, unsigned cnt);
+static void scalar_alaw_decode(pj_int16_t *dst, const pj_uint8_t *src, unsigned cnt);
+
+static g711_kernels_t kernels =
+{
+    ISA_SCALAR,
+    &scalar_ulaw_encode,
+    &scalar_alaw_encode,
+    &scalar_ulaw_decode,
+    &scalar_alaw_decode,
+};
+
+/* The reference itself, also the tails of the vector kernels */
+static void scalar_ulaw_encode(pj_uint8_t *dst, const pj_int16_t *src, unsigned cnt)
+{
+    for (unsigned i = 0; i < cnt; i++)
+    {
+        dst[i] = (pj_uint8_t)pjmedia_linear2ulaw(src[i]);
+    }
+
+    return;
+}
+
+static void scalar_alaw_encode(pj_uint8_t *dst, const pj_int16_t *src, unsigned cnt)
+{
+    for (unsigned i = 0; i < cnt; i++)
+    {
+        dst[i] = (pj_uint8_t)pjmedia_linear2alaw(src[i]);
+    }
+
+    return;
+}
+
+static void scalar_ulaw_decode(pj_int16_t *dst, const pj_uint8_t *src, unsigned cnt)
+{
+    for (unsigned i = 0; i < cnt; i++)
+    {
+        dst[i] = (pj_int16_t)pjmedia_ulaw2linear(src[i]);
+    }
+
+    return;
+}
+
+static void scalar_alaw_decode(pj_int16_t *dst, const pj_uint8_t *src, unsigned cnt)
+{
+    for (unsigned i = 0; i < cnt; i++)
+    {
+        dst[i] = (pj_int16_t)pjmedia_alaw2linear(src[i]);
+    }
+
+    return;
+}
+
+#if defined(G711_SIMD_X86)
+
+/* The kernels are built for AVX2 whatever -march says and only called
+ * when the CPU has it. No 16-bit variable shifts in AVX2: a right shift
+ * by the segment is a high multiply by a power of two, a left shift a low
+ * multiply; the powers are looked up by the segment with a byte shuffle
+ */
+#define AVX2_TARGET                 __attribute__((target("avx2")))
+
+/* 16 words into 16 bytes in order, the words fit a byte */
+static AVX2_TARGET __m128i avx2_pack_bytes(__m256i words)
+{
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(words, words), 0xD8);
+
+    return _mm256_castsi256_si128(packed);
+}
+
+/* Number of segment ends below v. The compares are independent and added
+ * up as a tree, each gives -1 where v is above the end
+ */
+static AVX2_TARGET __m256i avx2_segment(__m256i v, const __m256i ends[SEG_MASK])
+{
+    __m256i sum01 = _mm256_add_epi16(_mm256_cmpgt_epi16(v, ends[0]), _mm256_cmpgt_epi16(v, ends[1]));
+    __m256i sum23 = _mm256_add_epi16(_mm256_cmpgt_epi16(v, ends[2]), _mm256_cmpgt_epi16(v, ends[3]));
+    __m256i sum45 = _mm256_add_epi16(_mm256_cmpgt_epi16(v, ends[4]), _mm256_cmpgt_epi16(v, ends[5]));
+    __m256i sum = _mm256_add_epi16(_mm256_add_epi16(sum01, sum23),
+                                   _mm256_add_epi16(sum45, _mm256_cmpgt_epi16(v, ends[6])));
+
+    return _mm256_sub_epi16(_mm256_setzero_si256(), sum);
+}
+
+/* table[seg] << 8 in each word: the high byte index is seg, the low one
+ * has the top bit set and reads zero
+ */
+static AVX2_TARGET __m256i avx2_lookup_high(__m256i table, __m256i seg)
+{
+    return _mm256_shuffle_epi8(table, _mm256_or_si256(_mm256_slli_epi16(seg, 8), _mm256_set1_epi16(0x80)));
+}
+
+static AVX2_TARGET void avx2_ulaw_encode(pj_uint8_t *dst, const pj_int16_t *src, unsigned cnt)
+{
+    /* >> (seg + 1) as a high multiply by 1 << (15 - seg) */
+    const __m256i mul_high = _mm256_setr_epi8((char)0x80, 0x40, 0x20, 0x10, 8, 4, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0,
+                                              (char)0x80, 0x40, 0x20, 0x10, 8, 4, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i ends[SEG_MASK] =
+    {
+        _mm256_set1_epi16(0x3F), _mm256_set1_epi16(0x7F), _mm256_set1_epi16(0xFF), _mm256_set1_epi16(0x1FF),
+        _mm256_set1_epi16(0x3FF), _mm256_set1_epi16(0x7FF), _mm256_set1_epi16(0xFFF),
+    };
+    const __m256i clip = _mm256_set1_epi16(ULAW_CLIP);
+    const __m256i bias = _mm256_set1_epi16(ULAW_BIAS >> 2);
+    const __m256i max = _mm256_set1_epi16(ULAW_MAX);
+    const __m256i mant_mask = _mm256_set1_epi16(MANT_MASK);
+    const __m256i pos_mask = _mm256_set1_epi16(ULAW_POS_MASK);
+    const __m256i sign_bit = _mm256_set1_epi16(SIGN_BIT);
+    unsigned i = 0;
+
+    for (; i + AVX2_STEP <= cnt; i += AVX2_STEP)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i neg = _mm256_srai_epi16(x, 15);
+        __m256i v = _mm256_abs_epi16(_mm256_srai_epi16(x, 2));
+        __m256i seg;
+        __m256i code;
+
+        v = _mm256_min_epi16(_mm256_add_epi16(_mm256_min_epi16(v, clip), bias), max);
+        seg = avx2_segment(v, ends);
+
+        code = _mm256_mulhi_epu16(v, avx2_lookup_high(mul_high, seg));
+        code = _mm256_or_si256(_mm256_slli_epi16(seg, SEG_SHIFT), _mm256_and_si256(code, mant_mask));
+        code = _mm256_xor_si256(code, _mm256_xor_si256(pos_mask, _mm256_and_si256(neg, sign_bit)));
+
+        _mm_storeu_si128((__m128i *)(dst + i), avx2_pack_bytes(code));
+    }
+
+    scalar_ulaw_encode(dst + i, src + i, cnt - i);
+
+    return;
+}
+
+static AVX2_TARGET void avx2_alaw_encode(pj_uint8_t *dst, const pj_int16_t *src, unsigned cnt)
+{
+    /* >> 1 for the first two segments, >> seg from then on */
+    const __m256i mul_high = _mm256_setr_epi8((char)0x80, (char)0x80, 0x40, 0x20, 0x10, 8, 4, 2, 0, 0, 0, 0, 0, 0, 0, 0,
+                                              (char)0x80, (char)0x80, 0x40, 0x20, 0x10, 8, 4, 2, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i ends[SEG_MASK] =
+    {
+        _mm256_set1_epi16(0x1F), _mm256_set1_epi16(0x3F), _mm256_set1_epi16(0x7F), _mm256_set1_epi16(0xFF),
+        _mm256_set1_epi16(0x1FF), _mm256_set1_epi16(0x3FF), _mm256_set1_epi16(0x7FF),
+    };
+    const __m256i mant_mask = _mm256_set1_epi16(MANT_MASK);
+    const __m256i pos_mask = _mm256_set1_epi16(ALAW_POS_MASK);
+    const __m256i sign_bit = _mm256_set1_epi16(SIGN_BIT);
+    unsigned i = 0;
+
+    for (; i + AVX2_STEP <= cnt; i += AVX2_STEP)
+    {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i neg = _mm256_srai_epi16(x, 15);
+        __m256i v = _mm256_xor_si256(_mm256_srai_epi16(x, 3), neg);   /* -x - 1 for the negative */
+        __m256i seg = avx2_segment(v, ends);
+        __m256i code;
+
+        code = _mm256_mulhi_epu16(v, avx2_lookup_high(mul_high, seg));
+        code = _mm256_or_si256(_mm256_slli_epi16(seg, SEG_SHIFT), _mm256_and_si256(code, mant_mask));
+        code = _mm256_xor_si256(code, _mm256_xor_si256(pos_mask, _mm256_and_si256(neg, sign_bit)));
+
+        _mm_storeu_si128((__m128i *)(dst + i), avx2_pack_bytes(code));
+    }
+
+    scalar_alaw_encode(dst + i, src + i, cnt - i);
+
+    return;
+}
+
+/* 1 << n for n in the low byte of each word, the high byte index has the
+ * top bit set and reads zero
+ */
+static AVX2_TARGET __m256i avx2_pow2(__m256i table, __m256i n)
+{
+    return _mm256_shuffle_epi8(table, _mm256_or_si256(n, _mm256_set1_epi16((short)0x8000)));
+}
+
+static AVX2_TARGET void avx2_ulaw_decode(pj_int16_t *dst, const pj_uint8_t *src, unsigned cnt)
+{
+    const __m256i pow2 = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0,
+                                          1, 2, 4, 8, 16, 32, 64, (char)128, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i byte_mask = _mm256_set1_epi16(0xFF);
+    const __m256i mant_mask = _mm256_set1_epi16(MANT_MASK);
+    const __m256i seg_mask = _mm256_set1_epi16(SEG_MASK);
+    const __m256i sign_bit = _mm256_set1_epi16(SIGN_BIT);
+    const __m256i bias = _mm256_set1_epi16(ULAW_BIAS);
+    unsigned i = 0;
+
+    for (; i + AVX2_STEP <= cnt; i += AVX2_STEP)
+    {
+        __m256i u = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src + i)));
+        __m256i t;
+        __m256i neg;
+
+        u = _mm256_andnot_si256(u, byte_mask);
+        t = _mm256_add_epi16(_mm256_slli_epi16(_mm256_and_si256(u, mant_mask), 3), bias);
+        t = _mm256_mullo_epi16(t, avx2_pow2(pow2, _mm256_and_si256(_mm256_srli_epi16(u, SEG_SHIFT), seg_mask)));
+        t = _mm256_sub_epi16(t, bias);
+
+        neg = _mm256_cmpeq_epi16(_mm256_and_si256(u, sign_bit), sign_bit);
+        t = _mm256_sub_epi16(_mm256_xor_si256(t, neg), neg);
+
+        _mm256_storeu_si256((__m256i *)(dst + i), t);
+    }
+
+    scalar_ulaw_decode(dst + i, src + i, cnt - i);
+
+    return;
+}
+
+static AVX2_TARGET void avx2_alaw_decode(pj_int16_t *dst, const pj_uint8_t *src, unsigned cnt)
+{
+    /* The first two segments are not shifted */
+    const __m256i pow2 = _mm256_setr_epi8(1, 1, 2, 4, 8, 16, 32, 64, 0, 0, 0, 0, 0, 0, 0, 0,
+                                          1, 1, 2, 4, 8, 16, 32, 64, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i pos_mask = _mm256_set1_epi16(ALAW_POS_MASK ^ SIGN_BIT);
+    const __m256i mant_mask = _mm256_set1_epi16(MANT_MASK);
+    const __m256i seg_mask = _mm256_set1_epi16(SEG_MASK);
+    const __m256i sign_bit = _mm256_set1_epi16(SIGN_BIT);
+    const __m256i seg0_bias = _mm256_set1_epi16(ALAW_SEG0_BIAS);
+    const __m256i bias = _mm256_set1_epi16(ALAW_BIAS);
+    const __m256i zero = _mm256_setzero_si256();
+    unsigned i = 0;
+
+    for (; i + AVX2_STEP <= cnt; i += AVX2_STEP)
+    {
+        __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(src + i)));
+        __m256i seg;
+        __m256i t;
+        __m256i neg;
+
+        a = _mm256_xor_si256(a, pos_mask);
+        seg = _mm256_and_si256(_mm256_srli_epi16(a, SEG_SHIFT), seg_mask);
+        t = _mm256_slli_epi16(_mm256_and_si256(a, mant_mask), SEG_SHIFT);
+        t = _mm256_add_epi16(t, _mm256_blendv_epi8(bias, seg0_bias, _mm256_cmpeq_epi16(seg, zero)));
+        t = _mm256_mullo_epi16(t, avx2_pow2(pow2, seg));
+
+        /* Sign bit clear after the XOR is a negative sample */
+        neg = _mm256_cmpeq_epi16(_mm256_and_si256(a, sign_bit), zero);
+        t = _mm256_sub_epi16(_mm256_xor_si256(t, neg), neg);
+
+        _mm256_storeu_si256((__m256i *)(dst + i), t);
+    }
+
+    scalar_alaw_decode(dst + i, src + i, cnt - i);
+
+    return;
+}
+
+#elif defined(G711_SIMD_NEON)
+
+/* NEON has per lane shifts and a leading zero count on 16-bit lanes, the
+ * segment is the bit length of the biased magnitude
+ */
+static void neon_ulaw_encode(pj_uint8_t *dst, const pj_int16_t *src, unsigned cnt)
+{
+    const int16x8_t clip = vdupq_n_s16(ULAW_CLIP);
+    const int16x8_t bias = vdupq_n_s16(ULAW_BIAS >> 2);
+    const uint16x8_t max = vdupq_n_u16(ULAW_MAX);
+    const uint16x8_t bitlen_seg0 = vdupq_n_u16(16 - 6);    /* 0x21..0x3F have 6 bits */
+    const uint16x8_t one = vdupq_n_u16(1);
+    const uint16x8_t mant_mask = vdupq_n_u16(MANT_MASK);
+    const uint16x8_t pos_mask = vdupq_n_u16(ULAW_POS_MASK);
+    const uint16x8_t sign_bit = vdupq_n_u16(SIGN_BIT);
+    unsigned i = 0;
+
+    for (; i + NEON_STEP <= cnt; i += NEON_STEP)
+    {
+        int16x8_t x = vld1q_s16(src + i);
+        uint16x8_t neg = vreinterpretq_u16_s16(vshrq_n_s16(x, 15));
+        int16x8_t mag = vaddq_s16(vminq_s16(vabsq_s16(vshrq_n_s16(x, 2)), clip), bias);
+        uint16x8_t v = vminq_u16(vreinterpretq_u16_s16(mag), max);
+        uint16x8_t seg = vsubq_u16(bitlen_seg0, vclzq_u16(v));
+        int16x8_t shift = vnegq_s16(vreinterpretq_s16_u16(vaddq_u16(seg, one)));
+        uint16x8_t code;
+
+        code = vorrq_u16(vshlq_n_u16(seg, SEG_SHIFT), vandq_u16(vshlq_u16(v, shift), mant_mask));
+        code = veorq_u16(code, veorq_u16(pos_mask, vandq_u16(neg, sign_bit)));
+
+        vst1_u8(dst + i, vmovn_u16(code));
+    }
+
+    scalar_ulaw_encode(dst + i, src + i, cnt - i);
+
+    return;
+}
+
+static void neon_alaw_encode(pj_uint8_t *dst, const pj_int16_t *src, unsigned cnt)
+{
+    const uint16x8_t bitlen_seg0 = vdupq_n_u16(16 - 5);    /* 0..0x1F have up to 5 bits */
+    const uint16x8_t one = vdupq_n_u16(1);
+    const uint16x8_t mant_mask = vdupq_n_u16(MANT_MASK);
+    const uint16x8_t pos_mask = vdupq_n_u16(ALAW_POS_MASK);
+    const uint16x8_t sign_bit = vdupq_n_u16(SIGN_BIT);
+    unsigned i = 0;
+
+    for (; i + NEON_STEP <= cnt; i += NEON_STEP)
+    {
+        int16x8_t x = vld1q_s16(src + i);
+        int16x8_t neg = vshrq_n_s16(x, 15);
+        uint16x8_t v = vreinterpretq_u16_s16(veorq_s16(vshrq_n_s16(x, 3), neg));
+        uint16x8_t seg = vqsubq_u16(bitlen_seg0, vclzq_u16(v));
+        int16x8_t shift = vnegq_s16(vreinterpretq_s16_u16(vmaxq_u16(seg, one)));
+        uint16x8_t code;
+
+        code = vorrq_u16(vshlq_n_u16(seg, SEG_SHIFT), vandq_u16(vshlq_u16(v, shift), mant_mask));
+        code = veorq_u16(code, veorq_u16(pos_mask, vandq_u16(vreinterpretq_u16_s16(neg), sign_bit)));
+
+        vst1_u8(dst + i, vmovn_u16(code));
+    }
+
+    scalar_alaw_encode(dst + i, src + i, cnt - i);
+
+    return;
+}
+
+static void neon_ulaw_decode(pj_int16_t *dst, const pj_uint8_t *src, unsigned cnt)
+{
+    const uint16x8_t mant_mask = vdupq_n_u16(MANT_MASK);
+    const uint16x8_t seg_mask = vdupq_n_u16(SEG_MASK);
+    const uint16x8_t sign_bit = vdupq_n_u16(SIGN_BIT);
+    const uint16x8_t bias = vdupq_n_u16(ULAW_BIAS);
+    unsigned i = 0;
+
+    for (; i + NEON_STEP <= cnt; i += NEON_STEP)
+    {
+        uint16x8_t u = vmovl_u8(vmvn_u8(vld1_u8(src + i)));
+        int16x8_t seg = vreinterpretq_s16_u16(vandq_u16(vshrq_n_u16(u, SEG_SHIFT), seg_mask));
+        uint16x8_t t = vaddq_u16(vshlq_n_u16(vandq_u16(u, mant_mask), 3), bias);
+        int16x8_t pcm;
+
+        t = vsubq_u16(vshlq_u16(t, seg), bias);
+        pcm = vreinterpretq_s16_u16(t);
+        pcm = vbslq_s16(vtstq_u16(u, sign_bit), vnegq_s16(pcm), pcm);
+
+        vst1q_s16(dst + i, pcm);
+    }
+
+    scalar_ulaw_decode(dst + i, src + i, cnt - i);
+
+    return;
+}
+
+static void neon_alaw_decode(pj_int16_t *dst, const pj_uint8_t *src, unsigned cnt)
+{
+    const uint8x8_t pos_mask = vdup_n_u8(ALAW_POS_MASK ^ SIGN_BIT);
+    const uint16x8_t mant_mask = vdupq_n_u16(MANT_MASK);
+    const uint16x8_t seg_mask = vdupq_n_u16(SEG_MASK);
+    const uint16x8_t sign_bit = vdupq_n_u16(SIGN_BIT);
+    const uint16x8_t seg0_bias = vdupq_n_u16(ALAW_SEG0_BIAS);
+    const uint16x8_t seg_bias = vdupq_n_u16(ALAW_BIAS - ALAW_SEG0_BIAS);
+    const uint16x8_t one = vdupq_n_u16(1);
+    unsigned i = 0;
+
+    for (; i + NEON_STEP <= cnt; i += NEON_STEP)
+    {
+        uint16x8_t a = vmovl_u8(veor_u8(vld1_u8(src + i), pos_mask));
+        uint16x8_t seg = vandq_u16(vshrq_n_u16(a, SEG_SHIFT), seg_mask);
+        uint16x8_t t = vaddq_u16(vshlq_n_u16(vandq_u16(a, mant_mask), SEG_SHIFT), seg0_bias);
+        int16x8_t pcm;
+
+        /* 0x108 and a shift by seg - 1 from the second segment on */
+        t = vmlaq_u16(t, vminq_u16(seg, one), seg_bias);
+        t = vshlq_u16(t, vreinterpretq_s16_u16(vqsubq_u16(seg, one)));
+        pcm = vreinterpretq_s16_u16(t);
+        pcm = vbslq_s16(vtstq_u16(a, sign_bit), pcm, vnegq_s16(pcm));
+
+        vst1q_s16(dst + i, pcm);
+    }
+
+    scalar_alaw_decode(dst + i, src + i, cnt - i);
+
+    return;
+}
+
+#endif
+
+void g711_simd_init(void)
+{
+#if defined(G711_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        kernels.isa = ISA_AVX2;
+        kernels.ulaw_encode = &avx2_ulaw_encode;
+        kernels.alaw_encode = &avx2_alaw_encode;
+        kernels.ulaw_decode = &avx2_ulaw_decode;
+        kernels.alaw_decode = &avx2_alaw_decode;
+    }
+#elif defined(G711_SIMD_NEON)
+    kernels.isa = ISA_NEON;
+    kernels.ulaw_encode = &neon_ulaw_encode;
+    kernels.alaw_encode = &neon_alaw_encode;
+    kernels.ulaw_decode = &neon_ulaw_decode;
+    kernels.alaw_decode = &neon_alaw_decode;
+#endif
+
+    return;
+}
+
+const char *g711_simd_isa(void)
+{
+    return kernels.isa;
+}
+
+void g711_simd_ulaw_encode(pj_uint8_t *dst, const pj_int16_t *src, unsigned cnt)
+{
+    kernels.ulaw_encode(dst, src, cnt);
+
+    return;
+}
+
+void g711_simd_alaw_encode(pj_uint8_t *dst, const pj_int16_t *src, unsigned cnt)
+{
+    kernels.alaw_encode(dst, src, cnt);
+
+    return;
+}
+
+void g711_simd_ulaw_decode(pj_int16_t *dst, const pj_uint8_t *src, unsigned cnt)
+{
+    kernels.ulaw_decode(dst, src, cnt);
+
+    return;
+}
+
+void g711_simd_alaw_decode(pj_int16_t *dst, const pj_uint8_t *src, unsigned cnt)
+{
+    kernels.alaw_decode(dst, src, cnt);
+
+    return;
+}
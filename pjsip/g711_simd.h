@@ -0,0 +1,24 @@
+#ifndef _AUTO_ANSWER_G711_SIMD_H_
+#define _AUTO_ANSWER_G711_SIMD_H_
+
+#include <pjmedia.h>
+
+/* G.711 u-law and A-law over whole frames, bit exact with pjmedia_linear2ulaw()
+ * and the rest of alaw_ulaw.h for every input. AVX2 when the CPU has it
+ * (checked at run time, the build needs no -mavx2), NEON on aarch64, the
+ * pjmedia loops otherwise. 16 samples per step on AVX2, 8 on NEON, the
+ * tail of a frame goes through the scalar code
+ */
+
+/* Pick the kernels for this CPU, before the first frame */
+void g711_simd_init(void);
+
+/* "avx2", "neon" or "scalar" */
+const char *g711_simd_isa(void);
+
+void g711_simd_ulaw_encode(pj_uint8_t *dst, const pj_int16_t *src, unsigned cnt);
+void g711_simd_alaw_encode(pj_uint8_t *dst, const pj_int16_t *src, unsigned cnt);
+void g711_simd_ulaw_decode(pj_int16_t *dst, const pj_uint8_t *src, unsigned cnt);
+void g711_simd_alaw_decode(pj_int16_t *dst, const pj_uint8_t *src, unsigned cnt);
+
+#endif /* _AUTO_ANSWER_G711_SIMD_H_ */
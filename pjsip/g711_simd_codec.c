@@ -0,0 +1,389 @@
+#include "g711_simd.h"
+#include "g711_simd_codec.h"
+
+#define THIS_FILE                   "g711_simd_codec.c"
+#define POOL_NAME                   "g711simd%p"
+#define POOL_SIZE                   4000
+#define POOL_INCREMENT_SIZE         4000
+#define G711_CLOCK_RATE             8000
+#define G711_CHANNELS               1
+#define G711_BPS                    64000
+#define G711_FRAME_MSEC             10
+#define G711_FRAMES_PER_PACKET      2
+#define G711_BITS_PER_SAMPLE        16
+#define MSEC_IN_SEC                 1000
+#define SAMPLES_PER_FRAME           (G711_CLOCK_RATE * G711_FRAME_MSEC / MSEC_IN_SEC)
+#define CODEC_CNT                   2
+
+/* base first, the codec manager only knows pjmedia_codec */
+typedef struct g711_codec_t
+{
+    pjmedia_codec               base;
+    pj_pool_t                   *pool;
+    unsigned                    pt;
+    pj_bool_t                   vad_enabled;
+    pj_bool_t                   plc_enabled;
+    pjmedia_silence_det         *vad;
+    pjmedia_plc                 *plc;
+    pj_timestamp                last_tx;
+} g711_codec_t;
+
+static pj_status_t test_alloc(pjmedia_codec_factory *factory, const pjmedia_codec_info *info);
+static pj_status_t default_attr(pjmedia_codec_factory *factory, const pjmedia_codec_info *info,
+                                pjmedia_codec_param *attr);
+static pj_status_t enum_info(pjmedia_codec_factory *factory, unsigned *count, pjmedia_codec_info codecs[]);
+static pj_status_t alloc_codec(pjmedia_codec_factory *factory, const pjmedia_codec_info *info,
+                               pjmedia_codec **p_codec);
+static pj_status_t dealloc_codec(pjmedia_codec_factory *factory, pjmedia_codec *codec);
+static pj_status_t factory_destroy(void);
+
+static pj_status_t codec_init(pjmedia_codec *codec, pj_pool_t *pool);
+static pj_status_t codec_open(pjmedia_codec *codec, pjmedia_codec_param *attr);
+static pj_status_t codec_close(pjmedia_codec *codec);
+static pj_status_t codec_modify(pjmedia_codec *codec, const pjmedia_codec_param *attr);
+static pj_status_t codec_parse(pjmedia_codec *codec, void *pkt, pj_size_t pkt_size, const pj_timestamp *ts,
+                               unsigned *frame_cnt, pjmedia_frame frames[]);
+static pj_status_t codec_encode(pjmedia_codec *codec, const struct pjmedia_frame *input,
+                                unsigned output_buf_len, struct pjmedia_frame *output);
+static pj_status_t codec_decode(pjmedia_codec *codec, const struct pjmedia_frame *input,
+                                unsigned output_buf_len, struct pjmedia_frame *output);
+static pj_status_t codec_recover(pjmedia_codec *codec, unsigned output_buf_len, struct pjmedia_frame *output);
+
+static pjmedia_codec_factory_op factory_op =
+{
+    &test_alloc,
+    &default_attr,
+    &enum_info,
+    &alloc_codec,
+    &dealloc_codec,
+    &factory_destroy,
+};
+
+static pjmedia_codec_op codec_op =
+{
+    &codec_init,
+    &codec_open,
+    &codec_close,
+    &codec_modify,
+    &codec_parse,
+    &codec_encode,
+    &codec_decode,
+    &codec_recover,
+};
+
+static struct g711_factory_t
+{
+    pjmedia_codec_factory       base;
+    pjmedia_endpt               *endpt;
+} g711_factory;
+
+pj_status_t g711_simd_codec_init(pjmedia_endpt *endpt)
+{
+    pj_status_t status = PJ_SUCCESS;
+
+    if (g711_factory.endpt)
+        goto _exit;
+
+    g711_simd_init();
+
+    pj_list_init(&g711_factory.base);
+    g711_factory.base.op = &factory_op;
+    g711_factory.base.factory_data = NULL;
+    g711_factory.endpt = endpt;
+
+    status = pjmedia_codec_mgr_register_factory(pjmedia_endpt_get_codec_mgr(endpt), &g711_factory.base);
+    if (status != PJ_SUCCESS)
+    {
+        g711_factory.endpt = NULL;
+        goto _exit;
+    }
+
+    PJ_LOG(4, (THIS_FILE, "G.711 on %s kernels", g711_simd_isa()));
+
+_exit:
+    return status;
+}
+
+pj_status_t g711_simd_codec_deinit(void)
+{
+    pj_status_t status = PJ_SUCCESS;
+
+    if (g711_factory.endpt == NULL)
+        goto _exit;
+
+    status = pjmedia_codec_mgr_unregister_factory(pjmedia_endpt_get_codec_mgr(g711_factory.endpt), &g711_factory.base);
+    g711_factory.endpt = NULL;
+
+_exit:
+    return status;
+}
+
+static pj_status_t test_alloc(pjmedia_codec_factory *factory, const pjmedia_codec_info *info)
+{
+    PJ_UNUSED_ARG(factory);
+
+    if (((info->pt == PJMEDIA_RTP_PT_PCMU) || (info->pt == PJMEDIA_RTP_PT_PCMA))
+        && (info->clock_rate == G711_CLOCK_RATE) && (info->channel_cnt == G711_CHANNELS))
+    {
+        return PJ_SUCCESS;
+    }
+
+    return PJMEDIA_CODEC_EUNSUP;
+}
+
+/* The defaults of the pjmedia G.711 */
+static pj_status_t default_attr(pjmedia_codec_factory *factory, const pjmedia_codec_info *info,
+                                pjmedia_codec_param *attr)
+{
+    PJ_UNUSED_ARG(factory);
+
+    pj_bzero(attr, sizeof(*attr));
+    attr->info.clock_rate = G711_CLOCK_RATE;
+    attr->info.channel_cnt = G711_CHANNELS;
+    attr->info.avg_bps = G711_BPS;
+    attr->info.max_bps = G711_BPS;
+    attr->info.pcm_bits_per_sample = G711_BITS_PER_SAMPLE;
+    attr->info.frm_ptime = G711_FRAME_MSEC;
+    attr->info.pt = (pj_uint8_t)info->pt;
+
+    attr->setting.frm_per_pkt = G711_FRAMES_PER_PACKET;
+    attr->setting.vad = 1;
+    attr->setting.plc = 1;
+
+    return PJ_SUCCESS;
+}
+
+static pj_status_t enum_info(pjmedia_codec_factory *factory, unsigned *count, pjmedia_codec_info codecs[])
+{
+    static const struct
+    {
+        unsigned                pt;
+        const char              *name;
+    } kCODECS[CODEC_CNT] =
+    {
+        { PJMEDIA_RTP_PT_PCMU,  "PCMU" },
+        { PJMEDIA_RTP_PT_PCMA,  "PCMA" },
+    };
+    unsigned cnt = 0;
+
+    PJ_UNUSED_ARG(factory);
+
+    for (; (cnt < *count) && (cnt < CODEC_CNT); cnt++)
+    {
+        pj_bzero(&codecs[cnt], sizeof(codecs[cnt]));
+        codecs[cnt].type = PJMEDIA_TYPE_AUDIO;
+        codecs[cnt].pt = kCODECS[cnt].pt;
+        codecs[cnt].encoding_name = pj_str((char *)kCODECS[cnt].name);
+        codecs[cnt].clock_rate = G711_CLOCK_RATE;
+        codecs[cnt].channel_cnt = G711_CHANNELS;
+    }
+
+    *count = cnt;
+
+    return PJ_SUCCESS;
+}
+
+/* A pool per codec, the codec goes with it */
+static pj_status_t alloc_codec(pjmedia_codec_factory *factory, const pjmedia_codec_info *info,
+                               pjmedia_codec **p_codec)
+{
+    pj_status_t status;
+    pj_pool_t *pool;
+    g711_codec_t *codec;
+
+    pool = pjmedia_endpt_create_pool(g711_factory.endpt, POOL_NAME, POOL_SIZE, POOL_INCREMENT_SIZE);
+    if (!pool)
+    {
+        status = PJ_ENOMEM;
+        goto _exit;
+    }
+
+    codec = PJ_POOL_ZALLOC_T(pool, g711_codec_t);
+    codec->pool = pool;
+    codec->pt = info->pt;
+
+    status = pjmedia_plc_create(pool, G711_CLOCK_RATE, SAMPLES_PER_FRAME, 0, &codec->plc);
+    if (status != PJ_SUCCESS)
+    {
+        pj_pool_release(pool);
+        goto _exit;
+    }
+
+    status = pjmedia_silence_det_create(pool, G711_CLOCK_RATE, SAMPLES_PER_FRAME, &codec->vad);
+    if (status != PJ_SUCCESS)
+    {
+        pj_pool_release(pool);
+        goto _exit;
+    }
+
+    codec->base.op = &codec_op;
+    codec->base.factory = factory;
+    codec->base.codec_data = codec;
+
+    *p_codec = &codec->base;
+
+_exit:
+    return status;
+}
+
+static pj_status_t dealloc_codec(pjmedia_codec_factory *factory, pjmedia_codec *codec)
+{
+    g711_codec_t *g711 = (g711_codec_t *)codec->codec_data;
+
+    PJ_UNUSED_ARG(factory);
+
+    pj_pool_release(g711->pool);
+
+    return PJ_SUCCESS;
+}
+
+/* Called by the codec manager when the endpoint goes */
+static pj_status_t factory_destroy(void)
+{
+    return g711_simd_codec_deinit();
+}
+
+static pj_status_t codec_init(pjmedia_codec *codec, pj_pool_t *pool)
+{
+    PJ_UNUSED_ARG(codec);
+    PJ_UNUSED_ARG(pool);
+
+    return PJ_SUCCESS;
+}
+
+static pj_status_t codec_open(pjmedia_codec *codec, pjmedia_codec_param *attr)
+{
+    g711_codec_t *g711 = (g711_codec_t *)codec->codec_data;
+
+    g711->pt = attr->info.pt;
+    g711->vad_enabled = (attr->setting.vad != 0);
+    g711->plc_enabled = (attr->setting.plc != 0);
+
+    return PJ_SUCCESS;
+}
+
+static pj_status_t codec_close(pjmedia_codec *codec)
+{
+    PJ_UNUSED_ARG(codec);
+
+    return PJ_SUCCESS;
+}
+
+static pj_status_t codec_modify(pjmedia_codec *codec, const pjmedia_codec_param *attr)
+{
+    g711_codec_t *g711 = (g711_codec_t *)codec->codec_data;
+
+    if (attr->info.pt != g711->pt)
+        return PJMEDIA_EINVALIDPT;
+
+    g711->vad_enabled = (attr->setting.vad != 0);
+    g711->plc_enabled = (attr->setting.plc != 0);
+
+    return PJ_SUCCESS;
+}
+
+/* A byte per sample, frames of 10 ms */
+static pj_status_t codec_parse(pjmedia_codec *codec, void *pkt, pj_size_t pkt_size, const pj_timestamp *ts,
+                               unsigned *frame_cnt, pjmedia_frame frames[])
+{
+    unsigned cnt = 0;
+
+    PJ_UNUSED_ARG(codec);
+
+    while ((pkt_size >= SAMPLES_PER_FRAME) && (cnt < *frame_cnt))
+    {
+        frames[cnt].type = PJMEDIA_FRAME_TYPE_AUDIO;
+        frames[cnt].buf = pkt;
+        frames[cnt].size = SAMPLES_PER_FRAME;
+        frames[cnt].timestamp.u64 = ts->u64 + (pj_uint64_t)SAMPLES_PER_FRAME * cnt;
+
+        pkt = (pj_uint8_t *)pkt + SAMPLES_PER_FRAME;
+        pkt_size -= SAMPLES_PER_FRAME;
+        cnt++;
+    }
+
+    *frame_cnt = cnt;
+
+    return PJ_SUCCESS;
+}
+
+static pj_status_t codec_encode(pjmedia_codec *codec, const struct pjmedia_frame *input,
+                                unsigned output_buf_len, struct pjmedia_frame *output)
+{
+    g711_codec_t *g711 = (g711_codec_t *)codec->codec_data;
+    unsigned sample_cnt = (unsigned)(input->size >> 1);
+
+    if (output_buf_len < sample_cnt)
+        return PJMEDIA_CODEC_EFRMTOOSHORT;
+
+    /* Silence is not sent, but at least once per max silence period */
+    if (g711->vad_enabled)
+    {
+        pj_int32_t silence_duration = pj_timestamp_diff32(&g711->last_tx, &input->timestamp);
+        pj_bool_t is_silence = pjmedia_silence_det_detect(g711->vad, (const pj_int16_t *)input->buf,
+                                                          sample_cnt, NULL);
+
+        if (is_silence && ((PJMEDIA_CODEC_MAX_SILENCE_PERIOD == -1)
+                           || (silence_duration < PJMEDIA_CODEC_MAX_SILENCE_PERIOD * G711_CLOCK_RATE / MSEC_IN_SEC)))
+        {
+            output->type = PJMEDIA_FRAME_TYPE_NONE;
+            output->buf = NULL;
+            output->size = 0;
+            output->timestamp = input->timestamp;
+            return PJ_SUCCESS;
+        }
+
+        g711->last_tx = input->timestamp;
+    }
+
+    if (g711->pt == PJMEDIA_RTP_PT_PCMA)
+        g711_simd_alaw_encode((pj_uint8_t *)output->buf, (const pj_int16_t *)input->buf, sample_cnt);
+    else
+        g711_simd_ulaw_encode((pj_uint8_t *)output->buf, (const pj_int16_t *)input->buf, sample_cnt);
+
+    output->type = PJMEDIA_FRAME_TYPE_AUDIO;
+    output->size = sample_cnt;
+    output->timestamp = input->timestamp;
+
+    return PJ_SUCCESS;
+}
+
+static pj_status_t codec_decode(pjmedia_codec *codec, const struct pjmedia_frame *input,
+                                unsigned output_buf_len, struct pjmedia_frame *output)
+{
+    g711_codec_t *g711 = (g711_codec_t *)codec->codec_data;
+
+    if (output_buf_len < (input->size << 1))
+        return PJMEDIA_CODEC_EPCMTOOSHORT;
+
+    if (g711->pt == PJMEDIA_RTP_PT_PCMA)
+        g711_simd_alaw_decode((pj_int16_t *)output->buf, (const pj_uint8_t *)input->buf, (unsigned)input->size);
+    else
+        g711_simd_ulaw_decode((pj_int16_t *)output->buf, (const pj_uint8_t *)input->buf, (unsigned)input->size);
+
+    output->type = PJMEDIA_FRAME_TYPE_AUDIO;
+    output->size = input->size << 1;
+    output->timestamp = input->timestamp;
+
+    if (g711->plc_enabled && (input->size == SAMPLES_PER_FRAME))
+        pjmedia_plc_save(g711->plc, (pj_int16_t *)output->buf);
+
+    return PJ_SUCCESS;
+}
+
+static pj_status_t codec_recover(pjmedia_codec *codec, unsigned output_buf_len, struct pjmedia_frame *output)
+{
+    g711_codec_t *g711 = (g711_codec_t *)codec->codec_data;
+
+    if (!g711->plc_enabled)
+        return PJ_EINVALIDOP;
+
+    if (output_buf_len < SAMPLES_PER_FRAME * sizeof(pj_int16_t))
+        return PJMEDIA_CODEC_EPCMTOOSHORT;
+
+    pjmedia_plc_generate(g711->plc, (pj_int16_t *)output->buf);
+    output->type = PJMEDIA_FRAME_TYPE_AUDIO;
+    output->size = SAMPLES_PER_FRAME * sizeof(pj_int16_t);
+
+    return PJ_SUCCESS;
+}
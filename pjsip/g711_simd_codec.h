@@ -0,0 +1,15 @@
+#ifndef _AUTO_ANSWER_G711_SIMD_CODEC_H_
+#define _AUTO_ANSWER_G711_SIMD_CODEC_H_
+
+#include <pjmedia.h>
+
+/* PCMU/8000 and PCMA/8000 on the kernels of g711_simd.c, in place of
+ * pjmedia_codec_g711_init(): same defaults, packets, VAD and PLC as the
+ * pjmedia codec and the same bytes on the wire. Register only one of the
+ * two, both offer the same codec ids
+ */
+pj_status_t g711_simd_codec_init(pjmedia_endpt *endpt);
+
+pj_status_t g711_simd_codec_deinit(void);
+
+#endif /* _AUTO_ANSWER_G711_SIMD_CODEC_H_ */
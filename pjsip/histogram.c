@@ -0,0 +1,77 @@
+#include "histogram.h"
+
+#define PERCENT                     100
+#define P50                         50
+#define P99                         99
+#define UINT32_BITS                 32
+
+static unsigned bucket_index(pj_uint32_t value);
+static pj_uint32_t bucket_upper_bound(unsigned idx);
+
+void histogram_add(histogram_t *hist, pj_uint32_t value)
+{
+    hist->buckets[bucket_index(value)]++;
+    hist->count++;
+    hist->sum += value;
+
+    if (value > hist->max)
+        hist->max = value;
+
+    return;
+}
+
+pj_uint32_t histogram_percentile(const histogram_t *hist, unsigned percentile)
+{
+    pj_uint64_t rank = ((hist->count * percentile) + (PERCENT - 1)) / PERCENT;
+    pj_uint64_t seen = 0;
+    pj_uint32_t value = 0;
+
+    for (unsigned i = 0; (i < HISTOGRAM_BUCKETS) && (rank > 0); i++)
+    {
+        seen += hist->buckets[i];
+        if (seen >= rank)
+        {
+            value = PJ_MIN(bucket_upper_bound(i), hist->max);
+            break;
+        }
+    }
+
+    return value;
+}
+
+void histogram_print(const histogram_t *hist, char *buf, pj_size_t size)
+{
+    pj_uint64_t avg = (hist->count > 0) ? (hist->sum / hist->count) : 0;
+
+    pj_ansi_snprintf(buf,
+                     size,
+                     "count=%llu avg=%llu p50=%u p99=%u max=%u",
+                     (unsigned long long)hist->count,
+                     (unsigned long long)avg,
+                     histogram_percentile(hist, P50),
+                     histogram_percentile(hist, P99),
+                     hist->max);
+
+    return;
+}
+
+/* Number of significant bits of the value */
+static unsigned bucket_index(pj_uint32_t value)
+{
+    unsigned idx = 0;
+
+    if (value != 0)
+        idx = UINT32_BITS - (unsigned)__builtin_clz(value);
+
+    return PJ_MIN(idx, HISTOGRAM_BUCKETS - 1);
+}
+
+static pj_uint32_t bucket_upper_bound(unsigned idx)
+{
+    pj_uint32_t bound = 0;
+
+    if (idx > 0)
+        bound = (pj_uint32_t)(((pj_uint64_t)1 << idx) - 1);
+
+    return bound;
+}
@@ -0,0 +1,30 @@
+#ifndef _AUTO_ANSWER_HISTOGRAM_H_
+#define _AUTO_ANSWER_HISTOGRAM_H_
+
+#include <pjlib.h>
+
+/* Bucket i counts the values in [2^(i-1), 2^i), bucket 0 counts zeros */
+#define HISTOGRAM_BUCKETS           32
+#define HISTOGRAM_STR_SIZE          512
+
+/* Log2 histogram of the unsigned values (microseconds as a rule).
+ * Filled by a single writer without locks, a reader may see a slightly
+ * inconsistent snapshot which is fine for statistics
+ */
+typedef struct histogram_t
+{
+    pj_uint64_t         buckets[HISTOGRAM_BUCKETS];
+    pj_uint64_t         count;
+    pj_uint64_t         sum;
+    pj_uint32_t         max;
+} histogram_t;
+
+void histogram_add(histogram_t *hist, pj_uint32_t value);
+
+/* Upper bound of the bucket holding the given percentile (0..100) */
+pj_uint32_t histogram_percentile(const histogram_t *hist, unsigned percentile);
+
+/* "count=N avg=A p50=B p99=C max=D" */
+void histogram_print(const histogram_t *hist, char *buf, pj_size_t size);
+
+#endif /* _AUTO_ANSWER_HISTOGRAM_H_ */
@@ -0,0 +1,183 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "hugepage_policy.h"
+
+#define THIS_FILE                   "hugepage_policy.c"
+#define HUGE_PAGE_SIZE              (2 * 1024 * 1024)
+#define MIN_CLASS_SHIFT             12      /* 4 KB */
+#define MAX_CLASS_SHIFT             20      /* 1 MB */
+#define CLASS_CNT                   (MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1)
+
+/* Freed block of a size class, the link is kept in the block */
+typedef struct free_block_t
+{
+    struct free_block_t         *next;
+} free_block_t;
+
+typedef struct hugepage_arena_t
+{
+    pthread_mutex_t             lock;       /* Pools of different threads grow at once */
+    pj_uint8_t                  *base;
+    pj_size_t                   size;
+    pj_size_t                   carved;
+    pj_bool_t                   is_huge;
+    free_block_t                *free_lists[CLASS_CNT];
+    pj_uint64_t                 fallback_cnt;
+} hugepage_arena_t;
+
+static hugepage_arena_t arena = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, PJ_FALSE, { NULL }, 0 };
+
+static int size_class(pj_size_t size);
+static pj_bool_t is_in_arena(const void *mem);
+static void *block_alloc(pj_pool_factory *factory, pj_size_t size);
+static void block_free(pj_pool_factory *factory, void *mem, pj_size_t size);
+
+pj_status_t hugepage_policy_init(pj_size_t arena_size, pj_pool_factory_policy *policy)
+{
+    pj_status_t status = PJ_SUCCESS;
+    pj_size_t size = (arena_size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    void *base;
+
+    if (size == 0)
+    {
+        status = PJ_EINVAL;
+        goto _exit;
+    }
+
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (base != MAP_FAILED)
+    {
+        arena.is_huge = PJ_TRUE;
+    }
+    else
+    {
+        PJ_LOG(2, (THIS_FILE, "No %lu MB of huge pages (%s), the pools use normal pages",
+                   (unsigned long)(size / HUGE_PAGE_SIZE * 2), strerror(errno)));
+
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+        {
+            status = PJ_STATUS_FROM_OS(errno);
+            goto _exit;
+        }
+
+        /* Transparent huge pages, where the kernel has them enabled */
+        madvise(base, size, MADV_HUGEPAGE);
+    }
+
+    arena.base = (pj_uint8_t *)base;
+    arena.size = size;
+
+    *policy = pj_pool_factory_default_policy;
+    policy->block_alloc = &block_alloc;
+    policy->block_free = &block_free;
+
+    PJ_LOG(4, (THIS_FILE, "Pool arena of %lu KB on %s pages",
+               (unsigned long)(size / 1024), arena.is_huge ? "huge" : "normal"));
+
+_exit:
+    return status;
+}
+
+void hugepage_policy_destroy(void)
+{
+    if (arena.base)
+    {
+        munmap(arena.base, arena.size);
+
+        /* A next init starts from nothing, the counters and the page
+         * kind included. Nobody holds the lock any more */
+        pj_bzero(&arena, sizeof(arena));
+        pthread_mutex_init(&arena.lock, NULL);
+    }
+
+    return;
+}
+
+void hugepage_policy_get_stats(pj_size_t *arena_size, pj_size_t *carved_size, pj_uint64_t *fallback_cnt)
+{
+    pthread_mutex_lock(&arena.lock);
+    *arena_size = arena.size;
+    *carved_size = arena.carved;
+    *fallback_cnt = arena.fallback_cnt;
+    pthread_mutex_unlock(&arena.lock);
+
+    return;
+}
+
+/* Index of the smallest class holding the size, -1 above the biggest */
+static int size_class(pj_size_t size)
+{
+    int shift = MIN_CLASS_SHIFT;
+
+    while ((shift <= MAX_CLASS_SHIFT) && (((pj_size_t)1 << shift) < size))
+    {
+        shift++;
+    }
+
+    return (shift <= MAX_CLASS_SHIFT) ? (shift - MIN_CLASS_SHIFT) : -1;
+}
+
+static pj_bool_t is_in_arena(const void *mem)
+{
+    const pj_uint8_t *ptr = (const pj_uint8_t *)mem;
+
+    return (arena.base != NULL) && (ptr >= arena.base) && (ptr < arena.base + arena.size);
+}
+
+static void *block_alloc(pj_pool_factory *factory, pj_size_t size)
+{
+    void *mem = NULL;
+    int idx = size_class(size);
+
+    pthread_mutex_lock(&arena.lock);
+
+    if (idx >= 0)
+    {
+        pj_size_t class_size = (pj_size_t)1 << (idx + MIN_CLASS_SHIFT);
+
+        if (arena.free_lists[idx])
+        {
+            mem = arena.free_lists[idx];
+            arena.free_lists[idx] = arena.free_lists[idx]->next;
+        }
+        else if (arena.carved + class_size <= arena.size)
+        {
+            mem = arena.base + arena.carved;
+            arena.carved += class_size;
+        }
+    }
+
+    if (mem == NULL)
+        arena.fallback_cnt++;
+
+    pthread_mutex_unlock(&arena.lock);
+
+    if (mem == NULL)
+        mem = pj_pool_factory_default_policy.block_alloc(factory, size);
+
+    return mem;
+}
+
+static void block_free(pj_pool_factory *factory, void *mem, pj_size_t size)
+{
+    int idx = size_class(size);
+
+    if (!is_in_arena(mem) || (idx < 0))
+    {
+        pj_pool_factory_default_policy.block_free(factory, mem, size);
+        goto _exit;
+    }
+
+    pthread_mutex_lock(&arena.lock);
+    ((free_block_t *)mem)->next = arena.free_lists[idx];
+    arena.free_lists[idx] = (free_block_t *)mem;
+    pthread_mutex_unlock(&arena.lock);
+
+_exit:
+    return;
+}
@@ -0,0 +1,26 @@
+#ifndef _AUTO_ANSWER_HUGEPAGE_POLICY_H_
+#define _AUTO_ANSWER_HUGEPAGE_POLICY_H_
+
+#include <pjlib.h>
+
+/* Pool factory policy carving the pool blocks from one arena of 2 MB huge
+ * pages mapped at start. A freed block goes to the free list of its size
+ * class (powers of two from 4 KB to 1 MB) and is reused by the next block
+ * of the class, the arena is never given back. Without huge pages the
+ * arena is mapped from normal pages with transparent huge pages advised;
+ * bigger blocks and blocks above a full arena come from the default
+ * policy. One arena per process, for the factory of the caching pool.
+ * The classes never coalesce and a freed block never goes back to the
+ * arena: a workload whose pool sizes drift slowly leaves its old blocks
+ * on the free lists of sizes no longer asked for, carves the arena up
+ * and then runs on the default policy, seen as a growing fallback count
+ */
+pj_status_t hugepage_policy_init(pj_size_t arena_size, pj_pool_factory_policy *policy);
+
+/* Unmap the arena, after the caching pool is destroyed */
+void hugepage_policy_destroy(void);
+
+/* Arena bytes mapped and carved, blocks taken from the default policy */
+void hugepage_policy_get_stats(pj_size_t *arena_size, pj_size_t *carved_size, pj_uint64_t *fallback_cnt);
+
+#endif /* _AUTO_ANSWER_HUGEPAGE_POLICY_H_ */
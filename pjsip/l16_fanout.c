@@ -0,0 +1,235 @@
+#include "l16_fanout.h"
+
+#define THIS_FILE                   "l16_fanout.c"
+#define FANOUT_NAME                 "l16-fanout"
+#define FANOUT_SIGNATURE            PJMEDIA_SIG_CLASS_APP('L', 'F')
+#define NCHANNELS                   1
+#define BITS_PER_SAMPLE             16
+#define RTP_HDR_SIZE                12  /* No CSRC, no extension */
+
+typedef struct l16_listener_t
+{
+    pj_bool_t                   in_use;
+    pj_bool_t                   silent;     /* Next packet starts a talkspurt */
+    unsigned                    pt;
+    pjmedia_transport           *transport;
+    pjmedia_rtp_session         rtp;
+} l16_listener_t;
+
+typedef struct l16_fanout_t
+{
+    pjmedia_port                base;
+    pj_lock_t                   *lock;
+    l16_listener_t              *listeners;
+    unsigned                    max_listeners;
+    unsigned                    listener_cnt;
+    pj_uint8_t                  *packet;    /* RTP header room followed by the payload */
+    pj_size_t                   payload_size;
+} l16_fanout_t;
+
+static void swap_to_network(const pj_int16_t *samples, unsigned count, pj_uint16_t *payload);
+static void send_to_listener(l16_fanout_t *fanout, l16_listener_t *listener, pj_size_t payload_size);
+static pj_status_t fanout_put_frame(pjmedia_port *this_port, pjmedia_frame *frame);
+static pj_status_t fanout_get_frame(pjmedia_port *this_port, pjmedia_frame *frame);
+static pj_status_t fanout_on_destroy(pjmedia_port *this_port);
+
+pj_status_t l16_fanout_create(pj_pool_t *pool,
+                              unsigned clock_rate,
+                              unsigned samples_per_frame,
+                              unsigned max_listeners,
+                              pjmedia_port **p_port)
+{
+    pj_status_t status;
+    l16_fanout_t *fanout;
+    pj_str_t name = pj_str(FANOUT_NAME);
+
+    fanout = PJ_POOL_ZALLOC_T(pool, l16_fanout_t);
+
+    status = pjmedia_port_info_init(&fanout->base.info,
+                                    &name,
+                                    FANOUT_SIGNATURE,
+                                    clock_rate,
+                                    NCHANNELS,
+                                    BITS_PER_SAMPLE,
+                                    samples_per_frame);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    status = pj_lock_create_simple_mutex(pool, FANOUT_NAME, &fanout->lock);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    fanout->max_listeners = max_listeners;
+    fanout->listeners = (l16_listener_t *)pj_pool_zalloc(pool, max_listeners * sizeof(l16_listener_t));
+    fanout->payload_size = (pj_size_t)samples_per_frame * sizeof(pj_int16_t);
+    fanout->packet = (pj_uint8_t *)pj_pool_alloc(pool, RTP_HDR_SIZE + fanout->payload_size);
+    if ((fanout->listeners == NULL) || (fanout->packet == NULL))
+    {
+        pj_lock_destroy(fanout->lock);
+        status = PJ_ENOMEM;
+        goto _exit;
+    }
+
+    fanout->base.put_frame = &fanout_put_frame;
+    fanout->base.get_frame = &fanout_get_frame;
+    fanout->base.on_destroy = &fanout_on_destroy;
+
+    *p_port = &fanout->base;
+
+_exit:
+    return status;
+}
+
+pj_status_t l16_fanout_add_listener(pjmedia_port *port,
+                                    pjmedia_transport *transport,
+                                    unsigned pt,
+                                    int *p_id)
+{
+    l16_fanout_t *fanout = (l16_fanout_t *)port;
+    pj_status_t status = PJ_ETOOMANY;
+
+    pj_lock_acquire(fanout->lock);
+
+    for (unsigned i = 0; i < fanout->max_listeners; i++)
+    {
+        l16_listener_t *listener = &fanout->listeners[i];
+
+        if (listener->in_use)
+            continue;
+
+        status = pjmedia_rtp_session_init(&listener->rtp, (int)pt, pj_rand());
+        if (status != PJ_SUCCESS)
+            break;
+
+        listener->in_use = PJ_TRUE;
+        listener->silent = PJ_TRUE;
+        listener->pt = pt;
+        listener->transport = transport;
+        fanout->listener_cnt++;
+        *p_id = (int)i;
+        break;
+    }
+
+    pj_lock_release(fanout->lock);
+
+    return status;
+}
+
+void l16_fanout_remove_listener(pjmedia_port *port, int id)
+{
+    l16_fanout_t *fanout = (l16_fanout_t *)port;
+
+    if ((id >= 0) && ((unsigned)id < fanout->max_listeners))
+    {
+        pj_lock_acquire(fanout->lock);
+        if (fanout->listeners[id].in_use)
+            fanout->listener_cnt--;
+        fanout->listeners[id].in_use = PJ_FALSE;
+        fanout->listeners[id].transport = NULL;
+        pj_lock_release(fanout->lock);
+    }
+
+    return;
+}
+
+/* L16 is big endian (RFC 3551) */
+static void swap_to_network(const pj_int16_t *samples, unsigned count, pj_uint16_t *payload)
+{
+    for (unsigned i = 0; i < count; i++)
+    {
+        payload[i] = pj_htons((pj_uint16_t)samples[i]);
+    }
+
+    return;
+}
+
+/* The payload is in place, only the header of the listener is written */
+static void send_to_listener(l16_fanout_t *fanout, l16_listener_t *listener, pj_size_t payload_size)
+{
+    const void *hdr;
+    int hdr_len;
+    unsigned samples = PJMEDIA_PIA_SPF(&fanout->base.info);
+    pj_status_t status;
+
+    status = pjmedia_rtp_encode_rtp(&listener->rtp,
+                                    (int)listener->pt,
+                                    listener->silent,
+                                    (int)payload_size,
+                                    (int)samples,
+                                    &hdr,
+                                    &hdr_len);
+    if ((status != PJ_SUCCESS) || (hdr_len != RTP_HDR_SIZE))
+        goto _exit;
+
+    listener->silent = PJ_FALSE;
+
+    pj_memcpy(fanout->packet, hdr, RTP_HDR_SIZE);
+    pjmedia_transport_send_rtp(listener->transport, fanout->packet, RTP_HDR_SIZE + payload_size);
+
+_exit:
+    return;
+}
+
+static pj_status_t fanout_put_frame(pjmedia_port *this_port, pjmedia_frame *frame)
+{
+    l16_fanout_t *fanout = (l16_fanout_t *)this_port;
+    pj_bool_t has_audio = (frame->type == PJMEDIA_FRAME_TYPE_AUDIO) && (frame->size == fanout->payload_size);
+    const void *hdr;
+    int hdr_len;
+
+    pj_lock_acquire(fanout->lock);
+
+    /* No call is listening, no frame is converted */
+    if (fanout->listener_cnt == 0)
+        goto _exit;
+
+    if (has_audio)
+    {
+        swap_to_network((const pj_int16_t *)frame->buf,
+                        (unsigned)(frame->size / sizeof(pj_int16_t)),
+                        (pj_uint16_t *)(fanout->packet + RTP_HDR_SIZE));
+    }
+
+    for (unsigned i = 0; i < fanout->max_listeners; i++)
+    {
+        l16_listener_t *listener = &fanout->listeners[i];
+
+        if (!listener->in_use)
+            continue;
+
+        if (has_audio)
+        {
+            send_to_listener(fanout, listener, fanout->payload_size);
+        }
+        else
+        {
+            /* Only the timestamp moves on */
+            pjmedia_rtp_encode_rtp(&listener->rtp, (int)listener->pt, 0, 0,
+                                   (int)PJMEDIA_PIA_SPF(&this_port->info), &hdr, &hdr_len);
+            listener->silent = PJ_TRUE;
+        }
+    }
+
+_exit:
+    pj_lock_release(fanout->lock);
+
+    return PJ_SUCCESS;
+}
+
+/* Nothing is received from the listeners */
+static pj_status_t fanout_get_frame(pjmedia_port *this_port, pjmedia_frame *frame)
+{
+    PJ_UNUSED_ARG(this_port);
+
+    frame->type = PJMEDIA_FRAME_TYPE_NONE;
+    frame->size = 0;
+
+    return PJ_SUCCESS;
+}
+
+static pj_status_t fanout_on_destroy(pjmedia_port *this_port)
+{
+    l16_fanout_t *fanout = (l16_fanout_t *)this_port;
+
+    return pj_lock_destroy(fanout->lock);
+}
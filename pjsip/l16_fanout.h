@@ -0,0 +1,29 @@
+#ifndef _AUTO_ANSWER_L16_FANOUT_H_
+#define _AUTO_ANSWER_L16_FANOUT_H_
+
+#include <pjmedia.h>
+
+/* Sink port of the bridge which sends the frame it gets to all its
+ * listeners as L16 RTP, with no stream and no codec. The frame is
+ * converted to network byte order once per tick and the same payload
+ * goes to every listener, only the RTP header differs.
+ * A NONE frame (silence or nothing connected) sends nothing, the
+ * timestamps keep running and the next packet has the marker bit
+ */
+pj_status_t l16_fanout_create(pj_pool_t *pool,
+                              unsigned clock_rate,
+                              unsigned samples_per_frame,
+                              unsigned max_listeners,
+                              pjmedia_port **p_port);
+
+/* Start sending to the transport, which must be attached and started.
+ * The payload type is the negotiated one
+ */
+pj_status_t l16_fanout_add_listener(pjmedia_port *port,
+                                    pjmedia_transport *transport,
+                                    unsigned pt,
+                                    int *p_id);
+
+void l16_fanout_remove_listener(pjmedia_port *port, int id);
+
+#endif /* _AUTO_ANSWER_L16_FANOUT_H_ */
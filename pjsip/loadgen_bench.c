@@ -0,0 +1,1153 @@
+/* Load test of the auto answer on loopback, without sipp and a lab.
+ * The engine runs in this process, a minimal UDP UAC places calls at
+ * the given rate and concurrency, drains the RTP of every call, hangs up
+ * after the hold time (or answers the BYE of the engine with -d 0) and
+ * prints the result as JSON. The CPU of the UAC thread is measured
+ * apart and taken out of the CPU per call. invite_cps is the rate the
+ * INVITEs were sent at, setup_msec the INVITE to 200 time of each call,
+ * the ringing timer of the engine included.
+ * The RTP of every call is checked by the media verifier: the tone and
+ * the cadence of the number with the default tones of the engine, loss,
+ * jitter and timestamp continuity. The lowest concurrency at which a
+ * call went bad shows where the media breaks down. The cadence of 300
+ * needs calls longer than one period, e.g. -d 0.
+ * With -v the engine runs on its virtual clock: the UAC moves it by
+ * 10 ms whenever the SIP and the RTP are quiet and no response of the
+ * engine is due, so the ringing and media timers and the tones take no
+ * wall time and the run is repeatable. The latencies, invite_cps and
+ * the jitter are then in virtual time.
+ * Run it from the directory of auto_answer.conf and the wav file.
+ *
+ *   ./loadgen_bench [-r cps] [-l concurrent calls] [-m calls] [-d hold msec] [-s number] [-v]
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <pjlib.h>
+
+#include "auto_answer.h"
+#include "media_verifier.h"
+
+#define THIS_FILE                   "loadgen_bench.c"
+#define LOOPBACK_ADDR               "127.0.0.1"
+#define ENGINE_SIP_PORT             5062    /* SIP_PORT of the engine */
+#define UAC_SIP_PORT                5070
+#define UAC_RTP_PORT                30000
+#define RTP_PORT_STEP               2
+#define DEFAULT_CPS                 5
+#define DEFAULT_CONCURRENCY         30      /* MAX_CALLS_STATIC of the engine */
+#define DEFAULT_CALLS               100
+#define DEFAULT_HOLD_MSEC           1000    /* 0 - wait for the BYE of the engine */
+#define DEFAULT_NUMBER              "100"
+#define MAX_CONCURRENCY             256
+#define CALL_TIMEOUT_MSEC           30000   /* Per transaction, above the ringing and media timers of the engine */
+#define POLL_MSEC                   1
+#define BENCH_LOG_LEVEL             1       /* Otherwise the SIP dumps are measured too */
+#define MSG_SIZE                    4000
+#define SDP_SIZE                    512
+#define RTP_BUF_SIZE                2048
+#define HEADER_SIZE                 256
+#define NUMBER_SIZE                 32
+#define USEC_IN_SEC                 1000000ULL
+#define USEC_IN_MSEC                1000ULL
+#define NSEC_IN_USEC                1000ULL
+#define PERCENT                     100
+#define PERCENTILE_50               50
+#define PERCENTILE_90               90
+#define PERCENTILE_99               99
+#define SIP_STATUS_RINGING          180
+#define SIP_STATUS_OK               200
+#define SIP_STATUS_FAILURE_MIN      300
+#define SIP_RESPONSE_PREFIX         "SIP/2.0 "
+#define SIP_BYE_PREFIX              "BYE "
+#define CALL_ID_FORMAT              "lg-%u-%u@" LOOPBACK_ADDR
+#define TAG_PARAM                   ";tag="
+#define PTIME_ATTR                  "\r\na=ptime:"
+#define LONG_TONE_NUMBER            "200"   /* LONG_TONE_NAME of the engine */
+#define KPV_TONE_NUMBER             "300"   /* KPV_TONE_NAME of the engine */
+#define CLOCK_RATE                  8000
+#define TONE_FREQ                   425     /* FREQ1 of the engine */
+#define TONE_ON_MSEC                1000
+#define KPV_OFF_MSEC                4000
+#define CADENCE_TOLERANCE_MSEC      40
+#define MAX_JITTER_MSEC             20
+#define SIM_STEP_MSEC               10      /* Virtual time moved when the UAC is quiet */
+#define SIM_MAX_WAIT_MSEC           1000    /* Wall time a response of the engine is waited for */
+
+typedef enum
+{
+    eCALL_IDLE,
+    eCALL_INVITING,
+    eCALL_CONFIRMED,
+    eCALL_CANCEL_SENT,
+    eCALL_BYE_SENT
+} call_state_e;
+
+typedef enum
+{
+    eCALL_RESULT_ENDED,
+    eCALL_RESULT_REJECTED,
+    eCALL_RESULT_TIMED_OUT
+} call_result_e;
+
+typedef struct uac_call_t
+{
+    call_state_e                state;
+    unsigned                    index;
+    unsigned                    seq;            /* Number of the call in the run */
+    int                         rtp_sock;
+    pj_uint16_t                 rtp_port;
+    char                        to_tag[HEADER_SIZE];
+    pj_uint64_t                 invite_usec;
+    pj_uint64_t                 hangup_usec;    /* 0 - the engine hangs up */
+    pj_uint64_t                 timeout_usec;   /* Deadline of the step in progress, 0 - none */
+    pj_bool_t                   ringing;
+    pj_bool_t                   timed_out;      /* Counted as timed out however it ends */
+    unsigned                    concurrency;    /* Active calls when it started */
+    media_verifier_t            verifier;
+} uac_call_t;
+
+typedef struct bench_param_t
+{
+    unsigned                    cps;
+    unsigned                    concurrency;
+    unsigned                    calls;
+    unsigned                    hold_msec;
+    char                        number[NUMBER_SIZE];
+    pj_bool_t                   sim;            /* Virtual clock of the engine */
+} bench_param_t;
+
+/* Latencies of one kind, in usec */
+typedef struct latency_t
+{
+    pj_uint64_t                 *samples;
+    unsigned                    cnt;
+} latency_t;
+
+/* Media verifier results of the finished calls */
+typedef struct media_stats_t
+{
+    unsigned                    checked_cnt;
+    unsigned                    bad_cnt;
+    unsigned                    min_bad_concurrency;    /* 0 - no bad calls */
+    unsigned                    no_tone_cnt;
+    unsigned                    segment_cnt;
+    unsigned                    cadence_error_cnt;
+    pj_uint64_t                 lost_cnt;
+    pj_uint64_t                 disorder_cnt;
+    pj_uint64_t                 ts_jump_cnt;
+    pj_uint64_t                 ptime_error_cnt;
+    double                      max_jitter_msec;
+    double                      max_interarrival_msec;
+} media_stats_t;
+
+typedef struct bench_t
+{
+    bench_param_t               param;
+    int                         sip_sock;
+    struct sockaddr_in          engine_addr;
+    uac_call_t                  calls[MAX_CONCURRENCY];
+    struct pollfd               fds[MAX_CONCURRENCY + 1];
+
+    unsigned                    active_cnt;
+    unsigned                    started_cnt;
+    unsigned                    finished_cnt;
+    unsigned                    answered_cnt;
+    unsigned                    rejected_cnt;
+    unsigned                    timed_out_cnt;
+    pj_uint64_t                 rtp_packets;
+    pj_uint64_t                 rtp_bytes;
+    media_verifier_param_t      verifier_param;
+    media_stats_t               media;
+    latency_t                   ringing;        /* INVITE to 180: SIP processing of the engine */
+    latency_t                   answer;         /* INVITE to 200: the ringing timer included */
+
+    pj_uint64_t                 first_invite_usec;
+    pj_uint64_t                 last_invite_usec;   /* The send window of the INVITEs */
+    pj_uint64_t                 engine_cpu_usec;
+    pj_uint64_t                 uac_cpu_usec;
+    pj_uint64_t                 wall_usec;
+} bench_t;
+
+static pj_status_t parse_args(int argc, char *argv[], bench_param_t *param);
+static void log_to_stderr(int level, const char *data, int len);
+static pj_uint64_t now_usec(void);
+static pj_uint64_t bench_now_usec(const bench_t *bench);
+static pj_uint64_t process_cpu_usec(void);
+static pj_uint64_t thread_cpu_usec(void);
+static int open_udp_socket(pj_uint16_t port);
+static pj_status_t bench_open(bench_t *bench);
+static void bench_close(bench_t *bench);
+static void send_msg(bench_t *bench, const char *msg, int len);
+static uac_call_t *find_free_call(bench_t *bench);
+static void call_start(bench_t *bench, uac_call_t *call, pj_uint64_t now);
+static void call_send_ack(bench_t *bench, const uac_call_t *call, pj_bool_t is_2xx);
+static void call_send_cancel(bench_t *bench, uac_call_t *call, pj_uint64_t now);
+static void call_send_bye(bench_t *bench, uac_call_t *call, pj_uint64_t now);
+static void call_finish(bench_t *bench, uac_call_t *call, call_result_e result);
+static pj_bool_t get_header(const char *msg, const char *name, const char *compact, char *value, size_t size);
+static uac_call_t *find_call(bench_t *bench, const char *msg);
+static void on_response(bench_t *bench, uac_call_t *call, const char *msg, pj_uint64_t now);
+static void on_bye(bench_t *bench, uac_call_t *call, const char *msg);
+static void receive_sip(bench_t *bench);
+static void set_verifier_param(bench_t *bench);
+static void media_stats_add(bench_t *bench, const uac_call_t *call);
+static void drain_rtp(bench_t *bench, uac_call_t *call);
+static void check_timers(bench_t *bench, pj_uint64_t now);
+static pj_bool_t is_response_due(const bench_t *bench);
+static void run(bench_t *bench);
+static void latency_add(latency_t *latency, pj_uint64_t usec);
+static int compare_u64(const void *a, const void *b);
+static double latency_percentile_msec(latency_t *latency, unsigned percentile);
+static void print_latency(const char *name, latency_t *latency);
+static void print_media(const media_stats_t *media);
+static void print_json(bench_t *bench);
+
+int main(int argc, char *argv[])
+{
+    static bench_t bench;
+    pj_status_t status;
+    pj_bool_t started = PJ_FALSE;
+    pj_uint64_t process_cpu;
+    pj_uint64_t uac_cpu;
+
+    /* Nothing to close yet, whatever fails below */
+    bench.sip_sock = -1;
+    for (unsigned i = 0; i < MAX_CONCURRENCY; i++)
+    {
+        bench.calls[i].rtp_sock = -1;
+    }
+
+    status = parse_args(argc, argv, &bench.param);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    bench.ringing.samples = (pj_uint64_t *)calloc(bench.param.calls, sizeof(pj_uint64_t));
+    bench.answer.samples = (pj_uint64_t *)calloc(bench.param.calls, sizeof(pj_uint64_t));
+    if ((bench.ringing.samples == NULL) || (bench.answer.samples == NULL))
+    {
+        status = PJ_ENOMEM;
+        goto _exit;
+    }
+
+    /* stdout is left for the JSON */
+    pj_log_set_log_func(&log_to_stderr);
+
+    /* A failed start has released the engine itself */
+    status = bench.param.sim ? auto_answer_start_sim() : auto_answer_start();
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    started = PJ_TRUE;
+    pj_log_set_level(BENCH_LOG_LEVEL);
+    set_verifier_param(&bench);
+
+    status = bench_open(&bench);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    process_cpu = process_cpu_usec();
+    uac_cpu = thread_cpu_usec();
+    bench.wall_usec = now_usec();
+
+    run(&bench);
+
+    bench.wall_usec = now_usec() - bench.wall_usec;
+    bench.uac_cpu_usec = thread_cpu_usec() - uac_cpu;
+    process_cpu = process_cpu_usec() - process_cpu;
+    bench.engine_cpu_usec = (process_cpu > bench.uac_cpu_usec) ? (process_cpu - bench.uac_cpu_usec) : 0;
+
+    print_json(&bench);
+
+_exit:
+    bench_close(&bench);
+
+    if (started)
+        auto_answer_stop();
+
+    free(bench.ringing.samples);
+    free(bench.answer.samples);
+
+    return (status == PJ_SUCCESS) ? 0 : 1;
+}
+
+static pj_status_t parse_args(int argc, char *argv[], bench_param_t *param)
+{
+    pj_status_t status = PJ_SUCCESS;
+    int opt;
+
+    param->cps = DEFAULT_CPS;
+    param->concurrency = DEFAULT_CONCURRENCY;
+    param->calls = DEFAULT_CALLS;
+    param->hold_msec = DEFAULT_HOLD_MSEC;
+    snprintf(param->number, sizeof(param->number), "%s", DEFAULT_NUMBER);
+
+    while ((opt = getopt(argc, argv, "r:l:m:d:s:v")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            param->cps = (unsigned)atoi(optarg);
+            break;
+        case 'l':
+            param->concurrency = (unsigned)atoi(optarg);
+            break;
+        case 'm':
+            param->calls = (unsigned)atoi(optarg);
+            break;
+        case 'd':
+            param->hold_msec = (unsigned)atoi(optarg);
+            break;
+        case 's':
+            snprintf(param->number, sizeof(param->number), "%s", optarg);
+            break;
+        case 'v':
+            param->sim = PJ_TRUE;
+            break;
+        default:
+            status = PJ_EINVAL;
+            break;
+        }
+    }
+
+    if ((param->cps == 0) || (param->calls == 0)
+        || (param->concurrency == 0) || (param->concurrency > MAX_CONCURRENCY))
+    {
+        status = PJ_EINVAL;
+    }
+
+    if (status != PJ_SUCCESS)
+    {
+        fprintf(stderr, "Usage: %s [-r cps] [-l concurrent calls, up to %d] [-m calls] [-d hold msec] [-s number] [-v]\n",
+                argv[0], MAX_CONCURRENCY);
+    }
+
+    return status;
+}
+
+static void log_to_stderr(int level, const char *data, int len)
+{
+    PJ_UNUSED_ARG(level);
+
+    fwrite(data, 1, (size_t)len, stderr);
+
+    return;
+}
+
+static pj_uint64_t now_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (pj_uint64_t)ts.tv_sec * USEC_IN_SEC + (pj_uint64_t)ts.tv_nsec / NSEC_IN_USEC;
+}
+
+/* Time of the calls: the virtual clock of the engine with -v */
+static pj_uint64_t bench_now_usec(const bench_t *bench)
+{
+    return bench->param.sim ? auto_answer_sim_now_usec() : now_usec();
+}
+
+/* All the threads of the process: the engine and the UAC */
+static pj_uint64_t process_cpu_usec(void)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return (pj_uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * USEC_IN_SEC
+           + (pj_uint64_t)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+/* The UAC runs in the calling thread only */
+static pj_uint64_t thread_cpu_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+    return (pj_uint64_t)ts.tv_sec * USEC_IN_SEC + (pj_uint64_t)ts.tv_nsec / NSEC_IN_USEC;
+}
+
+static int open_udp_socket(pj_uint16_t port)
+{
+    struct sockaddr_in addr;
+    int sock;
+
+    sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0)
+        goto _exit;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, LOOPBACK_ADDR, &addr.sin_addr);
+
+    if ((bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+        || (fcntl(sock, F_SETFL, O_NONBLOCK) != 0))
+    {
+        fprintf(stderr, "Unable to open UDP port %u: %s\n", port, strerror(errno));
+        close(sock);
+        sock = -1;
+    }
+
+_exit:
+    return sock;
+}
+
+/* The SIP socket and one RTP socket for each call slot */
+static pj_status_t bench_open(bench_t *bench)
+{
+    pj_status_t status = PJ_SUCCESS;
+
+    memset(&bench->engine_addr, 0, sizeof(bench->engine_addr));
+    bench->engine_addr.sin_family = AF_INET;
+    bench->engine_addr.sin_port = htons(ENGINE_SIP_PORT);
+    inet_pton(AF_INET, LOOPBACK_ADDR, &bench->engine_addr.sin_addr);
+
+    bench->sip_sock = open_udp_socket(UAC_SIP_PORT);
+    if (bench->sip_sock < 0)
+    {
+        status = PJ_EINVALIDOP;
+        goto _exit;
+    }
+
+    bench->fds[0].fd = bench->sip_sock;
+    bench->fds[0].events = POLLIN;
+
+    for (unsigned i = 0; i < bench->param.concurrency; i++)
+    {
+        uac_call_t *call = &bench->calls[i];
+
+        call->index = i;
+        call->rtp_port = (pj_uint16_t)(UAC_RTP_PORT + i * RTP_PORT_STEP);
+        call->rtp_sock = open_udp_socket(call->rtp_port);
+        if (call->rtp_sock < 0)
+        {
+            status = PJ_EINVALIDOP;
+            goto _exit;
+        }
+
+        bench->fds[i + 1].fd = call->rtp_sock;
+        bench->fds[i + 1].events = POLLIN;
+    }
+
+_exit:
+    return status;
+}
+
+static void bench_close(bench_t *bench)
+{
+    if (bench->sip_sock >= 0)
+    {
+        close(bench->sip_sock);
+        bench->sip_sock = -1;
+    }
+
+    for (unsigned i = 0; i < MAX_CONCURRENCY; i++)
+    {
+        if (bench->calls[i].rtp_sock >= 0)
+        {
+            close(bench->calls[i].rtp_sock);
+            bench->calls[i].rtp_sock = -1;
+        }
+    }
+
+    return;
+}
+
+static void send_msg(bench_t *bench, const char *msg, int len)
+{
+    if ((len > 0) && (len < MSG_SIZE))
+    {
+        sendto(bench->sip_sock, msg, (size_t)len, 0,
+               (const struct sockaddr *)&bench->engine_addr, sizeof(bench->engine_addr));
+    }
+
+    return;
+}
+
+static uac_call_t *find_free_call(bench_t *bench)
+{
+    uac_call_t *call = NULL;
+
+    for (unsigned i = 0; i < bench->param.concurrency; i++)
+    {
+        if (bench->calls[i].state == eCALL_IDLE)
+        {
+            call = &bench->calls[i];
+            break;
+        }
+    }
+
+    return call;
+}
+
+static void call_start(bench_t *bench, uac_call_t *call, pj_uint64_t now)
+{
+    char sdp[SDP_SIZE];
+    char msg[MSG_SIZE];
+    int sdp_len;
+    int len;
+
+    call->seq = bench->started_cnt++;
+    call->state = eCALL_INVITING;
+    call->invite_usec = now;
+    call->hangup_usec = 0;
+    call->timeout_usec = now + CALL_TIMEOUT_MSEC * USEC_IN_MSEC;
+    call->ringing = PJ_FALSE;
+    call->timed_out = PJ_FALSE;
+    call->to_tag[0] = '\0';
+    bench->active_cnt++;
+    call->concurrency = bench->active_cnt;
+    media_verifier_init(&call->verifier, &bench->verifier_param);
+
+    if (bench->first_invite_usec == 0)
+        bench->first_invite_usec = now;
+    bench->last_invite_usec = now;
+
+    sdp_len = snprintf(sdp, sizeof(sdp),
+                       "v=0\r\n"
+                       "o=loadgen %u %u IN IP4 " LOOPBACK_ADDR "\r\n"
+                       "s=-\r\n"
+                       "c=IN IP4 " LOOPBACK_ADDR "\r\n"
+                       "t=0 0\r\n"
+                       "m=audio %u RTP/AVP 0\r\n"
+                       "a=rtpmap:0 PCMU/8000\r\n",
+                       call->seq, call->seq, call->rtp_port);
+
+    len = snprintf(msg, sizeof(msg),
+                   "INVITE sip:%s@" LOOPBACK_ADDR ":%d SIP/2.0\r\n"
+                   "Via: SIP/2.0/UDP " LOOPBACK_ADDR ":%d;branch=z9hG4bK-lg-%u-%u\r\n"
+                   "From: <sip:loadgen@" LOOPBACK_ADDR ":%d>;tag=lg-%u\r\n"
+                   "To: <sip:%s@" LOOPBACK_ADDR ":%d>\r\n"
+                   "Call-ID: " CALL_ID_FORMAT "\r\n"
+                   "CSeq: 1 INVITE\r\n"
+                   "Contact: <sip:loadgen@" LOOPBACK_ADDR ":%d>\r\n"
+                   "Max-Forwards: 70\r\n"
+                   "Content-Type: application/sdp\r\n"
+                   "Content-Length: %d\r\n"
+                   "\r\n"
+                   "%s",
+                   bench->param.number, ENGINE_SIP_PORT,
+                   UAC_SIP_PORT, call->index, call->seq,
+                   UAC_SIP_PORT, call->seq,
+                   bench->param.number, ENGINE_SIP_PORT,
+                   call->index, call->seq,
+                   UAC_SIP_PORT,
+                   sdp_len,
+                   sdp);
+
+    send_msg(bench, msg, len);
+
+    return;
+}
+
+/* The ACK of a 2xx is a new transaction, the ACK of a failure belongs
+ * to the INVITE transaction and has its branch
+ */
+static void call_send_ack(bench_t *bench, const uac_call_t *call, pj_bool_t is_2xx)
+{
+    char msg[MSG_SIZE];
+    int len;
+
+    len = snprintf(msg, sizeof(msg),
+                   "ACK sip:%s@" LOOPBACK_ADDR ":%d SIP/2.0\r\n"
+                   "Via: SIP/2.0/UDP " LOOPBACK_ADDR ":%d;branch=z9hG4bK-lg-%u-%u%s\r\n"
+                   "From: <sip:loadgen@" LOOPBACK_ADDR ":%d>;tag=lg-%u\r\n"
+                   "To: <sip:%s@" LOOPBACK_ADDR ":%d>" TAG_PARAM "%s\r\n"
+                   "Call-ID: " CALL_ID_FORMAT "\r\n"
+                   "CSeq: 1 ACK\r\n"
+                   "Max-Forwards: 70\r\n"
+                   "Content-Length: 0\r\n"
+                   "\r\n",
+                   bench->param.number, ENGINE_SIP_PORT,
+                   UAC_SIP_PORT, call->index, call->seq, is_2xx ? "-ack" : "",
+                   UAC_SIP_PORT, call->seq,
+                   bench->param.number, ENGINE_SIP_PORT, call->to_tag,
+                   call->index, call->seq);
+
+    send_msg(bench, msg, len);
+
+    return;
+}
+
+/* Same branch and To as the INVITE, the engine answers it with 487 */
+static void call_send_cancel(bench_t *bench, uac_call_t *call, pj_uint64_t now)
+{
+    char msg[MSG_SIZE];
+    int len;
+
+    len = snprintf(msg, sizeof(msg),
+                   "CANCEL sip:%s@" LOOPBACK_ADDR ":%d SIP/2.0\r\n"
+                   "Via: SIP/2.0/UDP " LOOPBACK_ADDR ":%d;branch=z9hG4bK-lg-%u-%u\r\n"
+                   "From: <sip:loadgen@" LOOPBACK_ADDR ":%d>;tag=lg-%u\r\n"
+                   "To: <sip:%s@" LOOPBACK_ADDR ":%d>\r\n"
+                   "Call-ID: " CALL_ID_FORMAT "\r\n"
+                   "CSeq: 1 CANCEL\r\n"
+                   "Max-Forwards: 70\r\n"
+                   "Content-Length: 0\r\n"
+                   "\r\n",
+                   bench->param.number, ENGINE_SIP_PORT,
+                   UAC_SIP_PORT, call->index, call->seq,
+                   UAC_SIP_PORT, call->seq,
+                   bench->param.number, ENGINE_SIP_PORT,
+                   call->index, call->seq);
+
+    send_msg(bench, msg, len);
+    call->state = eCALL_CANCEL_SENT;
+    call->timeout_usec = now + CALL_TIMEOUT_MSEC * USEC_IN_MSEC;
+
+    return;
+}
+
+static void call_send_bye(bench_t *bench, uac_call_t *call, pj_uint64_t now)
+{
+    char msg[MSG_SIZE];
+    int len;
+
+    len = snprintf(msg, sizeof(msg),
+                   "BYE sip:%s@" LOOPBACK_ADDR ":%d SIP/2.0\r\n"
+                   "Via: SIP/2.0/UDP " LOOPBACK_ADDR ":%d;branch=z9hG4bK-lg-%u-%u-bye\r\n"
+                   "From: <sip:loadgen@" LOOPBACK_ADDR ":%d>;tag=lg-%u\r\n"
+                   "To: <sip:%s@" LOOPBACK_ADDR ":%d>" TAG_PARAM "%s\r\n"
+                   "Call-ID: " CALL_ID_FORMAT "\r\n"
+                   "CSeq: 2 BYE\r\n"
+                   "Max-Forwards: 70\r\n"
+                   "Content-Length: 0\r\n"
+                   "\r\n",
+                   bench->param.number, ENGINE_SIP_PORT,
+                   UAC_SIP_PORT, call->index, call->seq,
+                   UAC_SIP_PORT, call->seq,
+                   bench->param.number, ENGINE_SIP_PORT, call->to_tag,
+                   call->index, call->seq);
+
+    send_msg(bench, msg, len);
+    call->state = eCALL_BYE_SENT;
+    call->timeout_usec = now + CALL_TIMEOUT_MSEC * USEC_IN_MSEC;
+
+    return;
+}
+
+static void call_finish(bench_t *bench, uac_call_t *call, call_result_e result)
+{
+    if (call->timed_out)
+        result = eCALL_RESULT_TIMED_OUT;
+
+    if (result == eCALL_RESULT_REJECTED)
+        bench->rejected_cnt++;
+    else if (result == eCALL_RESULT_TIMED_OUT)
+        bench->timed_out_cnt++;
+
+    media_stats_add(bench, call);
+
+    call->state = eCALL_IDLE;
+    bench->active_cnt--;
+    bench->finished_cnt++;
+
+    return;
+}
+
+/* Value of the header with the full or the compact name at a line start */
+static pj_bool_t get_header(const char *msg, const char *name, const char *compact, char *value, size_t size)
+{
+    char pattern[HEADER_SIZE];
+    const char *start = NULL;
+    const char *end;
+    pj_bool_t found = PJ_FALSE;
+
+    snprintf(pattern, sizeof(pattern), "\r\n%s:", name);
+    start = strstr(msg, pattern);
+    if ((start == NULL) && compact)
+    {
+        snprintf(pattern, sizeof(pattern), "\r\n%s:", compact);
+        start = strstr(msg, pattern);
+    }
+
+    if (start == NULL)
+        goto _exit;
+
+    start += strlen(pattern);
+    while (*start == ' ')
+        start++;
+
+    end = strstr(start, "\r\n");
+    if ((end == NULL) || ((size_t)(end - start) >= size))
+        goto _exit;
+
+    memcpy(value, start, (size_t)(end - start));
+    value[end - start] = '\0';
+    found = PJ_TRUE;
+
+_exit:
+    return found;
+}
+
+/* The Call-ID carries the slot and the number of the call */
+static uac_call_t *find_call(bench_t *bench, const char *msg)
+{
+    char call_id[HEADER_SIZE];
+    unsigned index;
+    unsigned seq;
+    uac_call_t *call = NULL;
+
+    if (!get_header(msg, "Call-ID", "i", call_id, sizeof(call_id)))
+        goto _exit;
+
+    if (sscanf(call_id, "lg-%u-%u@", &index, &seq) != 2)
+        goto _exit;
+
+    if ((index < bench->param.concurrency)
+        && (bench->calls[index].state != eCALL_IDLE)
+        && (bench->calls[index].seq == seq))
+    {
+        call = &bench->calls[index];
+    }
+
+_exit:
+    return call;
+}
+
+static void on_response(bench_t *bench, uac_call_t *call, const char *msg, pj_uint64_t now)
+{
+    char cseq[HEADER_SIZE];
+    char to[HEADER_SIZE];
+    const char *tag;
+    const char *ptime;
+    int code = atoi(msg + strlen(SIP_RESPONSE_PREFIX));
+
+    if (!get_header(msg, "CSeq", NULL, cseq, sizeof(cseq)))
+        goto _exit;
+
+    if (strstr(cseq, "BYE"))
+    {
+        if ((code >= SIP_STATUS_OK) && (call->state == eCALL_BYE_SENT))
+            call_finish(bench, call, eCALL_RESULT_ENDED);
+        goto _exit;
+    }
+
+    if (strstr(cseq, "CANCEL"))
+        goto _exit;
+
+    if (get_header(msg, "To", "t", to, sizeof(to)) && ((tag = strstr(to, TAG_PARAM)) != NULL))
+    {
+        tag += strlen(TAG_PARAM);
+        snprintf(call->to_tag, sizeof(call->to_tag), "%.*s", (int)strcspn(tag, ";>"), tag);
+    }
+
+    if ((code == SIP_STATUS_RINGING) && !call->ringing)
+    {
+        call->ringing = PJ_TRUE;
+        latency_add(&bench->ringing, now - call->invite_usec);
+    }
+    else if ((code >= SIP_STATUS_OK) && (code < SIP_STATUS_FAILURE_MIN))
+    {
+        /* Retransmissions of the 200 are acknowledged again */
+        call_send_ack(bench, call, PJ_TRUE);
+
+        if (call->state == eCALL_INVITING)
+        {
+            /* The offer has no a=ptime: the packets must have the length the answer announced */
+            if ((ptime = strstr(msg, PTIME_ATTR)) != NULL)
+                call->verifier.param.ptime_msec = (unsigned)atoi(ptime + strlen(PTIME_ATTR));
+
+            call->state = eCALL_CONFIRMED;
+            bench->answered_cnt++;
+            latency_add(&bench->answer, now - call->invite_usec);
+
+            /* Only the setup is timed: a held call has no deadline until
+             * its BYE, with -d 0 the BYE of the engine is waited for */
+            if (bench->param.hold_msec > 0)
+            {
+                call->hangup_usec = now + bench->param.hold_msec * USEC_IN_MSEC;
+                call->timeout_usec = 0;
+            }
+            else
+            {
+                call->timeout_usec = now + CALL_TIMEOUT_MSEC * USEC_IN_MSEC;
+            }
+        }
+        else if (call->state == eCALL_CANCEL_SENT)
+        {
+            /* Answered before the CANCEL: the call is ended at once */
+            call_send_bye(bench, call, now);
+        }
+    }
+    else if ((code >= SIP_STATUS_FAILURE_MIN) && (call->state == eCALL_INVITING))
+    {
+        call_send_ack(bench, call, PJ_FALSE);
+        call_finish(bench, call, eCALL_RESULT_REJECTED);
+    }
+    else if ((code >= SIP_STATUS_FAILURE_MIN) && (call->state == eCALL_CANCEL_SENT))
+    {
+        /* 487 of the cancelled INVITE */
+        call_send_ack(bench, call, PJ_FALSE);
+        call_finish(bench, call, eCALL_RESULT_TIMED_OUT);
+    }
+
+_exit:
+    return;
+}
+
+/* The engine hangs up: 200 with the headers of the request */
+static void on_bye(bench_t *bench, uac_call_t *call, const char *msg)
+{
+    char via[HEADER_SIZE];
+    char from[HEADER_SIZE];
+    char to[HEADER_SIZE];
+    char call_id[HEADER_SIZE];
+    char cseq[HEADER_SIZE];
+    char response[MSG_SIZE];
+    int len;
+
+    if (!get_header(msg, "Via", "v", via, sizeof(via))
+        || !get_header(msg, "From", "f", from, sizeof(from))
+        || !get_header(msg, "To", "t", to, sizeof(to))
+        || !get_header(msg, "Call-ID", "i", call_id, sizeof(call_id))
+        || !get_header(msg, "CSeq", NULL, cseq, sizeof(cseq)))
+    {
+        goto _exit;
+    }
+
+    len = snprintf(response, sizeof(response),
+                   SIP_RESPONSE_PREFIX "200 OK\r\n"
+                   "Via: %s\r\n"
+                   "From: %s\r\n"
+                   "To: %s\r\n"
+                   "Call-ID: %s\r\n"
+                   "CSeq: %s\r\n"
+                   "Content-Length: 0\r\n"
+                   "\r\n",
+                   via, from, to, call_id, cseq);
+
+    send_msg(bench, response, len);
+
+    if (call)
+        call_finish(bench, call, eCALL_RESULT_ENDED);
+
+_exit:
+    return;
+}
+
+static void receive_sip(bench_t *bench)
+{
+    char msg[MSG_SIZE];
+    ssize_t len;
+    pj_uint64_t now = bench_now_usec(bench);
+
+    while ((len = recv(bench->sip_sock, msg, sizeof(msg) - 1, 0)) > 0)
+    {
+        uac_call_t *call;
+
+        msg[len] = '\0';
+        call = find_call(bench, msg);
+
+        if (strncmp(msg, SIP_BYE_PREFIX, strlen(SIP_BYE_PREFIX)) == 0)
+            on_bye(bench, call, msg);
+        else if (call && (strncmp(msg, SIP_RESPONSE_PREFIX, strlen(SIP_RESPONSE_PREFIX)) == 0))
+            on_response(bench, call, msg, now);
+    }
+
+    return;
+}
+
+/* What the engine plays to the number with its default tones */
+static void set_verifier_param(bench_t *bench)
+{
+    media_verifier_param_t *param = &bench->verifier_param;
+
+    pj_bzero(param, sizeof(*param));
+    param->clock_rate = CLOCK_RATE;
+    param->tolerance_msec = CADENCE_TOLERANCE_MSEC;
+    param->max_jitter_msec = MAX_JITTER_MSEC;
+
+    if (strcmp(bench->param.number, LONG_TONE_NUMBER) == 0)
+    {
+        param->tone_freq = TONE_FREQ;
+        param->on_msec = TONE_ON_MSEC;
+    }
+    else if (strcmp(bench->param.number, KPV_TONE_NUMBER) == 0)
+    {
+        param->tone_freq = TONE_FREQ;
+        param->on_msec = TONE_ON_MSEC;
+        param->off_msec = KPV_OFF_MSEC;
+    }
+
+    return;
+}
+
+/* Calls without media (rejected before the answer) are not checked */
+static void media_stats_add(bench_t *bench, const uac_call_t *call)
+{
+    const media_verifier_t *verifier = &call->verifier;
+    media_stats_t *media = &bench->media;
+
+    if (verifier->packet_cnt == 0)
+        goto _exit;
+
+    media->checked_cnt++;
+    media->lost_cnt += verifier->lost_cnt;
+    media->disorder_cnt += verifier->disorder_cnt;
+    media->ts_jump_cnt += verifier->ts_jump_cnt;
+    media->ptime_error_cnt += verifier->ptime_error_cnt;
+    media->segment_cnt += verifier->segment_cnt;
+    media->cadence_error_cnt += verifier->cadence_error_cnt;
+    media->max_jitter_msec = PJ_MAX(media->max_jitter_msec, verifier->max_jitter_msec);
+    media->max_interarrival_msec = PJ_MAX(media->max_interarrival_msec, verifier->max_interarrival_msec);
+
+    if (verifier->param.tone_freq && !verifier->tone_detected)
+        media->no_tone_cnt++;
+
+    if (!media_verifier_is_ok(verifier))
+    {
+        media->bad_cnt++;
+        if ((media->min_bad_concurrency == 0) || (call->concurrency < media->min_bad_concurrency))
+            media->min_bad_concurrency = call->concurrency;
+    }
+
+_exit:
+    return;
+}
+
+/* RTP of a finished call is dropped unchecked */
+static void drain_rtp(bench_t *bench, uac_call_t *call)
+{
+    char buf[RTP_BUF_SIZE];
+    ssize_t len;
+
+    while ((len = recv(call->rtp_sock, buf, sizeof(buf), 0)) > 0)
+    {
+        bench->rtp_packets++;
+        bench->rtp_bytes += (pj_uint64_t)len;
+
+        if (call->state != eCALL_IDLE)
+            media_verifier_on_rtp(&call->verifier, buf, (pj_size_t)len, bench_now_usec(bench));
+    }
+
+    return;
+}
+
+static void check_timers(bench_t *bench, pj_uint64_t now)
+{
+    for (unsigned i = 0; i < bench->param.concurrency; i++)
+    {
+        uac_call_t *call = &bench->calls[i];
+
+        if (call->state == eCALL_IDLE)
+            continue;
+
+        if (call->timeout_usec && (now >= call->timeout_usec))
+        {
+            /* The dialog is torn down, the slot is reused only when it is gone */
+            call->timed_out = PJ_TRUE;
+
+            if (call->state == eCALL_INVITING)
+                call_send_cancel(bench, call, now);
+            else if (call->state == eCALL_CONFIRMED)
+                call_send_bye(bench, call, now);
+            else
+                call_finish(bench, call, eCALL_RESULT_TIMED_OUT);
+        }
+        else if ((call->state == eCALL_CONFIRMED) && call->hangup_usec && (now >= call->hangup_usec))
+        {
+            call_send_bye(bench, call, now);
+        }
+    }
+
+    return;
+}
+
+/* A request of the UAC which the engine answers at once, not on one of
+ * its timers: the INVITE before the 180, the CANCEL and the BYE */
+static pj_bool_t is_response_due(const bench_t *bench)
+{
+    pj_bool_t is_due = PJ_FALSE;
+
+    for (unsigned i = 0; (i < bench->param.concurrency) && !is_due; i++)
+    {
+        const uac_call_t *call = &bench->calls[i];
+
+        is_due = ((call->state == eCALL_INVITING) && !call->ringing)
+                 || (call->state == eCALL_CANCEL_SENT)
+                 || (call->state == eCALL_BYE_SENT);
+    }
+
+    return is_due;
+}
+
+/* Calls are started on a fixed schedule, a call which waits for a free
+ * slot does not make a burst later
+ */
+static void run(bench_t *bench)
+{
+    pj_uint64_t period_usec = USEC_IN_SEC / bench->param.cps;
+    pj_uint64_t next_invite_usec = bench_now_usec(bench);
+    pj_uint64_t progress_usec = now_usec();
+
+    while (bench->finished_cnt < bench->param.calls)
+    {
+        pj_uint64_t now = bench_now_usec(bench);
+
+        while ((bench->started_cnt < bench->param.calls)
+               && (bench->active_cnt < bench->param.concurrency)
+               && (now >= next_invite_usec))
+        {
+            call_start(bench, find_free_call(bench), now);
+            next_invite_usec += period_usec;
+        }
+
+        if (now > next_invite_usec + period_usec)
+            next_invite_usec = now;
+
+        if (poll(bench->fds, bench->param.concurrency + 1, POLL_MSEC) > 0)
+        {
+            progress_usec = now_usec();
+
+            if (bench->fds[0].revents & POLLIN)
+                receive_sip(bench);
+
+            for (unsigned i = 0; i < bench->param.concurrency; i++)
+            {
+                if (bench->fds[i + 1].revents & POLLIN)
+                    drain_rtp(bench, &bench->calls[i]);
+            }
+        }
+        else if (bench->param.sim
+                 && (!is_response_due(bench) || (now_usec() - progress_usec >= SIM_MAX_WAIT_MSEC * USEC_IN_MSEC)))
+        {
+            /* Nothing in flight on either side, the engine may go on. The
+             * virtual time stands still while the SIP threads of the
+             * engine, on the wall clock, still owe a response, so a slow
+             * thread does not move the results */
+            auto_answer_sim_advance(SIM_STEP_MSEC);
+            progress_usec = now_usec();
+        }
+
+        check_timers(bench, bench_now_usec(bench));
+    }
+
+    return;
+}
+
+static void latency_add(latency_t *latency, pj_uint64_t usec)
+{
+    latency->samples[latency->cnt++] = usec;
+
+    return;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    pj_uint64_t x = *(const pj_uint64_t *)a;
+    pj_uint64_t y = *(const pj_uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Nearest rank */
+static double latency_percentile_msec(latency_t *latency, unsigned percentile)
+{
+    unsigned rank;
+    double msec = 0;
+
+    if (latency->cnt == 0)
+        goto _exit;
+
+    qsort(latency->samples, latency->cnt, sizeof(pj_uint64_t), &compare_u64);
+
+    rank = (latency->cnt * percentile + PERCENT - 1) / PERCENT;
+    if (rank > 0)
+        rank--;
+
+    msec = (double)latency->samples[rank] / USEC_IN_MSEC;
+
+_exit:
+    return msec;
+}
+
+static void print_latency(const char *name, latency_t *latency)
+{
+    printf("  \"%s\": { \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f },\n",
+           name,
+           latency_percentile_msec(latency, PERCENTILE_50),
+           latency_percentile_msec(latency, PERCENTILE_90),
+           latency_percentile_msec(latency, PERCENTILE_99),
+           latency_percentile_msec(latency, PERCENT));
+
+    return;
+}
+
+static void print_media(const media_stats_t *media)
+{
+    printf("  \"media\": {\n");
+    printf("    \"checked_calls\": %u,\n", media->checked_cnt);
+    printf("    \"bad_calls\": %u,\n", media->bad_cnt);
+    printf("    \"min_bad_concurrency\": %u,\n", media->min_bad_concurrency);
+    printf("    \"lost_packets\": %llu,\n", (unsigned long long)media->lost_cnt);
+    printf("    \"disordered_packets\": %llu,\n", (unsigned long long)media->disorder_cnt);
+    printf("    \"timestamp_jumps\": %llu,\n", (unsigned long long)media->ts_jump_cnt);
+    printf("    \"ptime_errors\": %llu,\n", (unsigned long long)media->ptime_error_cnt);
+    printf("    \"max_jitter_msec\": %.3f,\n", media->max_jitter_msec);
+    printf("    \"max_interarrival_msec\": %.3f,\n", media->max_interarrival_msec);
+    printf("    \"no_tone_calls\": %u,\n", media->no_tone_cnt);
+    printf("    \"cadence_segments\": %u,\n", media->segment_cnt);
+    printf("    \"cadence_errors\": %u\n", media->cadence_error_cnt);
+    printf("  },\n");
+
+    return;
+}
+
+static void print_json(bench_t *bench)
+{
+    double send_sec = 0;
+    double invite_cps = 0;
+    double cpu_msec_per_call = 0;
+
+    /* The rate the INVITEs went out at: n INVITEs span n - 1 intervals.
+     * The ringing timer and the hold of the engine are not in it, they
+     * are in setup_msec of every call */
+    if (bench->last_invite_usec > bench->first_invite_usec)
+        send_sec = (double)(bench->last_invite_usec - bench->first_invite_usec) / USEC_IN_SEC;
+
+    if ((send_sec > 0) && (bench->started_cnt > 1))
+        invite_cps = (bench->started_cnt - 1) / send_sec;
+
+    if (bench->answered_cnt > 0)
+        cpu_msec_per_call = (double)bench->engine_cpu_usec / USEC_IN_MSEC / bench->answered_cnt;
+
+    printf("{\n");
+    printf("  \"offered_cps\": %u,\n", bench->param.cps);
+    printf("  \"concurrency\": %u,\n", bench->param.concurrency);
+    printf("  \"calls\": %u,\n", bench->param.calls);
+    printf("  \"hold_msec\": %u,\n", bench->param.hold_msec);
+    printf("  \"virtual_clock\": %s,\n", bench->param.sim ? "true" : "false");
+    printf("  \"wall_msec\": %.1f,\n", (double)bench->wall_usec / USEC_IN_MSEC);
+    printf("  \"answered\": %u,\n", bench->answered_cnt);
+    printf("  \"failed\": %u,\n", bench->rejected_cnt + bench->timed_out_cnt);
+    printf("  \"rejected\": %u,\n", bench->rejected_cnt);
+    printf("  \"timed_out\": %u,\n", bench->timed_out_cnt);
+    printf("  \"invite_cps\": %.2f,\n", invite_cps);
+    printf("  \"invite_window_msec\": %.1f,\n", (double)(bench->last_invite_usec - bench->first_invite_usec) / USEC_IN_MSEC);
+    print_latency("ringing_msec", &bench->ringing);
+    print_latency("setup_msec", &bench->answer);
+    print_media(&bench->media);
+    printf("  \"rtp_packets\": %llu,\n", (unsigned long long)bench->rtp_packets);
+    printf("  \"rtp_bytes\": %llu,\n", (unsigned long long)bench->rtp_bytes);
+    printf("  \"engine_cpu_msec\": %.1f,\n", (double)bench->engine_cpu_usec / USEC_IN_MSEC);
+    printf("  \"uac_cpu_msec\": %.1f,\n", (double)bench->uac_cpu_usec / USEC_IN_MSEC);
+    printf("  \"cpu_msec_per_call\": %.3f\n", cpu_msec_per_call);
+    printf("}\n");
+
+    return;
+}
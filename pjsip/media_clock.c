@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "media_clock.h"
+
+#define THIS_FILE                   "media_clock.c"
+#define THREAD_NAME                 "media-clock"
+#define NSEC_IN_USEC                1000
+#define USEC_IN_MSEC                1000
+#define NSEC_IN_SEC                 1000000000L
+#define BITS_IN_BYTE                8
+#define MAX_TIMER_ERRORS            100
+
+struct media_clock_t
+{
+    pjmedia_port                *u_port;
+    pjmedia_port                *d_port;
+    media_clock_param_t         param;
+    pj_thread_t                 *thread;
+    int                         timer_fd;
+    volatile pj_bool_t          quit;
+    pj_status_t                 status;     /* Set once by the thread when it gives up */
+
+    void                        *buf;
+    pj_size_t                   buf_size;
+    unsigned                    samples_per_frame;
+    pj_uint64_t                 period_nsec;
+    pj_timestamp                timestamp;
+    pj_uint64_t                 skipped_cnt;
+};
+
+static pj_size_t port_frame_size(const pjmedia_port *port);
+static void timespec_add_nsec(struct timespec *ts, pj_uint64_t nsec);
+static pj_status_t start_timer(media_clock_t *clock);
+static void apply_thread_settings(const media_clock_t *clock);
+static void run_tick(media_clock_t *clock);
+static int clock_thread_routine(void *arg);
+
+pj_status_t media_clock_create(pj_pool_t *pool,
+                               pjmedia_port *u_port,
+                               pjmedia_port *d_port,
+                               const media_clock_param_t *param,
+                               media_clock_t **p_clock)
+{
+    pj_status_t status = PJ_SUCCESS;
+    media_clock_t *clock;
+
+    clock = PJ_POOL_ZALLOC_T(pool, media_clock_t);
+    clock->u_port = u_port;
+    clock->d_port = d_port;
+    clock->param = *param;
+    clock->timer_fd = -1;
+    clock->samples_per_frame = PJMEDIA_PIA_SPF(&d_port->info);
+    clock->period_nsec = (pj_uint64_t)d_port->info.fmt.det.aud.frame_time_usec * NSEC_IN_USEC;
+
+    if (clock->param.max_catch_up == 0)
+        clock->param.max_catch_up = 1;
+
+    /* The buffer fits the frame of both ports */
+    clock->buf_size = PJ_MAX(port_frame_size(u_port), port_frame_size(d_port));
+    clock->buf = pj_pool_alloc(pool, clock->buf_size);
+    if (clock->buf == NULL)
+    {
+        status = PJ_ENOMEM;
+        goto _exit;
+    }
+
+    status = pj_thread_create(pool, THREAD_NAME, &clock_thread_routine, clock, 0, PJ_THREAD_SUSPENDED, &clock->thread);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    *p_clock = clock;
+
+_exit:
+    return status;
+}
+
+pj_status_t media_clock_start(media_clock_t *clock)
+{
+    pj_status_t status;
+
+    status = start_timer(clock);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    status = pj_thread_resume(clock->thread);
+
+_exit:
+    return status;
+}
+
+pj_status_t media_clock_stop(media_clock_t *clock)
+{
+    clock->quit = PJ_TRUE;
+
+    if (clock->thread)
+    {
+        pj_thread_resume(clock->thread);
+        pj_thread_join(clock->thread);
+        pj_thread_destroy(clock->thread);
+        clock->thread = NULL;
+    }
+
+    if (clock->timer_fd >= 0)
+    {
+        close(clock->timer_fd);
+        clock->timer_fd = -1;
+    }
+
+    return PJ_SUCCESS;
+}
+
+pj_uint64_t media_clock_get_skipped_cnt(const media_clock_t *clock)
+{
+    return clock->skipped_cnt;
+}
+
+pj_status_t media_clock_get_status(const media_clock_t *clock)
+{
+    return __atomic_load_n(&clock->status, __ATOMIC_ACQUIRE);
+}
+
+static pj_size_t port_frame_size(const pjmedia_port *port)
+{
+    return (pj_size_t)PJMEDIA_PIA_SPF(&port->info) * (PJMEDIA_PIA_BITS(&port->info) / BITS_IN_BYTE);
+}
+
+static void timespec_add_nsec(struct timespec *ts, pj_uint64_t nsec)
+{
+    ts->tv_sec += (time_t)(nsec / NSEC_IN_SEC);
+    ts->tv_nsec += (long)(nsec % NSEC_IN_SEC);
+
+    if (ts->tv_nsec >= NSEC_IN_SEC)
+    {
+        ts->tv_sec++;
+        ts->tv_nsec -= NSEC_IN_SEC;
+    }
+
+    return;
+}
+
+/* Periodic timer with the first deadline one period from now. The
+ * deadlines are absolute, so a late wake up does not shift the next ones
+ */
+static pj_status_t start_timer(media_clock_t *clock)
+{
+    pj_status_t status = PJ_SUCCESS;
+    struct itimerspec spec;
+
+    clock->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (clock->timer_fd < 0)
+    {
+        status = PJ_STATUS_FROM_OS(errno);
+        goto _exit;
+    }
+
+    pj_bzero(&spec, sizeof(spec));
+    clock_gettime(CLOCK_MONOTONIC, &spec.it_value);
+    timespec_add_nsec(&spec.it_value, clock->period_nsec);
+    timespec_add_nsec(&spec.it_interval, clock->period_nsec);
+
+    if (timerfd_settime(clock->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) != 0)
+    {
+        status = PJ_STATUS_FROM_OS(errno);
+        close(clock->timer_fd);
+        clock->timer_fd = -1;
+    }
+
+_exit:
+    return status;
+}
+
+/* Real time priority, a failure only degrades timing */
+static void apply_thread_settings(const media_clock_t *clock)
+{
+    int err;
+
+    if (clock->param.rt_priority != 0)
+    {
+        struct sched_param sched;
+
+        pj_bzero(&sched, sizeof(sched));
+        sched.sched_priority = (int)clock->param.rt_priority;
+
+        err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &sched);
+        if (err != 0)
+            PJ_LOG(2, (THIS_FILE, "Unable to set SCHED_FIFO %u for media clock: %s",
+                       clock->param.rt_priority, strerror(err)));
+    }
+
+    return;
+}
+
+/* Same frame exchange as the clock callback of pjmedia_master_port */
+static void run_tick(media_clock_t *clock)
+{
+    pjmedia_frame frame;
+
+    pj_bzero(&frame, sizeof(frame));
+    frame.buf = clock->buf;
+    frame.size = clock->buf_size;
+    frame.timestamp = clock->timestamp;
+
+    if (pjmedia_port_get_frame(clock->u_port, &frame) != PJ_SUCCESS)
+        frame.type = PJMEDIA_FRAME_TYPE_NONE;
+
+    pjmedia_port_put_frame(clock->d_port, &frame);
+
+    pj_bzero(&frame, sizeof(frame));
+    frame.buf = clock->buf;
+    frame.size = clock->buf_size;
+    frame.timestamp = clock->timestamp;
+
+    if (pjmedia_port_get_frame(clock->d_port, &frame) != PJ_SUCCESS)
+        frame.type = PJMEDIA_FRAME_TYPE_NONE;
+
+    pjmedia_port_put_frame(clock->u_port, &frame);
+
+    clock->timestamp.u64 += clock->samples_per_frame;
+
+    return;
+}
+
+/* Function for media clock thread */
+static int clock_thread_routine(void *arg)
+{
+    media_clock_t *clock = (media_clock_t *)arg;
+
+    unsigned error_cnt = 0;
+    pj_status_t status;
+
+    apply_thread_settings(clock);
+
+    while (!clock->quit)
+    {
+        pj_uint64_t expirations = 0;
+        ssize_t len;
+
+        len = read(clock->timer_fd, &expirations, sizeof(expirations));
+        if (len != (ssize_t)sizeof(expirations))
+        {
+            if ((len < 0) && (errno == EINTR))
+                continue;
+
+            /* Retry a while, then stop and let the owner see the status */
+            status = (len < 0) ? PJ_STATUS_FROM_OS(errno) : PJ_ETOOSMALL;
+            PJ_LOG(1, (THIS_FILE, "Media clock timer read failed: %s",
+                       (len < 0) ? strerror(errno) : "short read"));
+
+            if (++error_cnt >= MAX_TIMER_ERRORS)
+            {
+                PJ_LOG(1, (THIS_FILE, "Media clock timer failed %u times in a row, the clock stops", error_cnt));
+                __atomic_store_n(&clock->status, status, __ATOMIC_RELEASE);
+                break;
+            }
+
+            pj_thread_sleep((unsigned)(clock->period_nsec / NSEC_IN_USEC / USEC_IN_MSEC) + 1);
+            continue;
+        }
+
+        error_cnt = 0;
+
+        /* Too late to catch up: keep the timestamp running and go on from now */
+        if (expirations > clock->param.max_catch_up)
+        {
+            pj_uint64_t skipped = expirations - clock->param.max_catch_up;
+
+            clock->skipped_cnt += skipped;
+            clock->timestamp.u64 += skipped * clock->samples_per_frame;
+            expirations = clock->param.max_catch_up;
+        }
+
+        for (pj_uint64_t i = 0; (i < expirations) && !clock->quit; i++)
+        {
+            run_tick(clock);
+        }
+    }
+
+    return PJ_SUCCESS;
+}
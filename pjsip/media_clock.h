@@ -0,0 +1,41 @@
+#ifndef _AUTO_ANSWER_MEDIA_CLOCK_H_
+#define _AUTO_ANSWER_MEDIA_CLOCK_H_
+
+#include <pjmedia.h>
+
+/* Clock thread settings */
+typedef struct media_clock_param_t
+{
+    unsigned            rt_priority;    /* SCHED_FIFO priority, 0 keeps the default policy */
+    unsigned            max_catch_up;   /* Late ticks processed in a batch, older ones are skipped */
+} media_clock_param_t;
+
+typedef struct media_clock_t media_clock_t;
+
+/* Replacement of pjmedia_master_port driven by a timerfd with absolute
+ * deadlines on CLOCK_MONOTONIC. Every tick moves a frame from u_port to
+ * d_port and back, exactly like the master port does. When the thread
+ * wakes up late, the expired ticks are processed back to back. The
+ * thread inherits the CPU affinity of the creating thread
+ */
+pj_status_t media_clock_create(pj_pool_t *pool,
+                               pjmedia_port *u_port,
+                               pjmedia_port *d_port,
+                               const media_clock_param_t *param,
+                               media_clock_t **p_clock);
+
+pj_status_t media_clock_start(media_clock_t *clock);
+
+/* Stop and join the clock thread, returns within one period */
+pj_status_t media_clock_stop(media_clock_t *clock);
+
+/* Ticks dropped because the thread was late more than max_catch_up ticks */
+pj_uint64_t media_clock_get_skipped_cnt(const media_clock_t *clock);
+
+/* PJ_SUCCESS while the clock runs. When the timer keeps failing the
+ * thread stops by itself and this returns the error, the owner decides
+ * what drives the ports then. media_clock_stop() is still needed
+ */
+pj_status_t media_clock_get_status(const media_clock_t *clock);
+
+#endif /* _AUTO_ANSWER_MEDIA_CLOCK_H_ */
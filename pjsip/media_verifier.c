@@ -0,0 +1,337 @@
+#include <math.h>
+
+#include "media_verifier.h"
+
+#define THIS_FILE                   "media_verifier.c"
+#define SEQ_MAX_DROPOUT             32768   /* A larger step forward is a late packet */
+#define JITTER_DIVISOR              16.0    /* RFC 3550 A.8 */
+#define BLOCK_MSEC                  10
+#define MSEC_IN_SEC                 1000
+#define USEC_IN_SEC                 1000000.0
+#define USEC_IN_MSEC                1000.0
+#define MAX_GAP_MSEC                10000   /* Longer gaps are not filled with silence */
+#define TONE_MIN_RATIO              0.5     /* Part of the block energy at the tone frequency */
+#define TONE_MIN_LEVEL              100.0   /* RMS, below it the block is silence */
+#define TONE_STATE_UNKNOWN          -1
+#define TONE_STATE_PAUSE            0
+#define TONE_STATE_ON               1
+#define PI                          3.14159265358979323846
+
+typedef struct rtp_info_t
+{
+    pj_bool_t                   marker;
+    unsigned                    pt;
+    pj_uint16_t                 seq;
+    pj_uint32_t                 ts;
+    const pj_uint8_t            *payload;
+    pj_size_t                   payload_len;
+} rtp_info_t;
+
+static pj_bool_t parse_rtp(media_verifier_t *verifier, const void *pkt, pj_size_t size, rtp_info_t *rtp);
+static pj_bool_t is_g711(unsigned pt);
+static void update_jitter(media_verifier_t *verifier, const rtp_info_t *rtp, pj_uint64_t arrival_usec);
+static void check_sequence(media_verifier_t *verifier, const rtp_info_t *rtp, pj_uint64_t arrival_usec);
+static void push_sample(media_verifier_t *verifier, pj_int16_t sample);
+static void feed_payload(media_verifier_t *verifier, const rtp_info_t *rtp);
+static void feed_silence(media_verifier_t *verifier, unsigned samples);
+static pj_bool_t is_tone_block(const media_verifier_t *verifier);
+static void add_block(media_verifier_t *verifier, pj_bool_t is_tone);
+static void finish_segment(media_verifier_t *verifier);
+
+void media_verifier_init(media_verifier_t *verifier, const media_verifier_param_t *param)
+{
+    pj_bzero(verifier, sizeof(*verifier));
+
+    verifier->param = *param;
+    verifier->block_size = PJ_MIN(param->clock_rate * BLOCK_MSEC / MSEC_IN_SEC, MEDIA_VERIFIER_BLOCK_MAX);
+    verifier->goertzel_coeff = 2.0 * cos(2.0 * PI * param->tone_freq / param->clock_rate);
+    verifier->tone_state = TONE_STATE_UNKNOWN;
+    verifier->first_segment = PJ_TRUE;
+
+    return;
+}
+
+void media_verifier_on_rtp(media_verifier_t *verifier, const void *pkt, pj_size_t size, pj_uint64_t arrival_usec)
+{
+    rtp_info_t rtp;
+
+    if (!parse_rtp(verifier, pkt, size, &rtp))
+        goto _exit;
+
+    verifier->packet_cnt++;
+    update_jitter(verifier, &rtp, arrival_usec);
+
+    /* One byte per sample */
+    if (verifier->param.ptime_msec && is_g711(rtp.pt)
+        && (rtp.payload_len != verifier->param.clock_rate / MSEC_IN_SEC * verifier->param.ptime_msec))
+    {
+        verifier->ptime_error_cnt++;
+    }
+
+    if (verifier->started)
+    {
+        pj_uint16_t seq_delta = (pj_uint16_t)(rtp.seq - verifier->last_seq);
+
+        if ((seq_delta == 0) || (seq_delta >= SEQ_MAX_DROPOUT))
+        {
+            verifier->disorder_cnt++;
+            goto _exit;
+        }
+
+        check_sequence(verifier, &rtp, arrival_usec);
+    }
+
+    verifier->started = PJ_TRUE;
+    verifier->last_seq = rtp.seq;
+    verifier->last_ts = rtp.ts;
+    verifier->last_arrival_usec = arrival_usec;
+    if (is_g711(rtp.pt))
+        verifier->last_samples = (unsigned)rtp.payload_len;
+
+    if (verifier->param.tone_freq && is_g711(rtp.pt))
+        feed_payload(verifier, &rtp);
+
+_exit:
+    return;
+}
+
+pj_bool_t media_verifier_is_ok(const media_verifier_t *verifier)
+{
+    pj_bool_t ok = (verifier->lost_cnt == 0)
+                   && (verifier->disorder_cnt == 0)
+                   && (verifier->ts_jump_cnt == 0)
+                   && (verifier->ptime_error_cnt == 0)
+                   && (verifier->cadence_error_cnt == 0);
+
+    if (verifier->param.max_jitter_msec && (verifier->max_jitter_msec > verifier->param.max_jitter_msec))
+        ok = PJ_FALSE;
+
+    if (verifier->param.tone_freq && !verifier->tone_detected)
+        ok = PJ_FALSE;
+
+    return ok;
+}
+
+/* The header is checked and the CSRC, extension and padding skipped by pjmedia */
+static pj_bool_t parse_rtp(media_verifier_t *verifier, const void *pkt, pj_size_t size, rtp_info_t *rtp)
+{
+    const pjmedia_rtp_hdr *hdr;
+    const void *payload;
+    unsigned payload_len;
+    pj_bool_t valid = PJ_FALSE;
+
+    if (pjmedia_rtp_decode_rtp(&verifier->rtp_session, pkt, (int)size, &hdr, &payload, &payload_len) != PJ_SUCCESS)
+        goto _exit;
+
+    rtp->marker = (hdr->m != 0);
+    rtp->pt = hdr->pt;
+    rtp->seq = pj_ntohs(hdr->seq);
+    rtp->ts = pj_ntohl(hdr->ts);
+    rtp->payload = (const pj_uint8_t *)payload;
+    rtp->payload_len = payload_len;
+    valid = PJ_TRUE;
+
+_exit:
+    return valid;
+}
+
+static pj_bool_t is_g711(unsigned pt)
+{
+    return (pt == PJMEDIA_RTP_PT_PCMU) || (pt == PJMEDIA_RTP_PT_PCMA);
+}
+
+/* Interarrival jitter of RFC 3550: the smoothed difference of the
+ * transit times of successive packets
+ */
+static void update_jitter(media_verifier_t *verifier, const rtp_info_t *rtp, pj_uint64_t arrival_usec)
+{
+    double arrival = (double)arrival_usec * verifier->param.clock_rate / USEC_IN_SEC;
+    double transit = arrival - rtp->ts;
+
+    if (verifier->started)
+    {
+        verifier->jitter += (fabs(transit - verifier->last_transit) - verifier->jitter) / JITTER_DIVISOR;
+        verifier->max_jitter_msec = PJ_MAX(verifier->max_jitter_msec,
+                                           verifier->jitter * MSEC_IN_SEC / verifier->param.clock_rate);
+    }
+
+    verifier->last_transit = transit;
+
+    return;
+}
+
+/* Loss and timestamp continuity of an in order packet. A pause of the
+ * sender starts with the marker bit, its gap is fed as silence
+ */
+static void check_sequence(media_verifier_t *verifier, const rtp_info_t *rtp, pj_uint64_t arrival_usec)
+{
+    pj_uint16_t seq_delta = (pj_uint16_t)(rtp->seq - verifier->last_seq);
+    pj_uint32_t ts_delta = rtp->ts - verifier->last_ts;
+    unsigned max_gap = verifier->param.clock_rate / MSEC_IN_SEC * MAX_GAP_MSEC;
+
+    verifier->lost_cnt += seq_delta - 1;
+
+    if (verifier->last_samples == 0)
+        goto _exit;
+
+    if (ts_delta != seq_delta * verifier->last_samples)
+    {
+        if (!rtp->marker)
+            verifier->ts_jump_cnt++;
+
+        if ((ts_delta > verifier->last_samples) && (ts_delta - verifier->last_samples <= max_gap)
+            && verifier->param.tone_freq && is_g711(rtp->pt))
+        {
+            feed_silence(verifier, ts_delta - verifier->last_samples);
+        }
+    }
+
+    /* The pauses of the sender are not arrival gaps */
+    if (!rtp->marker)
+    {
+        verifier->max_interarrival_msec = PJ_MAX(verifier->max_interarrival_msec,
+                                                 (arrival_usec - verifier->last_arrival_usec) / USEC_IN_MSEC);
+    }
+
+_exit:
+    return;
+}
+
+static void push_sample(media_verifier_t *verifier, pj_int16_t sample)
+{
+    verifier->block[verifier->block_fill++] = sample;
+
+    if (verifier->block_fill == verifier->block_size)
+    {
+        add_block(verifier, is_tone_block(verifier));
+        verifier->block_fill = 0;
+    }
+
+    return;
+}
+
+static void feed_payload(media_verifier_t *verifier, const rtp_info_t *rtp)
+{
+    for (pj_size_t i = 0; i < rtp->payload_len; i++)
+    {
+        if (rtp->pt == PJMEDIA_RTP_PT_PCMU)
+            push_sample(verifier, pjmedia_ulaw2linear(rtp->payload[i]));
+        else
+            push_sample(verifier, pjmedia_alaw2linear(rtp->payload[i]));
+    }
+
+    return;
+}
+
+/* Whole blocks of silence are counted without the detector */
+static void feed_silence(media_verifier_t *verifier, unsigned samples)
+{
+    while ((samples > 0) && (verifier->block_fill > 0))
+    {
+        push_sample(verifier, 0);
+        samples--;
+    }
+
+    for (unsigned i = 0; i < samples / verifier->block_size; i++)
+    {
+        add_block(verifier, PJ_FALSE);
+    }
+
+    for (unsigned i = 0; i < samples % verifier->block_size; i++)
+    {
+        push_sample(verifier, 0);
+    }
+
+    return;
+}
+
+/* Goertzel power at the tone frequency against the whole block energy,
+ * a pure tone gives about 1
+ */
+static pj_bool_t is_tone_block(const media_verifier_t *verifier)
+{
+    double s1 = 0;
+    double s2 = 0;
+    double energy = 0;
+    double power;
+    unsigned n = verifier->block_size;
+    pj_bool_t is_tone = PJ_FALSE;
+
+    for (unsigned i = 0; i < n; i++)
+    {
+        double x = verifier->block[i];
+        double s0 = x + verifier->goertzel_coeff * s1 - s2;
+
+        s2 = s1;
+        s1 = s0;
+        energy += x * x;
+    }
+
+    if (energy / n < TONE_MIN_LEVEL * TONE_MIN_LEVEL)
+        goto _exit;
+
+    power = s1 * s1 + s2 * s2 - verifier->goertzel_coeff * s1 * s2;
+    is_tone = (power / (energy * n / 2)) >= TONE_MIN_RATIO;
+
+_exit:
+    return is_tone;
+}
+
+static void add_block(media_verifier_t *verifier, pj_bool_t is_tone)
+{
+    int state = is_tone ? TONE_STATE_ON : TONE_STATE_PAUSE;
+
+    if (is_tone)
+        verifier->tone_detected = PJ_TRUE;
+
+    if (state == verifier->tone_state)
+    {
+        verifier->segment_blocks++;
+        goto _exit;
+    }
+
+    if (verifier->tone_state != TONE_STATE_UNKNOWN)
+        finish_segment(verifier);
+
+    verifier->tone_state = state;
+    verifier->segment_blocks = 1;
+
+_exit:
+    return;
+}
+
+/* The first segment began before the call and the last one is cut by
+ * the hang up, only the ones between are checked
+ */
+static void finish_segment(media_verifier_t *verifier)
+{
+    unsigned msec = verifier->segment_blocks * BLOCK_MSEC;
+    unsigned expected;
+
+    if (verifier->first_segment)
+    {
+        verifier->first_segment = PJ_FALSE;
+        goto _exit;
+    }
+
+    verifier->segment_cnt++;
+
+    /* A continuous tone has no pauses */
+    if (verifier->param.off_msec == 0)
+    {
+        if (verifier->tone_state == TONE_STATE_PAUSE)
+            verifier->cadence_error_cnt++;
+        goto _exit;
+    }
+
+    expected = (verifier->tone_state == TONE_STATE_ON) ? verifier->param.on_msec : verifier->param.off_msec;
+    if ((msec + verifier->param.tolerance_msec < expected) || (msec > expected + verifier->param.tolerance_msec))
+    {
+        PJ_LOG(4, (THIS_FILE, "%s of %u ms, %u ms expected",
+                   (verifier->tone_state == TONE_STATE_ON) ? "Tone" : "Pause", msec, expected));
+        verifier->cadence_error_cnt++;
+    }
+
+_exit:
+    return;
+}
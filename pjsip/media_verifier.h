@@ -0,0 +1,74 @@
+#ifndef _AUTO_ANSWER_MEDIA_VERIFIER_H_
+#define _AUTO_ANSWER_MEDIA_VERIFIER_H_
+
+#include <pjmedia.h>
+
+#define MEDIA_VERIFIER_BLOCK_MAX    320     /* Samples of a detection block at 32 kHz */
+
+/* What the received audio must be, tone_freq 0 checks the RTP timing only.
+ * off_msec 0 expects a continuous tone, otherwise on_msec/off_msec cadence
+ */
+typedef struct media_verifier_param_t
+{
+    unsigned            clock_rate;
+    unsigned            tone_freq;
+    unsigned            on_msec;
+    unsigned            off_msec;
+    unsigned            tolerance_msec;     /* Allowed error of a tone or pause length */
+    unsigned            max_jitter_msec;    /* Above it the call is bad */
+    unsigned            ptime_msec;         /* Packet time the answer announced, 0 - not checked */
+} media_verifier_param_t;
+
+/* Receiver state of one call. RTP of G.711 (PT 0 and 8) is decoded and
+ * checked for the tone in blocks of 10 ms with the Goertzel algorithm, a
+ * timestamp gap with the marker bit is a pause (silence suppression).
+ * Other payload types are checked for timing only
+ */
+typedef struct media_verifier_t
+{
+    media_verifier_param_t  param;
+    pjmedia_rtp_session     rtp_session;        /* Only for decoding, it is not updated */
+    double                  goertzel_coeff;
+    unsigned                block_size;
+
+    /* RTP timing */
+    pj_bool_t               started;
+    pj_uint16_t             last_seq;
+    pj_uint32_t             last_ts;
+    unsigned                last_samples;
+    double                  last_transit;
+    pj_uint64_t             last_arrival_usec;
+    double                  jitter;             /* RFC 3550, timestamp units */
+
+    /* Tone detection */
+    pj_int16_t              block[MEDIA_VERIFIER_BLOCK_MAX];
+    unsigned                block_fill;
+    int                     tone_state;         /* -1 - unknown, 0 - pause, 1 - tone */
+    unsigned                segment_blocks;
+    pj_bool_t               first_segment;
+
+    /* Results */
+    pj_uint64_t             packet_cnt;
+    pj_uint64_t             lost_cnt;
+    pj_uint64_t             disorder_cnt;       /* Duplicates and late packets */
+    pj_uint64_t             ts_jump_cnt;        /* Timestamp gaps without the marker bit */
+    pj_uint64_t             ptime_error_cnt;    /* G.711 packets of another length than ptime_msec */
+    double                  max_jitter_msec;
+    double                  max_interarrival_msec;
+    pj_bool_t               tone_detected;
+    unsigned                segment_cnt;        /* Complete tones and pauses checked */
+    unsigned                cadence_error_cnt;
+} media_verifier_t;
+
+void media_verifier_init(media_verifier_t *verifier, const media_verifier_param_t *param);
+
+/* One received RTP packet with its arrival time on a monotonic clock */
+void media_verifier_on_rtp(media_verifier_t *verifier, const void *pkt, pj_size_t size, pj_uint64_t arrival_usec);
+
+/* No loss, no disorder, no timestamp jumps, the packet time as
+ * announced, the jitter within the limit and the tone and its cadence
+ * as expected
+ */
+pj_bool_t media_verifier_is_ok(const media_verifier_t *verifier);
+
+#endif /* _AUTO_ANSWER_MEDIA_VERIFIER_H_ */
@@ -0,0 +1,242 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "overload_ctl.h"
+
+#define THIS_FILE                   "overload_ctl.c"
+#define LOCK_NAME                   "overload"
+#define PROC_NET_UDP                "/proc/net/udp"
+#define PROC_NET_TCP                "/proc/net/tcp"
+#define PROC_LINE_SIZE              256
+#define PROC_NET_FIELDS             2
+#define USEC_IN_SEC                 1000000
+#define USEC_IN_MSEC                1000
+#define NSEC_IN_USEC                1000
+#define PERCENT                     100
+#define RETRY_AFTER_SPREAD_DIV      4       /* Up to +25% so rejected callers do not retry at once */
+
+static unsigned usable_cpu_count(void);
+static pj_uint64_t now_usec(void);
+static pj_uint64_t cpu_usec(void);
+static unsigned read_proc_queues(const char *path, pj_uint16_t sip_port);
+static unsigned read_sip_queue_bytes(pj_uint16_t sip_port);
+static unsigned load_percent(unsigned value, unsigned limit);
+
+pj_status_t overload_ctl_init(overload_ctl_t *ctl, pj_pool_t *pool, const overload_limits_t *limits,
+                              pj_uint16_t sip_port)
+{
+    pj_status_t status;
+
+    pj_bzero(ctl, sizeof(*ctl));
+    ctl->limits = *limits;
+    ctl->sip_port = sip_port;
+    ctl->cpu_count = usable_cpu_count();
+    ctl->last_wall_usec = now_usec();
+    ctl->last_cpu_usec = cpu_usec();
+
+    status = pj_lock_create_simple_mutex(pool, LOCK_NAME, &ctl->lock);
+
+    return status;
+}
+
+void overload_ctl_destroy(overload_ctl_t *ctl)
+{
+    if (ctl->lock)
+    {
+        pj_lock_destroy(ctl->lock);
+        ctl->lock = NULL;
+    }
+
+    return;
+}
+
+void overload_ctl_set_limits(overload_ctl_t *ctl, const overload_limits_t *limits)
+{
+    pj_lock_acquire(ctl->lock);
+    ctl->limits = *limits;
+    pj_lock_release(ctl->lock);
+
+    return;
+}
+
+void overload_ctl_sample(overload_ctl_t *ctl, unsigned clock_lag_usec)
+{
+    pj_uint64_t wall = now_usec();
+    pj_uint64_t cpu = cpu_usec();
+    unsigned sip_queue_bytes = read_sip_queue_bytes(ctl->sip_port);
+    pj_uint64_t wall_delta;
+    unsigned load = 0;
+    unsigned retry_after;
+
+    pj_lock_acquire(ctl->lock);
+
+    /* CPU time of all threads against the time of the cores the process may run on */
+    wall_delta = wall - ctl->last_wall_usec;
+    if (wall_delta > 0)
+    {
+        ctl->cpu_percent = (unsigned)(((cpu - ctl->last_cpu_usec) * PERCENT) / (wall_delta * ctl->cpu_count));
+    }
+    ctl->last_wall_usec = wall;
+    ctl->last_cpu_usec = cpu;
+
+    ctl->clock_lag_usec = clock_lag_usec;
+    ctl->sip_queue_bytes = sip_queue_bytes;
+
+    /* The most loaded signal decides */
+    load = PJ_MAX(load, load_percent(clock_lag_usec / USEC_IN_MSEC, ctl->limits.max_clock_lag_msec));
+    load = PJ_MAX(load, load_percent(ctl->sip_queue_bytes, ctl->limits.max_sip_queue_bytes));
+    load = PJ_MAX(load, load_percent(ctl->cpu_percent, ctl->limits.max_cpu_percent));
+
+    /* The further over the limit, the longer the proxies should back off */
+    retry_after = (ctl->limits.retry_after_min_sec * load) / PERCENT;
+    retry_after = PJ_MAX(retry_after, ctl->limits.retry_after_min_sec);
+    retry_after = PJ_MIN(retry_after, ctl->limits.retry_after_max_sec);
+
+    if ((load >= PERCENT) != ctl->overloaded)
+    {
+        PJ_LOG(3, (THIS_FILE, "Overload %s: clock lag %u usec, SIP queue %u bytes, CPU %u%%",
+                   (load >= PERCENT) ? "started" : "ended",
+                   ctl->clock_lag_usec,
+                   ctl->sip_queue_bytes,
+                   ctl->cpu_percent));
+    }
+
+    ctl->overloaded = (load >= PERCENT);
+    ctl->retry_after_sec = retry_after;
+
+    pj_lock_release(ctl->lock);
+
+    return;
+}
+
+pj_bool_t overload_ctl_is_overloaded(overload_ctl_t *ctl, unsigned *retry_after_sec)
+{
+    pj_bool_t overloaded;
+
+    pj_lock_acquire(ctl->lock);
+
+    overloaded = ctl->overloaded;
+    if (overloaded)
+    {
+        ctl->rejected_cnt++;
+        *retry_after_sec = ctl->retry_after_sec
+                           + (pj_rand() % ((ctl->retry_after_sec / RETRY_AFTER_SPREAD_DIV) + 1));
+    }
+
+    pj_lock_release(ctl->lock);
+
+    return overloaded;
+}
+
+void overload_ctl_get_stats(overload_ctl_t *ctl, pj_uint64_t *rejected_cnt, unsigned *cpu_percent,
+                            unsigned *sip_queue_bytes)
+{
+    pj_lock_acquire(ctl->lock);
+    *rejected_cnt = ctl->rejected_cnt;
+    *cpu_percent = ctl->cpu_percent;
+    *sip_queue_bytes = ctl->sip_queue_bytes;
+    pj_lock_release(ctl->lock);
+
+    return;
+}
+
+/* CPUs of the affinity mask of the process (taskset, cpusets of a
+ * container), all online CPUs when it cannot be read
+ */
+static unsigned usable_cpu_count(void)
+{
+    cpu_set_t set;
+    long online;
+    int count = 0;
+
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        count = CPU_COUNT(&set);
+
+    if (count <= 0)
+    {
+        online = sysconf(_SC_NPROCESSORS_ONLN);
+        count = (online > 0) ? (int)online : 1;
+    }
+
+    return (unsigned)count;
+}
+
+/* Share of the limit in percent, 100 and more means the limit is reached */
+static unsigned load_percent(unsigned value, unsigned limit)
+{
+    unsigned load = 0;
+
+    if (limit != 0)
+        load = (unsigned)(((pj_uint64_t)value * PERCENT) / limit);
+
+    return load;
+}
+
+static pj_uint64_t now_usec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((pj_uint64_t)ts.tv_sec * USEC_IN_SEC) + ((pj_uint64_t)ts.tv_nsec / NSEC_IN_USEC);
+}
+
+static pj_uint64_t cpu_usec(void)
+{
+    struct rusage usage;
+    pj_uint64_t total = 0;
+
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        total = ((pj_uint64_t)usage.ru_utime.tv_sec * USEC_IN_SEC) + (pj_uint64_t)usage.ru_utime.tv_usec
+                + ((pj_uint64_t)usage.ru_stime.tv_sec * USEC_IN_SEC) + (pj_uint64_t)usage.ru_stime.tv_usec;
+    }
+
+    return total;
+}
+
+/* Sum of the receive queues of the sockets with the SIP port as the
+ * local port in one of the /proc/net tables
+ */
+static unsigned read_proc_queues(const char *path, pj_uint16_t sip_port)
+{
+    char line[PROC_LINE_SIZE];
+    unsigned queue_bytes = 0;
+    FILE *file;
+
+    file = fopen(path, "r");
+    if (file == NULL)
+        goto _exit;
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        unsigned local_port;
+        unsigned rx_queue;
+
+        /* "sl: local_addr:port rem_addr:port st tx_queue:rx_queue ..." */
+        if (sscanf(line, "%*u: %*x:%x %*x:%*x %*x %*x:%x", &local_port, &rx_queue) != PROC_NET_FIELDS)
+            continue;
+
+        if (local_port == sip_port)
+            queue_bytes += rx_queue;
+    }
+
+    fclose(file);
+
+_exit:
+    return queue_bytes;
+}
+
+/* SIP work not read yet: the datagrams of the UDP sockets, the unread
+ * bytes of the TCP connections accepted on the SIP port and the
+ * connections waiting in the accept queue of the listener
+ */
+static unsigned read_sip_queue_bytes(pj_uint16_t sip_port)
+{
+    return read_proc_queues(PROC_NET_UDP, sip_port) + read_proc_queues(PROC_NET_TCP, sip_port);
+}
@@ -0,0 +1,59 @@
+#ifndef _AUTO_ANSWER_OVERLOAD_CTL_H_
+#define _AUTO_ANSWER_OVERLOAD_CTL_H_
+
+#include <pjlib.h>
+
+/* Admission limits, 0 disables the limit */
+typedef struct overload_limits_t
+{
+    unsigned            max_clock_lag_msec;
+    unsigned            max_sip_queue_bytes;
+    unsigned            max_cpu_percent;
+    unsigned            retry_after_min_sec;
+    unsigned            retry_after_max_sec;
+} overload_limits_t;
+
+/* Live load signals and the decision made from them. The SIP worker
+ * threads check it while the timer samples it, the fields are only
+ * touched under the lock
+ */
+typedef struct overload_ctl_t
+{
+    pj_lock_t           *lock;
+    overload_limits_t   limits;
+    pj_uint16_t         sip_port;
+    unsigned            cpu_count;
+
+    pj_uint64_t         last_wall_usec;
+    pj_uint64_t         last_cpu_usec;
+
+    unsigned            clock_lag_usec;
+    unsigned            sip_queue_bytes;
+    unsigned            cpu_percent;
+
+    pj_bool_t           overloaded;
+    unsigned            retry_after_sec;
+    pj_uint64_t         rejected_cnt;
+} overload_ctl_t;
+
+pj_status_t overload_ctl_init(overload_ctl_t *ctl, pj_pool_t *pool, const overload_limits_t *limits,
+                              pj_uint16_t sip_port);
+
+void overload_ctl_destroy(overload_ctl_t *ctl);
+
+/* New limits from a reloaded config */
+void overload_ctl_set_limits(overload_ctl_t *ctl, const overload_limits_t *limits);
+
+/* Take a fresh sample of CPU usage and of the SIP socket receive queue,
+ * combine it with the media clock lag and decide if new calls are admitted
+ */
+void overload_ctl_sample(overload_ctl_t *ctl, unsigned clock_lag_usec);
+
+/* Check the last decision, on overload return the Retry-After to send */
+pj_bool_t overload_ctl_is_overloaded(overload_ctl_t *ctl, unsigned *retry_after_sec);
+
+/* Calls rejected so far and the last CPU and SIP queue samples */
+void overload_ctl_get_stats(overload_ctl_t *ctl, pj_uint64_t *rejected_cnt, unsigned *cpu_percent,
+                            unsigned *sip_queue_bytes);
+
+#endif /* _AUTO_ANSWER_OVERLOAD_CTL_H_ */
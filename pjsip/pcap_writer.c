@@ -0,0 +1,384 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "pcap_writer.h"
+
+#define THIS_FILE                   "pcap_writer.c"
+#define THREAD_NAME                 "pcap-writer"
+#define LOCK_NAME                   "pcap"
+#define PCAP_MAGIC                  0xa1b2c3d4  /* Microsecond timestamps */
+#define PCAP_VERSION_MAJOR          2
+#define PCAP_VERSION_MINOR          4
+#define PCAP_LINKTYPE_RAW           101         /* Packets start with the IP header */
+#define PCAP_MAX_PAYLOAD            4000        /* PJSIP_MAX_PKT_LEN */
+#define IPV4_VERSION_IHL            0x45
+#define IPV4_DONT_FRAGMENT          0x4000
+#define IPV4_TTL                    64
+#define IPV4_PROTO_UDP              17
+#define FLUSH_PERIOD_MSEC           50
+#define FILE_BUF_SIZE               65536
+#define FILE_NAME_SIZE              320
+#define BYTES_IN_KB                 1024
+#define NSEC_IN_USEC                1000
+#define WORD_MASK                   0xffff
+#define BITS_IN_WORD                16
+
+typedef struct pcap_file_hdr_t
+{
+    pj_uint32_t                 magic;
+    pj_uint16_t                 version_major;
+    pj_uint16_t                 version_minor;
+    pj_int32_t                  thiszone;
+    pj_uint32_t                 sigfigs;
+    pj_uint32_t                 snaplen;
+    pj_uint32_t                 linktype;
+} pcap_file_hdr_t;
+
+typedef struct pcap_record_hdr_t
+{
+    pj_uint32_t                 ts_sec;
+    pj_uint32_t                 ts_usec;
+    pj_uint32_t                 incl_len;
+    pj_uint32_t                 orig_len;
+} pcap_record_hdr_t;
+
+/* Network byte order */
+typedef struct ipv4_hdr_t
+{
+    pj_uint8_t                  version_ihl;
+    pj_uint8_t                  tos;
+    pj_uint16_t                 total_len;
+    pj_uint16_t                 id;
+    pj_uint16_t                 frag;
+    pj_uint8_t                  ttl;
+    pj_uint8_t                  proto;
+    pj_uint16_t                 checksum;
+    pj_uint32_t                 src;
+    pj_uint32_t                 dst;
+} ipv4_hdr_t;
+
+typedef struct udp_hdr_t
+{
+    pj_uint16_t                 src_port;
+    pj_uint16_t                 dst_port;
+    pj_uint16_t                 len;
+    pj_uint16_t                 checksum;   /* 0 - not computed */
+} udp_hdr_t;
+
+#define PCAP_SNAPLEN                (sizeof(ipv4_hdr_t) + sizeof(udp_hdr_t) + PCAP_MAX_PAYLOAD)
+
+typedef struct pcap_slot_t
+{
+    pcap_record_hdr_t           hdr;
+    pj_uint8_t                  packet[PCAP_SNAPLEN];
+} pcap_slot_t;
+
+struct pcap_writer_t
+{
+    pcap_writer_param_t         param;
+    pj_lock_t                   *lock;
+    pj_thread_t                 *thread;
+    volatile pj_bool_t          quit;
+
+    /* Ring and counters, head and tail only grow, guarded by the lock */
+    pcap_slot_t                 *ring;
+    pj_uint64_t                 head;
+    pj_uint64_t                 tail;
+    pj_uint64_t                 dropped_cnt;
+    pj_uint64_t                 written_cnt;
+
+    /* Used by the writer thread only */
+    FILE                        *file;
+    unsigned                    file_index;
+    pj_size_t                   file_bytes;
+    pj_size_t                   max_file_bytes;
+};
+
+static pj_uint16_t ipv4_checksum(const ipv4_hdr_t *ip);
+static void fill_slot(pcap_slot_t *slot,
+                      const pj_sockaddr *src,
+                      const pj_sockaddr *dst,
+                      const void *payload,
+                      pj_size_t size);
+static pj_status_t open_next_file(pcap_writer_t *writer);
+static pj_bool_t write_slot(pcap_writer_t *writer, const pcap_slot_t *slot);
+static void flush_ring(pcap_writer_t *writer);
+static int writer_thread_routine(void *arg);
+
+pj_status_t pcap_writer_create(pj_pool_t *pool,
+                               const pcap_writer_param_t *param,
+                               pcap_writer_t **p_writer)
+{
+    pj_status_t status;
+    pcap_writer_t *writer;
+    pj_size_t prefix_len = strlen(param->file_prefix);
+
+    if ((param->ring_packets == 0) || (param->max_files == 0) || (prefix_len == 0))
+    {
+        status = PJ_EINVAL;
+        goto _exit;
+    }
+
+    writer = PJ_POOL_ZALLOC_T(pool, pcap_writer_t);
+    writer->param = *param;
+    writer->max_file_bytes = (pj_size_t)param->file_size_kb * BYTES_IN_KB;
+
+    writer->param.file_prefix = (char *)pj_pool_zalloc(pool, prefix_len + 1);
+    writer->ring = (pcap_slot_t *)pj_pool_calloc(pool, param->ring_packets, sizeof(pcap_slot_t));
+    if ((writer->param.file_prefix == NULL) || (writer->ring == NULL))
+    {
+        status = PJ_ENOMEM;
+        goto _exit;
+    }
+
+    pj_memcpy((char *)writer->param.file_prefix, param->file_prefix, prefix_len);
+
+    /* The first file is opened here, so a wrong path fails at start */
+    status = open_next_file(writer);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    status = pj_lock_create_simple_mutex(pool, LOCK_NAME, &writer->lock);
+    if (status != PJ_SUCCESS)
+    {
+        fclose(writer->file);
+        goto _exit;
+    }
+
+    status = pj_thread_create(pool, THREAD_NAME, &writer_thread_routine, writer, 0, 0, &writer->thread);
+    if (status != PJ_SUCCESS)
+    {
+        pj_lock_destroy(writer->lock);
+        fclose(writer->file);
+        goto _exit;
+    }
+
+    *p_writer = writer;
+
+_exit:
+    return status;
+}
+
+pj_status_t pcap_writer_destroy(pcap_writer_t *writer)
+{
+    writer->quit = PJ_TRUE;
+
+    pj_thread_join(writer->thread);
+    pj_thread_destroy(writer->thread);
+
+    if (writer->file)
+    {
+        fclose(writer->file);
+        writer->file = NULL;
+    }
+
+    PJ_LOG(4, (THIS_FILE, "%llu packets captured, %llu dropped",
+               (unsigned long long)writer->written_cnt,
+               (unsigned long long)writer->dropped_cnt));
+
+    return pj_lock_destroy(writer->lock);
+}
+
+void pcap_writer_write(pcap_writer_t *writer,
+                       const pj_sockaddr *src,
+                       const pj_sockaddr *dst,
+                       const void *payload,
+                       pj_size_t size)
+{
+    if ((src->addr.sa_family != pj_AF_INET()) || (dst->addr.sa_family != pj_AF_INET()))
+        goto _exit;
+
+    pj_lock_acquire(writer->lock);
+
+    if ((writer->head - writer->tail) < writer->param.ring_packets)
+    {
+        fill_slot(&writer->ring[writer->head % writer->param.ring_packets], src, dst, payload, size);
+        writer->head++;
+    }
+    else
+    {
+        writer->dropped_cnt++;
+    }
+
+    pj_lock_release(writer->lock);
+
+_exit:
+    return;
+}
+
+void pcap_writer_get_stats(pcap_writer_t *writer, pj_uint64_t *written_cnt, pj_uint64_t *dropped_cnt)
+{
+    pj_lock_acquire(writer->lock);
+    *written_cnt = writer->written_cnt;
+    *dropped_cnt = writer->dropped_cnt;
+    pj_lock_release(writer->lock);
+
+    return;
+}
+
+static pj_uint16_t ipv4_checksum(const ipv4_hdr_t *ip)
+{
+    const pj_uint16_t *word = (const pj_uint16_t *)ip;
+    pj_uint32_t sum = 0;
+
+    for (unsigned i = 0; i < sizeof(*ip) / sizeof(*word); i++)
+    {
+        sum += word[i];
+    }
+
+    while (sum > WORD_MASK)
+    {
+        sum = (sum & WORD_MASK) + (sum >> BITS_IN_WORD);
+    }
+
+    return (pj_uint16_t)~sum;
+}
+
+/* The cost of a captured packet: the headers and one copy of the payload */
+static void fill_slot(pcap_slot_t *slot,
+                      const pj_sockaddr *src,
+                      const pj_sockaddr *dst,
+                      const void *payload,
+                      pj_size_t size)
+{
+    struct timespec now;
+    ipv4_hdr_t *ip = (ipv4_hdr_t *)slot->packet;
+    udp_hdr_t *udp = (udp_hdr_t *)(slot->packet + sizeof(ipv4_hdr_t));
+    pj_size_t caplen = PJ_MIN(size, PCAP_MAX_PAYLOAD);
+    pj_size_t headers = sizeof(ipv4_hdr_t) + sizeof(udp_hdr_t);
+
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    slot->hdr.ts_sec = (pj_uint32_t)now.tv_sec;
+    slot->hdr.ts_usec = (pj_uint32_t)(now.tv_nsec / NSEC_IN_USEC);
+    slot->hdr.incl_len = (pj_uint32_t)(headers + caplen);
+    slot->hdr.orig_len = (pj_uint32_t)(headers + size);
+
+    pj_bzero(ip, sizeof(*ip));
+    ip->version_ihl = IPV4_VERSION_IHL;
+    ip->total_len = pj_htons((pj_uint16_t)(headers + size));
+    ip->frag = pj_htons(IPV4_DONT_FRAGMENT);
+    ip->ttl = IPV4_TTL;
+    ip->proto = IPV4_PROTO_UDP;
+    ip->src = src->ipv4.sin_addr.s_addr;
+    ip->dst = dst->ipv4.sin_addr.s_addr;
+    ip->checksum = ipv4_checksum(ip);
+
+    udp->src_port = src->ipv4.sin_port;
+    udp->dst_port = dst->ipv4.sin_port;
+    udp->len = pj_htons((pj_uint16_t)(sizeof(udp_hdr_t) + size));
+    udp->checksum = 0;
+
+    pj_memcpy(slot->packet + headers, payload, caplen);
+
+    return;
+}
+
+static pj_status_t open_next_file(pcap_writer_t *writer)
+{
+    pj_status_t status = PJ_SUCCESS;
+    char name[FILE_NAME_SIZE];
+    pcap_file_hdr_t hdr;
+
+    if (writer->file)
+        fclose(writer->file);
+
+    pj_ansi_snprintf(name, sizeof(name), "%s_%u.pcap", writer->param.file_prefix, writer->file_index);
+    writer->file_index = (writer->file_index + 1) % writer->param.max_files;
+
+    writer->file = fopen(name, "wb");
+    if (writer->file == NULL)
+    {
+        PJ_LOG(1, (THIS_FILE, "Unable to open %s", name));
+        status = PJ_ENOTFOUND;
+        goto _exit;
+    }
+
+    setvbuf(writer->file, NULL, _IOFBF, FILE_BUF_SIZE);
+
+    pj_bzero(&hdr, sizeof(hdr));
+    hdr.magic = PCAP_MAGIC;
+    hdr.version_major = PCAP_VERSION_MAJOR;
+    hdr.version_minor = PCAP_VERSION_MINOR;
+    hdr.snaplen = (pj_uint32_t)PCAP_SNAPLEN;
+    hdr.linktype = PCAP_LINKTYPE_RAW;
+
+    fwrite(&hdr, sizeof(hdr), 1, writer->file);
+    writer->file_bytes = sizeof(hdr);
+
+_exit:
+    return status;
+}
+
+static pj_bool_t write_slot(pcap_writer_t *writer, const pcap_slot_t *slot)
+{
+    pj_size_t record_size = sizeof(slot->hdr) + slot->hdr.incl_len;
+    pj_bool_t written = PJ_FALSE;
+
+    if ((writer->max_file_bytes > 0) && (writer->file_bytes + record_size > writer->max_file_bytes))
+        open_next_file(writer);
+
+    if (writer->file == NULL)
+        goto _exit;
+
+    /* The record header and the packet follow each other in the slot */
+    fwrite(slot, record_size, 1, writer->file);
+    writer->file_bytes += record_size;
+    written = PJ_TRUE;
+
+_exit:
+    return written;
+}
+
+/* The slots up to the head seen at the start are written without the
+ * lock, the callers do not reuse them until the tail moves
+ */
+static void flush_ring(pcap_writer_t *writer)
+{
+    pj_uint64_t head;
+    pj_uint64_t tail;
+    pj_uint64_t written_cnt = 0;
+
+    pj_lock_acquire(writer->lock);
+    head = writer->head;
+    tail = writer->tail;
+    pj_lock_release(writer->lock);
+
+    if (head == tail)
+        goto _exit;
+
+    for (pj_uint64_t i = tail; i < head; i++)
+    {
+        if (write_slot(writer, &writer->ring[i % writer->param.ring_packets]))
+            written_cnt++;
+    }
+
+    if (writer->file)
+        fflush(writer->file);
+
+    pj_lock_acquire(writer->lock);
+    writer->tail = head;
+    writer->written_cnt += written_cnt;
+    writer->dropped_cnt += (head - tail) - written_cnt;
+    pj_lock_release(writer->lock);
+
+_exit:
+    return;
+}
+
+static int writer_thread_routine(void *arg)
+{
+    pcap_writer_t *writer = (pcap_writer_t *)arg;
+
+    while (!writer->quit)
+    {
+        pj_thread_sleep(FLUSH_PERIOD_MSEC);
+        flush_ring(writer);
+    }
+
+    /* What was queued before the stop */
+    flush_ring(writer);
+
+    return PJ_SUCCESS;
+}
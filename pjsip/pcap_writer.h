@@ -0,0 +1,43 @@
+#ifndef _AUTO_ANSWER_PCAP_WRITER_H_
+#define _AUTO_ANSWER_PCAP_WRITER_H_
+
+#include <pjlib.h>
+
+/* Capture settings */
+typedef struct pcap_writer_param_t
+{
+    const char          *file_prefix;   /* Files are <prefix>_<n>.pcap */
+    unsigned            ring_packets;   /* Packets waiting for the writer thread */
+    unsigned            file_size_kb;   /* The next file is started above it */
+    unsigned            max_files;      /* The oldest file is overwritten after it */
+} pcap_writer_param_t;
+
+typedef struct pcap_writer_t pcap_writer_t;
+
+/* Capture of UDP payloads into rotating pcap files (raw IPv4 link type).
+ * The caller only copies the packet into a ring of fixed slots, the
+ * writer thread wakes up periodically and writes the ring to the file.
+ * When the ring is full the packet is dropped, the caller never waits
+ * for the disk
+ */
+pj_status_t pcap_writer_create(pj_pool_t *pool,
+                               const pcap_writer_param_t *param,
+                               pcap_writer_t **p_writer);
+
+/* Stop the writer thread, write what is left in the ring and close the file */
+pj_status_t pcap_writer_destroy(pcap_writer_t *writer);
+
+/* Queue the payload with the current time as an IPv4/UDP packet from src
+ * to dst. Payloads longer than a slot are truncated, other families than
+ * IPv4 are ignored. Safe to call from any thread
+ */
+void pcap_writer_write(pcap_writer_t *writer,
+                       const pj_sockaddr *src,
+                       const pj_sockaddr *dst,
+                       const void *payload,
+                       pj_size_t size);
+
+/* Packets written to the files and packets dropped on a full ring */
+void pcap_writer_get_stats(pcap_writer_t *writer, pj_uint64_t *written_cnt, pj_uint64_t *dropped_cnt);
+
+#endif /* _AUTO_ANSWER_PCAP_WRITER_H_ */
@@ -0,0 +1,324 @@
+#include "port_proxy.h"
+
+#define PROXY_NAME                  "proxy"
+#define PROXY_SIGNATURE             PJMEDIA_SIG_CLASS_APP('P', 'X')
+#define NCHANNELS                   1
+#define BITS_PER_SAMPLE             16
+#define BYTES_PER_SAMPLE            2
+#define MSEC_IN_SEC                 1000
+#define NARROWBAND_CLOCK_RATE       8000    /* G.711 */
+#define RESAMPLE_HIGH_QUALITY       PJ_TRUE /* As the bridge converts by default */
+#define RESAMPLE_LARGE_FILTER       PJ_TRUE
+
+/* The clock marks itself busy before it loads the bound port and the
+ * unbinding waits for it to leave, both in sequentially consistent order
+ */
+#define LOAD_SEQ(ptr)               __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+#define STORE_SEQ(ptr, val)         __atomic_store_n((ptr), (val), __ATOMIC_SEQ_CST)
+#define ADD_SEQ(ptr, val)           __atomic_add_fetch((ptr), (val), __ATOMIC_SEQ_CST)
+#define SUB_SEQ(ptr, val)           __atomic_sub_fetch((ptr), (val), __ATOMIC_SEQ_CST)
+
+typedef struct port_proxy_t
+{
+    pjmedia_port                base;
+    pjmedia_port                *port;
+    pj_bool_t                   rx;
+    unsigned                    busy;       /* Frame calls of the clock in the bound port */
+
+    /* Adapter for a port of another rate or ptime, allocated at creation.
+     * Set by the binding while no port is bound, then used by the clock
+     * only. The buffers are at the rate of the port
+     */
+    pj_bool_t                   can_adapt;
+    pjmedia_resample            *down;      /* Bridge to narrowband, NULL at 8 kHz */
+    pjmedia_resample            *up;
+    pj_bool_t                   is_adapted; /* PJ_FALSE - the port is called directly */
+    pjmedia_resample            *tx_resample;
+    pjmedia_resample            *rx_resample;
+    unsigned                    chunk;      /* One bridge frame at the rate of the port */
+    unsigned                    port_spf;
+    unsigned                    max_samples;
+    pj_int16_t                  *tx_buf;
+    unsigned                    tx_cnt;
+    pj_bool_t                   tx_audio;
+    pj_uint64_t                 tx_ts;
+    pj_int16_t                  *rx_buf;
+    unsigned                    rx_cnt;
+    pj_bool_t                   rx_audio;
+} port_proxy_t;
+
+static pj_bool_t is_exact(const pjmedia_port *proxy, const pjmedia_port *port);
+static void setup_adapter(port_proxy_t *proxy, const pjmedia_port *port);
+static pj_status_t adapt_put_frame(port_proxy_t *proxy, pjmedia_port *port, const pjmedia_frame *frame);
+static pj_status_t adapt_get_frame(port_proxy_t *proxy, pjmedia_port *port, pjmedia_frame *frame);
+static pj_status_t proxy_put_frame(pjmedia_port *this_port, pjmedia_frame *frame);
+static pj_status_t proxy_get_frame(pjmedia_port *this_port, pjmedia_frame *frame);
+
+pj_status_t port_proxy_create(pj_pool_t *pool,
+                              unsigned clock_rate,
+                              unsigned samples_per_frame,
+                              pj_bool_t can_adapt,
+                              pjmedia_port **p_port)
+{
+    pj_status_t status;
+    port_proxy_t *proxy;
+    pj_str_t name = pj_str(PROXY_NAME);
+
+    proxy = PJ_POOL_ZALLOC_T(pool, port_proxy_t);
+
+    status = pjmedia_port_info_init(&proxy->base.info,
+                                    &name,
+                                    PROXY_SIGNATURE,
+                                    clock_rate,
+                                    NCHANNELS,
+                                    BITS_PER_SAMPLE,
+                                    samples_per_frame);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    proxy->base.put_frame = &proxy_put_frame;
+    proxy->base.get_frame = &proxy_get_frame;
+
+    if (!can_adapt)
+        goto _on_exit_created;
+
+    /* The longest frame of a stream and what is left of the previous one */
+    proxy->max_samples = clock_rate * PJMEDIA_MAX_FRAME_DURATION_MS / MSEC_IN_SEC + samples_per_frame;
+    proxy->tx_buf = (pj_int16_t *)pj_pool_alloc(pool, proxy->max_samples * BYTES_PER_SAMPLE);
+    proxy->rx_buf = (pj_int16_t *)pj_pool_alloc(pool, proxy->max_samples * BYTES_PER_SAMPLE);
+
+    if ((clock_rate != NARROWBAND_CLOCK_RATE) && (clock_rate % NARROWBAND_CLOCK_RATE == 0))
+    {
+        status = pjmedia_resample_create(pool, RESAMPLE_HIGH_QUALITY, RESAMPLE_LARGE_FILTER, NCHANNELS,
+                                         clock_rate, NARROWBAND_CLOCK_RATE, samples_per_frame, &proxy->down);
+        if (status != PJ_SUCCESS)
+            goto _exit;
+
+        status = pjmedia_resample_create(pool, RESAMPLE_HIGH_QUALITY, RESAMPLE_LARGE_FILTER, NCHANNELS,
+                                         NARROWBAND_CLOCK_RATE, clock_rate,
+                                         samples_per_frame / (clock_rate / NARROWBAND_CLOCK_RATE), &proxy->up);
+        if (status != PJ_SUCCESS)
+            goto _exit;
+    }
+
+    proxy->can_adapt = PJ_TRUE;
+
+_on_exit_created:
+    *p_port = &proxy->base;
+
+_exit:
+    return status;
+}
+
+pj_bool_t port_proxy_fits(const pjmedia_port *proxy_port, const pjmedia_port *port)
+{
+    const port_proxy_t *proxy = (const port_proxy_t *)proxy_port;
+    unsigned rate = PJMEDIA_PIA_SRATE(&port->info);
+    pj_bool_t fits;
+
+    if (is_exact(proxy_port, port))
+    {
+        fits = PJ_TRUE;
+        goto _exit;
+    }
+
+    fits = proxy->can_adapt
+           && (PJMEDIA_PIA_CCNT(&port->info) == NCHANNELS)
+           && (PJMEDIA_PIA_BITS(&port->info) == BITS_PER_SAMPLE)
+           && ((rate == PJMEDIA_PIA_SRATE(&proxy_port->info)) || ((rate == NARROWBAND_CLOCK_RATE) && proxy->down))
+           && (PJMEDIA_PIA_SPF(&port->info) + PJMEDIA_PIA_SPF(&proxy_port->info) <= proxy->max_samples);
+
+_exit:
+    return fits;
+}
+
+void port_proxy_bind(pjmedia_port *proxy_port, pjmedia_port *port, pj_bool_t rx)
+{
+    port_proxy_t *proxy = (port_proxy_t *)proxy_port;
+
+    /* Nothing runs the adapter while the proxy is unbound. A bound port
+     * is bound again only to change rx */
+    if ((port != NULL) && (LOAD_SEQ(&proxy->port) == NULL))
+        setup_adapter(proxy, port);
+
+    STORE_SEQ(&proxy->rx, rx);
+    STORE_SEQ(&proxy->port, port);
+
+    /* The clock may still be in the old port, for one frame at most */
+    if (port == NULL)
+    {
+        while (LOAD_SEQ(&proxy->busy) != 0)
+            pj_thread_sleep(0);
+    }
+
+    return;
+}
+
+static pj_bool_t is_exact(const pjmedia_port *proxy, const pjmedia_port *port)
+{
+    return (PJMEDIA_PIA_SRATE(&port->info) == PJMEDIA_PIA_SRATE(&proxy->info))
+           && (PJMEDIA_PIA_CCNT(&port->info) == PJMEDIA_PIA_CCNT(&proxy->info))
+           && (PJMEDIA_PIA_SPF(&port->info) == PJMEDIA_PIA_SPF(&proxy->info))
+           && (PJMEDIA_PIA_BITS(&port->info) == PJMEDIA_PIA_BITS(&proxy->info));
+}
+
+static void setup_adapter(port_proxy_t *proxy, const pjmedia_port *port)
+{
+    unsigned rate = PJMEDIA_PIA_SRATE(&port->info);
+    unsigned proxy_rate = PJMEDIA_PIA_SRATE(&proxy->base.info);
+
+    proxy->is_adapted = !is_exact(&proxy->base, port);
+    if (!proxy->is_adapted)
+        goto _exit;
+
+    proxy->tx_resample = (rate != proxy_rate) ? proxy->down : NULL;
+    proxy->rx_resample = (rate != proxy_rate) ? proxy->up : NULL;
+    proxy->chunk = PJMEDIA_PIA_SPF(&proxy->base.info) / (proxy_rate / rate);
+    proxy->port_spf = PJMEDIA_PIA_SPF(&port->info);
+    proxy->tx_cnt = 0;
+    proxy->tx_audio = PJ_FALSE;
+    proxy->tx_ts = 0;
+    proxy->rx_cnt = 0;
+    proxy->rx_audio = PJ_FALSE;
+
+_exit:
+    return;
+}
+
+/* A bridge frame goes to the buffer at the rate of the port, the port
+ * gets its frames once the buffer has them. A frame with no audio in it
+ * stays NONE, so the stream still skips the silence
+ */
+static pj_status_t adapt_put_frame(port_proxy_t *proxy, pjmedia_port *port, const pjmedia_frame *frame)
+{
+    pj_status_t status = PJ_SUCCESS;
+    pj_int16_t *tail = proxy->tx_buf + proxy->tx_cnt;
+    pj_bool_t is_audio = (frame->type == PJMEDIA_FRAME_TYPE_AUDIO) && (frame->size > 0);
+
+    if (!is_audio)
+        pjmedia_zero_samples(tail, proxy->chunk);
+    else if (proxy->tx_resample)
+        pjmedia_resample_run(proxy->tx_resample, (const pj_int16_t *)frame->buf, tail);
+    else
+        pjmedia_copy_samples(tail, (const pj_int16_t *)frame->buf, proxy->chunk);
+
+    proxy->tx_cnt += proxy->chunk;
+    proxy->tx_audio |= is_audio;
+
+    while (proxy->tx_cnt >= proxy->port_spf)
+    {
+        pjmedia_frame out;
+
+        out.type = proxy->tx_audio ? PJMEDIA_FRAME_TYPE_AUDIO : PJMEDIA_FRAME_TYPE_NONE;
+        out.buf = proxy->tx_buf;
+        out.size = proxy->port_spf * BYTES_PER_SAMPLE;
+        out.timestamp.u64 = proxy->tx_ts;
+        out.bit_info = 0;
+
+        status = pjmedia_port_put_frame(port, &out);
+
+        proxy->tx_ts += proxy->port_spf;
+        proxy->tx_cnt -= proxy->port_spf;
+        pjmedia_move_samples(proxy->tx_buf, proxy->tx_buf + proxy->port_spf, proxy->tx_cnt);
+        proxy->tx_audio = is_audio && (proxy->tx_cnt > 0);
+    }
+
+    return status;
+}
+
+/* The port is read in its own frames until a bridge frame is buffered */
+static pj_status_t adapt_get_frame(port_proxy_t *proxy, pjmedia_port *port, pjmedia_frame *frame)
+{
+    pj_status_t status = PJ_SUCCESS;
+
+    while (proxy->rx_cnt < proxy->chunk)
+    {
+        pjmedia_frame in;
+        pj_size_t got;
+
+        in.type = PJMEDIA_FRAME_TYPE_NONE;
+        in.buf = proxy->rx_buf + proxy->rx_cnt;
+        in.size = proxy->port_spf * BYTES_PER_SAMPLE;
+        in.timestamp.u64 = 0;
+        in.bit_info = 0;
+
+        status = pjmedia_port_get_frame(port, &in);
+
+        got = ((status == PJ_SUCCESS) && (in.type == PJMEDIA_FRAME_TYPE_AUDIO)) ? in.size / BYTES_PER_SAMPLE : 0;
+        if (got > 0)
+            proxy->rx_audio = PJ_TRUE;
+        if (got < proxy->port_spf)
+            pjmedia_zero_samples(proxy->rx_buf + proxy->rx_cnt + got, proxy->port_spf - (unsigned)got);
+
+        proxy->rx_cnt += proxy->port_spf;
+    }
+
+    if (!proxy->rx_audio)
+    {
+        frame->type = PJMEDIA_FRAME_TYPE_NONE;
+        frame->size = 0;
+    }
+    else
+    {
+        if (proxy->rx_resample)
+            pjmedia_resample_run(proxy->rx_resample, proxy->rx_buf, (pj_int16_t *)frame->buf);
+        else
+            pjmedia_copy_samples((pj_int16_t *)frame->buf, proxy->rx_buf, proxy->chunk);
+
+        frame->type = PJMEDIA_FRAME_TYPE_AUDIO;
+        frame->size = PJMEDIA_PIA_SPF(&proxy->base.info) * BYTES_PER_SAMPLE;
+    }
+
+    proxy->rx_cnt -= proxy->chunk;
+    pjmedia_move_samples(proxy->rx_buf, proxy->rx_buf + proxy->chunk, proxy->rx_cnt);
+    proxy->rx_audio = proxy->rx_audio && (proxy->rx_cnt > 0);
+
+    return status;
+}
+
+static pj_status_t proxy_put_frame(pjmedia_port *this_port, pjmedia_frame *frame)
+{
+    port_proxy_t *proxy = (port_proxy_t *)this_port;
+    pj_status_t status = PJ_SUCCESS;
+    pjmedia_port *port;
+
+    ADD_SEQ(&proxy->busy, 1);
+
+    port = LOAD_SEQ(&proxy->port);
+    if (port && proxy->is_adapted)
+        status = adapt_put_frame(proxy, port, frame);
+    else if (port)
+        status = pjmedia_port_put_frame(port, frame);
+
+    SUB_SEQ(&proxy->busy, 1);
+
+    return status;
+}
+
+static pj_status_t proxy_get_frame(pjmedia_port *this_port, pjmedia_frame *frame)
+{
+    port_proxy_t *proxy = (port_proxy_t *)this_port;
+    pj_status_t status = PJ_SUCCESS;
+    pjmedia_port *port;
+
+    ADD_SEQ(&proxy->busy, 1);
+
+    port = LOAD_SEQ(&proxy->port);
+    if (port && LOAD_SEQ(&proxy->rx) && proxy->is_adapted)
+    {
+        status = adapt_get_frame(proxy, port, frame);
+    }
+    else if (port && LOAD_SEQ(&proxy->rx))
+    {
+        status = pjmedia_port_get_frame(port, frame);
+    }
+    else
+    {
+        frame->type = PJMEDIA_FRAME_TYPE_NONE;
+        frame->size = 0;
+    }
+
+    SUB_SEQ(&proxy->busy, 1);
+
+    return status;
+}
@@ -0,0 +1,33 @@
+#ifndef _AUTO_ANSWER_PORT_PROXY_H_
+#define _AUTO_ANSWER_PORT_PROXY_H_
+
+#include <pjmedia.h>
+
+/* Bridge port standing for the port of a call. It is added to the bridge
+ * once at start and stays there, a call only binds its port to it and
+ * unbinds it at the end, without the bridge lock and without touching
+ * the connection matrix. Unbound, it gives NONE frames and drops what it
+ * gets.
+ * can_adapt preallocates an adapter of its own, as the bridge has for a
+ * port of its own: mono 16-bit ports of 8 kHz or of clock_rate, with
+ * any ptime a stream may have, are then resampled and reframed by the
+ * proxy
+ */
+pj_status_t port_proxy_create(pj_pool_t *pool,
+                              unsigned clock_rate,
+                              unsigned samples_per_frame,
+                              pj_bool_t can_adapt,
+                              pjmedia_port **p_port);
+
+/* The format of the proxy, or one its adapter converts. The bridge does
+ * no conversion for the bound port
+ */
+pj_bool_t port_proxy_fits(const pjmedia_port *proxy, const pjmedia_port *port);
+
+/* Bind a port, rx PJ_FALSE keeps the bridge from reading it (a send only
+ * stream). NULL unbinds, it returns when the media clock has left the
+ * old port, which may be destroyed then
+ */
+void port_proxy_bind(pjmedia_port *proxy, pjmedia_port *port, pj_bool_t rx);
+
+#endif /* _AUTO_ANSWER_PORT_PROXY_H_ */
@@ -0,0 +1,403 @@
+/* Offline rendering of sound sources into WAV files at disk speed. The
+ * frames are pulled from the source port in a loop, with no clock and
+ * no bridge, so a minute of audio takes milliseconds. For pre-rendering
+ * tone cadences and announcements transcoded to the rate and the law
+ * of a trunk, any number of files in one run.
+ *
+ *   ./render_offline [-r rate] [-p ptime msec] [-d msec] [-f pcm|ulaw|alaw] out.wav source [out.wav source ...]
+ *
+ * source is a mono WAV file (resampled to the rate if needed) or
+ * tone:<freq1>[+<freq2>]:<on msec>:<off msec>. Without -d a tone is
+ * rendered for one cadence and a file up to its end
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <pjmedia.h>
+#include <pjlib.h>
+
+#define THIS_FILE                   "render_offline.c"
+#define DEFAULT_CLOCK_RATE          16000   /* CLOCK_RATE of the bridge */
+#define DEFAULT_PTIME_MSEC          10
+#define MAX_PTIME_MSEC              40
+#define MAX_CLOCK_RATE              48000
+#define MAX_SAMPLES_PER_FRAME       (MAX_CLOCK_RATE * MAX_PTIME_MSEC / MSEC_IN_SEC)
+#define NCHANNELS                   1
+#define BITS_PER_SAMPLE             16
+#define MSEC_IN_SEC                 1000
+#define TONE_PREFIX                 "tone:"
+#define TONE_FORMAT_DUAL            "%hd+%hd:%hd:%hd"
+#define TONE_FORMAT_SINGLE          "%hd:%hd:%hd"
+#define TONE_FIELDS_DUAL            4
+#define TONE_FIELDS_SINGLE          3
+#define FORMAT_PCM                  "pcm"
+#define FORMAT_ULAW                 "ulaw"
+#define FORMAT_ALAW                 "alaw"
+#define WRITER_BUF_SIZE             65536   /* Written to the disk in large blocks */
+#define POOL_SIZE                   4000
+#define POOL_INCREMENT_SIZE         4000
+
+typedef struct render_param_t
+{
+    unsigned                    clock_rate;
+    unsigned                    ptime_msec;
+    unsigned                    duration_msec;  /* 0 - the length of the source */
+    unsigned                    file_flags;     /* PJMEDIA_FILE_WRITE_* */
+} render_param_t;
+
+/* What render_init() got to, render_destroy() undoes only that */
+typedef struct render_t
+{
+    pj_bool_t                   is_pj_init;
+    pj_bool_t                   is_cp_init;
+    pj_caching_pool             cp;
+    pjmedia_endpt               *med_endpt;
+    render_param_t              param;
+} render_t;
+
+static pj_status_t parse_args(int argc, char *argv[], render_param_t *param);
+static pj_status_t render_init(render_t *render);
+static void render_destroy(render_t *render);
+static pj_status_t create_tone(pj_pool_t *pool,
+                               const render_param_t *param,
+                               const char *spec,
+                               pjmedia_port **p_port,
+                               unsigned *p_msec);
+static pj_status_t create_file_source(pj_pool_t *pool,
+                                      const render_param_t *param,
+                                      const char *file_name,
+                                      pjmedia_port **p_port);
+static pj_status_t render_file(render_t *render, const char *out_name, const char *source);
+static pj_status_t pull_frames(pjmedia_port *source, pjmedia_port *writer, unsigned frame_cnt, unsigned *p_rendered);
+
+int main(int argc, char *argv[])
+{
+    static render_t render;
+    pj_status_t status;
+
+    status = parse_args(argc, argv, &render.param);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    status = render_init(&render);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    for (int i = optind; i + 1 < argc; i += 2)
+    {
+        status = render_file(&render, argv[i], argv[i + 1]);
+        if (status != PJ_SUCCESS)
+            break;
+    }
+
+_exit:
+    render_destroy(&render);
+
+    return (status == PJ_SUCCESS) ? 0 : 1;
+}
+
+static pj_status_t parse_args(int argc, char *argv[], render_param_t *param)
+{
+    pj_status_t status = PJ_SUCCESS;
+    int opt;
+
+    param->clock_rate = DEFAULT_CLOCK_RATE;
+    param->ptime_msec = DEFAULT_PTIME_MSEC;
+    param->duration_msec = 0;
+    param->file_flags = PJMEDIA_FILE_WRITE_PCM;
+
+    while ((opt = getopt(argc, argv, "r:p:d:f:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            param->clock_rate = (unsigned)atoi(optarg);
+            break;
+        case 'p':
+            param->ptime_msec = (unsigned)atoi(optarg);
+            break;
+        case 'd':
+            param->duration_msec = (unsigned)atoi(optarg);
+            break;
+        case 'f':
+            if (strcmp(optarg, FORMAT_ULAW) == 0)
+                param->file_flags = PJMEDIA_FILE_WRITE_ULAW;
+            else if (strcmp(optarg, FORMAT_ALAW) == 0)
+                param->file_flags = PJMEDIA_FILE_WRITE_ALAW;
+            else if (strcmp(optarg, FORMAT_PCM) != 0)
+                status = PJ_EINVAL;
+            break;
+        default:
+            status = PJ_EINVAL;
+            break;
+        }
+    }
+
+    if ((param->clock_rate == 0) || (param->clock_rate > MAX_CLOCK_RATE)
+        || (param->ptime_msec == 0) || (param->ptime_msec > MAX_PTIME_MSEC)
+        || (optind >= argc) || (((argc - optind) % 2) != 0))
+    {
+        status = PJ_EINVAL;
+    }
+
+    if (status != PJ_SUCCESS)
+    {
+        fprintf(stderr, "Usage: %s [-r rate, up to %d] [-p ptime msec, up to %d] [-d msec] [-f pcm|ulaw|alaw]"
+                " out.wav source [out.wav source ...]\n"
+                "source: file.wav or " TONE_PREFIX "<freq1>[+<freq2>]:<on msec>:<off msec>\n",
+                argv[0], MAX_CLOCK_RATE, MAX_PTIME_MSEC);
+    }
+
+    return status;
+}
+
+static pj_status_t render_init(render_t *render)
+{
+    pj_status_t status;
+
+    status = pj_init();
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    render->is_pj_init = PJ_TRUE;
+
+    pj_caching_pool_init(&render->cp, &pj_pool_factory_default_policy, 0);
+    render->is_cp_init = PJ_TRUE;
+
+    status = pjmedia_endpt_create(&render->cp.factory, NULL, 1, &render->med_endpt);
+
+_exit:
+    return status;
+}
+
+static void render_destroy(render_t *render)
+{
+    if (render->med_endpt)
+    {
+        pjmedia_endpt_destroy(render->med_endpt);
+        render->med_endpt = NULL;
+    }
+
+    if (render->is_cp_init)
+    {
+        pj_caching_pool_destroy(&render->cp);
+        render->is_cp_init = PJ_FALSE;
+    }
+
+    if (render->is_pj_init)
+    {
+        pj_shutdown();
+        render->is_pj_init = PJ_FALSE;
+    }
+
+    return;
+}
+
+/* Looped cadence, one period of it by default */
+static pj_status_t create_tone(pj_pool_t *pool,
+                               const render_param_t *param,
+                               const char *spec,
+                               pjmedia_port **p_port,
+                               unsigned *p_msec)
+{
+    pj_status_t status;
+    pjmedia_tone_desc tone;
+
+    pj_bzero(&tone, sizeof(tone));
+    if ((sscanf(spec, TONE_FORMAT_DUAL, &tone.freq1, &tone.freq2, &tone.on_msec, &tone.off_msec)
+         != TONE_FIELDS_DUAL)
+        && (sscanf(spec, TONE_FORMAT_SINGLE, &tone.freq1, &tone.on_msec, &tone.off_msec) != TONE_FIELDS_SINGLE))
+    {
+        tone.on_msec = 0;
+    }
+
+    /* Without the on time a tone would be rendered forever */
+    if ((tone.on_msec <= 0) || (tone.off_msec < 0))
+    {
+        PJ_LOG(1, (THIS_FILE, "Malformed tone %s", spec));
+        status = PJ_EINVAL;
+        goto _exit;
+    }
+
+    status = pjmedia_tonegen_create(pool,
+                                    param->clock_rate,
+                                    NCHANNELS,
+                                    param->clock_rate * param->ptime_msec / MSEC_IN_SEC,
+                                    BITS_PER_SAMPLE,
+                                    0,
+                                    p_port);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    status = pjmedia_tonegen_play(*p_port, 1, &tone, PJMEDIA_TONEGEN_LOOP);
+    if (status != PJ_SUCCESS)
+    {
+        pjmedia_port_destroy(*p_port);
+        goto _exit;
+    }
+
+    *p_msec = (unsigned)(tone.on_msec + tone.off_msec);
+
+_exit:
+    return status;
+}
+
+/* The player decodes G.711 files, a resample port converts the rate */
+static pj_status_t create_file_source(pj_pool_t *pool,
+                                      const render_param_t *param,
+                                      const char *file_name,
+                                      pjmedia_port **p_port)
+{
+    pj_status_t status;
+    pjmedia_port *player;
+
+    status = pjmedia_wav_player_port_create(pool, file_name, param->ptime_msec, PJMEDIA_FILE_NO_LOOP, 0, &player);
+    if (status != PJ_SUCCESS)
+    {
+        PJ_LOG(1, (THIS_FILE, "Unable to open %s", file_name));
+        goto _exit;
+    }
+
+    if (PJMEDIA_PIA_CCNT(&player->info) != NCHANNELS)
+    {
+        PJ_LOG(1, (THIS_FILE, "%s is not mono", file_name));
+        pjmedia_port_destroy(player);
+        status = PJ_EINVAL;
+        goto _exit;
+    }
+
+    *p_port = player;
+    if (PJMEDIA_PIA_SRATE(&player->info) == param->clock_rate)
+        goto _exit;
+
+    /* The player is destroyed with the resample port */
+    status = pjmedia_resample_port_create(pool, player, param->clock_rate, 0, p_port);
+    if (status != PJ_SUCCESS)
+        pjmedia_port_destroy(player);
+
+_exit:
+    return status;
+}
+
+static pj_status_t render_file(render_t *render, const char *out_name, const char *source_spec)
+{
+    pj_status_t status;
+    pj_pool_t *pool;
+    pjmedia_port *source = NULL;
+    pjmedia_port *writer = NULL;
+    unsigned msec = render->param.duration_msec;
+    unsigned source_msec = 0;
+    unsigned rendered_cnt = 0;
+    pj_timestamp start, stop;
+
+    pool = pjmedia_endpt_create_pool(render->med_endpt, "render", POOL_SIZE, POOL_INCREMENT_SIZE);
+    if (pool == NULL)
+    {
+        status = PJ_ENOMEM;
+        goto _exit;
+    }
+
+    if (strncmp(source_spec, TONE_PREFIX, strlen(TONE_PREFIX)) == 0)
+        status = create_tone(pool, &render->param, source_spec + strlen(TONE_PREFIX), &source, &source_msec);
+    else
+        status = create_file_source(pool, &render->param, source_spec, &source);
+
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    if (msec == 0)
+        msec = source_msec;
+
+    status = pjmedia_wav_writer_port_create(pool,
+                                            out_name,
+                                            render->param.clock_rate,
+                                            NCHANNELS,
+                                            PJMEDIA_PIA_SPF(&source->info),
+                                            BITS_PER_SAMPLE,
+                                            render->param.file_flags,
+                                            WRITER_BUF_SIZE,
+                                            &writer);
+    if (status != PJ_SUCCESS)
+    {
+        PJ_LOG(1, (THIS_FILE, "Unable to create %s", out_name));
+        goto _exit;
+    }
+
+    pj_get_timestamp(&start);
+
+    /* 0 frames - up to the end of the file */
+    status = pull_frames(source, writer, msec / render->param.ptime_msec, &rendered_cnt);
+
+    pj_get_timestamp(&stop);
+
+    if (status == PJ_SUCCESS)
+    {
+        printf("%s: %u ms of audio in %u ms\n",
+               out_name,
+               rendered_cnt * render->param.ptime_msec,
+               pj_elapsed_msec(&start, &stop));
+    }
+
+_exit:
+    /* The writer completes the WAV header when destroyed */
+    if (writer)
+        pjmedia_port_destroy(writer);
+
+    if (source)
+        pjmedia_port_destroy(source);
+
+    if (pool)
+        pj_pool_release(pool);
+
+    return status;
+}
+
+/* A frame without audio (the pause of a tone) is written as silence */
+static pj_status_t pull_frames(pjmedia_port *source, pjmedia_port *writer, unsigned frame_cnt, unsigned *p_rendered)
+{
+    pj_status_t status = PJ_SUCCESS;
+    pj_int16_t samples[MAX_SAMPLES_PER_FRAME];
+    pj_size_t frame_size = PJMEDIA_PIA_AVG_FSZ(&source->info);
+    pjmedia_frame frame;
+
+    if (frame_size > sizeof(samples))
+    {
+        status = PJ_ETOOBIG;
+        goto _exit;
+    }
+
+    *p_rendered = 0;
+    while ((frame_cnt == 0) || (*p_rendered < frame_cnt))
+    {
+        frame.buf = samples;
+        frame.size = frame_size;
+        frame.type = PJMEDIA_FRAME_TYPE_AUDIO;
+
+        status = pjmedia_port_get_frame(source, &frame);
+        if (status == PJ_EEOF)
+        {
+            status = PJ_SUCCESS;
+            break;
+        }
+
+        if (status != PJ_SUCCESS)
+            break;
+
+        if (frame.type != PJMEDIA_FRAME_TYPE_AUDIO)
+            pj_bzero(samples, frame_size);
+
+        frame.type = PJMEDIA_FRAME_TYPE_AUDIO;
+        frame.size = frame_size;
+
+        status = pjmedia_port_put_frame(writer, &frame);
+        if (status != PJ_SUCCESS)
+            break;
+
+        (*p_rendered)++;
+    }
+
+_exit:
+    return status;
+}
@@ -0,0 +1,345 @@
+#include "rtp_tap.h"
+
+#define THIS_FILE                   "rtp_tap.c"
+#define TAP_NAME                    "rtp-tap"
+#define POOL_SIZE                   512
+#define POOL_INCREMENT_SIZE         512
+
+typedef struct rtp_tap_t
+{
+    pjmedia_transport           base;
+    pj_pool_t                   *pool;
+    pjmedia_transport           *slave;
+    pcap_writer_t               *writer;
+    unsigned                    sample_every;
+    rtp_tap_rx_cb               rx_cb;          /* Published after rx_user_data */
+    void                        *rx_user_data;
+    pj_sockaddr                 local_addr;
+    pj_sockaddr                 rem_addr;
+
+    /* Callbacks of the stream, which sees the tap as its transport */
+    void                        *user_data;
+    void                        (*rtp_cb)(void *user_data, void *pkt, pj_ssize_t size);
+    void                        (*rtp_cb2)(pjmedia_tp_cb_param *param);
+    void                        (*rtcp_cb)(void *user_data, void *pkt, pj_ssize_t size);
+
+    pj_uint64_t                 tx_cnt;     /* Media thread */
+    pj_uint64_t                 rx_cnt;     /* ioqueue thread */
+} rtp_tap_t;
+
+static pj_bool_t is_sampled(const rtp_tap_t *tap, pj_uint64_t cnt);
+static void on_rx_packet(rtp_tap_t *tap, const pj_sockaddr *src, const void *pkt, pj_ssize_t size);
+static void tap_on_rx_rtp(void *user_data, void *pkt, pj_ssize_t size);
+static void tap_on_rx_rtp2(pjmedia_tp_cb_param *param);
+static void tap_on_rx_rtcp(void *user_data, void *pkt, pj_ssize_t size);
+
+static pj_status_t tap_get_info(pjmedia_transport *tp, pjmedia_transport_info *info);
+static pj_status_t tap_attach(pjmedia_transport *tp,
+                              void *user_data,
+                              const pj_sockaddr_t *rem_addr,
+                              const pj_sockaddr_t *rem_rtcp,
+                              unsigned addr_len,
+                              void (*rtp_cb)(void *user_data, void *pkt, pj_ssize_t size),
+                              void (*rtcp_cb)(void *user_data, void *pkt, pj_ssize_t size));
+static pj_status_t tap_attach2(pjmedia_transport *tp, pjmedia_transport_attach_param *att_param);
+static void tap_detach(pjmedia_transport *tp, void *user_data);
+static pj_status_t tap_send_rtp(pjmedia_transport *tp, const void *pkt, pj_size_t size);
+static pj_status_t tap_send_rtcp(pjmedia_transport *tp, const void *pkt, pj_size_t size);
+static pj_status_t tap_send_rtcp2(pjmedia_transport *tp,
+                                  const pj_sockaddr_t *addr,
+                                  unsigned addr_len,
+                                  const void *pkt,
+                                  pj_size_t size);
+static pj_status_t tap_media_create(pjmedia_transport *tp,
+                                    pj_pool_t *sdp_pool,
+                                    unsigned options,
+                                    const pjmedia_sdp_session *remote_sdp,
+                                    unsigned media_index);
+static pj_status_t tap_encode_sdp(pjmedia_transport *tp,
+                                  pj_pool_t *sdp_pool,
+                                  pjmedia_sdp_session *local_sdp,
+                                  const pjmedia_sdp_session *remote_sdp,
+                                  unsigned media_index);
+static pj_status_t tap_media_start(pjmedia_transport *tp,
+                                   pj_pool_t *pool,
+                                   const pjmedia_sdp_session *local_sdp,
+                                   const pjmedia_sdp_session *remote_sdp,
+                                   unsigned media_index);
+static pj_status_t tap_media_stop(pjmedia_transport *tp);
+static pj_status_t tap_simulate_lost(pjmedia_transport *tp, pjmedia_dir dir, unsigned pct_lost);
+static pj_status_t tap_destroy(pjmedia_transport *tp);
+
+static pjmedia_transport_op tap_op =
+{
+    &tap_get_info,
+    &tap_attach,
+    &tap_detach,
+    &tap_send_rtp,
+    &tap_send_rtcp,
+    &tap_send_rtcp2,
+    &tap_media_create,
+    &tap_encode_sdp,
+    &tap_media_start,
+    &tap_media_stop,
+    &tap_simulate_lost,
+    &tap_destroy,
+    &tap_attach2
+};
+
+pj_status_t rtp_tap_create(pjmedia_endpt *endpt,
+                           pjmedia_transport *base,
+                           pcap_writer_t *writer,
+                           unsigned sample_every,
+                           pjmedia_transport **p_tp)
+{
+    pj_status_t status;
+    pj_pool_t *pool;
+    rtp_tap_t *tap;
+    pjmedia_transport_info info;
+
+    pool = pjmedia_endpt_create_pool(endpt, TAP_NAME, POOL_SIZE, POOL_INCREMENT_SIZE);
+    if (pool == NULL)
+    {
+        status = PJ_ENOMEM;
+        goto _exit;
+    }
+
+    tap = PJ_POOL_ZALLOC_T(pool, rtp_tap_t);
+    tap->pool = pool;
+    tap->slave = base;
+    tap->writer = writer;
+    tap->sample_every = (sample_every > 0) ? sample_every : 1;
+
+    pjmedia_transport_info_init(&info);
+    status = pjmedia_transport_get_info(base, &info);
+    if (status != PJ_SUCCESS)
+    {
+        pj_pool_release(pool);
+        goto _exit;
+    }
+
+    pj_memcpy(&tap->local_addr, &info.sock_info.rtp_addr_name, sizeof(pj_sockaddr));
+
+    pj_ansi_strncpy(tap->base.name, TAP_NAME, sizeof(tap->base.name) - 1);
+    tap->base.type = PJMEDIA_TRANSPORT_TYPE_USER;
+    tap->base.op = &tap_op;
+
+    *p_tp = &tap->base;
+
+_exit:
+    return status;
+}
+
+void rtp_tap_set_rx_cb(pjmedia_transport *tp, rtp_tap_rx_cb cb, void *user_data)
+{
+    rtp_tap_t *tap = (rtp_tap_t *)tp;
+
+    tap->rx_user_data = user_data;
+    __atomic_store_n(&tap->rx_cb, cb, __ATOMIC_RELEASE);
+
+    return;
+}
+
+static pj_bool_t is_sampled(const rtp_tap_t *tap, pj_uint64_t cnt)
+{
+    return tap->writer && ((cnt % tap->sample_every) == 0);
+}
+
+static void on_rx_packet(rtp_tap_t *tap, const pj_sockaddr *src, const void *pkt, pj_ssize_t size)
+{
+    rtp_tap_rx_cb rx_cb = __atomic_load_n(&tap->rx_cb, __ATOMIC_ACQUIRE);
+
+    if (size <= 0)
+        goto _exit;
+
+    if (is_sampled(tap, tap->rx_cnt++))
+        pcap_writer_write(tap->writer, src, &tap->local_addr, pkt, (pj_size_t)size);
+
+    if (rx_cb)
+        (*rx_cb)(tap->rx_user_data, pkt, size);
+
+_exit:
+    return;
+}
+
+static void tap_on_rx_rtp(void *user_data, void *pkt, pj_ssize_t size)
+{
+    rtp_tap_t *tap = (rtp_tap_t *)user_data;
+
+    on_rx_packet(tap, &tap->rem_addr, pkt, size);
+
+    (*tap->rtp_cb)(tap->user_data, pkt, size);
+
+    return;
+}
+
+static void tap_on_rx_rtp2(pjmedia_tp_cb_param *param)
+{
+    rtp_tap_t *tap = (rtp_tap_t *)param->user_data;
+    const pj_sockaddr *src = param->src_addr ? param->src_addr : &tap->rem_addr;
+
+    on_rx_packet(tap, src, param->pkt, param->size);
+
+    param->user_data = tap->user_data;
+    (*tap->rtp_cb2)(param);
+
+    return;
+}
+
+static void tap_on_rx_rtcp(void *user_data, void *pkt, pj_ssize_t size)
+{
+    rtp_tap_t *tap = (rtp_tap_t *)user_data;
+
+    if (tap->rtcp_cb)
+        (*tap->rtcp_cb)(tap->user_data, pkt, size);
+
+    return;
+}
+
+static pj_status_t tap_get_info(pjmedia_transport *tp, pjmedia_transport_info *info)
+{
+    rtp_tap_t *tap = (rtp_tap_t *)tp;
+
+    return pjmedia_transport_get_info(tap->slave, info);
+}
+
+static pj_status_t tap_attach(pjmedia_transport *tp,
+                              void *user_data,
+                              const pj_sockaddr_t *rem_addr,
+                              const pj_sockaddr_t *rem_rtcp,
+                              unsigned addr_len,
+                              void (*rtp_cb)(void *user_data, void *pkt, pj_ssize_t size),
+                              void (*rtcp_cb)(void *user_data, void *pkt, pj_ssize_t size))
+{
+    rtp_tap_t *tap = (rtp_tap_t *)tp;
+
+    tap->user_data = user_data;
+    tap->rtp_cb = rtp_cb;
+    tap->rtp_cb2 = NULL;
+    tap->rtcp_cb = rtcp_cb;
+    pj_bzero(&tap->rem_addr, sizeof(tap->rem_addr));
+    pj_memcpy(&tap->rem_addr, rem_addr, PJ_MIN(addr_len, sizeof(tap->rem_addr)));
+
+    return pjmedia_transport_attach(tap->slave, tap, rem_addr, rem_rtcp, addr_len,
+                                    rtp_cb ? &tap_on_rx_rtp : NULL, &tap_on_rx_rtcp);
+}
+
+static pj_status_t tap_attach2(pjmedia_transport *tp, pjmedia_transport_attach_param *att_param)
+{
+    rtp_tap_t *tap = (rtp_tap_t *)tp;
+    pjmedia_transport_attach_param param = *att_param;
+
+    tap->user_data = att_param->user_data;
+    tap->rtp_cb = att_param->rtp_cb;
+    tap->rtp_cb2 = att_param->rtp_cb2;
+    tap->rtcp_cb = att_param->rtcp_cb;
+    pj_memcpy(&tap->rem_addr, &att_param->rem_addr, sizeof(tap->rem_addr));
+
+    param.user_data = tap;
+    param.rtp_cb = att_param->rtp_cb ? &tap_on_rx_rtp : NULL;
+    param.rtp_cb2 = att_param->rtp_cb2 ? &tap_on_rx_rtp2 : NULL;
+    param.rtcp_cb = &tap_on_rx_rtcp;
+
+    return pjmedia_transport_attach2(tap->slave, &param);
+}
+
+static void tap_detach(pjmedia_transport *tp, void *user_data)
+{
+    rtp_tap_t *tap = (rtp_tap_t *)tp;
+
+    PJ_UNUSED_ARG(user_data);
+
+    pjmedia_transport_detach(tap->slave, tap);
+
+    tap->rtp_cb = NULL;
+    tap->rtp_cb2 = NULL;
+    tap->rtcp_cb = NULL;
+
+    return;
+}
+
+static pj_status_t tap_send_rtp(pjmedia_transport *tp, const void *pkt, pj_size_t size)
+{
+    rtp_tap_t *tap = (rtp_tap_t *)tp;
+
+    if (is_sampled(tap, tap->tx_cnt++))
+        pcap_writer_write(tap->writer, &tap->local_addr, &tap->rem_addr, pkt, size);
+
+    return pjmedia_transport_send_rtp(tap->slave, pkt, size);
+}
+
+static pj_status_t tap_send_rtcp(pjmedia_transport *tp, const void *pkt, pj_size_t size)
+{
+    rtp_tap_t *tap = (rtp_tap_t *)tp;
+
+    return pjmedia_transport_send_rtcp(tap->slave, pkt, size);
+}
+
+static pj_status_t tap_send_rtcp2(pjmedia_transport *tp,
+                                  const pj_sockaddr_t *addr,
+                                  unsigned addr_len,
+                                  const void *pkt,
+                                  pj_size_t size)
+{
+    rtp_tap_t *tap = (rtp_tap_t *)tp;
+
+    return pjmedia_transport_send_rtcp2(tap->slave, addr, addr_len, pkt, size);
+}
+
+static pj_status_t tap_media_create(pjmedia_transport *tp,
+                                    pj_pool_t *sdp_pool,
+                                    unsigned options,
+                                    const pjmedia_sdp_session *remote_sdp,
+                                    unsigned media_index)
+{
+    rtp_tap_t *tap = (rtp_tap_t *)tp;
+
+    return pjmedia_transport_media_create(tap->slave, sdp_pool, options, remote_sdp, media_index);
+}
+
+static pj_status_t tap_encode_sdp(pjmedia_transport *tp,
+                                  pj_pool_t *sdp_pool,
+                                  pjmedia_sdp_session *local_sdp,
+                                  const pjmedia_sdp_session *remote_sdp,
+                                  unsigned media_index)
+{
+    rtp_tap_t *tap = (rtp_tap_t *)tp;
+
+    return pjmedia_transport_encode_sdp(tap->slave, sdp_pool, local_sdp, remote_sdp, media_index);
+}
+
+static pj_status_t tap_media_start(pjmedia_transport *tp,
+                                   pj_pool_t *pool,
+                                   const pjmedia_sdp_session *local_sdp,
+                                   const pjmedia_sdp_session *remote_sdp,
+                                   unsigned media_index)
+{
+    rtp_tap_t *tap = (rtp_tap_t *)tp;
+
+    return pjmedia_transport_media_start(tap->slave, pool, local_sdp, remote_sdp, media_index);
+}
+
+static pj_status_t tap_media_stop(pjmedia_transport *tp)
+{
+    rtp_tap_t *tap = (rtp_tap_t *)tp;
+
+    return pjmedia_transport_media_stop(tap->slave);
+}
+
+static pj_status_t tap_simulate_lost(pjmedia_transport *tp, pjmedia_dir dir, unsigned pct_lost)
+{
+    rtp_tap_t *tap = (rtp_tap_t *)tp;
+
+    return pjmedia_transport_simulate_lost(tap->slave, dir, pct_lost);
+}
+
+static pj_status_t tap_destroy(pjmedia_transport *tp)
+{
+    rtp_tap_t *tap = (rtp_tap_t *)tp;
+    pj_status_t status;
+
+    status = pjmedia_transport_close(tap->slave);
+    pj_pool_release(tap->pool);
+
+    return status;
+}
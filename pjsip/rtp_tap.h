@@ -0,0 +1,28 @@
+#ifndef _AUTO_ANSWER_RTP_TAP_H_
+#define _AUTO_ANSWER_RTP_TAP_H_
+
+#include <pjmedia.h>
+
+#include "pcap_writer.h"
+
+/* Received RTP packet, before the stream gets it */
+typedef void (*rtp_tap_rx_cb)(void *user_data, const void *pkt, pj_ssize_t size);
+
+/* Media transport adapter which passes everything to the wrapped
+ * transport and copies every sample_every-th RTP packet of each
+ * direction to the pcap writer (none without a writer). RTCP is not
+ * captured. Closing the tap closes the wrapped transport
+ */
+pj_status_t rtp_tap_create(pjmedia_endpt *endpt,
+                           pjmedia_transport *base,
+                           pcap_writer_t *writer,
+                           unsigned sample_every,
+                           pjmedia_transport **p_tp);
+
+/* Give every received RTP packet to cb too, from the ioqueue thread of
+ * the transport. Set once, at any time: the packets already on the way
+ * may still miss it
+ */
+void rtp_tap_set_rx_cb(pjmedia_transport *tp, rtp_tap_rx_cb cb, void *user_data);
+
+#endif /* _AUTO_ANSWER_RTP_TAP_H_ */
@@ -0,0 +1,101 @@
+#include "silence_gate.h"
+
+#define THIS_FILE                   "silence_gate.c"
+#define GATE_NAME                   "silence-gate"
+#define GATE_SIGNATURE              PJMEDIA_SIG_CLASS_APP('S', 'G')
+
+typedef struct silence_gate_t
+{
+    pjmedia_port                base;
+    pjmedia_port                *source;
+    unsigned                    max_level;
+    pj_uint64_t                 frame_cnt;
+    pj_uint64_t                 silent_cnt;
+} silence_gate_t;
+
+static pj_bool_t is_silent(const silence_gate_t *gate, const pjmedia_frame *frame);
+static pj_status_t gate_get_frame(pjmedia_port *this_port, pjmedia_frame *frame);
+static pj_status_t gate_on_destroy(pjmedia_port *this_port);
+
+/* Create the gate in front of the source port */
+pj_status_t silence_gate_create(pj_pool_t *pool,
+                                pjmedia_port *source,
+                                unsigned max_level,
+                                pjmedia_port **p_port)
+{
+    pj_status_t status;
+    silence_gate_t *gate;
+    pj_str_t name = pj_str(GATE_NAME);
+
+    gate = PJ_POOL_ZALLOC_T(pool, silence_gate_t);
+
+    status = pjmedia_port_info_init(&gate->base.info,
+                                    &name,
+                                    GATE_SIGNATURE,
+                                    PJMEDIA_PIA_SRATE(&source->info),
+                                    PJMEDIA_PIA_CCNT(&source->info),
+                                    PJMEDIA_PIA_BITS(&source->info),
+                                    PJMEDIA_PIA_SPF(&source->info));
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    gate->base.get_frame = &gate_get_frame;
+    gate->base.on_destroy = &gate_on_destroy;
+    gate->source = source;
+    gate->max_level = max_level;
+
+    *p_port = &gate->base;
+
+_exit:
+    return status;
+}
+
+void silence_gate_get_stats(pjmedia_port *port, pj_uint64_t *frame_cnt, pj_uint64_t *silent_cnt)
+{
+    silence_gate_t *gate = (silence_gate_t *)port;
+
+    *frame_cnt = gate->frame_cnt;
+    *silent_cnt = gate->silent_cnt;
+
+    return;
+}
+
+static pj_bool_t is_silent(const silence_gate_t *gate, const pjmedia_frame *frame)
+{
+    unsigned count = (unsigned)(frame->size / sizeof(pj_int16_t));
+    pj_bool_t silent = PJ_TRUE;
+
+    if ((frame->type == PJMEDIA_FRAME_TYPE_AUDIO) && (count > 0))
+        silent = ((unsigned)pjmedia_calc_avg_signal((const pj_int16_t *)frame->buf, count) <= gate->max_level);
+
+    return silent;
+}
+
+static pj_status_t gate_get_frame(pjmedia_port *this_port, pjmedia_frame *frame)
+{
+    silence_gate_t *gate = (silence_gate_t *)this_port;
+    pj_status_t status;
+
+    status = pjmedia_port_get_frame(gate->source, frame);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    gate->frame_cnt++;
+
+    if (is_silent(gate, frame))
+    {
+        gate->silent_cnt++;
+        frame->type = PJMEDIA_FRAME_TYPE_NONE;
+        frame->size = 0;
+    }
+
+_exit:
+    return status;
+}
+
+static pj_status_t gate_on_destroy(pjmedia_port *this_port)
+{
+    silence_gate_t *gate = (silence_gate_t *)this_port;
+
+    return pjmedia_port_destroy(gate->source);
+}
@@ -0,0 +1,22 @@
+#ifndef _AUTO_ANSWER_SILENCE_GATE_H_
+#define _AUTO_ANSWER_SILENCE_GATE_H_
+
+#include <pjmedia.h>
+
+/* Port which passes the frames of the wrapped source and returns
+ * PJMEDIA_FRAME_TYPE_NONE instead of the silent ones. The bridge does
+ * not mix such a frame, so the streams listening only to this source get
+ * no audio: they skip encoding and sending, keep the RTP timestamp running
+ * and set the marker bit on the first packet after the silence.
+ * The silence is checked once per tick for all the listeners.
+ * The wrapped port is destroyed with the gate
+ */
+pj_status_t silence_gate_create(pj_pool_t *pool,
+                                pjmedia_port *source,
+                                unsigned max_level,
+                                pjmedia_port **p_port);
+
+/* Frames passed through and frames suppressed as silence */
+void silence_gate_get_stats(pjmedia_port *port, pj_uint64_t *frame_cnt, pj_uint64_t *silent_cnt);
+
+#endif /* _AUTO_ANSWER_SILENCE_GATE_H_ */
@@ -0,0 +1,281 @@
+#include "sim_clock.h"
+
+#define THIS_FILE                   "sim_clock.c"
+#define LOCK_NAME                   "sim_clock"
+#define USEC_IN_SEC                 1000000ULL
+#define USEC_IN_MSEC                1000ULL
+#define BITS_IN_BYTE                8
+#define NO_TIMER                    -1
+
+/* Pending timer, entry NULL when the slot is free */
+typedef struct sim_timer_t
+{
+    pj_timer_entry              *entry;
+    pj_uint64_t                 due_usec;
+    pj_uint64_t                 seq;            /* Schedule order of timers with the same deadline */
+} sim_timer_t;
+
+struct sim_clock_t
+{
+    pjmedia_port                *u_port;
+    pjmedia_port                *d_port;
+    pj_lock_t                   *lock;
+
+    void                        *buf;
+    pj_size_t                   buf_size;
+    unsigned                    samples_per_frame;
+    pj_uint64_t                 period_usec;
+    pj_timestamp                timestamp;
+
+    pj_uint64_t                 now_usec;
+    pj_uint64_t                 next_tick_usec;
+    pj_uint64_t                 timer_seq;
+    sim_timer_t                 *timers;
+    unsigned                    max_timers;
+};
+
+static pj_size_t port_frame_size(const pjmedia_port *port);
+static int find_earliest_timer(const sim_clock_t *clock);
+static pj_bool_t fire_timer(sim_clock_t *clock, pj_uint64_t until_usec);
+static void run_tick(sim_clock_t *clock);
+
+pj_status_t sim_clock_create(pj_pool_t *pool,
+                             pjmedia_port *u_port,
+                             pjmedia_port *d_port,
+                             unsigned max_timers,
+                             sim_clock_t **p_clock)
+{
+    pj_status_t status = PJ_SUCCESS;
+    sim_clock_t *clock;
+
+    clock = PJ_POOL_ZALLOC_T(pool, sim_clock_t);
+    clock->u_port = u_port;
+    clock->d_port = d_port;
+    clock->samples_per_frame = PJMEDIA_PIA_SPF(&d_port->info);
+    clock->period_usec = d_port->info.fmt.det.aud.frame_time_usec;
+    clock->next_tick_usec = clock->period_usec;
+    clock->max_timers = max_timers;
+
+    /* The buffer fits the frame of both ports */
+    clock->buf_size = PJ_MAX(port_frame_size(u_port), port_frame_size(d_port));
+    clock->buf = pj_pool_alloc(pool, clock->buf_size);
+    clock->timers = (sim_timer_t *)pj_pool_calloc(pool, max_timers, sizeof(sim_timer_t));
+    if ((clock->buf == NULL) || (clock->timers == NULL))
+    {
+        status = PJ_ENOMEM;
+        goto _exit;
+    }
+
+    status = pj_lock_create_simple_mutex(pool, LOCK_NAME, &clock->lock);
+    if (status != PJ_SUCCESS)
+        goto _exit;
+
+    PJ_LOG(4, (THIS_FILE, "Virtual clock, tick %llu usec, %u timers",
+               (unsigned long long)clock->period_usec, max_timers));
+
+    *p_clock = clock;
+
+_exit:
+    return status;
+}
+
+pj_status_t sim_clock_destroy(sim_clock_t *clock)
+{
+    if (clock->lock)
+    {
+        pj_lock_destroy(clock->lock);
+        clock->lock = NULL;
+    }
+
+    return PJ_SUCCESS;
+}
+
+pj_status_t sim_clock_schedule(sim_clock_t *clock, pj_timer_entry *entry, const pj_time_val *delay)
+{
+    pj_status_t status = PJ_ETOOMANY;
+    pj_uint64_t delay_usec;
+
+    delay_usec = (pj_uint64_t)delay->sec * USEC_IN_SEC + (pj_uint64_t)delay->msec * USEC_IN_MSEC;
+
+    pj_lock_acquire(clock->lock);
+
+    if (entry->_timer_id > 0)
+    {
+        status = PJ_EINVALIDOP;
+        goto _exit;
+    }
+
+    for (unsigned i = 0; i < clock->max_timers; i++)
+    {
+        if (clock->timers[i].entry == NULL)
+        {
+            clock->timers[i].entry = entry;
+            clock->timers[i].due_usec = clock->now_usec + delay_usec;
+            clock->timers[i].seq = clock->timer_seq++;
+            entry->_timer_id = (pj_timer_id_t)(i + 1);
+            status = PJ_SUCCESS;
+            break;
+        }
+    }
+
+_exit:
+    pj_lock_release(clock->lock);
+
+    return status;
+}
+
+int sim_clock_cancel(sim_clock_t *clock, pj_timer_entry *entry)
+{
+    int cancelled = 0;
+
+    pj_lock_acquire(clock->lock);
+
+    if ((entry->_timer_id > 0) && ((unsigned)entry->_timer_id <= clock->max_timers)
+        && (clock->timers[entry->_timer_id - 1].entry == entry))
+    {
+        clock->timers[entry->_timer_id - 1].entry = NULL;
+        entry->_timer_id = -1;
+        cancelled = 1;
+    }
+
+    pj_lock_release(clock->lock);
+
+    return cancelled;
+}
+
+/* The ticks and the timers in the order of their deadlines, a timer
+ * before the tick of the same time
+ */
+void sim_clock_advance(sim_clock_t *clock, pj_uint64_t usec)
+{
+    pj_uint64_t target_usec;
+
+    pj_lock_acquire(clock->lock);
+    target_usec = clock->now_usec + usec;
+    pj_lock_release(clock->lock);
+
+    for (;;)
+    {
+        pj_uint64_t until_usec = PJ_MIN(clock->next_tick_usec, target_usec);
+
+        if (fire_timer(clock, until_usec))
+            continue;
+
+        if (clock->next_tick_usec > target_usec)
+            break;
+
+        pj_lock_acquire(clock->lock);
+        clock->now_usec = clock->next_tick_usec;
+        pj_lock_release(clock->lock);
+
+        run_tick(clock);
+        clock->next_tick_usec += clock->period_usec;
+    }
+
+    pj_lock_acquire(clock->lock);
+    clock->now_usec = target_usec;
+    pj_lock_release(clock->lock);
+
+    return;
+}
+
+pj_uint64_t sim_clock_now_usec(sim_clock_t *clock)
+{
+    pj_uint64_t now_usec;
+
+    pj_lock_acquire(clock->lock);
+    now_usec = clock->now_usec;
+    pj_lock_release(clock->lock);
+
+    return now_usec;
+}
+
+static pj_size_t port_frame_size(const pjmedia_port *port)
+{
+    return (pj_size_t)PJMEDIA_PIA_SPF(&port->info) * (PJMEDIA_PIA_BITS(&port->info) / BITS_IN_BYTE);
+}
+
+/* Called with the lock held */
+static int find_earliest_timer(const sim_clock_t *clock)
+{
+    int earliest = NO_TIMER;
+
+    for (unsigned i = 0; i < clock->max_timers; i++)
+    {
+        const sim_timer_t *timer = &clock->timers[i];
+
+        if (timer->entry == NULL)
+            continue;
+
+        if ((earliest == NO_TIMER)
+            || (timer->due_usec < clock->timers[earliest].due_usec)
+            || ((timer->due_usec == clock->timers[earliest].due_usec) && (timer->seq < clock->timers[earliest].seq)))
+        {
+            earliest = (int)i;
+        }
+    }
+
+    return earliest;
+}
+
+/* Fire the earliest timer due not later than until_usec. The callback
+ * runs without the lock, it may schedule and cancel timers
+ */
+static pj_bool_t fire_timer(sim_clock_t *clock, pj_uint64_t until_usec)
+{
+    pj_bool_t fired = PJ_FALSE;
+    pj_timer_entry *entry = NULL;
+    int idx;
+
+    pj_lock_acquire(clock->lock);
+
+    idx = find_earliest_timer(clock);
+    if ((idx != NO_TIMER) && (clock->timers[idx].due_usec <= until_usec))
+    {
+        entry = clock->timers[idx].entry;
+        clock->timers[idx].entry = NULL;
+        clock->now_usec = PJ_MAX(clock->now_usec, clock->timers[idx].due_usec);
+        entry->_timer_id = -1;
+    }
+
+    pj_lock_release(clock->lock);
+
+    if (entry)
+    {
+        if (entry->cb)
+            (*entry->cb)(NULL, entry);
+        fired = PJ_TRUE;
+    }
+
+    return fired;
+}
+
+/* Same frame exchange as the clock callback of pjmedia_master_port */
+static void run_tick(sim_clock_t *clock)
+{
+    pjmedia_frame frame;
+
+    pj_bzero(&frame, sizeof(frame));
+    frame.buf = clock->buf;
+    frame.size = clock->buf_size;
+    frame.timestamp = clock->timestamp;
+
+    if (pjmedia_port_get_frame(clock->u_port, &frame) != PJ_SUCCESS)
+        frame.type = PJMEDIA_FRAME_TYPE_NONE;
+
+    pjmedia_port_put_frame(clock->d_port, &frame);
+
+    pj_bzero(&frame, sizeof(frame));
+    frame.buf = clock->buf;
+    frame.size = clock->buf_size;
+    frame.timestamp = clock->timestamp;
+
+    if (pjmedia_port_get_frame(clock->d_port, &frame) != PJ_SUCCESS)
+        frame.type = PJMEDIA_FRAME_TYPE_NONE;
+
+    pjmedia_port_put_frame(clock->u_port, &frame);
+
+    clock->timestamp.u64 += clock->samples_per_frame;
+
+    return;
+}
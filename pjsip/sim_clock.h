@@ -0,0 +1,40 @@
+#ifndef _AUTO_ANSWER_SIM_CLOCK_H_
+#define _AUTO_ANSWER_SIM_CLOCK_H_
+
+#include <pjmedia.h>
+
+typedef struct sim_clock_t sim_clock_t;
+
+/* Virtual time for tests and benchmarks. It replaces the media clock
+ * (a frame from u_port to d_port and back every tick, as the master port
+ * does) and the timer heap of the call timers. Nothing moves until the
+ * harness calls sim_clock_advance(), then the ticks and the timers run
+ * in the calling thread in the order of their virtual deadlines, as fast
+ * as the CPU allows.
+ * The SIP transaction timers of pjsip stay on the wall clock
+ */
+pj_status_t sim_clock_create(pj_pool_t *pool,
+                             pjmedia_port *u_port,
+                             pjmedia_port *d_port,
+                             unsigned max_timers,
+                             sim_clock_t **p_clock);
+
+pj_status_t sim_clock_destroy(sim_clock_t *clock);
+
+/* Same contract as pj_timer_heap_schedule(): the callback is called with
+ * a NULL timer heap once the virtual time passes now + delay.
+ * PJ_EINVALIDOP when the entry is already scheduled, PJ_ETOOMANY when
+ * max_timers are pending
+ */
+pj_status_t sim_clock_schedule(sim_clock_t *clock, pj_timer_entry *entry, const pj_time_val *delay);
+
+/* Returns 1 when the entry was pending, 0 otherwise */
+int sim_clock_cancel(sim_clock_t *clock, pj_timer_entry *entry);
+
+/* Move the virtual time forward, call it from one thread at a time */
+void sim_clock_advance(sim_clock_t *clock, pj_uint64_t usec);
+
+/* Virtual time since the creation */
+pj_uint64_t sim_clock_now_usec(sim_clock_t *clock);
+
+#endif /* _AUTO_ANSWER_SIM_CLOCK_H_ */
@@ -0,0 +1,61 @@
+#!/bin/bash
+# CPS and CPU of a running auto_answer for SIP over UDP and over TCP.
+# sipp on this host is the UAC, over TCP all the calls share one
+# connection (-t t1), as from a trunk.
+# Every call waits for the ringing timer of auto_answer, so the rate is
+# capped by the call slots: compare the CPU per call first.
+#
+#   ./sip_bench.sh [calls] [rate] [number]
+
+CALLS=${1:-300}
+RATE=${2:-10}
+NUMBER=${3:-100}
+HOST=127.0.0.1
+PORT=5062
+MAX_CONCURRENT=30
+SCENARIO=sip_bench.xml
+
+PID=$(pidof auto_answer)
+if [ -z "$PID" ]; then
+    echo "auto_answer is not running"
+    exit 1
+fi
+
+CLK_TCK=$(getconf CLK_TCK)
+
+# utime + stime of auto_answer in clock ticks
+cpu_ticks()
+{
+    awk '{ print $14 + $15 }' /proc/$PID/stat
+}
+
+run()
+{
+    local name=$1
+    local transport=$2
+    local cpu_start cpu_end start_ns end_ns failed
+
+    cpu_start=$(cpu_ticks)
+    start_ns=$(date +%s%N)
+
+    sipp -sf $SCENARIO $HOST:$PORT -t $transport -s $NUMBER \
+         -r $RATE -m $CALLS -l $MAX_CONCURRENT -timeout 300s > /dev/null 2>&1
+    failed=$?
+
+    end_ns=$(date +%s%N)
+    cpu_end=$(cpu_ticks)
+
+    awk -v name=$name -v calls=$CALLS -v failed=$failed \
+        -v ns=$((end_ns - start_ns)) -v ticks=$((cpu_end - cpu_start)) -v hz=$CLK_TCK '
+        BEGIN {
+            sec = ns / 1e9
+            cpu_ms = ticks * 1000 / hz
+            printf "%-4s %6.1f CPS  %6.2f ms CPU per call  %5.1f%% CPU%s\n",
+                   name, calls / sec, cpu_ms / calls, cpu_ms / 10 / sec,
+                   (failed != 0) ? "  (some calls failed)" : ""
+        }'
+}
+
+echo "$CALLS calls to $NUMBER at $RATE CPS"
+run UDP u1
+run TCP t1
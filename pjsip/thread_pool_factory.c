@@ -0,0 +1,430 @@
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "thread_pool_factory.h"
+
+#define THIS_FILE                   "thread_pool_factory.c"
+#define CLASS_CNT                   9       /* Blocks of 4 KB .. 1 MB */
+#define MIN_CLASS_SHIFT             12
+#define MAX_CLASS_SHIFT             (MIN_CLASS_SHIFT + CLASS_CNT - 1)
+#define REFILL_BATCH                8       /* Blocks a thread takes from the reserve at once */
+#define CACHE_MAX_BLOCKS            32      /* Half of them go back above it */
+#define RESERVE_MAX_BYTES           (4 * 1024 * 1024)  /* Per class, the rest goes upstream */
+
+/* Free block, the link is kept in the block */
+typedef struct thread_pool_block_t
+{
+    struct thread_pool_block_t  *next;
+} thread_pool_block_t;
+
+/* base first, the pools only know the factory */
+struct thread_pool_factory_t
+{
+    pj_pool_factory             base;
+    pj_pool_factory_policy      upstream;
+    pthread_key_t               cache_key;
+    pthread_mutex_t             lock;       /* Reserve, caches and counters */
+    struct thread_cache_t       *caches;    /* Of every thread, drained by the destroy */
+    thread_pool_block_t         *reserve[CLASS_CNT];
+    unsigned                    reserve_cnt[CLASS_CNT];
+    pj_uint64_t                 refill_cnt;
+    pj_uint64_t                 upstream_cnt;
+};
+
+/* Free blocks of one thread, given back to the reserve when it ends */
+typedef struct thread_cache_t
+{
+    thread_pool_factory_t       *tpf;
+    struct thread_cache_t       *prev;
+    struct thread_cache_t       *next;
+    thread_pool_block_t         *blocks[CLASS_CNT];
+    unsigned                    cnt[CLASS_CNT];
+} thread_cache_t;
+
+static int size_class(pj_size_t size);
+static pj_size_t class_size(int idx);
+static thread_cache_t *get_cache(thread_pool_factory_t *tpf);
+static void put_to_reserve(thread_pool_factory_t *tpf, int idx, thread_pool_block_t *blocks, unsigned cnt);
+static void flush_cache(thread_cache_t *cache, int idx, unsigned keep_cnt);
+static void release_cache(thread_cache_t *cache);
+static void on_thread_exit(void *arg);
+static void *block_alloc(pj_pool_factory *factory, pj_size_t size);
+static void block_free(pj_pool_factory *factory, void *mem, pj_size_t size);
+static pj_pool_t *create_pool(pj_pool_factory *factory, const char *name, pj_size_t initial_size,
+                              pj_size_t increment_size, pj_pool_callback *callback);
+static void release_pool(pj_pool_factory *factory, pj_pool_t *pool);
+static void dump_status(pj_pool_factory *factory, pj_bool_t detail);
+
+pj_status_t thread_pool_factory_create(const pj_pool_factory_policy *upstream, thread_pool_factory_t **p_tpf)
+{
+    pj_status_t status = PJ_SUCCESS;
+    thread_pool_factory_t *tpf;
+    int rc;
+
+    tpf = (thread_pool_factory_t *)calloc(1, sizeof(thread_pool_factory_t));
+    if (tpf == NULL)
+    {
+        status = PJ_ENOMEM;
+        goto _exit;
+    }
+    tpf->upstream = *upstream;
+
+    rc = pthread_key_create(&tpf->cache_key, &on_thread_exit);
+    if (rc != 0)
+    {
+        free(tpf);
+        status = PJ_STATUS_FROM_OS(rc);
+        goto _exit;
+    }
+
+    rc = pthread_mutex_init(&tpf->lock, NULL);
+    if (rc != 0)
+    {
+        pthread_key_delete(tpf->cache_key);
+        free(tpf);
+        status = PJ_STATUS_FROM_OS(rc);
+        goto _exit;
+    }
+
+    tpf->base.policy = *upstream;
+    tpf->base.policy.block_alloc = &block_alloc;
+    tpf->base.policy.block_free = &block_free;
+    tpf->base.create_pool = &create_pool;
+    tpf->base.release_pool = &release_pool;
+    tpf->base.dump_status = &dump_status;
+
+    PJ_LOG(4, (THIS_FILE, "Pool factory with thread caches of %u blocks", CACHE_MAX_BLOCKS));
+
+    *p_tpf = tpf;
+
+_exit:
+    return status;
+}
+
+void thread_pool_factory_destroy(thread_pool_factory_t *tpf)
+{
+    thread_cache_t *caches;
+
+    /* No destructor runs after this, a thread which ends later, or never,
+     * does not come back to the freed factory. Its cache is drained here
+     * with those of the calling thread and of the threads still running */
+    pthread_key_delete(tpf->cache_key);
+
+    pthread_mutex_lock(&tpf->lock);
+    caches = tpf->caches;
+    tpf->caches = NULL;
+    pthread_mutex_unlock(&tpf->lock);
+
+    while (caches)
+    {
+        thread_cache_t *cache = caches;
+
+        caches = cache->next;
+        release_cache(cache);
+    }
+
+    for (int i = 0; i < CLASS_CNT; i++)
+    {
+        while (tpf->reserve[i])
+        {
+            thread_pool_block_t *block = tpf->reserve[i];
+
+            tpf->reserve[i] = block->next;
+            tpf->upstream.block_free(&tpf->base, block, class_size(i));
+        }
+        tpf->reserve_cnt[i] = 0;
+    }
+
+    pthread_mutex_destroy(&tpf->lock);
+    free(tpf);
+
+    return;
+}
+
+pj_pool_factory *thread_pool_factory_get(thread_pool_factory_t *tpf)
+{
+    return &tpf->base;
+}
+
+void thread_pool_factory_get_stats(thread_pool_factory_t *tpf, pj_uint64_t *refill_cnt, pj_uint64_t *upstream_cnt)
+{
+    pthread_mutex_lock(&tpf->lock);
+    *refill_cnt = tpf->refill_cnt;
+    *upstream_cnt = tpf->upstream_cnt;
+    pthread_mutex_unlock(&tpf->lock);
+
+    return;
+}
+
+/* Index of the smallest class holding the size, -1 above the biggest */
+static int size_class(pj_size_t size)
+{
+    int shift = MIN_CLASS_SHIFT;
+
+    while ((shift <= MAX_CLASS_SHIFT) && (((pj_size_t)1 << shift) < size))
+    {
+        shift++;
+    }
+
+    return (shift <= MAX_CLASS_SHIFT) ? (shift - MIN_CLASS_SHIFT) : -1;
+}
+
+static pj_size_t class_size(int idx)
+{
+    return (pj_size_t)1 << (idx + MIN_CLASS_SHIFT);
+}
+
+/* NULL when the cache cannot be allocated, the reserve is used directly then */
+static thread_cache_t *get_cache(thread_pool_factory_t *tpf)
+{
+    thread_cache_t *cache = (thread_cache_t *)pthread_getspecific(tpf->cache_key);
+
+    if (cache == NULL)
+    {
+        cache = (thread_cache_t *)calloc(1, sizeof(thread_cache_t));
+        if (cache)
+        {
+            cache->tpf = tpf;
+            if (pthread_setspecific(tpf->cache_key, cache) != 0)
+            {
+                free(cache);
+                cache = NULL;
+            }
+        }
+
+        if (cache)
+        {
+            pthread_mutex_lock(&tpf->lock);
+            cache->next = tpf->caches;
+            if (tpf->caches)
+                tpf->caches->prev = cache;
+            tpf->caches = cache;
+            pthread_mutex_unlock(&tpf->lock);
+        }
+    }
+
+    return cache;
+}
+
+/* Blocks above RESERVE_MAX_BYTES go upstream, outside the lock */
+static void put_to_reserve(thread_pool_factory_t *tpf, int idx, thread_pool_block_t *blocks, unsigned cnt)
+{
+    unsigned max_cnt = (unsigned)(RESERVE_MAX_BYTES / class_size(idx));
+    thread_pool_block_t *extra = NULL;
+
+    pthread_mutex_lock(&tpf->lock);
+    while (blocks && cnt)
+    {
+        thread_pool_block_t *block = blocks;
+
+        blocks = block->next;
+        cnt--;
+
+        if (tpf->reserve_cnt[idx] < max_cnt)
+        {
+            block->next = tpf->reserve[idx];
+            tpf->reserve[idx] = block;
+            tpf->reserve_cnt[idx]++;
+        }
+        else
+        {
+            block->next = extra;
+            extra = block;
+        }
+    }
+    pthread_mutex_unlock(&tpf->lock);
+
+    while (extra)
+    {
+        thread_pool_block_t *block = extra;
+
+        extra = block->next;
+        tpf->upstream.block_free(&tpf->base, block, class_size(idx));
+    }
+
+    return;
+}
+
+/* Give the blocks above keep_cnt of a class to the reserve */
+static void flush_cache(thread_cache_t *cache, int idx, unsigned keep_cnt)
+{
+    thread_pool_block_t *blocks = NULL;
+    unsigned cnt = 0;
+
+    while (cache->cnt[idx] > keep_cnt)
+    {
+        thread_pool_block_t *block = cache->blocks[idx];
+
+        cache->blocks[idx] = block->next;
+        cache->cnt[idx]--;
+        block->next = blocks;
+        blocks = block;
+        cnt++;
+    }
+
+    if (cnt)
+        put_to_reserve(cache->tpf, idx, blocks, cnt);
+
+    return;
+}
+
+/* Every block to the reserve, the cache is unlinked already */
+static void release_cache(thread_cache_t *cache)
+{
+    for (int i = 0; i < CLASS_CNT; i++)
+    {
+        flush_cache(cache, i, 0);
+    }
+
+    free(cache);
+
+    return;
+}
+
+static void on_thread_exit(void *arg)
+{
+    thread_cache_t *cache = (thread_cache_t *)arg;
+    thread_pool_factory_t *tpf = cache->tpf;
+
+    pthread_mutex_lock(&tpf->lock);
+    if (cache->prev)
+        cache->prev->next = cache->next;
+    else
+        tpf->caches = cache->next;
+    if (cache->next)
+        cache->next->prev = cache->prev;
+    pthread_mutex_unlock(&tpf->lock);
+
+    release_cache(cache);
+
+    return;
+}
+
+static void *block_alloc(pj_pool_factory *factory, pj_size_t size)
+{
+    thread_pool_factory_t *tpf = (thread_pool_factory_t *)factory;
+    thread_pool_block_t *block = NULL;
+    thread_cache_t *cache;
+    int idx = size_class(size);
+
+    if (idx < 0)
+    {
+        pthread_mutex_lock(&tpf->lock);
+        tpf->upstream_cnt++;
+        pthread_mutex_unlock(&tpf->lock);
+
+        return tpf->upstream.block_alloc(factory, size);
+    }
+
+    cache = get_cache(tpf);
+    if (cache && cache->blocks[idx])
+    {
+        block = cache->blocks[idx];
+        cache->blocks[idx] = block->next;
+        cache->cnt[idx]--;
+        goto _exit;
+    }
+
+    /* One block for the caller and a batch for the cache */
+    pthread_mutex_lock(&tpf->lock);
+    if (tpf->reserve[idx])
+    {
+        block = tpf->reserve[idx];
+        tpf->reserve[idx] = block->next;
+        tpf->reserve_cnt[idx]--;
+
+        for (unsigned i = 0; cache && tpf->reserve[idx] && (i < REFILL_BATCH - 1); i++)
+        {
+            thread_pool_block_t *next = tpf->reserve[idx];
+
+            tpf->reserve[idx] = next->next;
+            tpf->reserve_cnt[idx]--;
+            next->next = cache->blocks[idx];
+            cache->blocks[idx] = next;
+            cache->cnt[idx]++;
+        }
+        tpf->refill_cnt++;
+    }
+    else
+    {
+        tpf->upstream_cnt++;
+    }
+    pthread_mutex_unlock(&tpf->lock);
+
+    if (block == NULL)
+        block = (thread_pool_block_t *)tpf->upstream.block_alloc(factory, class_size(idx));
+
+_exit:
+    return block;
+}
+
+static void block_free(pj_pool_factory *factory, void *mem, pj_size_t size)
+{
+    thread_pool_factory_t *tpf = (thread_pool_factory_t *)factory;
+    thread_pool_block_t *block = (thread_pool_block_t *)mem;
+    thread_cache_t *cache;
+    int idx = size_class(size);
+
+    if (idx < 0)
+    {
+        tpf->upstream.block_free(factory, mem, size);
+        goto _exit;
+    }
+
+    cache = get_cache(tpf);
+    if (cache == NULL)
+    {
+        block->next = NULL;
+        put_to_reserve(tpf, idx, block, 1);
+        goto _exit;
+    }
+
+    block->next = cache->blocks[idx];
+    cache->blocks[idx] = block;
+    cache->cnt[idx]++;
+
+    if (cache->cnt[idx] > CACHE_MAX_BLOCKS)
+        flush_cache(cache, idx, CACHE_MAX_BLOCKS / 2);
+
+_exit:
+    return;
+}
+
+/* Same as the caching pool: the callback of the policy by default.
+ * pj_pool_create_int() and pj_pool_destroy_int() are the hooks pjlib
+ * exports for custom factories, pj_caching_pool is built on them too.
+ * They take the blocks through factory->policy, i.e. block_alloc() and
+ * block_free() of this factory
+ */
+static pj_pool_t *create_pool(pj_pool_factory *factory, const char *name, pj_size_t initial_size,
+                              pj_size_t increment_size, pj_pool_callback *callback)
+{
+    if (callback == NULL)
+        callback = factory->policy.callback;
+
+    return pj_pool_create_int(factory, name, initial_size, increment_size, callback);
+}
+
+static void release_pool(pj_pool_factory *factory, pj_pool_t *pool)
+{
+    PJ_UNUSED_ARG(factory);
+
+    pj_pool_destroy_int(pool);
+
+    return;
+}
+
+static void dump_status(pj_pool_factory *factory, pj_bool_t detail)
+{
+    thread_pool_factory_t *tpf = (thread_pool_factory_t *)factory;
+    pj_uint64_t refill_cnt;
+    pj_uint64_t upstream_cnt;
+
+    PJ_UNUSED_ARG(detail);
+
+    thread_pool_factory_get_stats(tpf, &refill_cnt, &upstream_cnt);
+    PJ_LOG(3, (THIS_FILE, "Thread pool factory: %llu refills, %llu blocks from upstream",
+               (unsigned long long)refill_cnt, (unsigned long long)upstream_cnt));
+
+    return;
+}
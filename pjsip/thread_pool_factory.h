@@ -0,0 +1,32 @@
+#ifndef _AUTO_ANSWER_THREAD_POOL_FACTORY_H_
+#define _AUTO_ANSWER_THREAD_POOL_FACTORY_H_
+
+#include <pjlib.h>
+
+typedef struct thread_pool_factory_t thread_pool_factory_t;
+
+/* Pool factory with a cache of free blocks in each thread. A pool is
+ * created and released with no lock while the cache of the thread has
+ * blocks of its size class; an empty cache takes a batch from the global
+ * reserve and a full one gives half of it back, under the lock of the
+ * factory. Blocks above 1 MB, and blocks the reserve has none of, come
+ * from the upstream policy (malloc() or the huge page arena).
+ * The factory itself is taken from malloc(), it exists before any pool
+ */
+pj_status_t thread_pool_factory_create(const pj_pool_factory_policy *upstream, thread_pool_factory_t **p_tpf);
+
+/* Give every block back to the upstream policy, the blocks in the caches
+ * of all the threads included. Call it after the pools are released and
+ * the other threads using the factory have ended or stopped using it: a
+ * thread still running loses its cache, and ends without coming back to
+ * the factory
+ */
+void thread_pool_factory_destroy(thread_pool_factory_t *tpf);
+
+/* The factory for pj_pool_create() and the endpoints */
+pj_pool_factory *thread_pool_factory_get(thread_pool_factory_t *tpf);
+
+/* Batches taken from the reserve and blocks taken from upstream */
+void thread_pool_factory_get_stats(thread_pool_factory_t *tpf, pj_uint64_t *refill_cnt, pj_uint64_t *upstream_cnt);
+
+#endif /* _AUTO_ANSWER_THREAD_POOL_FACTORY_H_ */